@@ -20,22 +20,36 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
+// AviSynth 2.5 plugin; AVSPlusPlugin.cpp is built instead when VIDEOINPUTSOURCE_AVISYNTHPLUS is defined
+
+#ifndef VIDEOINPUTSOURCE_AVISYNTHPLUS
+
+#define _CRT_NONSTDC_NO_DEPRECATE
+
+
+
 #include <windows.h>
 #include "avisynth/avisynth.h"
 
+#include <memory>
+
 #include "VideoInputSource.h"
+#include "FrameCopy.h"
 
 
 
 class AVSVideoInputSource : public IClip {
 private:
-	VideoInputSource* videoInputSource;
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase;
 	VideoInfo vi;
 
 public:
-	AVSVideoInputSource(const int device_id, const char* connection_type, const int width, const int height, const unsigned int fps_numerator, const unsigned int fps_denominator, const int num_frames, const bool frame_skip, IScriptEnvironment* env) {
+	AVSVideoInputSource(const VideoInputSourceParams& params, const int num_frames, IScriptEnvironment* env) {
 		try {
-			videoInputSource = new VideoInputSource(device_id, connection_type, width, height, frame_skip);
+			videoInputSource = VideoInputSource::Create(params);
+			sharedBase = videoInputSource->OpenSharedClip();
 		} catch (const char* e) {
 			env->ThrowError(e);
 		}
@@ -43,14 +57,30 @@ public:
 		memset(&vi, 0, sizeof(vi));
 		vi.width = videoInputSource->GetWidth();
 		vi.height = videoInputSource->GetHeight();
-		vi.fps_numerator = fps_numerator;
-		vi.fps_denominator = fps_denominator;
+		vi.fps_numerator = params.fpsNumerator;
+		vi.fps_denominator = params.fpsDenominator;
 		vi.num_frames = num_frames;
 		vi.pixel_type = VideoInfo::CS_BGR24;
+
+		// every captured frame is served as its two fields, like SeparateFields does
+		if (videoInputSource->HasFields()) {
+			vi.height /= 2;
+			vi.num_frames *= 2;
+			vi.MulDivFPS(2, 1);
+			vi.SetFieldBased(true);
+			vi.image_type |= videoInputSource->IsTopField(0) ? VideoInfo::IT_TFF : VideoInfo::IT_BFF;
+		}
+
+		if (videoInputSource->HasAudio()) {
+			vi.audio_samples_per_second = videoInputSource->GetAudioRate();
+			vi.nchannels = videoInputSource->GetAudioChannels();
+			vi.sample_type = SAMPLE_INT16;
+			vi.num_audio_samples = vi.AudioSamplesFromFrames(vi.num_frames);
+		}
 	}
 
 	__stdcall ~AVSVideoInputSource() {
-		delete videoInputSource;
+		videoInputSource->Release();
 	}
 
 	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
@@ -61,15 +91,83 @@ public:
 		const int dst_height = dst->GetHeight();
 
 		int videoWidth = videoInputSource->GetWidth();
-		int videoHeight = videoInputSource->GetHeight();
+		int videoHeight = videoInputSource->HasFields() ? videoInputSource->GetHeight() / 2 : videoInputSource->GetHeight();
 		int videoRowSize = sizeof(unsigned char) * 3 * videoWidth;
 		if (!(dst_row_size == videoRowSize && dst_height == videoHeight)) {
 			env->ThrowError("VideoInputSource: frame format is not match");
 		}
 
-		const unsigned char* videoBuffer = videoInputSource->GetFrame();
+		// device setup errors surface here, since the device is opened in background
+		// a field is read straight out of the captured frame, so it is copied only once
+		const unsigned char* videoBuffer = NULL;
+		ptrdiff_t videoPitch = videoRowSize;
+		std::shared_ptr<const FrameSnapshot> shared;
+		try {
+			// clips opened later on the same session capture through the history, so this one reads from there too
+			bool duplicate;
+			int dropped;
+			shared = videoInputSource->GetSharedFrame(sharedBase, n, duplicate, dropped);
+			videoBuffer = videoInputSource->HasFields() ? videoInputSource->GetFieldRows(shared->pixels, n, videoPitch) : shared->pixels;
+		} catch (const char* e) {
+			env->ThrowError(e);
+		}
+
+		CopyFrameRows(dst_p, dst_pitch, videoBuffer, videoPitch, videoRowSize, videoHeight);
+
+		return dst;
+	}
+
+	const VideoInfo& __stdcall GetVideoInfo() {
+		return vi;
+	}
+
+	bool __stdcall GetParity(int n) { return videoInputSource->HasFields() && videoInputSource->IsTopField(n); }
+	void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env) {
+		if (!vi.HasAudio()) {
+			return;
+		}
+		videoInputSource->GetAudio((short*)buf, start, count);
+	}
+	void __stdcall SetCacheHints(int cachehints, int frame_range) {}
+};
+
+
+
+// a region of a source opened by VideoInputSource; its rows are copied straight out of the frame all clips share
+class AVSVideoInputSourceRegion : public IClip {
+private:
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	int region;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase;
+	VideoInfo vi;
+
+public:
+	AVSVideoInputSourceRegion(const std::shared_ptr<VideoInputSource>& source, const int index, const int num_frames) : videoInputSource(source), region(index), sharedBase(source->OpenSharedClip()) {
+		memset(&vi, 0, sizeof(vi));
+		vi.width = source->GetRegion(index).width;
+		vi.height = source->GetRegion(index).height;
+		vi.fps_numerator = source->GetFpsNumerator();
+		vi.fps_denominator = source->GetFpsDenominator();
+		vi.num_frames = num_frames;
+		vi.pixel_type = VideoInfo::CS_BGR24;
+	}
+
+	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
+		PVideoFrame dst = env->NewVideoFrame(vi);
+
+		std::shared_ptr<const FrameSnapshot> shared;
+		try {
+			bool duplicate;
+			int dropped;
+			shared = videoInputSource->GetSharedFrame(sharedBase, n, duplicate, dropped);
+		} catch (const char* e) {
+			env->ThrowError(e);
+		}
 
-		env->BitBlt(dst_p, dst_pitch, videoBuffer, videoRowSize, videoRowSize, videoHeight);
+		ptrdiff_t regionPitch;
+		const unsigned char* regionRows = videoInputSource->GetRegionRows(shared->pixels, region, regionPitch);
+		CopyFrameRows(dst->GetWritePtr(), dst->GetPitch(), regionRows, regionPitch, sizeof(unsigned char) * 3 * vi.width, vi.height);
 
 		return dst;
 	}
@@ -86,17 +184,193 @@ public:
 
 
 AVSValue __cdecl Create_AVSVideoInputSource(AVSValue args, void* user_data, IScriptEnvironment* env) {
-	int fps_numerator = args[4].AsInt(30);
-	int fps_denominator = args[5].AsInt(1);
-	int num_frames = calculateDefaultNumFrames(fps_numerator, fps_denominator);
-	return new AVSVideoInputSource(args[0].AsInt(), args[1].AsString(), args[2].AsInt(), args[3].AsInt(), fps_numerator, fps_denominator, args[6].AsInt(num_frames), args[7].AsBool(true), env);
+	VideoInputSourceParams params;
+	params.deviceID = args[0].AsInt();
+	params.connectionType = args[1].AsString();
+	params.width = args[2].AsInt();
+	params.height = args[3].AsInt();
+	params.fpsNumerator = args[4].AsInt(30);
+	params.fpsDenominator = args[5].AsInt(1);
+	params.frameSkip = args[7].AsBool(true);
+	params.reconnectTimeout = args[8].AsInt(0);
+	params.captureFormat = args[9].AsString("RGB24");
+	params.audio = args[10].AsString("none");
+	params.audioRate = args[11].AsInt(48000);
+	params.audioChannels = args[12].AsInt(2);
+	params.queueDepth = args[13].AsInt(4);
+	params.fields = args[14].AsString("none");
+	params.regions = args[15].AsString("");
+	params.waitSpin = args[16].AsInt(50);
+	params.waitTimeout = args[17].AsInt(0);
+	params.frameDeadline = args[18].AsInt(0);
+	params.realtime = args[19].AsBool(false);
+	params.lossless = args[20].AsInt(0);
+	params.resize = args[21].AsString("none");
+	int num_frames = calculateDefaultNumFrames(params.fpsNumerator, params.fpsDenominator);
+	return new AVSVideoInputSource(params, args[6].AsInt(num_frames), env);
+}
+
+
+
+AVSValue __cdecl Create_AVSVideoInputSourceRegion(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::FindByDeviceID(args[0].AsInt());
+	if (!source) {
+		env->ThrowError("VideoInputSourceRegion: no VideoInputSource is capturing from this device");
+	}
+	int region = source->FindRegion(args[1].AsString());
+	if (region < 0) {
+		env->ThrowError("VideoInputSourceRegion: region name is invalid");
+	}
+	int num_frames = calculateDefaultNumFrames(source->GetFpsNumerator(), source->GetFpsDenominator());
+	return new AVSVideoInputSourceRegion(source, region, args[2].AsInt(num_frames));
+}
+
+
+
+AVSValue __cdecl Get_AVSVideoInputSourceStats(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	VideoInputSourceStats stats;
+	if (!VideoInputSource::GetStatsByDeviceID(args[0].AsInt(), stats)) {
+		env->ThrowError("VideoInputSourceStats: no VideoInputSource is capturing from this device");
+	}
+
+	const char* name = args[1].AsString();
+	if (stricmp(name, "samples_received") == 0) {
+		return (int)stats.samplesReceived;
+	}
+	else if (stricmp(name, "samples_dropped") == 0) {
+		return (int)stats.samplesDropped;
+	}
+	else if (stricmp(name, "frames_delivered") == 0) {
+		return (int)stats.framesDelivered;
+	}
+	else if (stricmp(name, "frames_duplicated") == 0) {
+		return (int)stats.framesDuplicated;
+	}
+	else if (stricmp(name, "deadline_misses") == 0) {
+		return (int)stats.deadlineMisses;
+	}
+	else if (stricmp(name, "wait_time") == 0) {
+		return stats.waitTime;
+	}
+	else if (stricmp(name, "frame_latency") == 0) {
+		return stats.frameLatency;
+	}
+	else if (stricmp(name, "reconnects") == 0) {
+		return stats.reconnects;
+	}
+	else if (stricmp(name, "construct_time") == 0) {
+		return stats.constructTime;
+	}
+	else if (stricmp(name, "setup_time") == 0) {
+		return stats.setupTime;
+	}
+	else if (stricmp(name, "startup_wait") == 0) {
+		return stats.startupWait;
+	}
+	else if (stricmp(name, "negotiated_fps") == 0) {
+		return stats.negotiatedFps;
+	}
+	else if (stricmp(name, "measured_fps") == 0) {
+		return stats.measuredFps;
+	}
+	else if (stricmp(name, "clock_ratio") == 0) {
+		return stats.clockRatio;
+	}
+	else if (stricmp(name, "output_fps") == 0) {
+		return stats.outputFps;
+	}
+	else if (stricmp(name, "realtime_slips") == 0) {
+		return stats.realtimeSlips;
+	}
+	else if (stricmp(name, "audio_frames") == 0) {
+		return (int)stats.audioFrames;
+	}
+	else if (stricmp(name, "audio_latency") == 0) {
+		return stats.audioLatency;
+	}
+	else if (stricmp(name, "audio_drift") == 0) {
+		return stats.audioDrift;
+	}
+	else if (stricmp(name, "audio_slips") == 0) {
+		return stats.audioSlips;
+	}
+	else if (stricmp(name, "copy_rate") == 0) {
+		return stats.copyRate;
+	}
+	else if (stricmp(name, "capture_bytes") == 0) {
+		return stats.captureBytes;
+	}
+	else if (stricmp(name, "region_bytes") == 0) {
+		return stats.regionBytes;
+	}
+	else if (stricmp(name, "frames_shared") == 0) {
+		return (int)stats.framesShared;
+	}
+	else if (stricmp(name, "opens") == 0) {
+		return stats.opens;
+	}
+	else if (stricmp(name, "frame_memory") == 0) {
+		return stats.frameMemory;
+	}
+	else if (stricmp(name, "queued_frames") == 0) {
+		return stats.queuedFrames;
+	}
+	else if (stricmp(name, "spilled_frames") == 0) {
+		return stats.spilledFrames;
+	}
+	else if (stricmp(name, "spill_bytes") == 0) {
+		return stats.spillBytes;
+	}
+	else if (stricmp(name, "capture_width") == 0) {
+		return stats.captureWidth;
+	}
+	else if (stricmp(name, "capture_height") == 0) {
+		return stats.captureHeight;
+	}
+	else if (stricmp(name, "capture_mode") == 0) {
+		return env->SaveString(stats.captureMode.c_str());
+	}
+
+	env->ThrowError("VideoInputSourceStats: counter name is invalid");
+	return AVSValue();
+}
+
+
+
+AVSValue __cdecl Get_AVSVideoInputSourceWait(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	std::vector<int> device_ids;
+	for (int i = 0; i < args[0].ArraySize(); i++) {
+		device_ids.push_back(args[0][i].AsInt());
+	}
+
+	std::vector<DeviceOpenResult> results;
+	if (!VideoInputSource::WaitForDevices(device_ids, results)) {
+		env->ThrowError("VideoInputSourceWait: no VideoInputSource is capturing from this device");
+	}
+
+	// every device is waited for before the first failure is reported
+	double setupTime = 0.0;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].error != NULL) {
+			env->ThrowError("VideoInputSourceWait: device %d cannot be opened, %s", results[i].deviceID, results[i].error);
+		}
+		if (results[i].setupTime > setupTime) {
+			setupTime = results[i].setupTime;
+		}
+	}
+	return setupTime;
 }
 
 
 
 extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit2(IScriptEnvironment * env) {
-	//const char* ARG_FORMAT = "[device_id]i[connection_type]s[width]i[height]i[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b";
-	const char* ARG_FORMAT = "isii[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b";
+	//const char* ARG_FORMAT = "[device_id]i[connection_type]s[width]i[height]i[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b[reconnect_timeout]i[capture_format]s[audio]s[audio_rate]i[audio_channels]i[queue_depth]i[fields]s[regions]s[wait_spin]i[wait_timeout]i[frame_deadline]i[realtime]b[lossless]i[resize]s";
+	const char* ARG_FORMAT = "isii[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b[reconnect_timeout]i[capture_format]s[audio]s[audio_rate]i[audio_channels]i[queue_depth]i[fields]s[regions]s[wait_spin]i[wait_timeout]i[frame_deadline]i[realtime]b[lossless]i[resize]s";
 	env->AddFunction("VideoInputSource", ARG_FORMAT, Create_AVSVideoInputSource, 0);
+	env->AddFunction("VideoInputSourceRegion", "is[num_frames]i", Create_AVSVideoInputSourceRegion, 0);
+	env->AddFunction("VideoInputSourceStats", "is", Get_AVSVideoInputSourceStats, 0);
+	env->AddFunction("VideoInputSourceWait", "i+", Get_AVSVideoInputSourceWait, 0);
 	return "`VideoInputSource' VideoInputSource plugin";
 }
+
+#endif
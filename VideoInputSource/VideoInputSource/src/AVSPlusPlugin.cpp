@@ -0,0 +1,549 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// AviSynth+ plugin (interface version 8), built instead of AVSPlugin.cpp when VIDEOINPUTSOURCE_AVISYNTHPLUS is defined
+
+#ifdef VIDEOINPUTSOURCE_AVISYNTHPLUS
+
+#define _CRT_NONSTDC_NO_DEPRECATE
+
+
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <avisynth.h>
+
+#include <memory>
+
+#include "VideoInputSource.h"
+#include "FrameCopy.h"
+
+
+
+const AVS_Linkage* AVS_linkage = nullptr;
+
+// output names and their pixel types; the YUV ones are converted with the BT.601 limited range matrix
+static const char* OUTPUT_NAMES[] = { "RGB24", "RGBP8", "YV24", "YV16", "YV12" };
+static const int OUTPUT_PIXEL_TYPES[] = { VideoInfo::CS_BGR24, VideoInfo::CS_RGBP8, VideoInfo::CS_YV24, VideoInfo::CS_YV16, VideoInfo::CS_YV12 };
+static const int NUM_OUTPUTS = sizeof(OUTPUT_NAMES) / sizeof(OUTPUT_NAMES[0]);
+
+// frame property values of _Matrix and _ColorRange
+static const int MATRIX_RGB = 0;
+static const int MATRIX_BT601 = 6;
+static const int RANGE_FULL = 0;
+static const int RANGE_LIMITED = 1;
+
+
+
+static inline BYTE RgbToY(const int r, const int g, const int b) {
+	return (BYTE)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline BYTE RgbToU(const int r, const int g, const int b) {
+	return (BYTE)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline BYTE RgbToV(const int r, const int g, const int b) {
+	return (BYTE)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// src is bottom-up BGR24 as captured, rows srcPitch apart so a field can be read in place; planes are top-down
+static void ConvertToRGBP8(const unsigned char* src, const ptrdiff_t srcPitch, const int width, const int height, PVideoFrame& dst) {
+	BYTE* g = dst->GetWritePtr(PLANAR_G);
+	BYTE* b = dst->GetWritePtr(PLANAR_B);
+	BYTE* r = dst->GetWritePtr(PLANAR_R);
+	const int pitch = dst->GetPitch(PLANAR_G);
+	for (int y = 0; y < height; y++) {
+		const unsigned char* srcp = src + (height - y - 1) * srcPitch;
+		for (int x = 0; x < width; x++) {
+			b[x] = srcp[x * 3];
+			g[x] = srcp[x * 3 + 1];
+			r[x] = srcp[x * 3 + 2];
+		}
+		g += pitch;
+		b += pitch;
+		r += pitch;
+	}
+}
+
+// chroma is taken from the average colour of each subsampled block
+static void ConvertToYUV(const unsigned char* src, const ptrdiff_t srcPitch, const int width, const int height, const int subsampleX, const int subsampleY, PVideoFrame& dst) {
+	BYTE* yp = dst->GetWritePtr(PLANAR_Y);
+	BYTE* up = dst->GetWritePtr(PLANAR_U);
+	BYTE* vp = dst->GetWritePtr(PLANAR_V);
+	const int pitchY = dst->GetPitch(PLANAR_Y);
+	const int pitchUV = dst->GetPitch(PLANAR_U);
+	const int blockWidth = 1 << subsampleX;
+	const int blockHeight = 1 << subsampleY;
+	const int blockSize = blockWidth * blockHeight;
+
+	for (int y = 0; y < height; y += blockHeight) {
+		for (int x = 0; x < width; x += blockWidth) {
+			int sumR = 0, sumG = 0, sumB = 0;
+			for (int by = 0; by < blockHeight; by++) {
+				const unsigned char* srcp = src + (height - y - by - 1) * srcPitch + x * 3;
+				for (int bx = 0; bx < blockWidth; bx++, srcp += 3) {
+					yp[(y + by) * pitchY + x + bx] = RgbToY(srcp[2], srcp[1], srcp[0]);
+					sumB += srcp[0];
+					sumG += srcp[1];
+					sumR += srcp[2];
+				}
+			}
+			int chroma = (y >> subsampleY) * pitchUV + (x >> subsampleX);
+			int half = blockSize / 2;
+			up[chroma] = RgbToU((sumR + half) / blockSize, (sumG + half) / blockSize, (sumB + half) / blockSize);
+			vp[chroma] = RgbToV((sumR + half) / blockSize, (sumG + half) / blockSize, (sumB + half) / blockSize);
+		}
+	}
+}
+
+// pixel type of an output name, 0 when there is none
+static int GetOutputPixelType(const char* output) {
+	for (int i = 0; i < NUM_OUTPUTS; i++) {
+		if (stricmp(output, OUTPUT_NAMES[i]) == 0) {
+			return OUTPUT_PIXEL_TYPES[i];
+		}
+	}
+	return 0;
+}
+
+static bool FitsSubsampling(const VideoInfo& vi) {
+	return !vi.IsYUV() || ((vi.width % (1 << vi.GetPlaneWidthSubsampling(PLANAR_U))) == 0 && (vi.height % (1 << vi.GetPlaneHeightSubsampling(PLANAR_U))) == 0);
+}
+
+// writes captured rows, bottom-up BGR24, into dst in the pixel type of vi
+static void WriteOutput(const VideoInfo& vi, const unsigned char* src, const ptrdiff_t srcPitch, PVideoFrame& dst) {
+	if (vi.IsRGB24()) {
+		// captured frames already are bottom-up BGR24, the packed RGB layout of AviSynth
+		CopyFrameRows(dst->GetWritePtr(), dst->GetPitch(), src, srcPitch, sizeof(unsigned char) * 3 * vi.width, vi.height);
+	}
+	else if (vi.IsPlanarRGB()) {
+		ConvertToRGBP8(src, srcPitch, vi.width, vi.height, dst);
+	}
+	else {
+		ConvertToYUV(src, srcPitch, vi.width, vi.height, vi.GetPlaneWidthSubsampling(PLANAR_U), vi.GetPlaneHeightSubsampling(PLANAR_U), dst);
+	}
+}
+
+static void SetCaptureProps(IScriptEnvironment* env, PVideoFrame& dst, const VideoInfo& vi, const double time, const unsigned long sequence, const bool duplicate, const int dropped) {
+	AVSMap* props = env->getFramePropsRW(dst);
+	env->propSetFloat(props, "_AbsoluteTime", time, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "_DurationNum", vi.fps_denominator, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "_DurationDen", vi.fps_numerator, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "_Matrix", vi.IsYUV() ? MATRIX_BT601 : MATRIX_RGB, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "_ColorRange", vi.IsYUV() ? RANGE_LIMITED : RANGE_FULL, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "CaptureSequence", sequence, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "CaptureIsDuplicate", duplicate ? 1 : 0, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+	env->propSetInt(props, "CaptureDropped", dropped, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+}
+
+// frame properties came with interface version 8
+static bool HasFrameProps(IScriptEnvironment* env) {
+	try {
+		env->CheckVersion(8);
+	}
+	catch (const AvisynthError&) {
+		return false;
+	}
+	return true;
+}
+
+
+
+class AVSPlusVideoInputSource : public IClip {
+private:
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase;
+	VideoInfo vi;
+	bool hasFrameProps;
+
+public:
+	AVSPlusVideoInputSource(const VideoInputSourceParams& params, const int num_frames, const char* output, IScriptEnvironment* env) {
+		int pixelType = GetOutputPixelType(output);
+		if (pixelType == 0) {
+			env->ThrowError("VideoInputSource: output is invalid");
+		}
+
+		memset(&vi, 0, sizeof(vi));
+		vi.width = params.width;
+		vi.height = params.height;
+		vi.pixel_type = pixelType;
+
+		hasFrameProps = HasFrameProps(env);
+
+		try {
+			videoInputSource = VideoInputSource::Create(params);
+			sharedBase = videoInputSource->OpenSharedClip();
+		} catch (const char* e) {
+			env->ThrowError(e);
+		}
+
+		vi.fps_numerator = params.fpsNumerator;
+		vi.fps_denominator = params.fpsDenominator;
+		vi.num_frames = num_frames;
+
+		// every captured frame is served as its two fields, like SeparateFields does
+		if (videoInputSource->HasFields()) {
+			vi.height /= 2;
+			vi.num_frames *= 2;
+			vi.MulDivFPS(2, 1);
+			vi.SetFieldBased(true);
+			vi.image_type |= videoInputSource->IsTopField(0) ? VideoInfo::IT_TFF : VideoInfo::IT_BFF;
+		}
+
+		if (!FitsSubsampling(vi)) {
+			videoInputSource->Release();
+			videoInputSource.reset();
+			env->ThrowError("VideoInputSource: width or height does not fit the chroma subsampling of output");
+		}
+
+		if (videoInputSource->HasAudio()) {
+			vi.audio_samples_per_second = videoInputSource->GetAudioRate();
+			vi.nchannels = videoInputSource->GetAudioChannels();
+			vi.sample_type = SAMPLE_INT16;
+			vi.num_audio_samples = vi.AudioSamplesFromFrames(vi.num_frames);
+		}
+	}
+
+	__stdcall ~AVSPlusVideoInputSource() {
+		videoInputSource->Release();
+	}
+
+	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
+		PVideoFrame dst = env->NewVideoFrame(vi);
+
+		// device setup errors surface here, since the device is opened in background
+		// a field is read straight out of the captured frame, so it is copied or converted only once
+		int videoRowSize = sizeof(unsigned char) * 3 * vi.width;
+		const unsigned char* videoBuffer = NULL;
+		ptrdiff_t videoPitch = videoRowSize;
+		std::shared_ptr<const FrameSnapshot> shared;
+		bool sharedDuplicate = false;
+		int sharedDropped = 0;
+		try {
+			// clips opened later on the same session capture through the history, so this one reads from there too
+			shared = videoInputSource->GetSharedFrame(sharedBase, n, sharedDuplicate, sharedDropped);
+			videoBuffer = videoInputSource->HasFields() ? videoInputSource->GetFieldRows(shared->pixels, n, videoPitch) : shared->pixels;
+		} catch (const char* e) {
+			env->ThrowError(e);
+		}
+
+		WriteOutput(vi, videoBuffer, videoPitch, dst);
+
+		if (hasFrameProps) {
+			// the later field of a frame was captured one field period after the earlier one
+			bool laterField = videoInputSource->HasFields() && n % 2 == 1;
+			double fieldOffset = laterField ? (double)vi.fps_denominator / vi.fps_numerator : 0.0;
+			SetCaptureProps(env, dst, vi, shared->time + fieldOffset, shared->number, sharedDuplicate, laterField ? 0 : sharedDropped);
+			if (videoInputSource->HasFields()) {
+				env->propSetInt(env->getFramePropsRW(dst), "_Field", videoInputSource->IsTopField(n) ? 1 : 0, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+			}
+		}
+
+		return dst;
+	}
+
+	const VideoInfo& __stdcall GetVideoInfo() {
+		return vi;
+	}
+
+	bool __stdcall GetParity(int n) { return videoInputSource->HasFields() && videoInputSource->IsTopField(n); }
+	void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env) {
+		if (!vi.HasAudio()) {
+			return;
+		}
+		videoInputSource->GetAudio((short*)buf, start, count);
+	}
+
+	// a live source hands out samples in call order and paces them itself, so it runs serialized
+	int __stdcall SetCacheHints(int cachehints, int frame_range) {
+		return (cachehints == CACHE_GET_MTMODE) ? MT_SERIALIZED : 0;
+	}
+};
+
+
+
+// a region of a source opened by VideoInputSource; its rows are read straight out of the frame all clips share
+class AVSPlusVideoInputSourceRegion : public IClip {
+private:
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	int region;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase;
+	VideoInfo vi;
+	bool hasFrameProps;
+
+public:
+	AVSPlusVideoInputSourceRegion(const std::shared_ptr<VideoInputSource>& source, const int index, const int num_frames, const char* output, IScriptEnvironment* env) : videoInputSource(source), region(index), sharedBase(source->OpenSharedClip()) {
+		int pixelType = GetOutputPixelType(output);
+		if (pixelType == 0) {
+			env->ThrowError("VideoInputSourceRegion: output is invalid");
+		}
+
+		memset(&vi, 0, sizeof(vi));
+		vi.width = source->GetRegion(index).width;
+		vi.height = source->GetRegion(index).height;
+		vi.fps_numerator = source->GetFpsNumerator();
+		vi.fps_denominator = source->GetFpsDenominator();
+		vi.num_frames = num_frames;
+		vi.pixel_type = pixelType;
+		if (!FitsSubsampling(vi)) {
+			env->ThrowError("VideoInputSourceRegion: region size does not fit the chroma subsampling of output");
+		}
+
+		hasFrameProps = HasFrameProps(env);
+	}
+
+	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) {
+		PVideoFrame dst = env->NewVideoFrame(vi);
+
+		std::shared_ptr<const FrameSnapshot> shared;
+		bool duplicate = false;
+		int dropped = 0;
+		try {
+			shared = videoInputSource->GetSharedFrame(sharedBase, n, duplicate, dropped);
+		} catch (const char* e) {
+			env->ThrowError(e);
+		}
+
+		ptrdiff_t regionPitch;
+		const unsigned char* regionRows = videoInputSource->GetRegionRows(shared->pixels, region, regionPitch);
+		WriteOutput(vi, regionRows, regionPitch, dst);
+
+		if (hasFrameProps) {
+			SetCaptureProps(env, dst, vi, shared->time, shared->number, duplicate, dropped);
+			env->propSetData(env->getFramePropsRW(dst), "CaptureRegion", videoInputSource->GetRegion(region).name.c_str(), -1, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+		}
+
+		return dst;
+	}
+
+	const VideoInfo& __stdcall GetVideoInfo() {
+		return vi;
+	}
+
+	bool __stdcall GetParity(int n) { return false; }
+	void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env) {}
+
+	// shared frames are looked up by frame number, but capturing still has to follow call order
+	int __stdcall SetCacheHints(int cachehints, int frame_range) {
+		return (cachehints == CACHE_GET_MTMODE) ? MT_SERIALIZED : 0;
+	}
+};
+
+
+
+AVSValue __cdecl Create_AVSPlusVideoInputSource(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	VideoInputSourceParams params;
+	params.deviceID = args[0].AsInt();
+	params.connectionType = args[1].AsString();
+	params.width = args[2].AsInt();
+	params.height = args[3].AsInt();
+	params.fpsNumerator = args[4].AsInt(30);
+	params.fpsDenominator = args[5].AsInt(1);
+	params.frameSkip = args[7].AsBool(true);
+	params.reconnectTimeout = args[8].AsInt(0);
+	params.captureFormat = args[9].AsString("RGB24");
+	params.audio = args[10].AsString("none");
+	params.audioRate = args[11].AsInt(48000);
+	params.audioChannels = args[12].AsInt(2);
+	params.queueDepth = args[13].AsInt(4);
+	params.fields = args[14].AsString("none");
+	params.regions = args[16].AsString("");
+	params.waitSpin = args[17].AsInt(50);
+	params.waitTimeout = args[18].AsInt(0);
+	params.frameDeadline = args[19].AsInt(0);
+	params.realtime = args[20].AsBool(false);
+	params.lossless = args[21].AsInt(0);
+	params.resize = args[22].AsString("none");
+	int num_frames = calculateDefaultNumFrames(params.fpsNumerator, params.fpsDenominator);
+	return new AVSPlusVideoInputSource(params, args[6].AsInt(num_frames), args[15].AsString("RGB24"), env);
+}
+
+
+
+AVSValue __cdecl Create_AVSPlusVideoInputSourceRegion(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::FindByDeviceID(args[0].AsInt());
+	if (!source) {
+		env->ThrowError("VideoInputSourceRegion: no VideoInputSource is capturing from this device");
+	}
+	int region = source->FindRegion(args[1].AsString());
+	if (region < 0) {
+		env->ThrowError("VideoInputSourceRegion: region name is invalid");
+	}
+	int num_frames = calculateDefaultNumFrames(source->GetFpsNumerator(), source->GetFpsDenominator());
+	return new AVSPlusVideoInputSourceRegion(source, region, args[2].AsInt(num_frames), args[3].AsString("RGB24"), env);
+}
+
+
+
+AVSValue __cdecl Get_AVSPlusVideoInputSourceStats(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	VideoInputSourceStats stats;
+	if (!VideoInputSource::GetStatsByDeviceID(args[0].AsInt(), stats)) {
+		env->ThrowError("VideoInputSourceStats: no VideoInputSource is capturing from this device");
+	}
+
+	const char* name = args[1].AsString();
+	if (stricmp(name, "samples_received") == 0) {
+		return (int)stats.samplesReceived;
+	}
+	else if (stricmp(name, "samples_dropped") == 0) {
+		return (int)stats.samplesDropped;
+	}
+	else if (stricmp(name, "frames_delivered") == 0) {
+		return (int)stats.framesDelivered;
+	}
+	else if (stricmp(name, "frames_duplicated") == 0) {
+		return (int)stats.framesDuplicated;
+	}
+	else if (stricmp(name, "deadline_misses") == 0) {
+		return (int)stats.deadlineMisses;
+	}
+	else if (stricmp(name, "wait_time") == 0) {
+		return stats.waitTime;
+	}
+	else if (stricmp(name, "frame_latency") == 0) {
+		return stats.frameLatency;
+	}
+	else if (stricmp(name, "reconnects") == 0) {
+		return stats.reconnects;
+	}
+	else if (stricmp(name, "construct_time") == 0) {
+		return stats.constructTime;
+	}
+	else if (stricmp(name, "setup_time") == 0) {
+		return stats.setupTime;
+	}
+	else if (stricmp(name, "startup_wait") == 0) {
+		return stats.startupWait;
+	}
+	else if (stricmp(name, "negotiated_fps") == 0) {
+		return stats.negotiatedFps;
+	}
+	else if (stricmp(name, "measured_fps") == 0) {
+		return stats.measuredFps;
+	}
+	else if (stricmp(name, "clock_ratio") == 0) {
+		return stats.clockRatio;
+	}
+	else if (stricmp(name, "output_fps") == 0) {
+		return stats.outputFps;
+	}
+	else if (stricmp(name, "realtime_slips") == 0) {
+		return stats.realtimeSlips;
+	}
+	else if (stricmp(name, "audio_frames") == 0) {
+		return (int)stats.audioFrames;
+	}
+	else if (stricmp(name, "audio_latency") == 0) {
+		return stats.audioLatency;
+	}
+	else if (stricmp(name, "audio_drift") == 0) {
+		return stats.audioDrift;
+	}
+	else if (stricmp(name, "audio_slips") == 0) {
+		return stats.audioSlips;
+	}
+	else if (stricmp(name, "copy_rate") == 0) {
+		return stats.copyRate;
+	}
+	else if (stricmp(name, "capture_bytes") == 0) {
+		return stats.captureBytes;
+	}
+	else if (stricmp(name, "region_bytes") == 0) {
+		return stats.regionBytes;
+	}
+	else if (stricmp(name, "frames_shared") == 0) {
+		return (int)stats.framesShared;
+	}
+	else if (stricmp(name, "opens") == 0) {
+		return stats.opens;
+	}
+	else if (stricmp(name, "frame_memory") == 0) {
+		return stats.frameMemory;
+	}
+	else if (stricmp(name, "queued_frames") == 0) {
+		return stats.queuedFrames;
+	}
+	else if (stricmp(name, "spilled_frames") == 0) {
+		return stats.spilledFrames;
+	}
+	else if (stricmp(name, "spill_bytes") == 0) {
+		return stats.spillBytes;
+	}
+	else if (stricmp(name, "capture_width") == 0) {
+		return stats.captureWidth;
+	}
+	else if (stricmp(name, "capture_height") == 0) {
+		return stats.captureHeight;
+	}
+	else if (stricmp(name, "capture_mode") == 0) {
+		return env->SaveString(stats.captureMode.c_str());
+	}
+
+	env->ThrowError("VideoInputSourceStats: counter name is invalid");
+	return AVSValue();
+}
+
+
+
+AVSValue __cdecl Get_AVSPlusVideoInputSourceWait(AVSValue args, void* user_data, IScriptEnvironment* env) {
+	std::vector<int> device_ids;
+	for (int i = 0; i < args[0].ArraySize(); i++) {
+		device_ids.push_back(args[0][i].AsInt());
+	}
+
+	std::vector<DeviceOpenResult> results;
+	if (!VideoInputSource::WaitForDevices(device_ids, results)) {
+		env->ThrowError("VideoInputSourceWait: no VideoInputSource is capturing from this device");
+	}
+
+	// every device is waited for before the first failure is reported
+	double setupTime = 0.0;
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].error != NULL) {
+			env->ThrowError("VideoInputSourceWait: device %d cannot be opened, %s", results[i].deviceID, results[i].error);
+		}
+		if (results[i].setupTime > setupTime) {
+			setupTime = results[i].setupTime;
+		}
+	}
+	return setupTime;
+}
+
+
+
+extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors) {
+	AVS_linkage = vectors;
+
+	//const char* ARG_FORMAT = "[device_id]i[connection_type]s[width]i[height]i[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b[reconnect_timeout]i[capture_format]s[audio]s[audio_rate]i[audio_channels]i[queue_depth]i[fields]s[output]s[regions]s[wait_spin]i[wait_timeout]i[frame_deadline]i[realtime]b[lossless]i[resize]s";
+	const char* ARG_FORMAT = "isii[fps_numerator]i[fps_denominator]i[num_frames]i[frame_skip]b[reconnect_timeout]i[capture_format]s[audio]s[audio_rate]i[audio_channels]i[queue_depth]i[fields]s[output]s[regions]s[wait_spin]i[wait_timeout]i[frame_deadline]i[realtime]b[lossless]i[resize]s";
+	env->AddFunction("VideoInputSource", ARG_FORMAT, Create_AVSPlusVideoInputSource, 0);
+	env->AddFunction("VideoInputSourceRegion", "is[num_frames]i[output]s", Create_AVSPlusVideoInputSourceRegion, 0);
+	env->AddFunction("VideoInputSourceStats", "is", Get_AVSPlusVideoInputSourceStats, 0);
+	env->AddFunction("VideoInputSourceWait", "i+", Get_AVSPlusVideoInputSourceWait, 0);
+	return "`VideoInputSource' VideoInputSource plugin";
+}
+
+#endif
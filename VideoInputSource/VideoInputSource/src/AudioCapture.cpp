@@ -0,0 +1,163 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "AudioCapture.h"
+
+
+
+// beyond this many seconds apart, a new block means a restart rather than jitter
+static const double AUDIO_RESYNC = 0.1;
+// weight of each block's timestamp in the clock mapping
+static const double AUDIO_OFFSET_GAIN = 0.01;
+
+static const double TONE_BLOCK = 0.01;
+static const double TONE_LEVEL = 0.1;
+
+
+
+AudioRing::AudioRing(const int rate, const int channels, const double seconds)
+	: mRate(rate), mChannels(channels), mCapacity((__int64)(rate * seconds)), mWritten(0), mOffset(0.0), mMapped(false) {
+	mSamples.resize((size_t)(mCapacity * mChannels));
+}
+
+void AudioRing::ReceiveAudio(const short* samples, int frames, double time) {
+	__int64 written = mWritten.load(std::memory_order_relaxed);
+
+	// a block larger than the ring only keeps its tail
+	if (frames > mCapacity) {
+		samples += (frames - mCapacity) * mChannels;
+		time += (double)(frames - mCapacity) / (double)mRate;
+		written += frames - mCapacity;
+		frames = (int)mCapacity;
+	}
+
+	int position = (int)(written % mCapacity);
+	int first = (int)((frames < mCapacity - position) ? frames : mCapacity - position);
+	memcpy(&mSamples[(size_t)position * mChannels], samples, sizeof(short) * first * mChannels);
+	if (first < frames) {
+		memcpy(&mSamples[0], samples + first * mChannels, sizeof(short) * (frames - first) * mChannels);
+	}
+
+	double offset = (double)written - time * mRate;
+	double current = mOffset.load(std::memory_order_relaxed);
+	if (!mMapped || fabs(offset - current) > AUDIO_RESYNC * mRate) {
+		mOffset.store(offset, std::memory_order_relaxed);
+	}
+	else {
+		mOffset.store(current + AUDIO_OFFSET_GAIN * (offset - current), std::memory_order_relaxed);
+	}
+
+	mWritten.store(written + frames, std::memory_order_release);
+	mMapped.store(true, std::memory_order_release);
+}
+
+int AudioRing::GetRate() {
+	return mRate;
+}
+
+int AudioRing::GetChannels() {
+	return mChannels;
+}
+
+__int64 AudioRing::GetWritten() {
+	return mWritten.load(std::memory_order_acquire);
+}
+
+bool AudioRing::IndexAt(const double time, __int64& index) {
+	if (!mMapped.load(std::memory_order_acquire)) {
+		return false;
+	}
+	index = (__int64)floor(mOffset.load(std::memory_order_relaxed) + time * mRate + 0.5);
+	return true;
+}
+
+int AudioRing::Read(const __int64 index, short* out, const int count) {
+	__int64 written = mWritten.load(std::memory_order_acquire);
+	__int64 begin = (index > written - mCapacity) ? index : written - mCapacity;
+	__int64 end = (index + count < written) ? index + count : written;
+
+	memset(out, 0, sizeof(short) * count * mChannels);
+	if (begin >= end) {
+		return 0;
+	}
+
+	for (__int64 i = begin; i < end; ) {
+		int position = (int)(i % mCapacity);
+		int length = (int)((end - i < mCapacity - position) ? end - i : mCapacity - position);
+		memcpy(out + (i - index) * mChannels, &mSamples[(size_t)position * mChannels], sizeof(short) * length * mChannels);
+		i += length;
+	}
+
+	// the producer may have wrapped around onto the oldest frames while they were copied
+	__int64 after = mWritten.load(std::memory_order_acquire);
+	if (begin < after - mCapacity) {
+		__int64 lost = ((after - mCapacity < end) ? after - mCapacity : end) - begin;
+		memset(out + (begin - index) * mChannels, 0, sizeof(short) * lost * mChannels);
+		begin += lost;
+	}
+	return (int)(end - begin);
+}
+
+
+
+ToneSource::ToneSource(AudioSink* sink, const int rate, const int channels, const double frequency)
+	: mSink(sink), mRate(rate), mChannels(channels), mFrequency(frequency), mStop(false) {
+	mThread = std::thread(&ToneSource::Run, this);
+}
+
+ToneSource::~ToneSource() {
+	mStop = true;
+	mThread.join();
+}
+
+void ToneSource::Run() {
+	const int blockFrames = (int)(mRate * TONE_BLOCK);
+	std::vector<short> block((size_t)blockFrames * mChannels);
+	const double step = 2.0 * 3.14159265358979323846 * mFrequency / mRate;
+
+	double start = GetCaptureTime();
+	__int64 frame = 0;
+	while (!mStop) {
+		// like a device, a block is delivered once its last frame is due
+		double due = start + (double)(frame + blockFrames) / mRate;
+		double now = GetCaptureTime();
+		if (now < due) {
+			std::this_thread::sleep_for(std::chrono::milliseconds((int)((due - now) * 1000.0) + 1));
+			continue;
+		}
+
+		for (int i = 0; i < blockFrames; i++) {
+			// wrapping the frame count once a second keeps the argument small, exact for whole frequencies
+			short value = (short)(TONE_LEVEL * 32767.0 * sin(step * (double)((frame + i) % mRate)));
+			for (int c = 0; c < mChannels; c++) {
+				block[(size_t)i * mChannels + c] = value;
+			}
+		}
+		mSink->ReceiveAudio(&block[0], blockFrames, start + (double)frame / mRate);
+		frame += blockFrames;
+	}
+}
@@ -0,0 +1,84 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include "CaptureBackend.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+
+// lock-free ring of interleaved 16 bit audio for one producer (the capture thread) and one consumer,
+// addressed by absolute frame index. Every block also refines a mapping from the sample clock to
+// frame indices, so audio can be looked up by the time it was captured.
+class AudioRing : public AudioSink {
+private:
+	int mRate;
+	int mChannels;
+	__int64 mCapacity;
+	std::vector<short> mSamples;
+
+	// frames written since the ring was created
+	std::atomic<__int64> mWritten;
+	// frame index = mOffset + time * mRate, smoothed over blocks to take out delivery jitter
+	std::atomic<double> mOffset;
+	std::atomic<bool> mMapped;
+
+public:
+	AudioRing(const int rate, const int channels, const double seconds);
+
+	// producer side
+	void ReceiveAudio(const short* samples, int frames, double time);
+
+	int GetRate();
+	int GetChannels();
+	__int64 GetWritten();
+
+	// frame index captured at time, false until the first block has arrived
+	bool IndexAt(const double time, __int64& index);
+	// copies frames [index, index + count); frames no longer or not yet in the ring are zeroed.
+	// returns how many frames were really copied
+	int Read(const __int64 index, short* out, const int count);
+};
+
+
+
+// synthetic audio source for testing without a capture device: a sine tone delivered in 10ms blocks,
+// paced and stamped on the same clock as video samples
+class ToneSource {
+private:
+	AudioSink* mSink;
+	int mRate;
+	int mChannels;
+	double mFrequency;
+	std::thread mThread;
+	std::atomic<bool> mStop;
+
+	void Run();
+
+public:
+	ToneSource(AudioSink* sink, const int rate, const int channels, const double frequency);
+	~ToneSource();
+};
@@ -0,0 +1,59 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "CaptureBackend.h"
+
+#ifdef _WIN32
+#include "DirectShowBackend.h"
+#else
+#include "V4L2Backend.h"
+#include "SyntheticDevice.h"
+
+#include <time.h>
+#endif
+
+
+
+CaptureBackend* CreateCaptureBackend(const CaptureParams& params) {
+#ifdef _WIN32
+	if (params.connection == CONNECTION_SYNTHETIC) {
+		throw "VideoInputSource: synthetic device is only available on Linux";
+	}
+	return new DirectShowBackend(params);
+#else
+	if (params.connection == CONNECTION_SYNTHETIC) {
+		return new SyntheticBackend(params);
+	}
+	return new V4L2Backend(params);
+#endif
+}
+
+double GetCaptureTime() {
+#ifdef _WIN32
+	return videoInput::getTime();
+#else
+	// buffer timestamps of V4L2 are taken on the monotonic clock as well
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
@@ -0,0 +1,139 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include "Platform.h"
+
+#include <string>
+
+
+
+// physical input of the device
+static const int CONNECTION_COMPOSITE = 0;
+static const int CONNECTION_S_VIDEO = 1;
+static const int CONNECTION_TUNER = 2;
+static const int CONNECTION_USB = 3;
+// pattern generator in software, for measuring without hardware
+static const int CONNECTION_SYNTHETIC = 4;
+
+// capture_format that lets the backend pick the cheapest format offered
+static const char* const CAPTURE_FORMAT_AUTO = "auto";
+
+// order of the fields of an interlaced capture in time, none for progressive
+static const int FIELD_ORDER_NONE = 0;
+static const int FIELD_ORDER_TOP_FIRST = 1;
+static const int FIELD_ORDER_BOTTOM_FIRST = 2;
+
+// what a backend signals when a new sample arrives: an event handle on Windows, a file descriptor that
+// polls readable elsewhere
+#ifdef _WIN32
+typedef HANDLE CaptureEvent;
+static const CaptureEvent NO_CAPTURE_EVENT = NULL;
+#else
+typedef int CaptureEvent;
+static const CaptureEvent NO_CAPTURE_EVENT = -1;
+#endif
+
+
+
+// receives audio captured along with video as interleaved 16 bit frames, on a capture thread
+class AudioSink {
+public:
+	virtual ~AudioSink() {}
+
+	// time is when the first frame was captured, on the clock of GetCaptureTime
+	virtual void ReceiveAudio(const short* samples, int frames, double time) = 0;
+};
+
+
+
+struct CaptureParams {
+	int deviceID;
+	int connection;
+	int width, height;
+	unsigned int fpsNumerator, fpsDenominator;
+	std::string captureFormat;
+	// backends that can negotiate interlacing ask for this field order
+	int fieldOrder;
+	// milliseconds without a sample before the device counts as frozen, 0 never
+	int reconnectTimeout;
+	// buffers the driver fills in turn, for backends that stream into buffers of their own
+	int queueDepth;
+	// hand out every sample in order instead of only the newest, as far as the device keeps them
+	bool lossless;
+	// take the closest size the device offers when it cannot do the requested one, VideoInputSource scales it
+	bool resize;
+	// audio captured from the device goes here, NULL for none
+	AudioSink* audioSink;
+	int audioRate, audioChannels;
+	// synthetic device only: what follows "Synthetic:" in connection_type, read by the synthetic backend
+	std::string syntheticOptions;
+};
+
+
+
+// a capture device as VideoInputSource sees it. Calls are not synchronized, the caller serializes them.
+// Frames are delivered as BGR24 with rows bottom-up, at exactly the requested size unless resize is set.
+class CaptureBackend {
+public:
+	virtual ~CaptureBackend() {}
+
+	// opens the device with the requested mode, returns an error message on failure
+	virtual const char* Open() = 0;
+	virtual void Close() = 0;
+	virtual bool IsOpen() = 0;
+	// true when no sample arrived for the reconnect timeout
+	virtual bool IsFrozen() = 0;
+
+	virtual bool IsFrameNew() = 0;
+	// signalled when a new sample arrives, so one thread can wait on many devices at once. Valid from a
+	// successful Open until Close; a sample IsFrozen took in already is not signalled again.
+	virtual CaptureEvent GetFrameEvent() = 0;
+	// writes the newest sample to pixels, which holds 3 bytes for every pixel of the capture size
+	virtual bool GetPixels(unsigned char* pixels) = 0;
+	// sample number and capture time of the sample written by the last GetPixels call
+	virtual unsigned long GetFrameNumber() = 0;
+	virtual double GetFrameTime() = 0;
+
+	// counters of the current session, they restart with every Open
+	virtual unsigned long GetSampleCount() = 0;
+	virtual unsigned long GetDroppedSampleCount() = 0;
+
+	// 0 when the device did not report a frame rate
+	virtual double GetNegotiatedFramerate() = 0;
+	// how the capture mode was picked, empty unless capture_format is "auto"
+	virtual std::string GetCaptureModeReport() = 0;
+	// bytes of frame buffers held for the open device, driver buffers mapped into the process included
+	virtual size_t GetBufferMemory() = 0;
+	// size of the samples of the open device; the requested size unless resize let the device pick another
+	virtual int GetCaptureWidth() = 0;
+	virtual int GetCaptureHeight() = 0;
+};
+
+
+
+// the backend of this platform; throws when the parameters cannot work with it
+CaptureBackend* CreateCaptureBackend(const CaptureParams& params);
+
+// seconds on the clock every frame and audio timestamp is taken on
+double GetCaptureTime();
@@ -0,0 +1,179 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifdef _WIN32
+
+#define _CRT_NONSTDC_NO_DEPRECATE
+
+#include "DirectShowBackend.h"
+
+
+
+// capture_format names, in the order of the VI_MEDIASUBTYPE_* indices
+static const char* MEDIA_SUBTYPE_NAMES[VI_NUM_TYPES] = {
+	"RGB24", "RGB32", "RGB555", "RGB565", "YUY2", "YVYU", "YUYV", "IYUV", "UYVY", "YV12",
+	"YVU9", "Y411", "Y41P", "Y211", "AYUV", "Y800", "Y8", "GREY", "MJPG"
+};
+static const int MEDIA_SUBTYPE_AUTO = -1;
+
+static const int CONNECTIONS[] = { VI_COMPOSITE, VI_S_VIDEO, VI_TUNER, VI_USB };
+
+
+
+DirectShowBackend::AudioAdapter::AudioAdapter(AudioSink* sink) : mSink(sink) {
+}
+
+void DirectShowBackend::AudioAdapter::receiveAudio(const short* samples, int frames, double time) {
+	mSink->ReceiveAudio(samples, frames, time);
+}
+
+
+
+DirectShowBackend::DirectShowBackend(const CaptureParams& params)
+	: mParams(params), mConnection(CONNECTIONS[params.connection]), mAudioAdapter(params.audioSink), mNegotiatedFps(0.0), mCaptureWidth(params.width), mCaptureHeight(params.height) {
+	if (stricmp(mParams.captureFormat.c_str(), CAPTURE_FORMAT_AUTO) == 0) {
+		mMediaSubType = MEDIA_SUBTYPE_AUTO;
+	}
+	else {
+		mMediaSubType = VI_NUM_TYPES;
+		for (int i = 0; i < VI_NUM_TYPES; i++) {
+			if (stricmp(mParams.captureFormat.c_str(), MEDIA_SUBTYPE_NAMES[i]) == 0) {
+				mMediaSubType = i;
+				break;
+			}
+		}
+		if (mMediaSubType == VI_NUM_TYPES) {
+			throw "VideoInputSource: capture format is invalid";
+		}
+	}
+}
+
+DirectShowBackend::~DirectShowBackend() {
+	Close();
+}
+
+const char* DirectShowBackend::Open() {
+	int deviceID = mParams.deviceID;
+
+	if (mMediaSubType == MEDIA_SUBTYPE_AUTO) {
+		mVideoInput.setAutoMediaSubType(true);
+	}
+	else {
+		mVideoInput.setRequestedMediaSubType(mMediaSubType);
+	}
+	mVideoInput.setIdealFramerate(deviceID, mParams.fpsNumerator, mParams.fpsDenominator);
+	mVideoInput.setLossless(deviceID, mParams.lossless);
+	if (mParams.audioSink != NULL) {
+		mVideoInput.setupAudio(deviceID, mParams.audioRate, mParams.audioChannels, &mAudioAdapter);
+	}
+
+	bool success = mVideoInput.setupDevice(deviceID, mParams.width, mParams.height, mConnection);
+	mModeReport = mVideoInput.getCaptureModeReport(deviceID);
+	mNegotiatedFps = mVideoInput.getNegotiatedFramerate(deviceID);
+	if (!success) {
+		return "VideoInputSource: cannot init device";
+	}
+
+	// videoInput falls back to the closest size the device offers, which is only good enough to be scaled;
+	// fields are scaled one by one, so their frame needs an even height
+	mCaptureWidth = mVideoInput.getWidth(deviceID);
+	mCaptureHeight = mVideoInput.getHeight(deviceID);
+	bool exact = (mCaptureWidth == mParams.width && mCaptureHeight == mParams.height);
+	bool scalable = mParams.resize && (mParams.fieldOrder == FIELD_ORDER_NONE || mCaptureHeight % 2 == 0);
+	if (!exact && !scalable) {
+		mVideoInput.stopDevice(deviceID);
+		return "VideoInputSource: cannot init device with assigned width and height";
+	}
+
+	if (mParams.audioSink != NULL && !mVideoInput.hasAudio(deviceID)) {
+		mVideoInput.stopDevice(deviceID);
+		return "VideoInputSource: cannot capture audio with assigned rate and channels from device";
+	}
+
+	if (mParams.reconnectTimeout > 0) {
+		mVideoInput.setAutoReconnectOnFreeze(deviceID, true, mParams.reconnectTimeout);
+	}
+	return NULL;
+}
+
+void DirectShowBackend::Close() {
+	mVideoInput.stopDevice(mParams.deviceID);
+}
+
+bool DirectShowBackend::IsOpen() {
+	return mVideoInput.isDeviceSetup(mParams.deviceID);
+}
+
+bool DirectShowBackend::IsFrozen() {
+	return mVideoInput.isDeviceFrozen(mParams.deviceID);
+}
+
+bool DirectShowBackend::IsFrameNew() {
+	return mVideoInput.isFrameNew(mParams.deviceID);
+}
+
+CaptureEvent DirectShowBackend::GetFrameEvent() {
+	return mVideoInput.getFrameEvent(mParams.deviceID);
+}
+
+bool DirectShowBackend::GetPixels(unsigned char* pixels) {
+	// RGB24 of DirectShow already is BGR bottom-up
+	return mVideoInput.getPixels(mParams.deviceID, pixels, false, false);
+}
+
+unsigned long DirectShowBackend::GetFrameNumber() {
+	return mVideoInput.getFrameNumber(mParams.deviceID);
+}
+
+double DirectShowBackend::GetFrameTime() {
+	return mVideoInput.getFrameTime(mParams.deviceID);
+}
+
+unsigned long DirectShowBackend::GetSampleCount() {
+	return mVideoInput.getSampleCount(mParams.deviceID);
+}
+
+unsigned long DirectShowBackend::GetDroppedSampleCount() {
+	return mVideoInput.getDroppedSampleCount(mParams.deviceID);
+}
+
+double DirectShowBackend::GetNegotiatedFramerate() {
+	return mNegotiatedFps;
+}
+
+std::string DirectShowBackend::GetCaptureModeReport() {
+	return mModeReport;
+}
+
+size_t DirectShowBackend::GetBufferMemory() {
+	return (size_t)mVideoInput.getBufferMemory(mParams.deviceID);
+}
+
+int DirectShowBackend::GetCaptureWidth() {
+	return mCaptureWidth;
+}
+
+int DirectShowBackend::GetCaptureHeight() {
+	return mCaptureHeight;
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#ifdef _WIN32
+
+#include "videoInput/videoInput.h"
+#include "CaptureBackend.h"
+
+
+
+// captures through DirectShow with videoInput
+class DirectShowBackend : public CaptureBackend {
+private:
+	// hands audio from the videoInput grabber on to the sink of the source
+	class AudioAdapter : public audioSampleSink {
+	private:
+		AudioSink* mSink;
+
+	public:
+		AudioAdapter(AudioSink* sink);
+		void receiveAudio(const short* samples, int frames, double time);
+	};
+
+	videoInput mVideoInput;
+	CaptureParams mParams;
+	int mConnection;
+	// index into the VI_MEDIASUBTYPE_* list, -1 for auto
+	int mMediaSubType;
+	AudioAdapter mAudioAdapter;
+
+	// kept from the last setup, videoInput forgets them when a device that failed a check is stopped
+	std::string mModeReport;
+	double mNegotiatedFps;
+	int mCaptureWidth, mCaptureHeight;
+
+public:
+	DirectShowBackend(const CaptureParams& params);
+	~DirectShowBackend();
+
+	const char* Open();
+	void Close();
+	bool IsOpen();
+	bool IsFrozen();
+
+	bool IsFrameNew();
+	CaptureEvent GetFrameEvent();
+	bool GetPixels(unsigned char* pixels);
+	unsigned long GetFrameNumber();
+	double GetFrameTime();
+
+	unsigned long GetSampleCount();
+	unsigned long GetDroppedSampleCount();
+
+	double GetNegotiatedFramerate();
+	std::string GetCaptureModeReport();
+	size_t GetBufferMemory();
+	int GetCaptureWidth();
+	int GetCaptureHeight();
+};
+
+#endif
@@ -0,0 +1,281 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "FrameCopy.h"
+#include "CaptureBackend.h"
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// a 3840x2160 RGB24 frame is about 24MB, a 1920x1080 one 6MB
+static const size_t STREAMING_THRESHOLD = 8 << 20;
+static const size_t PARALLEL_THRESHOLD = 16 << 20;
+static const int MAX_COPY_THREADS = 4;
+// each thread copies at least this much, so handing it the band stays cheap against the copy
+static const size_t PARALLEL_MIN_BAND = 4 << 20;
+
+static std::mutex policyLock;
+static FrameCopyPolicy policy = { STREAMING_THRESHOLD, PARALLEL_THRESHOLD, MAX_COPY_THREADS };
+
+static std::atomic<unsigned long long> copiedBytes(0);
+static std::atomic<unsigned long long> copyNanoseconds(0);
+
+
+
+FrameCopyPolicy GetFrameCopyPolicy() {
+	std::lock_guard<std::mutex> lock(policyLock);
+	return policy;
+}
+
+void SetFrameCopyPolicy(const FrameCopyPolicy& newPolicy) {
+	std::lock_guard<std::mutex> lock(policyLock);
+	policy = newPolicy;
+}
+
+double GetFrameCopyRate() {
+	unsigned long long nanoseconds = copyNanoseconds;
+	return (nanoseconds > 0) ? (double)copiedBytes * 1e9 / (double)nanoseconds : 0.0;
+}
+
+
+
+// the destination goes to memory through write-combining buffers, without being read into the caches first.
+// Loads are left to the hardware prefetcher, a software prefetch of the source only slowed the copy down.
+static void StreamCopy(unsigned char* dst, const unsigned char* src, size_t size) {
+	size_t head = (16 - ((size_t)dst & 15)) & 15;
+	if (head > size) {
+		head = size;
+	}
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, dst += 64, src += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i*)src);
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+		_mm_stream_si128((__m128i*)dst, a);
+		_mm_stream_si128((__m128i*)(dst + 16), b);
+		_mm_stream_si128((__m128i*)(dst + 32), c);
+		_mm_stream_si128((__m128i*)(dst + 48), d);
+	}
+	memcpy(dst, src, size);
+}
+
+static void CopyRows(unsigned char* dst, const ptrdiff_t dstPitch, const unsigned char* src, const ptrdiff_t srcPitch, const size_t rowSize, const int height, const bool streaming) {
+	// contiguous rows are copied in one go
+	if (dstPitch == srcPitch && (size_t)dstPitch == rowSize) {
+		if (streaming) {
+			StreamCopy(dst, src, rowSize * height);
+		}
+		else {
+			memcpy(dst, src, rowSize * height);
+		}
+	}
+	else {
+		for (int y = 0; y < height; y++, dst += dstPitch, src += srcPitch) {
+			if (streaming) {
+				StreamCopy(dst, src, rowSize);
+			}
+			else {
+				memcpy(dst, src, rowSize);
+			}
+		}
+	}
+
+	// streaming stores are weakly ordered, they must be visible before the frame is handed on
+	if (streaming) {
+		_mm_sfence();
+	}
+}
+
+
+
+// a band of rows one thread copies
+struct CopyBand {
+	unsigned char* dst;
+	ptrdiff_t dstPitch;
+	const unsigned char* src;
+	ptrdiff_t srcPitch;
+	size_t rowSize;
+	int height;
+	bool streaming;
+	// bands of the same copy not done yet, guarded by the lock of the workers
+	int* pending;
+};
+
+// threads kept for the whole process, started as parallel copies first need them, so a copy hands its
+// bands to threads that are waiting already instead of starting and joining threads of its own.
+// Copies running at once, from several sources, queue their bands to the same threads.
+class CopyWorkers {
+private:
+	std::mutex mLock;
+	std::condition_variable mBandSignal;
+	std::condition_variable mDoneSignal;
+	std::deque<CopyBand> mBands;
+	std::vector<std::thread> mThreads;
+
+	void Run();
+
+public:
+	static CopyWorkers& GetInstance();
+
+	// copies all bands, the last one on the calling thread, and returns when every one is done
+	void Copy(std::vector<CopyBand>& bands);
+};
+
+CopyWorkers& CopyWorkers::GetInstance() {
+	// leaked on purpose, like the FrameScheduler: joining its threads during static destruction
+	// deadlocks while a DLL is unloaded
+	static CopyWorkers* instance = new CopyWorkers();
+	return *instance;
+}
+
+void CopyWorkers::Run() {
+	std::unique_lock<std::mutex> lock(mLock);
+	while (true) {
+		mBandSignal.wait(lock, [this] { return !mBands.empty(); });
+		CopyBand band = mBands.front();
+		mBands.pop_front();
+		lock.unlock();
+
+		CopyRows(band.dst, band.dstPitch, band.src, band.srcPitch, band.rowSize, band.height, band.streaming);
+
+		lock.lock();
+		(*band.pending)--;
+		if (*band.pending == 0) {
+			mDoneSignal.notify_all();
+		}
+	}
+}
+
+void CopyWorkers::Copy(std::vector<CopyBand>& bands) {
+	int pending = (int)bands.size() - 1;
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		for (size_t i = 0; i + 1 < bands.size(); i++) {
+			bands[i].pending = &pending;
+			mBands.push_back(bands[i]);
+		}
+		// as many threads as the largest copy hands out bands; copies at the same time take turns
+		while (mThreads.size() < bands.size() - 1) {
+			mThreads.push_back(std::thread(&CopyWorkers::Run, this));
+		}
+	}
+	mBandSignal.notify_all();
+
+	const CopyBand& last = bands.back();
+	CopyRows(last.dst, last.dstPitch, last.src, last.srcPitch, last.rowSize, last.height, last.streaming);
+
+	std::unique_lock<std::mutex> lock(mLock);
+	mDoneSignal.wait(lock, [&pending] { return pending == 0; });
+}
+
+
+
+static int CountThreads(const size_t size, const int height, const FrameCopyPolicy& current) {
+	if (size < current.parallelThreshold) {
+		return 1;
+	}
+	int threads = (int)(size / PARALLEL_MIN_BAND);
+	int cores = (int)std::thread::hardware_concurrency();
+	if (cores > 0 && threads > cores) {
+		threads = cores;
+	}
+	if (threads > current.maxThreads) {
+		threads = current.maxThreads;
+	}
+	if (threads > height) {
+		threads = height;
+	}
+	return (threads < 1) ? 1 : threads;
+}
+
+
+
+void CopyFrameRows(unsigned char* dst, const ptrdiff_t dstPitch, const unsigned char* src, const ptrdiff_t srcPitch, const size_t rowSize, const int height) {
+	size_t size = rowSize * height;
+	if (size == 0) {
+		return;
+	}
+
+	// contiguous rows are handled as one long row, which is cut into bands of whole cache lines
+	bool contiguous = (dstPitch == srcPitch && (size_t)dstPitch == rowSize);
+	size_t bandUnit = contiguous ? 64 : rowSize;
+	int units = contiguous ? (int)((size + 63) / 64) : height;
+
+	FrameCopyPolicy current = GetFrameCopyPolicy();
+	bool streaming = size >= current.streamingThreshold;
+	int threads = CountThreads(size, units, current);
+
+	double start = GetCaptureTime();
+
+	if (threads == 1) {
+		CopyRows(dst, dstPitch, src, srcPitch, rowSize, height, streaming);
+	}
+	else {
+		std::vector<CopyBand> bands(threads);
+		int unit = 0;
+		for (int i = 0; i < threads; i++) {
+			int count = (units - unit) / (threads - i);
+			CopyBand& band = bands[i];
+			if (contiguous) {
+				size_t offset = (size_t)unit * bandUnit;
+				size_t length = (i < threads - 1) ? (size_t)count * bandUnit : size - offset;
+				band.dst = dst + offset;
+				band.src = src + offset;
+				band.dstPitch = band.srcPitch = (ptrdiff_t)length;
+				band.rowSize = length;
+				band.height = 1;
+			}
+			else {
+				band.dst = dst + unit * dstPitch;
+				band.src = src + unit * srcPitch;
+				band.dstPitch = dstPitch;
+				band.srcPitch = srcPitch;
+				band.rowSize = rowSize;
+				band.height = count;
+			}
+			band.streaming = streaming;
+			unit += count;
+		}
+		CopyWorkers::GetInstance().Copy(bands);
+	}
+
+	copiedBytes += size;
+	copyNanoseconds += (unsigned long long)((GetCaptureTime() - start) * 1e9);
+}
+
+void CopyFrame(void* dst, const void* src, const size_t size) {
+	CopyFrameRows((unsigned char*)dst, (ptrdiff_t)size, (const unsigned char*)src, (ptrdiff_t)size, size, 1);
+}
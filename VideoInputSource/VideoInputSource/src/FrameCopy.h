@@ -0,0 +1,49 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include <stddef.h>
+
+
+
+// how bulk frame copies are done. Frames of at least streamingThreshold bytes are written with
+// non-temporal stores, so copying them does not evict the working set of downstream filters from
+// the caches, and frames of at least parallelThreshold bytes are split across up to maxThreads threads.
+// Smaller frames are copied with memcpy, since they are read again while still in the cache.
+struct FrameCopyPolicy {
+	size_t streamingThreshold;
+	size_t parallelThreshold;
+	int maxThreads;
+};
+
+FrameCopyPolicy GetFrameCopyPolicy();
+void SetFrameCopyPolicy(const FrameCopyPolicy& policy);
+
+// copies a whole frame, the buffers must not overlap
+void CopyFrame(void* dst, const void* src, const size_t size);
+
+// copies height rows of rowSize bytes; a negative pitch walks the rows upwards, which flips the frame
+void CopyFrameRows(unsigned char* dst, const ptrdiff_t dstPitch, const unsigned char* src, const ptrdiff_t srcPitch, const size_t rowSize, const int height);
+
+// bytes per second of all frame copies in this process so far, 0 before the first copy
+double GetFrameCopyRate();
@@ -0,0 +1,266 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "FrameResize.h"
+
+#include <math.h>
+#include <string.h>
+#include <emmintrin.h>
+
+
+
+// weights sum up to this; 14 bits leave room in the 16 bit lanes for the negative lobes of bicubic
+static const int WEIGHT_BITS = 14;
+static const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+// the horizontal pass reads 8 bytes for a pair of pixels, and a pair of taps may reach one pixel past the last
+static const size_t ROW_PADDING = 16;
+
+
+
+static double Bilinear(double x) {
+	x = fabs(x);
+	return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+// the cubic of Mitchell and Netravali with B = C = 1/3, which BicubicResize uses as well
+static double Bicubic(double x) {
+	const double b = 1.0 / 3.0;
+	const double c = 1.0 / 3.0;
+	x = fabs(x);
+	if (x < 1.0) {
+		return ((12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x + (6.0 - 2.0 * b)) / 6.0;
+	}
+	if (x < 2.0) {
+		return ((-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x + (-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c)) / 6.0;
+	}
+	return 0.0;
+}
+
+
+
+// dst[x] = sum of rows[t][x] * weight of tap t, for size bytes; the taps come in pairs, 16 bytes at a time
+static void BlendRows(const unsigned char* const* rows, const int* weights, const int pairs, unsigned char* dst, const size_t size) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+
+	size_t x = 0;
+	for (; x + 16 <= size; x += 16) {
+		__m128i sum0 = round;
+		__m128i sum1 = round;
+		__m128i sum2 = round;
+		__m128i sum3 = round;
+		for (int p = 0; p < pairs; p++) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[2 * p] + x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(rows[2 * p + 1] + x));
+			__m128i weight = _mm_set1_epi32(weights[p]);
+			// bytes of the two rows side by side, widened to 16 bits, so one multiply-add weights both
+			__m128i low = _mm_unpacklo_epi8(a, b);
+			__m128i high = _mm_unpackhi_epi8(a, b);
+			sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), weight));
+			sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), weight));
+			sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), weight));
+			sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), weight));
+		}
+		__m128i low = _mm_packs_epi32(_mm_srai_epi32(sum0, WEIGHT_BITS), _mm_srai_epi32(sum1, WEIGHT_BITS));
+		__m128i high = _mm_packs_epi32(_mm_srai_epi32(sum2, WEIGHT_BITS), _mm_srai_epi32(sum3, WEIGHT_BITS));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(low, high));
+	}
+
+	for (; x < size; x++) {
+		int sum = 1 << (WEIGHT_BITS - 1);
+		for (int p = 0; p < pairs; p++) {
+			sum += rows[2 * p][x] * (short)weights[p] + rows[2 * p + 1][x] * (weights[p] >> 16);
+		}
+		sum >>= WEIGHT_BITS;
+		dst[x] = (unsigned char)((sum < 0) ? 0 : (sum > 255) ? 255 : sum);
+	}
+}
+
+// every BGR pixel of dst from the pixels of row under its kernel, two taps at a time
+static void BlendPixels(const unsigned char* row, const int* starts, const int* weights, const int pairs, unsigned char* dst, const int width) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+
+	for (int x = 0; x < width; x++, weights += pairs, dst += 3) {
+		const unsigned char* src = row + (ptrdiff_t)starts[x] * 3;
+		__m128i sum = round;
+		for (int p = 0; p < pairs; p++, src += 6) {
+			// b, g and r of the two pixels side by side, widened to 16 bits
+			__m128i both = _mm_loadl_epi64((const __m128i*)src);
+			__m128i pixels = _mm_unpacklo_epi8(_mm_unpacklo_epi8(both, _mm_srli_si128(both, 3)), zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, _mm_set1_epi32(weights[p])));
+		}
+		sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+		int bgr = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(sum, sum), zero));
+		// the fourth byte is overwritten by the next pixel, only the last one has to stop at three
+		if (x < width - 1) {
+			memcpy(dst, &bgr, 4);
+		}
+		else {
+			dst[0] = (unsigned char)bgr;
+			dst[1] = (unsigned char)(bgr >> 8);
+			dst[2] = (unsigned char)(bgr >> 16);
+		}
+	}
+}
+
+
+
+FrameResizer::FrameResizer(const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int filter, const bool fields)
+	: mSrcWidth(srcWidth), mSrcHeight(srcHeight), mDstWidth(dstWidth), mDstHeight(dstHeight), mFields(fields) {
+	BuildAxis(mHorizontal, srcWidth, dstWidth, filter);
+	BuildAxis(mVertical, fields ? srcHeight / 2 : srcHeight, fields ? dstHeight / 2 : dstHeight, filter);
+	mRow.assign((size_t)srcWidth * 3 + ROW_PADDING, 0);
+}
+
+int FrameResizer::GetSrcWidth() {
+	return mSrcWidth;
+}
+
+int FrameResizer::GetSrcHeight() {
+	return mSrcHeight;
+}
+
+void FrameResizer::BuildAxis(Axis& axis, const int srcSize, const int dstSize, const int filter) {
+	double scale = (double)srcSize / (double)dstSize;
+
+	// the weights of the source pixels under the kernel of every output pixel, those past the edges folded into
+	// the edge pixels
+	std::vector<int> firsts(dstSize);
+	std::vector<std::vector<double> > spans(dstSize);
+	axis.taps = 1;
+	for (int i = 0; i < dstSize; i++) {
+		int low, high;
+		std::vector<double> kernel;
+		if (filter == RESIZE_AREA) {
+			// how much of each source pixel the output pixel covers
+			double left = i * scale;
+			double right = (i + 1) * scale;
+			low = (int)floor(left);
+			high = (int)ceil(right) - 1;
+			for (int k = low; k <= high; k++) {
+				double overlap = ((right < k + 1.0) ? right : k + 1.0) - ((left > k) ? left : (double)k);
+				kernel.push_back((overlap > 0.0) ? overlap : 0.0);
+			}
+		}
+		else {
+			double center = (i + 0.5) * scale - 0.5;
+			double stretch = (scale > 1.0) ? scale : 1.0;
+			double support = ((filter == RESIZE_BICUBIC) ? 2.0 : 1.0) * stretch;
+			low = (int)ceil(center - support);
+			high = (int)floor(center + support);
+			for (int k = low; k <= high; k++) {
+				double x = (k - center) / stretch;
+				kernel.push_back((filter == RESIZE_BICUBIC) ? Bicubic(x) : Bilinear(x));
+			}
+		}
+
+		int first = (low < 0) ? 0 : (low > srcSize - 1) ? srcSize - 1 : low;
+		int last = (high > srcSize - 1) ? srcSize - 1 : (high < first) ? first : high;
+		spans[i].assign(last - first + 1, 0.0);
+		for (int k = low; k <= high; k++) {
+			int index = (k < first) ? first : (k > last) ? last : k;
+			spans[i][index - first] += kernel[k - low];
+		}
+		firsts[i] = first;
+		if ((int)spans[i].size() > axis.taps) {
+			axis.taps = (int)spans[i].size();
+		}
+	}
+
+	// every output pixel gets the same number of taps, windows near the end are moved back to stay inside
+	int pairs = (axis.taps + 1) / 2;
+	axis.starts.resize(dstSize);
+	axis.weights.assign((size_t)dstSize * pairs, 0);
+	std::vector<int> fixed(pairs * 2);
+	for (int i = 0; i < dstSize; i++) {
+		int start = (firsts[i] < srcSize - axis.taps) ? firsts[i] : srcSize - axis.taps;
+		int offset = firsts[i] - start;
+
+		double sum = 0.0;
+		for (size_t j = 0; j < spans[i].size(); j++) {
+			sum += spans[i][j];
+		}
+		// the fixed point weights add up to exactly one, so flat areas stay flat; rounding is made up on the heaviest
+		fixed.assign(pairs * 2, 0);
+		int total = 0;
+		int heaviest = offset;
+		for (size_t j = 0; j < spans[i].size(); j++) {
+			int weight = (sum != 0.0) ? (int)floor(spans[i][j] / sum * WEIGHT_ONE + 0.5) : 0;
+			fixed[offset + j] = weight;
+			total += weight;
+			if (weight > fixed[heaviest]) {
+				heaviest = offset + (int)j;
+			}
+		}
+		fixed[heaviest] += WEIGHT_ONE - total;
+
+		axis.starts[i] = start;
+		for (int p = 0; p < pairs; p++) {
+			axis.weights[(size_t)i * pairs + p] = (int)(((unsigned int)fixed[2 * p] & 0xFFFF) | ((unsigned int)fixed[2 * p + 1] << 16));
+		}
+	}
+}
+
+
+
+void FrameResizer::ResizeRows(const unsigned char* src, const ptrdiff_t srcPitch, unsigned char* dst, const ptrdiff_t dstPitch, const int dstRows) {
+	size_t srcRowSize = (size_t)mSrcWidth * 3;
+	bool scaleRows = (mSrcHeight != mDstHeight);
+	bool scaleColumns = (mSrcWidth != mDstWidth);
+	int verticalPairs = (mVertical.taps + 1) / 2;
+	int horizontalPairs = (mHorizontal.taps + 1) / 2;
+
+	std::vector<const unsigned char*> rows(verticalPairs * 2);
+	for (int y = 0; y < dstRows; y++) {
+		unsigned char* out = dst + y * dstPitch;
+		// without horizontal scaling the blended row is the output row already
+		unsigned char* blended = scaleColumns ? &mRow[0] : out;
+		if (scaleRows) {
+			// the tap filling up an odd count has no weight, it only has to point at a row
+			int start = mVertical.starts[y];
+			for (int t = 0; t < verticalPairs * 2; t++) {
+				rows[t] = src + (ptrdiff_t)(start + ((t < mVertical.taps) ? t : mVertical.taps - 1)) * srcPitch;
+			}
+			BlendRows(&rows[0], &mVertical.weights[(size_t)y * verticalPairs], verticalPairs, blended, srcRowSize);
+		}
+		else {
+			memcpy(blended, src + y * srcPitch, srcRowSize);
+		}
+		if (scaleColumns) {
+			BlendPixels(&mRow[0], &mHorizontal.starts[0], &mHorizontal.weights[0], horizontalPairs, out, mDstWidth);
+		}
+	}
+}
+
+void FrameResizer::Resize(const unsigned char* src, unsigned char* dst) {
+	ptrdiff_t srcPitch = (ptrdiff_t)mSrcWidth * 3;
+	ptrdiff_t dstPitch = (ptrdiff_t)mDstWidth * 3;
+	if (mFields) {
+		// the fields are every second row, scaled one after the other so they do not blend into each other
+		ResizeRows(src, srcPitch * 2, dst, dstPitch * 2, mDstHeight / 2);
+		ResizeRows(src + srcPitch, srcPitch * 2, dst + dstPitch, dstPitch * 2, mDstHeight / 2);
+	}
+	else {
+		ResizeRows(src, srcPitch, dst, dstPitch, mDstHeight);
+	}
+}
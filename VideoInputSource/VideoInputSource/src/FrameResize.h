@@ -0,0 +1,75 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+
+
+// filters of the resize parameter
+static const int RESIZE_NONE = 0;
+static const int RESIZE_BILINEAR = 1;
+static const int RESIZE_BICUBIC = 2;
+static const int RESIZE_AREA = 3;
+
+
+
+// scales BGR24 frames with a separable filter: every output row is blended from the source rows under the
+// vertical kernel, then every pixel of it from the pixels under the horizontal kernel. The weights are worked
+// out once for the two sizes, in fixed point, and both passes blend two taps at a time with SSE2.
+// Kernels are widened by the scale factor when shrinking, so detail is averaged instead of aliased.
+// Not synchronized; Resize keeps a row of its own between the passes.
+class FrameResizer {
+private:
+	// for every output pixel or row the first source one under the kernel, and taps weights from there on
+	// stored in pairs, the second 16 bits of a pair weighting the next tap
+	struct Axis {
+		int taps;
+		std::vector<int> starts;
+		std::vector<int> weights;
+	};
+
+	int mSrcWidth, mSrcHeight;
+	int mDstWidth, mDstHeight;
+	bool mFields;
+	Axis mHorizontal;
+	Axis mVertical;
+	// one vertically blended row, with room for the horizontal pass to read past its last pixel
+	std::vector<unsigned char> mRow;
+
+	static void BuildAxis(Axis& axis, const int srcSize, const int dstSize, const int filter);
+	void ResizeRows(const unsigned char* src, const ptrdiff_t srcPitch, unsigned char* dst, const ptrdiff_t dstPitch, const int dstRows);
+
+public:
+	// fields scales the two fields of an interlaced frame, every second row, each on its own;
+	// both heights must be even then
+	FrameResizer(const int srcWidth, const int srcHeight, const int dstWidth, const int dstHeight, const int filter, const bool fields);
+
+	// src holds srcWidth x srcHeight pixels and dst dstWidth x dstHeight, both with contiguous rows in the same order
+	void Resize(const unsigned char* src, unsigned char* dst);
+
+	int GetSrcWidth();
+	int GetSrcHeight();
+};
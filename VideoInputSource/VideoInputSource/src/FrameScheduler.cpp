@@ -0,0 +1,263 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "FrameScheduler.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+
+// conversions run at once at most; a sample takes a few milliseconds to convert, so a few workers keep up
+// with many devices, and more would only compete with the threads of the host
+static const int MAX_SCHEDULER_WORKERS = 4;
+
+#ifdef _WIN32
+// WaitForMultipleObjects takes this many handles, one of them the wake event; a device beyond them is refused
+// by Watch rather than never waited on
+static const size_t MAX_WAIT_EVENTS = MAXIMUM_WAIT_OBJECTS - 1;
+#endif
+
+
+
+FrameScheduler::FrameScheduler() {
+#ifdef _WIN32
+	mWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (mWake == NULL) {
+		throw "VideoInputSource: cannot create scheduler event";
+	}
+#else
+	int fds[2];
+	if (pipe(fds) != 0) {
+		throw "VideoInputSource: cannot create scheduler pipe";
+	}
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	mWakeRead = fds[0];
+	mWakeWrite = fds[1];
+#endif
+}
+
+FrameScheduler& FrameScheduler::GetInstance() {
+	// leaked on purpose: a host that never frees its clips would otherwise have running threads joined
+	// during static destruction, which deadlocks while a DLL is unloaded
+	static FrameScheduler* instance = new FrameScheduler();
+	return *instance;
+}
+
+int FrameScheduler::GetWorkerCount() {
+	int cores = (int)std::thread::hardware_concurrency();
+	if (cores < 1) {
+		cores = 1;
+	}
+	return (cores < MAX_SCHEDULER_WORKERS) ? cores : MAX_SCHEDULER_WORKERS;
+}
+
+FrameScheduler::Entry* FrameScheduler::Find(FrameListener* listener) {
+	for (size_t i = 0; i < mEntries.size(); i++) {
+		if (mEntries[i].listener == listener) {
+			return &mEntries[i];
+		}
+	}
+	return NULL;
+}
+
+void FrameScheduler::Dispatch(Entry& entry) {
+	entry.busy = true;
+	mJobs.push_back(entry.listener);
+	mJobSignal.notify_one();
+}
+
+void FrameScheduler::Wake() {
+#ifdef _WIN32
+	SetEvent(mWake);
+#else
+	char byte = 0;
+	// a full pipe already wakes the waiter
+	ssize_t written = write(mWakeWrite, &byte, 1);
+	(void)written;
+#endif
+}
+
+void FrameScheduler::Start() {
+	mWaiter = std::thread(&FrameScheduler::WaitLoop, this);
+	int workers = GetWorkerCount();
+	for (int i = 0; i < workers; i++) {
+		mWorkers.push_back(std::thread(&FrameScheduler::WorkLoop, this));
+	}
+}
+
+const char* FrameScheduler::Watch(FrameListener* listener, const CaptureEvent event) {
+	std::lock_guard<std::mutex> control(mControlLock);
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		Entry* entry = Find(listener);
+		if (entry != NULL) {
+			entry->event = event;
+		}
+		else {
+#ifdef _WIN32
+			if (mEntries.size() >= MAX_WAIT_EVENTS) {
+				return "VideoInputSource: too many devices capturing at once";
+			}
+#endif
+			Entry added = { listener, event, false };
+			mEntries.push_back(added);
+		}
+	}
+	if (!mWaiter.joinable()) {
+		Start();
+	}
+	Wake();
+	return NULL;
+}
+
+void FrameScheduler::Unwatch(FrameListener* listener) {
+	std::lock_guard<std::mutex> control(mControlLock);
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+		if (Find(listener) == NULL) {
+			return;
+		}
+		mIdleSignal.wait(lock, [this, listener] { return !Find(listener)->busy; });
+		mEntries.erase(mEntries.begin() + (Find(listener) - &mEntries[0]));
+	}
+	// with nothing left the waiter parks on the wake event alone
+	Wake();
+}
+
+void FrameScheduler::Notify(FrameListener* listener) {
+	std::lock_guard<std::mutex> lock(mLock);
+	Entry* entry = Find(listener);
+	if (entry != NULL && !entry->busy) {
+		Dispatch(*entry);
+	}
+}
+
+void FrameScheduler::WorkLoop() {
+	std::unique_lock<std::mutex> lock(mLock);
+	while (true) {
+		mJobSignal.wait(lock, [this] { return !mJobs.empty(); });
+		FrameListener* listener = mJobs.front();
+		mJobs.pop_front();
+		lock.unlock();
+
+		listener->OnFrameReady();
+
+		lock.lock();
+		Find(listener)->busy = false;
+		mIdleSignal.notify_all();
+		// the event of the listener is waited on again
+		Wake();
+	}
+}
+
+#ifdef _WIN32
+
+void FrameScheduler::WaitLoop() {
+	std::vector<HANDLE> handles;
+	std::vector<FrameListener*> listeners;
+	std::unique_lock<std::mutex> lock(mLock);
+	while (true) {
+		handles.assign(1, mWake);
+		listeners.assign(1, NULL);
+		for (size_t i = 0; i < mEntries.size() && handles.size() <= MAX_WAIT_EVENTS; i++) {
+			if (!mEntries[i].busy && mEntries[i].event != NO_CAPTURE_EVENT) {
+				handles.push_back(mEntries[i].event);
+				listeners.push_back(mEntries[i].listener);
+			}
+		}
+		lock.unlock();
+
+		DWORD result = WaitForMultipleObjects((DWORD)handles.size(), &handles[0], FALSE, INFINITE);
+
+		lock.lock();
+		// the event returned is only the first one signalled, so the others are looked at as well
+		bool failed = (result == WAIT_FAILED);
+		for (size_t i = 1; i < handles.size(); i++) {
+			Entry* entry = Find(listeners[i]);
+			if (entry == NULL || entry->busy || entry->event != handles[i]) {
+				continue;
+			}
+			DWORD state = WaitForSingleObject(handles[i], 0);
+			if (state == WAIT_OBJECT_0 || (failed && state == WAIT_FAILED)) {
+				// a handle that cannot be waited on is called once more, then left alone until watched again
+				if (state == WAIT_FAILED) {
+					entry->event = NO_CAPTURE_EVENT;
+				}
+				Dispatch(*entry);
+			}
+		}
+	}
+}
+
+#else
+
+void FrameScheduler::WaitLoop() {
+	std::vector<pollfd> fds;
+	std::vector<FrameListener*> listeners;
+	std::unique_lock<std::mutex> lock(mLock);
+	while (true) {
+		pollfd wake = { mWakeRead, POLLIN, 0 };
+		fds.assign(1, wake);
+		listeners.assign(1, NULL);
+		for (size_t i = 0; i < mEntries.size(); i++) {
+			if (!mEntries[i].busy && mEntries[i].event != NO_CAPTURE_EVENT) {
+				pollfd watched = { mEntries[i].event, POLLIN, 0 };
+				fds.push_back(watched);
+				listeners.push_back(mEntries[i].listener);
+			}
+		}
+		lock.unlock();
+
+		int ready = poll(&fds[0], (nfds_t)fds.size(), -1);
+		if (fds[0].revents & POLLIN) {
+			char bytes[64];
+			while (read(mWakeRead, bytes, sizeof(bytes)) > 0) {
+			}
+		}
+
+		lock.lock();
+		if (ready <= 0) {
+			continue;
+		}
+		for (size_t i = 1; i < fds.size(); i++) {
+			Entry* entry = Find(listeners[i]);
+			if (fds[i].revents == 0 || entry == NULL || entry->busy || entry->event != fds[i].fd) {
+				continue;
+			}
+			// a device in error stays readable, so it is called once more, then left alone until watched again
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				entry->event = NO_CAPTURE_EVENT;
+			}
+			Dispatch(*entry);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,105 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include "CaptureBackend.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// told by FrameScheduler that the device it watches for has a new sample
+class FrameListener {
+public:
+	virtual ~FrameListener() {}
+
+	// called on a worker thread of the scheduler, never on two at once for the same listener
+	virtual void OnFrameReady() = 0;
+};
+
+
+
+// one waiter thread for every device of the process: it waits on the frame events of all watched devices
+// at once and hands the ready ones to a small pool of workers, so the threads and the CPU time spent
+// waiting do not grow with the number of devices, only the conversion work does. The event of a listener
+// is not waited on while its call is queued or running. The threads are started by the first Watch and stay
+// parked once nothing is watched, so a device reopened by the watchdog does not start them all over again.
+class FrameScheduler {
+private:
+	struct Entry {
+		FrameListener* listener;
+		// NO_CAPTURE_EVENT once the event failed, until the listener is watched again
+		CaptureEvent event;
+		// queued or running on a worker
+		bool busy;
+	};
+
+	// serializes Watch and Unwatch, so the threads are started by one caller
+	std::mutex mControlLock;
+
+	// guards everything below
+	std::mutex mLock;
+	std::condition_variable mJobSignal;
+	std::condition_variable mIdleSignal;
+	std::vector<Entry> mEntries;
+	std::deque<FrameListener*> mJobs;
+
+	std::thread mWaiter;
+	std::vector<std::thread> mWorkers;
+	// wakes the waiter, so it picks up watched and re-armed events
+#ifdef _WIN32
+	HANDLE mWake;
+#else
+	int mWakeRead, mWakeWrite;
+#endif
+
+	FrameScheduler();
+
+	Entry* Find(FrameListener* listener);
+	// queues a call of the listener of entry, which must not be busy; needs mLock
+	void Dispatch(Entry& entry);
+	void Wake();
+	void Start();
+	void WaitLoop();
+	void WorkLoop();
+
+public:
+	// the scheduler of the process, made on first use and never destroyed
+	static FrameScheduler& GetInstance();
+
+	// calls the listener on a worker whenever event is signalled, until Unwatch; returns an error, the listener
+	// not watched, when no more events can be waited on. Neither Watch nor Unwatch may be called while holding
+	// a lock the listener takes, since Unwatch waits for a call still running.
+	const char* Watch(FrameListener* listener, const CaptureEvent event);
+	void Unwatch(FrameListener* listener);
+	// calls a watched listener once as if its event was signalled, for a sample that arrived without
+	// signalling it; does nothing while a call is queued or running anyway
+	void Notify(FrameListener* listener);
+
+	// threads converting at most at once
+	static int GetWorkerCount();
+};
@@ -0,0 +1,207 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#include "FrameSpill.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+
+// bytes of a segment, about; large enough that mapping one costs nothing next to filling it
+static const size_t SPILL_SEGMENT_SIZE = 64 * 1024 * 1024;
+// segments start at multiples of this, which suits the page size and the allocation granularity of Windows
+static const size_t SPILL_ALIGNMENT = 64 * 1024;
+
+
+
+FrameSpill::FrameSpill(const size_t frameSize, const __int64 maxSize) : mFrameSize(frameSize), mFileSize(0), mMaxSize(maxSize), mWriteIndex(0), mReadIndex(0), mBytesWritten(0.0) {
+	mSegmentFrames = (frameSize < SPILL_SEGMENT_SIZE) ? SPILL_SEGMENT_SIZE / frameSize : 1;
+	mSegmentSize = (mSegmentFrames * frameSize + SPILL_ALIGNMENT - 1) / SPILL_ALIGNMENT * SPILL_ALIGNMENT;
+	mWriteMap.view = mReadMap.view = NULL;
+
+#ifdef _WIN32
+	char directory[MAX_PATH + 1];
+	char path[MAX_PATH + 1];
+	if (GetTempPathA(sizeof(directory), directory) == 0 || GetTempFileNameA(directory, "vis", 0, path) == 0) {
+		throw "VideoInputSource: cannot create spill file";
+	}
+	mFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (mFile == INVALID_HANDLE_VALUE) {
+		DeleteFileA(path);
+		throw "VideoInputSource: cannot create spill file";
+	}
+#else
+	const char* directory = getenv("TMPDIR");
+	std::string path = std::string((directory != NULL && directory[0] != '\0') ? directory : "/tmp") + "/VideoInputSource-spill-XXXXXX";
+	mFile = mkstemp(&path[0]);
+	if (mFile < 0) {
+		throw "VideoInputSource: cannot create spill file";
+	}
+	// unlinked at once, so it goes away with the last descriptor however the process ends
+	unlink(path.c_str());
+	fcntl(mFile, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+FrameSpill::~FrameSpill() {
+	Unmap(mWriteMap);
+	Unmap(mReadMap);
+#ifdef _WIN32
+	CloseHandle(mFile);
+#else
+	close(mFile);
+#endif
+}
+
+void FrameSpill::Map(Mapping& map, const __int64 offset) {
+	map.offset = offset;
+#ifdef _WIN32
+	__int64 end = offset + (__int64)mSegmentSize;
+	map.mapping = CreateFileMapping(mFile, NULL, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)end, NULL);
+	if (map.mapping == NULL) {
+		throw "VideoInputSource: cannot map spill file";
+	}
+	map.view = (unsigned char*)MapViewOfFile(map.mapping, FILE_MAP_WRITE, (DWORD)(offset >> 32), (DWORD)offset, mSegmentSize);
+	if (map.view == NULL) {
+		CloseHandle(map.mapping);
+		throw "VideoInputSource: cannot map spill file";
+	}
+#else
+	void* view = mmap(NULL, mSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, (off_t)offset);
+	if (view == MAP_FAILED) {
+		throw "VideoInputSource: cannot map spill file";
+	}
+	map.view = (unsigned char*)view;
+#endif
+}
+
+void FrameSpill::Unmap(Mapping& map) {
+	if (map.view == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(map.view);
+	CloseHandle(map.mapping);
+#else
+	munmap(map.view, mSegmentSize);
+#endif
+	map.view = NULL;
+}
+
+// gives the oldest segment back for reuse, once it is read to its end or nothing else is left
+void FrameSpill::ReleaseOldest() {
+	Unmap(mReadMap);
+	if (mSegments.size() == 1) {
+		Unmap(mWriteMap);
+	}
+	mFreeSegments.push_back(mSegments.front());
+	mSegments.pop_front();
+	mReadIndex = 0;
+}
+
+bool FrameSpill::Write(const unsigned char* pixels, const unsigned long number, const double time) {
+	if (mSegments.empty() || mWriteIndex == mSegmentFrames) {
+		__int64 offset;
+		if (!mFreeSegments.empty()) {
+			offset = mFreeSegments.back();
+			mFreeSegments.pop_back();
+		}
+		else if (mFileSize + (__int64)mSegmentSize > mMaxSize) {
+			return false;
+		}
+		else {
+			// the blocks are reserved up front, so a full disk fails here rather than when a page is written back
+			offset = mFileSize;
+#ifdef _WIN32
+			LARGE_INTEGER size;
+			size.QuadPart = offset + (__int64)mSegmentSize;
+			if (!SetFilePointerEx(mFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(mFile)) {
+				throw "VideoInputSource: cannot grow spill file";
+			}
+#else
+			if (posix_fallocate(mFile, (off_t)offset, (off_t)mSegmentSize) != 0) {
+				throw "VideoInputSource: cannot grow spill file";
+			}
+#endif
+			mFileSize += (__int64)mSegmentSize;
+		}
+
+		Unmap(mWriteMap);
+		try {
+			Map(mWriteMap, offset);
+		}
+		catch (const char*) {
+			mFreeSegments.push_back(offset);
+			throw;
+		}
+		mSegments.push_back(offset);
+		mWriteIndex = 0;
+	}
+
+	memcpy(mWriteMap.view + mWriteIndex * mFrameSize, pixels, mFrameSize);
+	mWriteIndex++;
+	FrameInfo info = { number, time };
+	mFrames.push_back(info);
+	mBytesWritten += (double)mFrameSize;
+	return true;
+}
+
+bool FrameSpill::Read(unsigned char* pixels, unsigned long& number, double& time) {
+	if (mFrames.empty()) {
+		return false;
+	}
+
+	if (mReadMap.view == NULL) {
+		Map(mReadMap, mSegments.front());
+	}
+	memcpy(pixels, mReadMap.view + mReadIndex * mFrameSize, mFrameSize);
+	mReadIndex++;
+	number = mFrames.front().number;
+	time = mFrames.front().time;
+	mFrames.pop_front();
+
+	if (mReadIndex == mSegmentFrames || mFrames.empty()) {
+		ReleaseOldest();
+	}
+	return true;
+}
+
+size_t FrameSpill::GetCount() {
+	return mFrames.size();
+}
+
+double FrameSpill::GetBytesWritten() {
+	return mBytesWritten;
+}
+
+__int64 FrameSpill::GetFileSize() {
+	return mFileSize;
+}
@@ -0,0 +1,90 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#include "Platform.h"
+
+#include <deque>
+#include <vector>
+
+
+
+// frames of lossless mode that do not fit in memory, kept in order in a temporary file that is mapped one
+// segment at a time. The file grows only as far as the backlog does, and never past its limit: a segment
+// read back completely is reused for the frames written next. The file is deleted when the spill is, or
+// when the process ends.
+class FrameSpill {
+private:
+	struct Mapping {
+		__int64 offset;
+		unsigned char* view;
+#ifdef _WIN32
+		HANDLE mapping;
+#endif
+	};
+	struct FrameInfo {
+		unsigned long number;
+		double time;
+	};
+
+	size_t mFrameSize;
+	size_t mSegmentFrames;
+	size_t mSegmentSize;
+#ifdef _WIN32
+	HANDLE mFile;
+#else
+	int mFile;
+#endif
+	__int64 mFileSize;
+	__int64 mMaxSize;
+
+	// offsets of the segments holding frames, oldest first, and of segments read back already
+	std::deque<__int64> mSegments;
+	std::vector<__int64> mFreeSegments;
+	// only the segment written to and the one read from are mapped
+	Mapping mWriteMap, mReadMap;
+	size_t mWriteIndex, mReadIndex;
+	std::deque<FrameInfo> mFrames;
+	double mBytesWritten;
+
+	void Map(Mapping& map, const __int64 offset);
+	void Unmap(Mapping& map);
+	void ReleaseOldest();
+
+public:
+	// frameSize is the bytes of one frame and maxSize the bytes the file may grow to; throws when the
+	// temporary file cannot be made
+	FrameSpill(const size_t frameSize, const __int64 maxSize);
+	~FrameSpill();
+
+	// appends a frame; returns false without it when the file is at its limit, throws when the file cannot
+	// grow, e.g. when the disk is full
+	bool Write(const unsigned char* pixels, const unsigned long number, const double time);
+	// takes the oldest frame, returns false when there is none
+	bool Read(unsigned char* pixels, unsigned long& number, double& time);
+
+	size_t GetCount();
+	// bytes written since the spill was made
+	double GetBytesWritten();
+	__int64 GetFileSize();
+};
@@ -0,0 +1,81 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// the few Windows names the portable part of the plugin relies on, provided on other platforms
+
+#pragma once
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <malloc.h>
+
+#else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a macro rather than a typedef, so unsigned __int64 works as it does with MSVC
+#define __int64 long long
+
+#define stricmp strcasecmp
+
+struct GUID {
+	unsigned int Data1;
+	unsigned short Data2;
+	unsigned short Data3;
+	unsigned char Data4[8];
+};
+
+inline void* _aligned_malloc(size_t size, size_t alignment) {
+	void* memory;
+	return (posix_memalign(&memory, alignment, size) == 0) ? memory : NULL;
+}
+
+inline void _aligned_free(void* memory) {
+	free(memory);
+}
+
+// the file functions the capability cache of videoInput uses
+static const int MOVEFILE_REPLACE_EXISTING = 1;
+
+inline int CreateDirectoryA(const char* path, void* /*attributes*/) {
+	return mkdir(path, 0777) == 0;
+}
+
+inline int MoveFileExA(const char* from, const char* to, int /*flags*/) {
+	return rename(from, to) == 0;
+}
+
+inline int DeleteFileA(const char* path) {
+	return unlink(path) == 0;
+}
+
+inline unsigned long GetCurrentProcessId() {
+	return (unsigned long)getpid();
+}
+
+#endif
@@ -0,0 +1,481 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifdef __linux__
+
+#include "SyntheticDevice.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <chrono>
+
+
+
+// formats the device offers, in the order it lists them
+static const unsigned int SYNTHETIC_FORMATS[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_GREY };
+static const int NUM_SYNTHETIC_FORMATS = sizeof(SYNTHETIC_FORMATS) / sizeof(SYNTHETIC_FORMATS[0]);
+
+static const unsigned int SYNTHETIC_MAX_BUFFERS = 32;
+// largest frame size and frame rate the device lists for auto to choose from
+static const unsigned int SYNTHETIC_MAX_SIZE = 4096;
+static const unsigned int SYNTHETIC_MAX_FPS = 1000;
+
+// seconds between stalls unless the options say otherwise
+static const double SYNTHETIC_STALL_INTERVAL = 10.0;
+
+// pixels the bars move per frame, even so 4:2:2 pairs stay aligned, and rows the band moves per frame
+static const int SCROLL_STEP = 4;
+static const int BAND_STEP = 2;
+static const int BAND_HEIGHT = 8;
+
+// 75% colour bars
+static const unsigned char BAR_COLORS[8][3] = {
+	{ 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+	{ 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 }, { 0, 0, 0 }
+};
+static const unsigned char BAND_COLOR[3] = { 255, 255, 255 };
+
+
+
+static bool IsSyntheticFormat(const unsigned int format) {
+	for (int i = 0; i < NUM_SYNTHETIC_FORMATS; i++) {
+		if (format == SYNTHETIC_FORMATS[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int BytesPerPixel(const unsigned int format) {
+	return (format == V4L2_PIX_FMT_BGR24) ? 3 : (format == V4L2_PIX_FMT_GREY) ? 1 : 2;
+}
+
+// writes count packed RGB pixels in format; count is even for the 4:2:2 formats
+static void PackPixels(const unsigned int format, const unsigned char* rgb, const int count, unsigned char* dst) {
+	for (int x = 0; x < count; x++) {
+		int r = rgb[x * 3], g = rgb[x * 3 + 1], b = rgb[x * 3 + 2];
+		switch (format) {
+		case V4L2_PIX_FMT_BGR24:
+			dst[x * 3] = (unsigned char)b;
+			dst[x * 3 + 1] = (unsigned char)g;
+			dst[x * 3 + 2] = (unsigned char)r;
+			break;
+		case V4L2_PIX_FMT_GREY:
+			dst[x] = (unsigned char)((77 * r + 150 * g + 29 * b + 128) >> 8);
+			break;
+		default: {
+			// BT.601 limited range, chroma taken from the first pixel of a pair
+			unsigned char y = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+			unsigned char* pair = dst + (x & ~1) * 2;
+			int luma = (format == V4L2_PIX_FMT_YUYV) ? 0 : 1;
+			pair[luma + (x & 1) * 2] = y;
+			if ((x & 1) == 0) {
+				int chroma = 1 - luma;
+				pair[chroma] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				pair[chroma + 2] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+			break;
+		}
+		}
+	}
+}
+
+
+
+SyntheticOptions ParseSyntheticOptions(const std::string& options) {
+	SyntheticOptions parsed = { 0.0, 0.0, SYNTHETIC_STALL_INTERVAL, 0.0 };
+	for (size_t start = 0; !options.empty() && start <= options.size(); ) {
+		size_t end = options.find(',', start);
+		if (end == std::string::npos) {
+			end = options.size();
+		}
+		std::string item = options.substr(start, end - start);
+		start = end + 1;
+
+		char name[16];
+		int milliseconds = 0;
+		int consumed = 0;
+		if (sscanf(item.c_str(), " %15[a-z_] = %d %n", name, &milliseconds, &consumed) != 2 || item[consumed] != '\0' || milliseconds < 0) {
+			throw "VideoInputSource: synthetic option is invalid";
+		}
+		if (strcmp(name, "jitter") == 0) {
+			parsed.jitter = milliseconds / 1000.0;
+		}
+		else if (strcmp(name, "stall") == 0) {
+			parsed.stall = milliseconds / 1000.0;
+		}
+		else if (strcmp(name, "interval") == 0) {
+			parsed.stallInterval = milliseconds / 1000.0;
+		}
+		else if (strcmp(name, "setup") == 0) {
+			parsed.setup = milliseconds / 1000.0;
+		}
+		else {
+			throw "VideoInputSource: synthetic option is invalid";
+		}
+	}
+	// a stall as long as its interval would never deliver again
+	if (parsed.stall > 0.0 && parsed.stall >= parsed.stallInterval) {
+		throw "VideoInputSource: synthetic stall is invalid";
+	}
+	return parsed;
+}
+
+
+
+SyntheticDevice::SyntheticDevice(const int seed, const SyntheticOptions& options)
+	: mJitter(options.jitter), mStall(options.stall), mStallInterval(options.stallInterval), mSetup(options.setup), mRandom(seed), mStreaming(false), mEvent(-1), mFormat(SYNTHETIC_FORMATS[0]), mWidth(640), mHeight(480), mBytesPerPixel(BytesPerPixel(SYNTHETIC_FORMATS[0])), mField(V4L2_FIELD_NONE), mFrameNumerator(1), mFrameDenominator(30) {
+}
+
+SyntheticDevice::~SyntheticDevice() {
+	StopStreaming();
+}
+
+int SyntheticDevice::Open(const char* /*path*/, int /*flags*/) {
+	// nothing is opened; the fd is an eventfd that polls readable like a device while samples are filled
+	std::lock_guard<std::mutex> lock(mLock);
+	if (mEvent < 0) {
+		mEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+	return mEvent;
+}
+
+int SyntheticDevice::Close(int /*fd*/) {
+	StopStreaming();
+	std::lock_guard<std::mutex> lock(mLock);
+	mBuffers.clear();
+	if (mEvent >= 0) {
+		close(mEvent);
+		mEvent = -1;
+	}
+	return 0;
+}
+
+void SyntheticDevice::SetReadable(const bool readable) {
+	if (readable) {
+		eventfd_write(mEvent, 1);
+	}
+	else {
+		eventfd_t count;
+		eventfd_read(mEvent, &count);
+	}
+}
+
+int SyntheticDevice::Ioctl(int /*fd*/, unsigned long request, void* arg) {
+	std::unique_lock<std::mutex> lock(mLock);
+
+	switch (request) {
+	case VIDIOC_QUERYCAP: {
+		v4l2_capability* capability = (v4l2_capability*)arg;
+		memset(capability, 0, sizeof(*capability));
+		strcpy((char*)capability->driver, "synthetic");
+		strcpy((char*)capability->card, "VideoInputSource synthetic device");
+		strcpy((char*)capability->bus_info, "platform:synthetic");
+		capability->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+		return 0;
+	}
+	case VIDIOC_ENUMINPUT: {
+		v4l2_input* input = (v4l2_input*)arg;
+		if (input->index != 0) {
+			break;
+		}
+		strcpy((char*)input->name, "Synthetic");
+		input->type = V4L2_INPUT_TYPE_CAMERA;
+		return 0;
+	}
+	case VIDIOC_S_INPUT:
+		if (*(int*)arg != 0) {
+			break;
+		}
+		return 0;
+	case VIDIOC_ENUM_FMT: {
+		v4l2_fmtdesc* description = (v4l2_fmtdesc*)arg;
+		if (description->type != V4L2_BUF_TYPE_VIDEO_CAPTURE || description->index >= (unsigned int)NUM_SYNTHETIC_FORMATS) {
+			break;
+		}
+		description->pixelformat = SYNTHETIC_FORMATS[description->index];
+		return 0;
+	}
+	case VIDIOC_ENUM_FRAMESIZES: {
+		// any even width, as S_FMT rounds to
+		v4l2_frmsizeenum* size = (v4l2_frmsizeenum*)arg;
+		if (size->index != 0 || !IsSyntheticFormat(size->pixel_format)) {
+			break;
+		}
+		size->type = V4L2_FRMSIZE_TYPE_STEPWISE;
+		size->stepwise.min_width = 2;
+		size->stepwise.max_width = SYNTHETIC_MAX_SIZE;
+		size->stepwise.step_width = 2;
+		size->stepwise.min_height = 1;
+		size->stepwise.max_height = SYNTHETIC_MAX_SIZE;
+		size->stepwise.step_height = 1;
+		return 0;
+	}
+	case VIDIOC_ENUM_FRAMEINTERVALS: {
+		v4l2_frmivalenum* interval = (v4l2_frmivalenum*)arg;
+		if (interval->index != 0 || !IsSyntheticFormat(interval->pixel_format)) {
+			break;
+		}
+		interval->type = V4L2_FRMIVAL_TYPE_CONTINUOUS;
+		interval->stepwise.min.numerator = 1;
+		interval->stepwise.min.denominator = SYNTHETIC_MAX_FPS;
+		interval->stepwise.max.numerator = 1;
+		interval->stepwise.max.denominator = 1;
+		interval->stepwise.step.numerator = 1;
+		interval->stepwise.step.denominator = SYNTHETIC_MAX_FPS;
+		return 0;
+	}
+	case VIDIOC_S_FMT: {
+		v4l2_format* format = (v4l2_format*)arg;
+		if (mStreaming || !mBuffers.empty()) {
+			errno = EBUSY;
+			return -1;
+		}
+		// like a driver, adjust what cannot be done instead of failing
+		mFormat = SYNTHETIC_FORMATS[0];
+		for (int i = 0; i < NUM_SYNTHETIC_FORMATS; i++) {
+			if (format->fmt.pix.pixelformat == SYNTHETIC_FORMATS[i]) {
+				mFormat = SYNTHETIC_FORMATS[i];
+			}
+		}
+		mWidth = (format->fmt.pix.width < 2) ? 2 : (int)(format->fmt.pix.width & ~1u);
+		mHeight = (format->fmt.pix.height < 1) ? 1 : (int)format->fmt.pix.height;
+		mBytesPerPixel = BytesPerPixel(mFormat);
+		mField = (format->fmt.pix.field == V4L2_FIELD_INTERLACED_TB || format->fmt.pix.field == V4L2_FIELD_INTERLACED_BT) ? format->fmt.pix.field : (unsigned int)V4L2_FIELD_NONE;
+
+		format->fmt.pix.pixelformat = mFormat;
+		format->fmt.pix.width = mWidth;
+		format->fmt.pix.height = mHeight;
+		format->fmt.pix.field = mField;
+		format->fmt.pix.bytesperline = mWidth * mBytesPerPixel;
+		format->fmt.pix.sizeimage = mWidth * mBytesPerPixel * mHeight;
+		return 0;
+	}
+	case VIDIOC_S_PARM:
+	case VIDIOC_G_PARM: {
+		v4l2_streamparm* parm = (v4l2_streamparm*)arg;
+		if (request == VIDIOC_S_PARM && parm->parm.capture.timeperframe.numerator > 0 && parm->parm.capture.timeperframe.denominator > 0) {
+			mFrameNumerator = parm->parm.capture.timeperframe.numerator;
+			mFrameDenominator = parm->parm.capture.timeperframe.denominator;
+		}
+		memset(&parm->parm, 0, sizeof(parm->parm));
+		parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		parm->parm.capture.timeperframe.numerator = mFrameNumerator;
+		parm->parm.capture.timeperframe.denominator = mFrameDenominator;
+		return 0;
+	}
+	case VIDIOC_REQBUFS: {
+		v4l2_requestbuffers* requestBuffers = (v4l2_requestbuffers*)arg;
+		if (mStreaming) {
+			errno = EBUSY;
+			return -1;
+		}
+		if (requestBuffers->count > SYNTHETIC_MAX_BUFFERS) {
+			requestBuffers->count = SYNTHETIC_MAX_BUFFERS;
+		}
+		mBuffers.assign(requestBuffers->count, std::vector<unsigned char>((size_t)mWidth * mBytesPerPixel * mHeight));
+		mQueued.clear();
+		mFilled.clear();
+		return 0;
+	}
+	case VIDIOC_QUERYBUF: {
+		v4l2_buffer* buffer = (v4l2_buffer*)arg;
+		if (buffer->index >= mBuffers.size()) {
+			break;
+		}
+		buffer->length = (unsigned int)mBuffers[buffer->index].size();
+		buffer->m.offset = buffer->index;
+		return 0;
+	}
+	case VIDIOC_QBUF: {
+		v4l2_buffer* buffer = (v4l2_buffer*)arg;
+		if (buffer->index >= mBuffers.size()) {
+			break;
+		}
+		mQueued.push_back((int)buffer->index);
+		return 0;
+	}
+	case VIDIOC_DQBUF: {
+		v4l2_buffer* buffer = (v4l2_buffer*)arg;
+		if (mFilled.empty()) {
+			errno = EAGAIN;
+			return -1;
+		}
+		Sample sample = mFilled.front();
+		mFilled.pop_front();
+		if (mFilled.empty()) {
+			SetReadable(false);
+		}
+		buffer->index = sample.index;
+		buffer->sequence = sample.sequence;
+		buffer->bytesused = (unsigned int)mBuffers[sample.index].size();
+		buffer->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		buffer->field = mField;
+		buffer->timestamp.tv_sec = (long)floor(sample.time);
+		buffer->timestamp.tv_usec = (long)((sample.time - floor(sample.time)) * 1e6);
+		return 0;
+	}
+	case VIDIOC_STREAMON:
+		lock.unlock();
+		if (mSetup > 0.0) {
+			std::this_thread::sleep_for(std::chrono::duration<double>(mSetup));
+		}
+		StartStreaming();
+		return 0;
+	case VIDIOC_STREAMOFF:
+		lock.unlock();
+		StopStreaming();
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+void* SyntheticDevice::Mmap(size_t length, int /*fd*/, off_t offset) {
+	std::lock_guard<std::mutex> lock(mLock);
+	if (offset < 0 || (size_t)offset >= mBuffers.size() || length > mBuffers[offset].size()) {
+		return NULL;
+	}
+	return &mBuffers[offset][0];
+}
+
+int SyntheticDevice::Munmap(void* /*address*/, size_t /*length*/) {
+	return 0;
+}
+
+void SyntheticDevice::BuildPattern() {
+	std::vector<unsigned char> bars((size_t)2 * mWidth * 3);
+	for (int x = 0; x < 2 * mWidth; x++) {
+		memcpy(&bars[(size_t)x * 3], BAR_COLORS[(x % mWidth) * 8 / mWidth], 3);
+	}
+	std::vector<unsigned char> band((size_t)mWidth * 3);
+	for (int x = 0; x < mWidth; x++) {
+		memcpy(&band[(size_t)x * 3], BAND_COLOR, 3);
+	}
+
+	mBarsRow.resize((size_t)2 * mWidth * mBytesPerPixel);
+	PackPixels(mFormat, &bars[0], 2 * mWidth, &mBarsRow[0]);
+	mBandRow.resize((size_t)mWidth * mBytesPerPixel);
+	PackPixels(mFormat, &band[0], mWidth, &mBandRow[0]);
+}
+
+// every row is copied from a prepared one, so rendering costs about as much as a device DMA.
+// Interlaced, the rows of the second field show the pattern half a step further on.
+void SyntheticDevice::Render(unsigned char* dst, const unsigned int sequence) {
+	size_t rowSize = (size_t)mWidth * mBytesPerPixel;
+	for (int y = 0; y < mHeight; y++) {
+		unsigned int half = 0;
+		if (mField != V4L2_FIELD_NONE) {
+			bool top = (y % 2 == 0);
+			half = (top == (mField == V4L2_FIELD_INTERLACED_TB)) ? 0 : 1;
+		}
+		unsigned int scroll = (sequence * (unsigned int)SCROLL_STEP + half * (unsigned int)SCROLL_STEP / 2) % (unsigned int)mWidth;
+		int band = (int)((sequence * (unsigned int)BAND_STEP + half * (unsigned int)BAND_STEP / 2) % (unsigned int)mHeight);
+		bool inBand = ((y - band + mHeight) % mHeight) < BAND_HEIGHT;
+		memcpy(dst + y * rowSize, inBand ? &mBandRow[0] : &mBarsRow[(size_t)scroll * mBytesPerPixel], rowSize);
+	}
+}
+
+void SyntheticDevice::StartStreaming() {
+	std::lock_guard<std::mutex> lock(mLock);
+	if (mStreaming) {
+		return;
+	}
+	BuildPattern();
+	mFilled.clear();
+	mStreaming = true;
+	mThread = std::thread(&SyntheticDevice::Run, this);
+}
+
+void SyntheticDevice::StopStreaming() {
+	{
+		std::lock_guard<std::mutex> lock(mLock);
+		if (!mStreaming) {
+			return;
+		}
+		mStreaming = false;
+	}
+	mSignal.notify_all();
+	mThread.join();
+
+	// like STREAMOFF, every buffer goes back to the application
+	std::lock_guard<std::mutex> lock(mLock);
+	mQueued.clear();
+	mFilled.clear();
+	SetReadable(false);
+}
+
+void SyntheticDevice::Run() {
+	std::unique_lock<std::mutex> lock(mLock);
+	double period = (double)mFrameNumerator / (double)mFrameDenominator;
+	double start = GetCaptureTime();
+	std::uniform_real_distribution<double> lateness(0.0, mJitter);
+
+	for (unsigned int sequence = 0; mStreaming; sequence++) {
+		double due = start + sequence * period;
+		if (mStall > 0.0 && mStall < mStallInterval && fmod(due - start, mStallInterval) >= mStallInterval - mStall) {
+			continue;
+		}
+
+		double arrival = due + ((mJitter > 0.0) ? lateness(mRandom) : 0.0);
+		for (double now = GetCaptureTime(); mStreaming && now < arrival; now = GetCaptureTime()) {
+			mSignal.wait_for(lock, std::chrono::duration<double>(arrival - now));
+		}
+		if (!mStreaming) {
+			break;
+		}
+
+		// without a queued buffer the sample is lost, as in a driver
+		if (mQueued.empty()) {
+			continue;
+		}
+		int index = mQueued.front();
+		mQueued.pop_front();
+
+		lock.unlock();
+		Render(&mBuffers[index][0], sequence);
+		lock.lock();
+
+		Sample sample = { index, sequence, GetCaptureTime() };
+		mFilled.push_back(sample);
+		SetReadable(true);
+	}
+}
+
+
+
+SyntheticBackend::SyntheticBackend(const CaptureParams& params)
+	: V4L2Backend(params, &mDevice), mDevice(params.deviceID, ParseSyntheticOptions(params.syntheticOptions)) {
+}
+
+SyntheticBackend::~SyntheticBackend() {
+	// the base class would close the device only after it is gone
+	Close();
+}
+
+#endif
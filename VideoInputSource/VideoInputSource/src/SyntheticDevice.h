@@ -0,0 +1,124 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#ifdef __linux__
+
+#include "V4L2Backend.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+// how the synthetic device misbehaves, in seconds: a sample may arrive up to jitter late, nothing arrives for
+// stall once every stallInterval, and VIDIOC_STREAMON takes setup
+struct SyntheticOptions {
+	double jitter;
+	double stall, stallInterval;
+	double setup;
+};
+
+// parses the options given as connection_type "Synthetic:<options>", e.g. "jitter=5,stall=1500,interval=3000,setup=200"
+// in milliseconds; every option may be left out. Throws when they are invalid.
+SyntheticOptions ParseSyntheticOptions(const std::string& options);
+
+
+
+// a V4L2 device in software: colour bars scrolling under a moving band, rendered at the negotiated size,
+// format and frame rate into mmap buffers by a streaming thread of its own. V4L2Backend captures from it
+// exactly as from a real device, so the whole pipeline can be measured without hardware.
+// Asked for V4L2_FIELD_INTERLACED_TB or _BT, it renders each field half a frame later than the previous one.
+class SyntheticDevice : public V4L2Io {
+private:
+	struct Sample {
+		int index;
+		unsigned int sequence;
+		double time;
+	};
+
+	// seconds a sample may arrive late, at random; samples due during a stall are lost
+	double mJitter;
+	double mStall;
+	double mStallInterval;
+	// seconds VIDIOC_STREAMON takes
+	double mSetup;
+	std::mt19937 mRandom;
+
+	// guards everything below; the streaming thread renders outside it into a buffer it took from mQueued
+	std::mutex mLock;
+	std::condition_variable mSignal;
+	std::thread mThread;
+	bool mStreaming;
+	// eventfd handed out by Open, readable while mFilled holds samples
+	int mEvent;
+
+	unsigned int mFormat;
+	int mWidth, mHeight;
+	int mBytesPerPixel;
+	unsigned int mField;
+	unsigned int mFrameNumerator, mFrameDenominator;
+	std::vector<std::vector<unsigned char> > mBuffers;
+	std::deque<int> mQueued;
+	std::deque<Sample> mFilled;
+
+	// rows of the pattern in the negotiated format; the bars row is twice as wide so it can scroll
+	std::vector<unsigned char> mBarsRow;
+	std::vector<unsigned char> mBandRow;
+
+	void BuildPattern();
+	void Render(unsigned char* dst, const unsigned int sequence);
+	void StartStreaming();
+	void StopStreaming();
+	void Run();
+	void SetReadable(const bool readable);
+
+public:
+	SyntheticDevice(const int seed, const SyntheticOptions& options);
+	~SyntheticDevice();
+
+	int Open(const char* path, int flags);
+	int Close(int fd);
+	int Ioctl(int fd, unsigned long request, void* arg);
+	void* Mmap(size_t length, int fd, off_t offset);
+	int Munmap(void* address, size_t length);
+};
+
+
+
+// V4L2Backend reading from its own SyntheticDevice, set up by params.syntheticOptions
+class SyntheticBackend : public V4L2Backend {
+private:
+	SyntheticDevice mDevice;
+
+public:
+	SyntheticBackend(const CaptureParams& params);
+	~SyntheticBackend();
+};
+
+#endif
@@ -0,0 +1,719 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#ifdef __linux__
+
+#include "V4L2Backend.h"
+#include "FrameCopy.h"
+#include "videoInput/captureModeSelector.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <climits>
+
+
+
+struct PixelFormat {
+	const char* name;
+	unsigned int fourcc;
+};
+
+// capture_format names. RGB24 of DirectShow is stored as BGR, which is BGR24 in V4L2.
+static const PixelFormat PIXEL_FORMATS[] = {
+	{ "RGB24", V4L2_PIX_FMT_BGR24 },
+	{ "YUY2", V4L2_PIX_FMT_YUYV },
+	{ "YUYV", V4L2_PIX_FMT_YUYV },
+	{ "UYVY", V4L2_PIX_FMT_UYVY },
+	{ "GREY", V4L2_PIX_FMT_GREY },
+	{ "Y800", V4L2_PIX_FMT_GREY },
+	{ "Y8", V4L2_PIX_FMT_GREY },
+};
+static const int NUM_PIXEL_FORMATS = sizeof(PIXEL_FORMATS) / sizeof(PIXEL_FORMATS[0]);
+
+// what auto pays to deliver each format we convert as RGB24, rated like the DirectShow subtypes of videoInput:
+// ns per pixel of the conversion, bytes per pixel on the bus, and whether colour is kept. Cheapest first,
+// which is the order tried when no format offers the requested size and resize takes the closest.
+static const struct {
+	unsigned int fourcc;
+	const char* name;
+	double nsPerPixel;
+	double bytesPerPixel;
+	bool color;
+} FORMAT_COSTS[] = {
+	{ V4L2_PIX_FMT_BGR24, "BGR3", 0.3, 3.0, true },
+	{ V4L2_PIX_FMT_YUYV, "YUYV", 1.0, 2.0, true },
+	{ V4L2_PIX_FMT_UYVY, "UYVY", 1.0, 2.0, true },
+	{ V4L2_PIX_FMT_GREY, "GREY", 0.5, 1.0, false },
+};
+static const int NUM_FORMAT_COSTS = sizeof(FORMAT_COSTS) / sizeof(FORMAT_COSTS[0]);
+
+// usable bandwidth of a USB device, as videoInput assumes with VI_USB_BANDWIDTH
+static const double USB_BANDWIDTH = 35000000.0;
+
+static V4L2Io defaultIo;
+
+
+
+int V4L2Io::Open(const char* path, int flags) {
+	return open(path, flags);
+}
+
+int V4L2Io::Close(int fd) {
+	return close(fd);
+}
+
+int V4L2Io::Ioctl(int fd, unsigned long request, void* arg) {
+	int result;
+	do {
+		result = ioctl(fd, request, arg);
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+void* V4L2Io::Mmap(size_t length, int fd, off_t offset) {
+	void* address = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+	return (address == MAP_FAILED) ? NULL : address;
+}
+
+int V4L2Io::Munmap(void* address, size_t length) {
+	return munmap(address, length);
+}
+
+
+
+static std::string FourccName(const unsigned int fourcc) {
+	char name[5] = { (char)(fourcc & 0xFF), (char)((fourcc >> 8) & 0xFF), (char)((fourcc >> 16) & 0xFF), (char)((fourcc >> 24) & 0xFF), '\0' };
+	return name;
+}
+
+// the media subtype of a fourcc, which is how the capture mode selector tells formats apart
+static GUID FourccSubtype(const unsigned int fourcc) {
+	GUID subtype = { fourcc, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 } };
+	return subtype;
+}
+
+// a frame interval in the 100ns units of videoCapability
+static __int64 FrameInterval(const v4l2_fract& interval) {
+	return (interval.denominator > 0) ? (__int64)interval.numerator * 10000000 / interval.denominator : 0;
+}
+
+static inline unsigned char Clip(const int value) {
+	return (value < 0) ? 0 : (value > 255) ? 255 : (unsigned char)value;
+}
+
+// BT.601 limited range, in 8 bit fixed point
+static inline void YuvToBgr(const int y, const int u, const int v, unsigned char* bgr) {
+	int c = 298 * (y - 16) + 128;
+	int d = u - 128;
+	int e = v - 128;
+	bgr[0] = Clip((c + 516 * d) >> 8);
+	bgr[1] = Clip((c - 100 * d - 208 * e) >> 8);
+	bgr[2] = Clip((c + 409 * e) >> 8);
+}
+
+// packed 4:2:2 with the byte offsets of Y0, U, Y1 and V in a pixel pair
+static void ConvertPacked422(const unsigned char* src, const int pitch, unsigned char* dst, const int width, const int height, const int y0, const int u, const int y1, const int v) {
+	for (int y = 0; y < height; y++) {
+		const unsigned char* s = src + (size_t)y * pitch;
+		unsigned char* d = dst + (size_t)(height - 1 - y) * width * 3;
+		for (int x = 0; x + 1 < width; x += 2, s += 4, d += 6) {
+			YuvToBgr(s[y0], s[u], s[v], d);
+			YuvToBgr(s[y1], s[u], s[v], d + 3);
+		}
+	}
+}
+
+static void ConvertBGR24(const unsigned char* src, const int pitch, unsigned char* dst, const int width, const int height) {
+	CopyFrameRows(dst + (size_t)(height - 1) * width * 3, -(ptrdiff_t)width * 3, src, pitch, (size_t)width * 3, height);
+}
+
+static void ConvertGrey(const unsigned char* src, const int pitch, unsigned char* dst, const int width, const int height) {
+	for (int y = 0; y < height; y++) {
+		const unsigned char* s = src + (size_t)y * pitch;
+		unsigned char* d = dst + (size_t)(height - 1 - y) * width * 3;
+		for (int x = 0; x < width; x++, d += 3) {
+			d[0] = d[1] = d[2] = s[x];
+		}
+	}
+}
+
+
+
+V4L2Backend::V4L2Backend(const CaptureParams& params, V4L2Io* io)
+	: mParams(params), mIo((io != NULL) ? io : &defaultIo), mFd(-1), mRequestedFormat(0), mFormat(0), mBytesPerLine(0), mImageSize(0), mCaptureWidth(params.width), mCaptureHeight(params.height), mHeld(-1), mHeldNumber(0), mHeldTime(0.0), mSequenced(false), mFirstSequence(0), mFrameNumber(0), mFrameTime(0.0), mSampleCount(0), mDroppedCount(0), mLastSampleTime(0.0), mNegotiatedFps(0.0) {
+	if (stricmp(mParams.captureFormat.c_str(), CAPTURE_FORMAT_AUTO) != 0) {
+		for (int i = 0; i < NUM_PIXEL_FORMATS; i++) {
+			if (stricmp(mParams.captureFormat.c_str(), PIXEL_FORMATS[i].name) == 0) {
+				mRequestedFormat = PIXEL_FORMATS[i].fourcc;
+				break;
+			}
+		}
+		if (mRequestedFormat == 0) {
+			throw "VideoInputSource: capture format is invalid";
+		}
+	}
+	if (mParams.audioSink != NULL) {
+		throw "VideoInputSource: audio capture from device is not supported with V4L2";
+	}
+}
+
+V4L2Backend::~V4L2Backend() {
+	Close();
+}
+
+const char* V4L2Backend::Open() {
+	Close();
+	mSequenced = false;
+	mSampleCount = 0;
+	mDroppedCount = 0;
+	mNegotiatedFps = 0.0;
+	mModeReport.clear();
+
+	char path[32];
+	sprintf(path, "/dev/video%d", mParams.deviceID);
+	mFd = mIo->Open(path, O_RDWR | O_NONBLOCK);
+	if (mFd < 0) {
+		return "VideoInputSource: cannot init device";
+	}
+
+	v4l2_capability capability;
+	memset(&capability, 0, sizeof(capability));
+	if (mIo->Ioctl(mFd, VIDIOC_QUERYCAP, &capability) < 0) {
+		return Fail("VideoInputSource: cannot init device");
+	}
+	unsigned int caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps : capability.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+		return Fail("VideoInputSource: device cannot stream video");
+	}
+
+	SelectInput();
+	if (!SelectFormat()) {
+		return Fail("VideoInputSource: cannot init device with assigned width and height");
+	}
+	SetFramerate();
+	if (!StartStreaming()) {
+		return Fail("VideoInputSource: cannot start streaming from device");
+	}
+
+	mLastSampleTime = GetCaptureTime();
+	return NULL;
+}
+
+const char* V4L2Backend::Fail(const char* error) {
+	Close();
+	return error;
+}
+
+// a device with several inputs is switched to the one of the connection type; USB and synthetic devices keep theirs
+void V4L2Backend::SelectInput() {
+	if (mParams.connection == CONNECTION_USB || mParams.connection == CONNECTION_SYNTHETIC) {
+		return;
+	}
+
+	v4l2_input input;
+	memset(&input, 0, sizeof(input));
+	for (input.index = 0; mIo->Ioctl(mFd, VIDIOC_ENUMINPUT, &input) == 0; input.index++) {
+		std::string name = (const char*)input.name;
+		for (size_t i = 0; i < name.size(); i++) {
+			name[i] = (char)tolower((unsigned char)name[i]);
+		}
+
+		bool match;
+		if (mParams.connection == CONNECTION_TUNER) {
+			match = (input.type == V4L2_INPUT_TYPE_TUNER);
+		}
+		else if (mParams.connection == CONNECTION_S_VIDEO) {
+			match = (name.find("s-video") != std::string::npos || name.find("svideo") != std::string::npos);
+		}
+		else {
+			match = (name.find("composite") != std::string::npos);
+		}
+
+		if (match) {
+			int index = (int)input.index;
+			mIo->Ioctl(mFd, VIDIOC_S_INPUT, &index);
+			return;
+		}
+	}
+}
+
+// asks the driver for fourcc at the requested size; format is what it agreed to, perhaps at another size
+bool V4L2Backend::TrySetFormat(const unsigned int fourcc, v4l2_format& format) {
+	memset(&format, 0, sizeof(format));
+	format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	format.fmt.pix.width = mParams.width;
+	format.fmt.pix.height = mParams.height;
+	format.fmt.pix.pixelformat = fourcc;
+	// both fields in one buffer, interleaved line by line
+	format.fmt.pix.field = (mParams.fieldOrder == FIELD_ORDER_TOP_FIRST) ? V4L2_FIELD_INTERLACED_TB : (mParams.fieldOrder == FIELD_ORDER_BOTTOM_FIRST) ? V4L2_FIELD_INTERLACED_BT : V4L2_FIELD_ANY;
+	if (mIo->Ioctl(mFd, VIDIOC_S_FMT, &format) < 0) {
+		return false;
+	}
+	// drivers adjust what they cannot do instead of failing
+	if (format.fmt.pix.pixelformat != fourcc) {
+		return false;
+	}
+	// packed 4:2:2 stores pixels in pairs, so an odd width leaves the last one without its chroma
+	if ((fourcc == V4L2_PIX_FMT_YUYV || fourcc == V4L2_PIX_FMT_UYVY) && format.fmt.pix.width % 2 != 0) {
+		return false;
+	}
+	// fields are served as every second row of a frame, so they cannot come in buffers of their own,
+	// and are scaled one by one, so their frame needs an even height
+	if (mParams.fieldOrder != FIELD_ORDER_NONE) {
+		if (format.fmt.pix.field != V4L2_FIELD_NONE && format.fmt.pix.field != V4L2_FIELD_INTERLACED && format.fmt.pix.field != V4L2_FIELD_INTERLACED_TB && format.fmt.pix.field != V4L2_FIELD_INTERLACED_BT) {
+			return false;
+		}
+		if (format.fmt.pix.height % 2 != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the sizes and fastest frame intervals the driver offers fourcc at; a driver that does not enumerate them
+// counts as offering any size at the requested rate
+void V4L2Backend::EnumerateCapabilities(const unsigned int fourcc, std::vector<videoCapability>& caps) {
+	size_t first = caps.size();
+	v4l2_frmsizeenum size;
+	memset(&size, 0, sizeof(size));
+	size.pixel_format = fourcc;
+	for (size.index = 0; mIo->Ioctl(mFd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++) {
+		videoCapability cap;
+		cap.subtype = FourccSubtype(fourcc);
+		if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+			cap.minWidth = cap.maxWidth = (int)size.discrete.width;
+			cap.minHeight = cap.maxHeight = (int)size.discrete.height;
+			cap.stepX = cap.stepY = 1;
+		}
+		else {
+			cap.minWidth = (int)size.stepwise.min_width;
+			cap.maxWidth = (int)size.stepwise.max_width;
+			cap.minHeight = (int)size.stepwise.min_height;
+			cap.maxHeight = (int)size.stepwise.max_height;
+			cap.stepX = (int)size.stepwise.step_width;
+			cap.stepY = (int)size.stepwise.step_height;
+		}
+		cap.minFrameInterval = cap.maxFrameInterval = 0;
+
+		// only the rate at the requested size matters to the selection
+		if (cap.supportsSize(mParams.width, mParams.height)) {
+			v4l2_frmivalenum interval;
+			memset(&interval, 0, sizeof(interval));
+			interval.pixel_format = fourcc;
+			interval.width = mParams.width;
+			interval.height = mParams.height;
+			for (interval.index = 0; mIo->Ioctl(mFd, VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0; interval.index++) {
+				if (interval.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+					cap.minFrameInterval = FrameInterval(interval.stepwise.min);
+					cap.maxFrameInterval = FrameInterval(interval.stepwise.max);
+					break;
+				}
+				__int64 frameInterval = FrameInterval(interval.discrete);
+				if (cap.minFrameInterval == 0 || frameInterval < cap.minFrameInterval) {
+					cap.minFrameInterval = frameInterval;
+				}
+				if (frameInterval > cap.maxFrameInterval) {
+					cap.maxFrameInterval = frameInterval;
+				}
+			}
+		}
+		caps.push_back(cap);
+		if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+			break;
+		}
+	}
+
+	if (caps.size() == first) {
+		videoCapability cap;
+		cap.subtype = FourccSubtype(fourcc);
+		cap.minWidth = cap.minHeight = 1;
+		cap.maxWidth = cap.maxHeight = INT_MAX;
+		cap.stepX = cap.stepY = 1;
+		cap.minFrameInterval = cap.maxFrameInterval = 0;
+		caps.push_back(cap);
+	}
+}
+
+// tries the requested format, or with auto the formats offered at the requested size from the best score
+// of the capture mode selector down, and keeps the first one the driver accepts at exactly that size.
+// With resize, when none does, the one the driver brings closest to it, as it adjusts the size to the
+// nearest it offers.
+bool V4L2Backend::SelectFormat() {
+	std::vector<unsigned int> offered;
+	v4l2_fmtdesc description;
+	memset(&description, 0, sizeof(description));
+	description.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	for (description.index = 0; mIo->Ioctl(mFd, VIDIOC_ENUM_FMT, &description) == 0; description.index++) {
+		offered.push_back(description.pixelformat);
+	}
+
+	std::vector<unsigned int> candidates;
+	std::vector<captureModeScore> scores;
+	if (mRequestedFormat != 0) {
+		candidates.push_back(mRequestedFormat);
+	}
+	else {
+		std::vector<videoCapability> caps;
+		std::vector<captureFormatCost> costs;
+		for (int i = 0; i < NUM_FORMAT_COSTS; i++) {
+			if (std::find(offered.begin(), offered.end(), FORMAT_COSTS[i].fourcc) == offered.end()) {
+				continue;
+			}
+			EnumerateCapabilities(FORMAT_COSTS[i].fourcc, caps);
+			captureFormatCost cost;
+			cost.subtype = FourccSubtype(FORMAT_COSTS[i].fourcc);
+			cost.name = FORMAT_COSTS[i].name;
+			cost.nsPerPixel = FORMAT_COSTS[i].nsPerPixel;
+			cost.bytesPerPixel = FORMAT_COSTS[i].bytesPerPixel;
+			cost.color = FORMAT_COSTS[i].color;
+			costs.push_back(cost);
+		}
+
+		v4l2_capability capability;
+		memset(&capability, 0, sizeof(capability));
+		bool usb = mIo->Ioctl(mFd, VIDIOC_QUERYCAP, &capability) == 0 && strncmp((const char*)capability.bus_info, "usb-", 4) == 0;
+		double fps = (double)mParams.fpsNumerator / (double)mParams.fpsDenominator;
+		selectCaptureMode(caps, costs, mParams.width, mParams.height, fps, usb ? USB_BANDWIDTH : 0.0, scores);
+
+		// the driver may still refuse a mode it listed, then the next best is tried
+		std::vector<captureModeScore> ranked(scores);
+		std::stable_sort(ranked.begin(), ranked.end(), [](const captureModeScore& a, const captureModeScore& b) { return a.score < b.score; });
+		for (size_t r = 0; r < ranked.size(); r++) {
+			candidates.push_back(ranked[r].subtype.Data1);
+		}
+		if (candidates.empty() && mParams.resize) {
+			for (size_t c = 0; c < costs.size(); c++) {
+				candidates.push_back(costs[c].subtype.Data1);
+			}
+		}
+	}
+
+	v4l2_format format;
+	bool found = false;
+	int closest = -1;
+	int closestDistance = 0;
+	for (size_t c = 0; c < candidates.size() && !found; c++) {
+		if (!TrySetFormat(candidates[c], format)) {
+			continue;
+		}
+		int distance = abs((int)format.fmt.pix.width - mParams.width) + abs((int)format.fmt.pix.height - mParams.height);
+		found = (distance == 0);
+		if (closest < 0 || distance < closestDistance) {
+			closest = (int)c;
+			closestDistance = distance;
+		}
+	}
+	// the closest was not necessarily the last one tried, so the driver is asked for it again
+	if (!found && mParams.resize && closest >= 0) {
+		found = TrySetFormat(candidates[closest], format);
+	}
+	if (!found) {
+		if (mRequestedFormat == 0) {
+			mModeReport = describeCaptureModeSelection(scores, -1);
+		}
+		return false;
+	}
+
+	int bytesPerPixel = (format.fmt.pix.pixelformat == V4L2_PIX_FMT_BGR24) ? 3 : (format.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY) ? 1 : 2;
+	mFormat = format.fmt.pix.pixelformat;
+	mCaptureWidth = (int)format.fmt.pix.width;
+	mCaptureHeight = (int)format.fmt.pix.height;
+	mBytesPerLine = ((int)format.fmt.pix.bytesperline >= mCaptureWidth * bytesPerPixel) ? (int)format.fmt.pix.bytesperline : mCaptureWidth * bytesPerPixel;
+	mImageSize = (size_t)mBytesPerLine * mCaptureHeight;
+
+	if (mRequestedFormat == 0) {
+		// the scores are for the requested size, a size the driver picked for resize has none
+		int selected = -1;
+		for (size_t s = 0; s < scores.size(); s++) {
+			if (scores[s].subtype.Data1 == mFormat && mCaptureWidth == mParams.width && mCaptureHeight == mParams.height) {
+				selected = (int)s;
+			}
+		}
+		if (selected >= 0) {
+			mModeReport = describeCaptureModeSelection(scores, selected);
+		}
+		else {
+			char size[32];
+			sprintf(size, " %dx%d", mCaptureWidth, mCaptureHeight);
+			mModeReport = "auto: selected " + FourccName(mFormat) + size + " to resize";
+		}
+		mModeReport += "; offered:";
+		for (size_t o = 0; o < offered.size(); o++) {
+			mModeReport += " " + FourccName(offered[o]);
+		}
+	}
+	return true;
+}
+
+// asks for the clip frame rate; drivers round to what they can do and report it back
+void V4L2Backend::SetFramerate() {
+	v4l2_streamparm parm;
+	memset(&parm, 0, sizeof(parm));
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (mIo->Ioctl(mFd, VIDIOC_G_PARM, &parm) < 0 || !(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+		return;
+	}
+
+	parm.parm.capture.timeperframe.numerator = mParams.fpsDenominator;
+	parm.parm.capture.timeperframe.denominator = mParams.fpsNumerator;
+	if (mIo->Ioctl(mFd, VIDIOC_S_PARM, &parm) < 0) {
+		return;
+	}
+	if (parm.parm.capture.timeperframe.numerator > 0) {
+		mNegotiatedFps = (double)parm.parm.capture.timeperframe.denominator / (double)parm.parm.capture.timeperframe.numerator;
+	}
+}
+
+bool V4L2Backend::StartStreaming() {
+	v4l2_requestbuffers request;
+	memset(&request, 0, sizeof(request));
+	request.count = mParams.queueDepth;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	// with a single buffer the driver would have nothing to fill while we read
+	if (mIo->Ioctl(mFd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+		return false;
+	}
+
+	for (unsigned int i = 0; i < request.count; i++) {
+		v4l2_buffer buffer;
+		memset(&buffer, 0, sizeof(buffer));
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		buffer.index = i;
+		if (mIo->Ioctl(mFd, VIDIOC_QUERYBUF, &buffer) < 0 || buffer.length < mImageSize) {
+			return false;
+		}
+
+		Buffer mapped;
+		mapped.length = buffer.length;
+		mapped.start = mIo->Mmap(buffer.length, mFd, (off_t)buffer.m.offset);
+		if (mapped.start == NULL) {
+			return false;
+		}
+		mBuffers.push_back(mapped);
+	}
+
+	for (size_t i = 0; i < mBuffers.size(); i++) {
+		if (!Queue((int)i)) {
+			return false;
+		}
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	return mIo->Ioctl(mFd, VIDIOC_STREAMON, &type) == 0;
+}
+
+bool V4L2Backend::Queue(const int index) {
+	v4l2_buffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer.memory = V4L2_MEMORY_MMAP;
+	buffer.index = index;
+	return mIo->Ioctl(mFd, VIDIOC_QBUF, &buffer) == 0;
+}
+
+// takes every filled buffer from the driver and keeps the newest; older ones go straight back unread.
+// Lossless takes one at a time, the others wait in the driver queue and keep the device readable.
+void V4L2Backend::Dequeue() {
+	while (!(mParams.lossless && mHeld >= 0)) {
+		v4l2_buffer buffer;
+		memset(&buffer, 0, sizeof(buffer));
+		buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buffer.memory = V4L2_MEMORY_MMAP;
+		// the device is non-blocking, so this fails with EAGAIN once nothing is filled
+		if (mIo->Ioctl(mFd, VIDIOC_DQBUF, &buffer) < 0) {
+			return;
+		}
+		if (buffer.index >= mBuffers.size()) {
+			continue;
+		}
+
+		// a damaged or short sample is given back and counts as dropped
+		if ((buffer.flags & V4L2_BUF_FLAG_ERROR) || (buffer.bytesused != 0 && buffer.bytesused < mImageSize)) {
+			Queue((int)buffer.index);
+			mDroppedCount++;
+			continue;
+		}
+
+		// some drivers never advance the sequence, their samples are simply counted
+		if (!mSequenced) {
+			mFirstSequence = buffer.sequence;
+			mSequenced = true;
+		}
+		unsigned long number = (unsigned long)(buffer.sequence - mFirstSequence) + 1;
+		if (number <= mSampleCount) {
+			number = mSampleCount + 1;
+		}
+		// a gap means the driver had no queued buffer to fill
+		mDroppedCount += number - mSampleCount - 1;
+		mSampleCount = number;
+
+		if (mHeld >= 0) {
+			Queue(mHeld);
+			mDroppedCount++;
+		}
+		mHeld = (int)buffer.index;
+		mHeldNumber = number;
+		if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+			mHeldTime = (double)buffer.timestamp.tv_sec + (double)buffer.timestamp.tv_usec * 1e-6;
+		}
+		else {
+			mHeldTime = GetCaptureTime();
+		}
+		mLastSampleTime = GetCaptureTime();
+	}
+}
+
+void V4L2Backend::Convert(const unsigned char* src, unsigned char* pixels) {
+	int width = mCaptureWidth;
+	int height = mCaptureHeight;
+	switch (mFormat) {
+	case V4L2_PIX_FMT_BGR24:
+		ConvertBGR24(src, mBytesPerLine, pixels, width, height);
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		ConvertPacked422(src, mBytesPerLine, pixels, width, height, 0, 1, 2, 3);
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		ConvertPacked422(src, mBytesPerLine, pixels, width, height, 1, 0, 3, 2);
+		break;
+	case V4L2_PIX_FMT_GREY:
+		ConvertGrey(src, mBytesPerLine, pixels, width, height);
+		break;
+	}
+}
+
+void V4L2Backend::Close() {
+	if (mFd < 0) {
+		return;
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	mIo->Ioctl(mFd, VIDIOC_STREAMOFF, &type);
+	for (size_t i = 0; i < mBuffers.size(); i++) {
+		mIo->Munmap(mBuffers[i].start, mBuffers[i].length);
+	}
+	mBuffers.clear();
+
+	v4l2_requestbuffers request;
+	memset(&request, 0, sizeof(request));
+	request.count = 0;
+	request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	request.memory = V4L2_MEMORY_MMAP;
+	mIo->Ioctl(mFd, VIDIOC_REQBUFS, &request);
+
+	mIo->Close(mFd);
+	mFd = -1;
+	mHeld = -1;
+}
+
+bool V4L2Backend::IsOpen() {
+	return mFd >= 0;
+}
+
+bool V4L2Backend::IsFrozen() {
+	if (mFd < 0) {
+		return false;
+	}
+	Dequeue();
+	return mParams.reconnectTimeout > 0 && GetCaptureTime() - mLastSampleTime > mParams.reconnectTimeout / 1000.0;
+}
+
+bool V4L2Backend::IsFrameNew() {
+	if (mFd < 0) {
+		return false;
+	}
+	Dequeue();
+	return mHeld >= 0;
+}
+
+CaptureEvent V4L2Backend::GetFrameEvent() {
+	// a streaming V4L2 device polls readable while a filled buffer waits
+	return mFd;
+}
+
+bool V4L2Backend::GetPixels(unsigned char* pixels) {
+	if (mHeld < 0) {
+		return false;
+	}
+
+	Convert((const unsigned char*)mBuffers[mHeld].start, pixels);
+	mFrameNumber = mHeldNumber;
+	mFrameTime = mHeldTime;
+
+	// a buffer the driver refuses back is only missing from the queue until the next open
+	Queue(mHeld);
+	mHeld = -1;
+	return true;
+}
+
+unsigned long V4L2Backend::GetFrameNumber() {
+	return mFrameNumber;
+}
+
+double V4L2Backend::GetFrameTime() {
+	return mFrameTime;
+}
+
+unsigned long V4L2Backend::GetSampleCount() {
+	return mSampleCount;
+}
+
+unsigned long V4L2Backend::GetDroppedSampleCount() {
+	return mDroppedCount;
+}
+
+double V4L2Backend::GetNegotiatedFramerate() {
+	return mNegotiatedFps;
+}
+
+std::string V4L2Backend::GetCaptureModeReport() {
+	return mModeReport;
+}
+
+size_t V4L2Backend::GetBufferMemory() {
+	size_t bytes = 0;
+	for (size_t i = 0; i < mBuffers.size(); i++) {
+		bytes += mBuffers[i].length;
+	}
+	return bytes;
+}
+
+int V4L2Backend::GetCaptureWidth() {
+	return mCaptureWidth;
+}
+
+int V4L2Backend::GetCaptureHeight() {
+	return mCaptureHeight;
+}
+
+#endif
@@ -0,0 +1,132 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+#pragma once
+
+#ifdef __linux__
+
+#include "CaptureBackend.h"
+#include "videoInput/capabilityCache.h"
+
+#include <sys/types.h>
+#include <linux/videodev2.h>
+
+#include <vector>
+
+
+
+// the system calls the V4L2 backend makes. Tests replace them with a stand-in, e.g. one that serves
+// frames from a file, so the backend runs without a device
+class V4L2Io {
+public:
+	virtual ~V4L2Io() {}
+
+	// the fd returned must poll readable while a sample waits to be dequeued
+	virtual int Open(const char* path, int flags);
+	virtual int Close(int fd);
+	// retried while interrupted by a signal
+	virtual int Ioctl(int fd, unsigned long request, void* arg);
+	// maps a driver buffer for reading and writing, returns NULL on failure
+	virtual void* Mmap(size_t length, int fd, off_t offset);
+	virtual int Munmap(void* address, size_t length);
+};
+
+
+
+// captures from /dev/video<device_id> with mmap streaming: queue_depth buffers are mapped once and
+// the driver fills them in turn. Samples are converted straight out of the dequeued buffer into the
+// frame, after which the buffer is queued again.
+class V4L2Backend : public CaptureBackend {
+private:
+	struct Buffer {
+		void* start;
+		size_t length;
+	};
+
+	CaptureParams mParams;
+	V4L2Io* mIo;
+	int mFd;
+
+	// pixel format asked for by capture_format, 0 for auto
+	unsigned int mRequestedFormat;
+	unsigned int mFormat;
+	int mBytesPerLine;
+	size_t mImageSize;
+	// size the driver agreed to, the requested one unless resize let it pick another
+	int mCaptureWidth, mCaptureHeight;
+	std::vector<Buffer> mBuffers;
+
+	// buffer holding the newest sample, -1 for none; only the newest is kept out of the queue
+	int mHeld;
+	unsigned long mHeldNumber;
+	double mHeldTime;
+
+	// sample numbers follow the driver sequence, so samples lost in the driver count as dropped
+	bool mSequenced;
+	unsigned int mFirstSequence;
+
+	unsigned long mFrameNumber;
+	double mFrameTime;
+	unsigned long mSampleCount;
+	unsigned long mDroppedCount;
+	double mLastSampleTime;
+	double mNegotiatedFps;
+	std::string mModeReport;
+
+	const char* Fail(const char* error);
+	void SelectInput();
+	void EnumerateCapabilities(const unsigned int fourcc, std::vector<videoCapability>& caps);
+	bool TrySetFormat(const unsigned int fourcc, v4l2_format& format);
+	bool SelectFormat();
+	void SetFramerate();
+	bool StartStreaming();
+	bool Queue(const int index);
+	void Dequeue();
+	void Convert(const unsigned char* src, unsigned char* pixels);
+
+public:
+	// io is not owned; NULL uses the real system calls
+	V4L2Backend(const CaptureParams& params, V4L2Io* io = NULL);
+	~V4L2Backend();
+
+	const char* Open();
+	void Close();
+	bool IsOpen();
+	bool IsFrozen();
+
+	bool IsFrameNew();
+	CaptureEvent GetFrameEvent();
+	bool GetPixels(unsigned char* pixels);
+	unsigned long GetFrameNumber();
+	double GetFrameTime();
+
+	unsigned long GetSampleCount();
+	unsigned long GetDroppedSampleCount();
+
+	double GetNegotiatedFramerate();
+	std::string GetCaptureModeReport();
+	size_t GetBufferMemory();
+	int GetCaptureWidth();
+	int GetCaptureHeight();
+};
+
+#endif
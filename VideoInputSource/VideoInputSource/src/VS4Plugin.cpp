@@ -0,0 +1,405 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// API 4 plugin, built instead of VSPlugin.cpp when VIDEOINPUTSOURCE_VAPOURSYNTH4 is defined
+
+#ifdef VIDEOINPUTSOURCE_VAPOURSYNTH4
+
+#include <vapoursynth/VapourSynth4.h>
+#include <vapoursynth/VSHelper4.h>
+
+#include "VideoInputSource.h"
+
+#include <memory>
+
+
+
+class VS4VideoInputSourceData {
+public:
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	// index of the region this clip serves, -1 for the full frame
+	int region = -1;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase = 0;
+	VSVideoInfo vi = {};
+
+	VS4VideoInputSourceData(const VideoInputSourceParams& params, const int num_frames, VSCore* core, const VSAPI* vsapi) {
+		videoInputSource = VideoInputSource::Create(params);
+		sharedBase = videoInputSource->OpenSharedClip();
+
+		vsapi->queryVideoFormat(&vi.format, cfRGB, stInteger, 8, 0, 0, core);
+		vi.width = videoInputSource->GetWidth();
+		vi.height = videoInputSource->GetHeight();
+		vi.fpsNum = params.fpsNumerator;
+		vi.fpsDen = params.fpsDenominator;
+		vi.numFrames = num_frames;
+
+		// every captured frame is served as its two fields, like SeparateFields does
+		if (videoInputSource->HasFields()) {
+			vi.height /= 2;
+			vi.numFrames *= 2;
+			vsh::muldivRational(&vi.fpsNum, &vi.fpsDen, 2, 1);
+		}
+	}
+
+	// a region of a source opened by VideoInputSource
+	VS4VideoInputSourceData(const std::shared_ptr<VideoInputSource>& source, const int index, const int num_frames, VSCore* core, const VSAPI* vsapi) : videoInputSource(source), region(index), sharedBase(source->OpenSharedClip()) {
+		vsapi->queryVideoFormat(&vi.format, cfRGB, stInteger, 8, 0, 0, core);
+		vi.width = source->GetRegion(index).width;
+		vi.height = source->GetRegion(index).height;
+		vi.fpsNum = source->GetFpsNumerator();
+		vi.fpsDen = source->GetFpsDenominator();
+		vi.numFrames = num_frames;
+	}
+
+	~VS4VideoInputSourceData() {
+		if (region < 0) {
+			videoInputSource->Release();
+		}
+	}
+};
+
+
+
+// runs on many threads at once (fmParallel): frames are read from the history kept by output frame number,
+// so requests out of order still get the samples in frame order, and only a request for a frame not captured
+// yet waits for the device. Both fields of a pair, and clips opened together on the source, read the same sample;
+// sharedBase is only touched inside GetSharedFrame, under its lock, so the threads may share it.
+static const VSFrame* VS_CC VS4VideoInputSourceGetFrame(int n, int activationReason, void* instanceData, void** frameData, VSFrameContext* frameCtx, VSCore* core, const VSAPI* vsapi) {
+	VS4VideoInputSourceData* videoInputSourceData = (VS4VideoInputSourceData*)instanceData;
+	if (activationReason == arInitial) {
+		// device setup errors surface here, since the device is opened in background
+		VideoInputSource* videoInputSource = videoInputSourceData->videoInputSource.get();
+		std::shared_ptr<const FrameSnapshot> snapshot;
+		bool duplicate;
+		int dropped;
+		try {
+			snapshot = videoInputSource->GetSharedFrame(videoInputSourceData->sharedBase, n, duplicate, dropped);
+		}
+		catch (const char* e) {
+			vsapi->setFilterError(e, frameCtx);
+			return nullptr;
+		}
+
+		const VSVideoInfo* vi = &videoInputSourceData->vi;
+		VSFrame* dst = vsapi->newVideoFrame(&vi->format, vi->width, vi->height, nullptr, core);
+
+		// one pass over the bottom-up BGR24 snapshot fills all three planes; a field or a region is read in place
+		ptrdiff_t src_stride = (ptrdiff_t)vi->width * 3;
+		const unsigned char* srcBase = snapshot->pixels;
+		if (videoInputSource->HasFields()) {
+			srcBase = videoInputSource->GetFieldRows(snapshot->pixels, n, src_stride);
+		}
+		else if (videoInputSourceData->region >= 0) {
+			srcBase = videoInputSource->GetRegionRows(snapshot->pixels, videoInputSourceData->region, src_stride);
+		}
+		ptrdiff_t dst_stride[3];
+		uint8_t* dstp[3];
+		for (int plane = 0; plane < 3; ++plane) {
+			dst_stride[plane] = vsapi->getStride(dst, plane);
+			dstp[plane] = vsapi->getWritePtr(dst, plane);
+		}
+		for (int y = 0; y < vi->height; y++) {
+			const unsigned char* srcp = srcBase + (vi->height - y - 1) * src_stride;
+			for (int x = 0; x < vi->width; x++) {
+				dstp[0][x] = srcp[x * 3 + 2];
+				dstp[1][x] = srcp[x * 3 + 1];
+				dstp[2][x] = srcp[x * 3];
+			}
+			for (int plane = 0; plane < 3; ++plane) {
+				dstp[plane] += dst_stride[plane];
+			}
+		}
+
+		// the later field of a frame was captured one field period after the earlier one
+		bool laterField = videoInputSource->HasFields() && n % 2 == 1;
+		double time = snapshot->time + (laterField ? (double)vi->fpsDen / vi->fpsNum : 0.0);
+
+		VSMap* props = vsapi->getFramePropertiesRW(dst);
+		vsapi->mapSetFloat(props, "_AbsoluteTime", time, maReplace);
+		vsapi->mapSetInt(props, "_DurationNum", vi->fpsDen, maReplace);
+		vsapi->mapSetInt(props, "_DurationDen", vi->fpsNum, maReplace);
+		vsapi->mapSetInt(props, "CaptureSequence", snapshot->number, maReplace);
+		vsapi->mapSetInt(props, "CaptureIsDuplicate", duplicate ? 1 : 0, maReplace);
+		vsapi->mapSetInt(props, "CaptureDropped", laterField ? 0 : dropped, maReplace);
+		if (videoInputSource->HasFields()) {
+			vsapi->mapSetInt(props, "_Field", videoInputSource->IsTopField(n) ? 1 : 0, maReplace);
+		}
+		if (videoInputSourceData->region >= 0) {
+			const std::string& name = videoInputSource->GetRegion(videoInputSourceData->region).name;
+			vsapi->mapSetData(props, "CaptureRegion", name.c_str(), (int)name.size(), dtUtf8, maReplace);
+		}
+
+		return dst;
+	}
+
+	return nullptr;
+}
+
+
+
+static void VS_CC VS4VideoInputSourceFree(void* instanceData, VSCore* core, const VSAPI* vsapi) {
+	VS4VideoInputSourceData* videoInputSourceData = (VS4VideoInputSourceData*)instanceData;
+	delete videoInputSourceData;
+}
+
+
+
+static void VS_CC VS4VideoInputSourceCreate(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	int err;
+
+	int device_id = vsapi->mapGetIntSaturated(in, "device_id", 0, NULL);
+	const char* connection_type = vsapi->mapGetData(in, "connection_type", 0, NULL);
+	int width = vsapi->mapGetIntSaturated(in, "width", 0, NULL);
+	int height = vsapi->mapGetIntSaturated(in, "height", 0, NULL);
+	int fps_numerator = vsapi->mapGetIntSaturated(in, "fps_numerator", 0, &err);
+	if (err) {
+		fps_numerator = 30;
+	}
+	int fps_denominator = vsapi->mapGetIntSaturated(in, "fps_denominator", 0, &err);
+	if (err) {
+		fps_denominator = 1;
+	}
+	int num_frames = vsapi->mapGetIntSaturated(in, "num_frames", 0, &err);
+	if (err) {
+		num_frames = calculateDefaultNumFrames(fps_numerator, fps_denominator);
+	}
+	bool frame_skip = !! vsapi->mapGetInt(in, "frame_skip", 0, &err);
+	if (err) {
+		frame_skip = true;
+	}
+	int reconnect_timeout = vsapi->mapGetIntSaturated(in, "reconnect_timeout", 0, &err);
+	if (err) {
+		reconnect_timeout = 0;
+	}
+	const char* capture_format = vsapi->mapGetData(in, "capture_format", 0, &err);
+	if (err) {
+		capture_format = "RGB24";
+	}
+	int queue_depth = vsapi->mapGetIntSaturated(in, "queue_depth", 0, &err);
+	if (err) {
+		queue_depth = 4;
+	}
+	const char* fields = vsapi->mapGetData(in, "fields", 0, &err);
+	if (err) {
+		fields = "none";
+	}
+	const char* regions = vsapi->mapGetData(in, "regions", 0, &err);
+	if (err) {
+		regions = "";
+	}
+	int wait_spin = vsapi->mapGetIntSaturated(in, "wait_spin", 0, &err);
+	if (err) {
+		wait_spin = 50;
+	}
+	int wait_timeout = vsapi->mapGetIntSaturated(in, "wait_timeout", 0, &err);
+	if (err) {
+		wait_timeout = 0;
+	}
+	int frame_deadline = vsapi->mapGetIntSaturated(in, "frame_deadline", 0, &err);
+	if (err) {
+		frame_deadline = 0;
+	}
+	bool realtime = !! vsapi->mapGetInt(in, "realtime", 0, &err);
+	if (err) {
+		realtime = false;
+	}
+	int lossless = vsapi->mapGetIntSaturated(in, "lossless", 0, &err);
+	if (err) {
+		lossless = 0;
+	}
+	const char* resize = vsapi->mapGetData(in, "resize", 0, &err);
+	if (err) {
+		resize = "none";
+	}
+
+	VideoInputSourceParams params;
+	params.deviceID = device_id;
+	params.connectionType = connection_type;
+	params.width = width;
+	params.height = height;
+	params.fpsNumerator = fps_numerator;
+	params.fpsDenominator = fps_denominator;
+	params.frameSkip = frame_skip;
+	params.reconnectTimeout = reconnect_timeout;
+	params.captureFormat = capture_format;
+	params.queueDepth = queue_depth;
+	params.waitSpin = wait_spin;
+	params.waitTimeout = wait_timeout;
+	params.frameDeadline = frame_deadline;
+	params.realtime = realtime;
+	params.lossless = lossless;
+	params.resize = resize;
+	params.fields = fields;
+	params.regions = regions;
+
+	VS4VideoInputSourceData* videoInputSourceData;
+	try {
+		videoInputSourceData = new VS4VideoInputSourceData(params, num_frames, core, vsapi);
+	}
+	catch (const char* e) {
+		vsapi->mapSetError(out, e);
+		return;
+	}
+
+	vsapi->createVideoFilter(out, "VideoInputSource", &videoInputSourceData->vi, VS4VideoInputSourceGetFrame, VS4VideoInputSourceFree, fmParallel, nullptr, 0, videoInputSourceData, core);
+}
+
+
+
+static void VS_CC VS4VideoInputSourceRegion(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	int err;
+
+	int device_id = vsapi->mapGetIntSaturated(in, "device_id", 0, NULL);
+	const char* name = vsapi->mapGetData(in, "name", 0, NULL);
+
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::FindByDeviceID(device_id);
+	if (!source) {
+		vsapi->mapSetError(out, "Region: no VideoInputSource is capturing from this device");
+		return;
+	}
+	int region = source->FindRegion(name);
+	if (region < 0) {
+		vsapi->mapSetError(out, "Region: region name is invalid");
+		return;
+	}
+	int num_frames = vsapi->mapGetIntSaturated(in, "num_frames", 0, &err);
+	if (err) {
+		num_frames = calculateDefaultNumFrames(source->GetFpsNumerator(), source->GetFpsDenominator());
+	}
+
+	VS4VideoInputSourceData* videoInputSourceData = new VS4VideoInputSourceData(source, region, num_frames, core, vsapi);
+	vsapi->createVideoFilter(out, "Region", &videoInputSourceData->vi, VS4VideoInputSourceGetFrame, VS4VideoInputSourceFree, fmParallel, nullptr, 0, videoInputSourceData, core);
+}
+
+
+
+static void VS_CC VS4VideoInputSourceStats(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	int device_id = vsapi->mapGetIntSaturated(in, "device_id", 0, NULL);
+
+	VideoInputSourceStats stats;
+	if (!VideoInputSource::GetStatsByDeviceID(device_id, stats)) {
+		vsapi->mapSetError(out, "Stats: no VideoInputSource is capturing from this device");
+		return;
+	}
+
+	vsapi->mapSetInt(out, "samples_received", stats.samplesReceived, maReplace);
+	vsapi->mapSetInt(out, "samples_dropped", stats.samplesDropped, maReplace);
+	vsapi->mapSetInt(out, "frames_delivered", stats.framesDelivered, maReplace);
+	vsapi->mapSetInt(out, "frames_duplicated", stats.framesDuplicated, maReplace);
+	vsapi->mapSetInt(out, "deadline_misses", stats.deadlineMisses, maReplace);
+	vsapi->mapSetFloat(out, "wait_time", stats.waitTime, maReplace);
+	vsapi->mapSetFloat(out, "frame_latency", stats.frameLatency, maReplace);
+	vsapi->mapSetInt(out, "reconnects", stats.reconnects, maReplace);
+	vsapi->mapSetFloat(out, "construct_time", stats.constructTime, maReplace);
+	vsapi->mapSetFloat(out, "setup_time", stats.setupTime, maReplace);
+	vsapi->mapSetFloat(out, "startup_wait", stats.startupWait, maReplace);
+	vsapi->mapSetFloat(out, "negotiated_fps", stats.negotiatedFps, maReplace);
+	vsapi->mapSetFloat(out, "measured_fps", stats.measuredFps, maReplace);
+	vsapi->mapSetFloat(out, "clock_ratio", stats.clockRatio, maReplace);
+	vsapi->mapSetFloat(out, "output_fps", stats.outputFps, maReplace);
+	vsapi->mapSetInt(out, "realtime_slips", stats.realtimeSlips, maReplace);
+	vsapi->mapSetInt(out, "audio_frames", stats.audioFrames, maReplace);
+	vsapi->mapSetFloat(out, "audio_latency", stats.audioLatency, maReplace);
+	vsapi->mapSetFloat(out, "audio_drift", stats.audioDrift, maReplace);
+	vsapi->mapSetInt(out, "audio_slips", stats.audioSlips, maReplace);
+	vsapi->mapSetFloat(out, "copy_rate", stats.copyRate, maReplace);
+	vsapi->mapSetFloat(out, "capture_bytes", stats.captureBytes, maReplace);
+	vsapi->mapSetFloat(out, "region_bytes", stats.regionBytes, maReplace);
+	vsapi->mapSetInt(out, "frames_shared", stats.framesShared, maReplace);
+	vsapi->mapSetInt(out, "opens", stats.opens, maReplace);
+	vsapi->mapSetFloat(out, "frame_memory", stats.frameMemory, maReplace);
+	vsapi->mapSetInt(out, "queued_frames", stats.queuedFrames, maReplace);
+	vsapi->mapSetInt(out, "spilled_frames", stats.spilledFrames, maReplace);
+	vsapi->mapSetFloat(out, "spill_bytes", stats.spillBytes, maReplace);
+	vsapi->mapSetInt(out, "capture_width", stats.captureWidth, maReplace);
+	vsapi->mapSetInt(out, "capture_height", stats.captureHeight, maReplace);
+	vsapi->mapSetData(out, "capture_mode", stats.captureMode.c_str(), (int)stats.captureMode.size(), dtUtf8, maReplace);
+}
+
+
+
+static void VS_CC VS4VideoInputSourceWait(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	std::vector<int> device_ids;
+	int count = vsapi->mapNumElements(in, "device_id");
+	for (int i = 0; i < count; i++) {
+		device_ids.push_back(vsapi->mapGetIntSaturated(in, "device_id", i, NULL));
+	}
+
+	std::vector<DeviceOpenResult> results;
+	if (!VideoInputSource::WaitForDevices(device_ids, results)) {
+		vsapi->mapSetError(out, "Wait: no VideoInputSource is capturing from this device");
+		return;
+	}
+
+	// every device is waited for before the first failure is reported
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].error != NULL) {
+			std::string error = "Wait: device " + std::to_string(results[i].deviceID) + " cannot be opened, " + results[i].error;
+			vsapi->mapSetError(out, error.c_str());
+			return;
+		}
+	}
+	for (size_t i = 0; i < results.size(); i++) {
+		vsapi->mapSetFloat(out, "setup_time", results[i].setupTime, maAppend);
+	}
+}
+
+
+
+VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin* plugin, const VSPLUGINAPI* vspapi) {
+	vspapi->configPlugin("org.fieliapm.VideoInputSource", "video_input_source", "VideoInputSource filter for VapourSynth R55 and later", VS_MAKE_VERSION(1, 0), VAPOURSYNTH_API_VERSION, 0, plugin);
+	vspapi->registerFunction("VideoInputSource",
+		"device_id:int;"
+		"connection_type:data;"
+		"width:int;"
+		"height:int;"
+		"fps_numerator:int:opt;"
+		"fps_denominator:int:opt;"
+		"num_frames:int:opt;"
+		"frame_skip:int:opt;"
+		"reconnect_timeout:int:opt;"
+		"capture_format:data:opt;"
+		"queue_depth:int:opt;"
+		"fields:data:opt;"
+		"regions:data:opt;"
+		"wait_spin:int:opt;"
+		"wait_timeout:int:opt;"
+		"frame_deadline:int:opt;"
+		"realtime:int:opt;"
+		"lossless:int:opt;"
+		"resize:data:opt;"
+	, "clip:vnode;", VS4VideoInputSourceCreate, nullptr, plugin);
+	vspapi->registerFunction("Region",
+		"device_id:int;"
+		"name:data;"
+		"num_frames:int:opt;"
+	, "clip:vnode;", VS4VideoInputSourceRegion, nullptr, plugin);
+	vspapi->registerFunction("Stats",
+		"device_id:int;"
+	, "any", VS4VideoInputSourceStats, nullptr, plugin);
+	vspapi->registerFunction("Wait",
+		"device_id:int[];"
+	, "setup_time:float[];", VS4VideoInputSourceWait, nullptr, plugin);
+}
+
+#endif
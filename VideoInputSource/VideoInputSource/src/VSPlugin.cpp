@@ -20,21 +20,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
+// API 3 plugin; VS4Plugin.cpp is built instead when VIDEOINPUTSOURCE_VAPOURSYNTH4 is defined
+
+#ifndef VIDEOINPUTSOURCE_VAPOURSYNTH4
+
 #include <vapoursynth/VapourSynth.h>
 #include <vapoursynth/VSHelper.h>
 
+#include <memory>
+
 #include "VideoInputSource.h"
 
 
 
 class VSVideoInputSourceData {
 public:
-	VideoInputSource* videoInputSource = nullptr;
+	std::shared_ptr<VideoInputSource> videoInputSource;
+	// index of the region this clip serves, -1 for the full frame
+	int region = -1;
+	// where the frames of this clip start among the output frames of the session, see GetSharedFrame
+	int sharedBase = 0;
 	VSVideoInfo vi = {};
 	const VSVideoInfo* videoInfo = nullptr;
 
-	VSVideoInputSourceData(const int device_id, const char* connection_type, const int width, const int height, const unsigned int fps_numerator, const unsigned int fps_denominator, const int num_frames, const bool frame_skip, VSCore* core, const VSAPI* vsapi) {
-		videoInputSource = new VideoInputSource(device_id, connection_type, width, height, frame_skip);
+	VSVideoInputSourceData(const VideoInputSourceParams& params, const int num_frames, VSCore* core, const VSAPI* vsapi) {
+		videoInputSource = VideoInputSource::Create(params);
+		sharedBase = videoInputSource->OpenSharedClip();
 
 		// set video info & format
 		//const VSFormat* videoFormat = vsapi->registerFormat(cmRGB, stInteger, 8, 0, 0, core);
@@ -43,18 +54,38 @@ public:
 		vi.format = videoFormat;
 		vi.width = videoInputSource->GetWidth();
 		vi.height = videoInputSource->GetHeight();
-		vi.fpsNum = fps_numerator;
-		vi.fpsDen = fps_denominator;
+		vi.fpsNum = params.fpsNumerator;
+		vi.fpsDen = params.fpsDenominator;
 		vi.numFrames = num_frames;
 
+		// every captured frame is served as its two fields, like SeparateFields does
+		if (videoInputSource->HasFields()) {
+			vi.height /= 2;
+			vi.numFrames *= 2;
+			muldivRational(&vi.fpsNum, &vi.fpsDen, 2, 1);
+		}
+
 		videoInfo = &vi;
 		//videoInfo = new VSVideoInfo();
 		//*videoInfo = vi;
 	}
 
+	// a region of a source opened by VideoInputSource
+	VSVideoInputSourceData(const std::shared_ptr<VideoInputSource>& source, const int index, const int num_frames, VSCore* core, const VSAPI* vsapi) : videoInputSource(source), region(index), sharedBase(source->OpenSharedClip()) {
+		vi.format = vsapi->getFormatPreset(pfRGB24, core);
+		vi.width = source->GetRegion(index).width;
+		vi.height = source->GetRegion(index).height;
+		vi.fpsNum = source->GetFpsNumerator();
+		vi.fpsDen = source->GetFpsDenominator();
+		vi.numFrames = num_frames;
+		videoInfo = &vi;
+	}
+
 	~VSVideoInputSourceData() {
-		delete videoInputSource;
 		//delete videoInfo;
+		if (region < 0) {
+			videoInputSource->Release();
+		}
 	}
 };
 
@@ -74,7 +105,30 @@ static const VSFrameRef* VS_CC VSVideoInputSourceGetFrame(int n, int activationR
 
 		VSFrameRef* dst = vsapi->newVideoFrame(videoFormat, videoInputSourceData->videoInfo->width, videoInputSourceData->videoInfo->height, nullptr, core);
 
-		const unsigned char* videoBuffer = videoInputSourceData->videoInputSource->GetFrame();
+		// device setup errors surface here, since the device is opened in background.
+		// A field or a region is read straight out of the captured frame, so it is converted only once.
+		VideoInputSource* videoInputSource = videoInputSourceData->videoInputSource.get();
+		const unsigned char* videoBuffer;
+		ptrdiff_t videoPitch = (ptrdiff_t)videoInputSourceData->videoInfo->width * 3;
+		std::shared_ptr<const FrameSnapshot> shared;
+		bool sharedDuplicate = false;
+		int sharedDropped = 0;
+		try {
+			// all clips of a source capture through the same history, also while there is only one
+			shared = videoInputSource->GetSharedFrame(videoInputSourceData->sharedBase, n, sharedDuplicate, sharedDropped);
+			videoBuffer = shared->pixels;
+			if (videoInputSource->HasFields()) {
+				videoBuffer = videoInputSource->GetFieldRows(shared->pixels, n, videoPitch);
+			}
+			else if (videoInputSourceData->region >= 0) {
+				videoBuffer = videoInputSource->GetRegionRows(shared->pixels, videoInputSourceData->region, videoPitch);
+			}
+		}
+		catch (const char* e) {
+			vsapi->freeFrame(dst);
+			vsapi->setFilterError(e, frameCtx);
+			return nullptr;
+		}
 
 		for (int plane = 0; plane < videoFormat->numPlanes; ++plane) {
 			int dst_stride = vsapi->getStride(dst, plane);
@@ -85,13 +139,32 @@ static const VSFrameRef* VS_CC VSVideoInputSourceGetFrame(int n, int activationR
 
 			for (int y = 0; y < height; y++) {
 				for (int x = 0; x < width; x++) {
-					dstp[x] = videoBuffer[((height - y - 1) * width + x) * 3 + (2 - plane)];
+					dstp[x] = videoBuffer[(height - y - 1) * videoPitch + x * 3 + (2 - plane)];
 				}
 
 				dstp += dst_stride;
 			}
 		}
 
+		// the later field of a frame was captured one field period after the earlier one
+		bool laterField = videoInputSource->HasFields() && n % 2 == 1;
+		double fieldOffset = laterField ? (double)videoInputSourceData->videoInfo->fpsDen / videoInputSourceData->videoInfo->fpsNum : 0.0;
+
+		VSMap* props = vsapi->getFramePropsRW(dst);
+		vsapi->propSetInt(props, "_DurationNum", videoInputSourceData->videoInfo->fpsDen, paReplace);
+		vsapi->propSetInt(props, "_DurationDen", videoInputSourceData->videoInfo->fpsNum, paReplace);
+		vsapi->propSetFloat(props, "_AbsoluteTime", shared->time + fieldOffset, paReplace);
+		vsapi->propSetInt(props, "CaptureSequence", shared->number, paReplace);
+		vsapi->propSetInt(props, "CaptureIsDuplicate", sharedDuplicate ? 1 : 0, paReplace);
+		vsapi->propSetInt(props, "CaptureDropped", laterField ? 0 : sharedDropped, paReplace);
+		if (videoInputSource->HasFields()) {
+			vsapi->propSetInt(props, "_Field", videoInputSource->IsTopField(n) ? 1 : 0, paReplace);
+		}
+		if (videoInputSourceData->region >= 0) {
+			const std::string& name = videoInputSource->GetRegion(videoInputSourceData->region).name;
+			vsapi->propSetData(props, "CaptureRegion", name.c_str(), (int)name.size(), paReplace);
+		}
+
 		return dst;
 	}
 
@@ -131,10 +204,75 @@ static void VS_CC VSVideoInputSourceCreate(const VSMap* in, VSMap* out, void* us
 	if (err) {
 		frame_skip = true;
 	}
+	int reconnect_timeout = vsapi->propGetInt(in, "reconnect_timeout", 0, &err);
+	if (err) {
+		reconnect_timeout = 0;
+	}
+	const char* capture_format = vsapi->propGetData(in, "capture_format", 0, &err);
+	if (err) {
+		capture_format = "RGB24";
+	}
+	int queue_depth = vsapi->propGetInt(in, "queue_depth", 0, &err);
+	if (err) {
+		queue_depth = 4;
+	}
+	const char* fields = vsapi->propGetData(in, "fields", 0, &err);
+	if (err) {
+		fields = "none";
+	}
+	const char* regions = vsapi->propGetData(in, "regions", 0, &err);
+	if (err) {
+		regions = "";
+	}
+	int wait_spin = vsapi->propGetInt(in, "wait_spin", 0, &err);
+	if (err) {
+		wait_spin = 50;
+	}
+	int wait_timeout = vsapi->propGetInt(in, "wait_timeout", 0, &err);
+	if (err) {
+		wait_timeout = 0;
+	}
+	int frame_deadline = vsapi->propGetInt(in, "frame_deadline", 0, &err);
+	if (err) {
+		frame_deadline = 0;
+	}
+	bool realtime = !! vsapi->propGetInt(in, "realtime", 0, &err);
+	if (err) {
+		realtime = false;
+	}
+	int lossless = vsapi->propGetInt(in, "lossless", 0, &err);
+	if (err) {
+		lossless = 0;
+	}
+	const char* resize = vsapi->propGetData(in, "resize", 0, &err);
+	if (err) {
+		resize = "none";
+	}
+
+	VideoInputSourceParams params;
+	params.deviceID = device_id;
+	params.connectionType = connection_type;
+	params.width = width;
+	params.height = height;
+	params.fpsNumerator = fps_numerator;
+	params.fpsDenominator = fps_denominator;
+	params.frameSkip = frame_skip;
+	params.reconnectTimeout = reconnect_timeout;
+	params.captureFormat = capture_format;
+	params.queueDepth = queue_depth;
+	// audio is left at none, VapourSynth API 3 has no audio clips
+	params.waitSpin = wait_spin;
+	params.waitTimeout = wait_timeout;
+	params.frameDeadline = frame_deadline;
+	params.realtime = realtime;
+	params.lossless = lossless;
+	params.resize = resize;
+	params.fields = fields;
+	params.regions = regions;
 
 	VSVideoInputSourceData* videoInputSourceData;
 	try {
-		videoInputSourceData = new VSVideoInputSourceData(device_id, connection_type, width, height, fps_numerator, fps_denominator, num_frames, frame_skip, core, vsapi);
+		videoInputSourceData = new VSVideoInputSourceData(params, num_frames, core, vsapi);
 	}
 	catch (const char* e) {
 		vsapi->setError(out, e);
@@ -146,6 +284,106 @@ static void VS_CC VSVideoInputSourceCreate(const VSMap* in, VSMap* out, void* us
 
 
 
+static void VS_CC VSVideoInputSourceRegion(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	int err;
+
+	int device_id = vsapi->propGetInt(in, "device_id", 0, NULL);
+	const char* name = vsapi->propGetData(in, "name", 0, NULL);
+
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::FindByDeviceID(device_id);
+	if (!source) {
+		vsapi->setError(out, "Region: no VideoInputSource is capturing from this device");
+		return;
+	}
+	int region = source->FindRegion(name);
+	if (region < 0) {
+		vsapi->setError(out, "Region: region name is invalid");
+		return;
+	}
+	int num_frames = vsapi->propGetInt(in, "num_frames", 0, &err);
+	if (err) {
+		num_frames = calculateDefaultNumFrames(source->GetFpsNumerator(), source->GetFpsDenominator());
+	}
+
+	VSVideoInputSourceData* videoInputSourceData = new VSVideoInputSourceData(source, region, num_frames, core, vsapi);
+	vsapi->createFilter(in, out, "Region", VSVideoInputSourceInit, VSVideoInputSourceGetFrame, VSVideoInputSourceFree, fmUnordered, 0, videoInputSourceData, core);
+}
+
+
+
+static void VS_CC VSVideoInputSourceStats(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	int device_id = vsapi->propGetInt(in, "device_id", 0, NULL);
+
+	VideoInputSourceStats stats;
+	if (!VideoInputSource::GetStatsByDeviceID(device_id, stats)) {
+		vsapi->setError(out, "Stats: no VideoInputSource is capturing from this device");
+		return;
+	}
+
+	vsapi->propSetInt(out, "samples_received", stats.samplesReceived, paReplace);
+	vsapi->propSetInt(out, "samples_dropped", stats.samplesDropped, paReplace);
+	vsapi->propSetInt(out, "frames_delivered", stats.framesDelivered, paReplace);
+	vsapi->propSetInt(out, "frames_duplicated", stats.framesDuplicated, paReplace);
+	vsapi->propSetInt(out, "deadline_misses", stats.deadlineMisses, paReplace);
+	vsapi->propSetFloat(out, "wait_time", stats.waitTime, paReplace);
+	vsapi->propSetFloat(out, "frame_latency", stats.frameLatency, paReplace);
+	vsapi->propSetInt(out, "reconnects", stats.reconnects, paReplace);
+	vsapi->propSetFloat(out, "construct_time", stats.constructTime, paReplace);
+	vsapi->propSetFloat(out, "setup_time", stats.setupTime, paReplace);
+	vsapi->propSetFloat(out, "startup_wait", stats.startupWait, paReplace);
+	vsapi->propSetFloat(out, "negotiated_fps", stats.negotiatedFps, paReplace);
+	vsapi->propSetFloat(out, "measured_fps", stats.measuredFps, paReplace);
+	vsapi->propSetFloat(out, "clock_ratio", stats.clockRatio, paReplace);
+	vsapi->propSetFloat(out, "output_fps", stats.outputFps, paReplace);
+	vsapi->propSetInt(out, "realtime_slips", stats.realtimeSlips, paReplace);
+	vsapi->propSetInt(out, "audio_frames", stats.audioFrames, paReplace);
+	vsapi->propSetFloat(out, "audio_latency", stats.audioLatency, paReplace);
+	vsapi->propSetFloat(out, "audio_drift", stats.audioDrift, paReplace);
+	vsapi->propSetInt(out, "audio_slips", stats.audioSlips, paReplace);
+	vsapi->propSetFloat(out, "copy_rate", stats.copyRate, paReplace);
+	vsapi->propSetFloat(out, "capture_bytes", stats.captureBytes, paReplace);
+	vsapi->propSetFloat(out, "region_bytes", stats.regionBytes, paReplace);
+	vsapi->propSetInt(out, "frames_shared", stats.framesShared, paReplace);
+	vsapi->propSetInt(out, "opens", stats.opens, paReplace);
+	vsapi->propSetFloat(out, "frame_memory", stats.frameMemory, paReplace);
+	vsapi->propSetInt(out, "queued_frames", stats.queuedFrames, paReplace);
+	vsapi->propSetInt(out, "spilled_frames", stats.spilledFrames, paReplace);
+	vsapi->propSetFloat(out, "spill_bytes", stats.spillBytes, paReplace);
+	vsapi->propSetInt(out, "capture_width", stats.captureWidth, paReplace);
+	vsapi->propSetInt(out, "capture_height", stats.captureHeight, paReplace);
+	vsapi->propSetData(out, "capture_mode", stats.captureMode.c_str(), (int)stats.captureMode.size(), paReplace);
+}
+
+
+
+static void VS_CC VSVideoInputSourceWait(const VSMap* in, VSMap* out, void* userData, VSCore* core, const VSAPI* vsapi) {
+	std::vector<int> device_ids;
+	int count = vsapi->propNumElements(in, "device_id");
+	for (int i = 0; i < count; i++) {
+		device_ids.push_back((int)vsapi->propGetInt(in, "device_id", i, NULL));
+	}
+
+	std::vector<DeviceOpenResult> results;
+	if (!VideoInputSource::WaitForDevices(device_ids, results)) {
+		vsapi->setError(out, "Wait: no VideoInputSource is capturing from this device");
+		return;
+	}
+
+	// every device is waited for before the first failure is reported
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].error != NULL) {
+			std::string error = "Wait: device " + std::to_string(results[i].deviceID) + " cannot be opened, " + results[i].error;
+			vsapi->setError(out, error.c_str());
+			return;
+		}
+	}
+	for (size_t i = 0; i < results.size(); i++) {
+		vsapi->propSetFloat(out, "setup_time", results[i].setupTime, paAppend);
+	}
+}
+
+
+
 VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegisterFunction registerFunc, VSPlugin* plugin) {
 	configFunc("org.fieliapm.VideoInputSource", "video_input_source", "VideoInputSource filter for VapourSynth prior to R55 & VapourSynth Classic", VAPOURSYNTH_API_VERSION, 1, plugin);
 	registerFunc("VideoInputSource",
@@ -157,5 +395,29 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
 		"fps_denominator:int:opt;"
 		"num_frames:int:opt;"
 		"frame_skip:int:opt;"
+		"reconnect_timeout:int:opt;"
+		"capture_format:data:opt;"
+		"queue_depth:int:opt;"
+		"fields:data:opt;"
+		"regions:data:opt;"
+		"wait_spin:int:opt;"
+		"wait_timeout:int:opt;"
+		"frame_deadline:int:opt;"
+		"realtime:int:opt;"
+		"lossless:int:opt;"
+		"resize:data:opt;"
 	, VSVideoInputSourceCreate, nullptr, plugin);
+	registerFunc("Region",
+		"device_id:int;"
+		"name:data;"
+		"num_frames:int:opt;"
+	, VSVideoInputSourceRegion, nullptr, plugin);
+	registerFunc("Stats",
+		"device_id:int;"
+	, VSVideoInputSourceStats, nullptr, plugin);
+	registerFunc("Wait",
+		"device_id:int[];"
+	, VSVideoInputSourceWait, nullptr, plugin);
 }
+
+#endif
@@ -24,12 +24,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
-#include "videoInput/videoInput.h"
-
-#include <malloc.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 #include <xmmintrin.h>
 
+#include <chrono>
+
 #include "VideoInputSource.h"
+#include "FrameCopy.h"
 
 
 
@@ -39,68 +42,1041 @@ int calculateDefaultNumFrames(const unsigned int fps_numerator, const unsigned i
 
 
 
-VideoInputSource::VideoInputSource(const int device_id, const char* connection_type, const int width, const int height, const bool frame_skip)
-	: mDeviceID(device_id), mFrameSkip(frame_skip) {
-	
-	int conenction;
-	if (stricmp(connection_type, "Composite") == 0) {
-		conenction = VI_COMPOSITE;
+VideoInputSourceParams::VideoInputSourceParams()
+	: deviceID(0), connectionType("USB"), width(640), height(480), fpsNumerator(30), fpsDenominator(1), frameSkip(true), reconnectTimeout(0), captureFormat("RGB24"), audio("none"), audioRate(48000), audioChannels(2), queueDepth(4), waitSpin(50), waitTimeout(0), frameDeadline(0), realtime(false), lossless(0), resize("none"), fields("none"), regions("") {
+}
+
+bool VideoInputSourceParams::operator==(const VideoInputSourceParams& other) const {
+	// region names are compared as written, since FindRegion looks them up that way
+	return deviceID == other.deviceID && stricmp(connectionType.c_str(), other.connectionType.c_str()) == 0 && width == other.width && height == other.height
+		&& fpsNumerator == other.fpsNumerator && fpsDenominator == other.fpsDenominator && frameSkip == other.frameSkip && reconnectTimeout == other.reconnectTimeout
+		&& stricmp(captureFormat.c_str(), other.captureFormat.c_str()) == 0 && stricmp(audio.c_str(), other.audio.c_str()) == 0 && audioRate == other.audioRate && audioChannels == other.audioChannels
+		&& queueDepth == other.queueDepth && waitSpin == other.waitSpin && waitTimeout == other.waitTimeout && frameDeadline == other.frameDeadline && realtime == other.realtime
+		&& lossless == other.lossless && stricmp(resize.c_str(), other.resize.c_str()) == 0 && stricmp(fields.c_str(), other.fields.c_str()) == 0 && regions == other.regions;
+}
+
+bool VideoInputSourceParams::operator!=(const VideoInputSourceParams& other) const {
+	return !(*this == other);
+}
+
+
+
+FrameRateMeter::FrameRateMeter(const double window) : mWindow(window) {
+	Reset();
+}
+
+void FrameRateMeter::Reset() {
+	mStarted = false;
+	mDone = false;
+	mFirstNumber = mLastNumber = 0;
+	mFirstTime = mLastTime = 0.0;
+}
+
+bool FrameRateMeter::AddSample(const unsigned long number, const double time) {
+	if (mDone) {
+		return false;
+	}
+	if (!mStarted) {
+		mStarted = true;
+		mFirstNumber = mLastNumber = number;
+		mFirstTime = mLastTime = time;
+		return false;
+	}
+	// a repeated or older sample carries no information
+	if (number <= mLastNumber || time <= mLastTime) {
+		return false;
+	}
+	mLastNumber = number;
+	mLastTime = time;
+	mDone = (mLastTime - mFirstTime >= mWindow);
+	return mDone;
+}
+
+bool FrameRateMeter::IsDone() {
+	return mDone;
+}
+
+double FrameRateMeter::GetRate() {
+	if (!mStarted || mLastTime <= mFirstTime) {
+		return 0.0;
+	}
+	return (double)(mLastNumber - mFirstNumber) / (mLastTime - mFirstTime);
+}
+
+
+
+// loop gains of the clock estimator: the phase follows quickly, the period slowly enough to average out jitter
+static const double CLOCK_PHASE_GAIN = 0.05;
+static const double CLOCK_PERIOD_GAIN = CLOCK_PHASE_GAIN * CLOCK_PHASE_GAIN / 4.0;
+// updates before the estimate is trusted
+static const int CLOCK_LOCK_TICKS = 32;
+// an error beyond this many periods is a pause or a reconnect, not jitter
+static const double CLOCK_RESYNC_PERIODS = 8.0;
+
+ClockEstimator::ClockEstimator() {
+	Reset(1.0);
+}
+
+void ClockEstimator::Reset(const double nominalPeriod) {
+	mNominalPeriod = nominalPeriod;
+	mPeriod = nominalPeriod;
+	mPhase = 0.0;
+	mTicks = 0;
+}
+
+void ClockEstimator::Update(const double time, const unsigned long ticks) {
+	if (mTicks == 0) {
+		mPhase = time;
+		mTicks = 1;
+		return;
 	}
-	else if (stricmp(connection_type, "S_Video") == 0) {
-		conenction = VI_S_VIDEO;
+
+	double n = (double)(ticks > 0 ? ticks : 1);
+	double predicted = mPhase + n * mPeriod;
+	double error = time - predicted;
+	if (error > CLOCK_RESYNC_PERIODS * mPeriod || error < -CLOCK_RESYNC_PERIODS * mPeriod) {
+		mPhase = time;
+		return;
+	}
+
+	mPhase = predicted + CLOCK_PHASE_GAIN * error;
+	mPeriod += CLOCK_PERIOD_GAIN * error / n;
+	// a real clock is never off by a factor of two, anything beyond is a broken estimate
+	if (mPeriod < mNominalPeriod * 0.5) {
+		mPeriod = mNominalPeriod * 0.5;
+	}
+	else if (mPeriod > mNominalPeriod * 2.0) {
+		mPeriod = mNominalPeriod * 2.0;
+	}
+	if (mTicks < CLOCK_LOCK_TICKS) {
+		mTicks++;
+	}
+}
+
+bool ClockEstimator::IsLocked() {
+	return mTicks >= CLOCK_LOCK_TICKS;
+}
+
+double ClockEstimator::GetPeriod() {
+	return mPeriod;
+}
+
+double ClockEstimator::GetPhase() {
+	return mPhase;
+}
+
+
+
+FramePacer::FramePacer(const double wait) : mLastSample(0), mWait(wait) {
+}
+
+void FramePacer::Reset(const double devicePeriod, const double outputPeriod) {
+	mOutputClock.Reset(outputPeriod);
+	ResetDevice(devicePeriod);
+}
+
+void FramePacer::ResetDevice(const double devicePeriod) {
+	mDeviceClock.Reset(devicePeriod);
+	mLastSample = 0;
+}
+
+void FramePacer::OnSample(const unsigned long number, const double time) {
+	unsigned long ticks = (mLastSample == 0 || number <= mLastSample) ? 1 : number - mLastSample;
+	mLastSample = number;
+	mDeviceClock.Update(time, ticks);
+}
+
+bool FramePacer::PlanFrame(const double time) {
+	mOutputClock.Update(time, 1);
+	if (!IsLocked()) {
+		return true;
 	}
-	else if (stricmp(connection_type, "Tuner") == 0) {
-		conenction = VI_TUNER;
+
+	// show a new sample when the one after the last shown is due before this frame's wait runs out;
+	// a faster device simply has its surplus overwritten in the grabber
+	double nextSample = mDeviceClock.GetPhase() + mDeviceClock.GetPeriod();
+	double deadline = mOutputClock.GetPhase() + mOutputClock.GetPeriod() * mWait;
+	return nextSample <= deadline;
+}
+
+bool FramePacer::IsLocked() {
+	return mDeviceClock.IsLocked() && mOutputClock.IsLocked();
+}
+
+double FramePacer::GetRatio() {
+	if (!IsLocked()) {
+		return 0.0;
 	}
-	else if (stricmp(connection_type, "USB") == 0) {
-		conenction = VI_USB;
+	return mOutputClock.GetPeriod() / mDeviceClock.GetPeriod();
+}
+
+double FramePacer::GetOutputPeriod() {
+	return mOutputClock.GetPeriod();
+}
+
+
+
+// sleeping may overrun by a timer tick, so the last stretch before a frame is due is spent yielding instead
+static const double REALTIME_SPIN = 0.001;
+
+RealtimeClock::RealtimeClock(const int catchUp) : mCatchUp(catchUp) {
+	Reset(0.0);
+}
+
+void RealtimeClock::Reset(const double period) {
+	mPeriod = period;
+	mTicks = 0;
+	mFrames = 0;
+	mSlips = 0;
+}
+
+void RealtimeClock::WaitTick() {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (mFrames == 0) {
+		mOrigin = mFirst = now;
 	}
 	else {
-		throw "VideoInputSource: connection type is invalid";
+		// due times are counted from the origin, so rounding never adds up to drift
+		mTicks++;
+		std::chrono::steady_clock::time_point due = mOrigin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(mPeriod * mTicks));
+		if (now - due > std::chrono::duration<double>(mPeriod * mCatchUp)) {
+			mOrigin = now;
+			mTicks = 0;
+			mSlips++;
+		}
+		else if (now < due) {
+			std::chrono::steady_clock::time_point spinStart = due - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(REALTIME_SPIN));
+			if (now < spinStart) {
+				std::this_thread::sleep_until(spinStart);
+			}
+			while (std::chrono::steady_clock::now() < due) {
+				std::this_thread::yield();
+			}
+			now = std::chrono::steady_clock::now();
+		}
+	}
+	mFrames++;
+	mLast = now;
+}
+
+double RealtimeClock::GetRate() {
+	double elapsed = std::chrono::duration<double>(mLast - mFirst).count();
+	return (mFrames < 2 || elapsed <= 0.0) ? 0.0 : (double)(mFrames - 1) / elapsed;
+}
+
+int RealtimeClock::GetSlips() {
+	return mSlips;
+}
+
+
+
+// open sources with the params they were created with, so clips asking for the same capture share it and
+// stats and regions can be looked up from script functions; newest last.
+// A source being constructed is held by a pending entry, which other clips asking for it wait on.
+struct SourceEntry {
+	VideoInputSourceParams params;
+	std::weak_ptr<VideoInputSource> source;
+	bool pending;
+};
+static std::mutex sourceRegistryLock;
+static std::condition_variable sourceRegistrySignal;
+static std::vector<SourceEntry> sourceRegistry;
+
+// how often the watchdog looks for a frozen device
+static const int WATCHDOG_INTERVAL = 100;
+
+// seconds of arrivals measured after the device is opened
+static const double FRAME_RATE_WARMUP = 2.0;
+
+// part of an output frame period a sample may be due late and still be planned for the frame,
+// and how long frame_skip really waits for it - twice that, so jitter around the plan does not
+// turn into a duplicate followed by a drop
+static const double PACER_WAIT = 0.25;
+static const double PACER_WAIT_LIMIT = 0.5;
+
+// output frames a realtime source hands out at once to catch up after a stall
+static const int REALTIME_CATCHUP = 2;
+
+static const int AUDIO_NONE = 0;
+static const int AUDIO_DEVICE = 1;
+static const int AUDIO_TONE = 2;
+
+// seconds of audio kept for lookup
+static const double AUDIO_RING_SIZE = 4.0;
+// contiguous requests keep reading on from the last one until it is this far off the clock mapping
+static const double AUDIO_SLIP = 0.02;
+// extra seconds a request waits for audio still being captured
+static const double AUDIO_WAIT = 0.1;
+static const double TONE_FREQUENCY = 1000.0;
+// spare buffers a source keeps for snapshots, enough for a few threads converting at once
+static const size_t SNAPSHOT_POOL_SIZE = 4;
+// output frames whose samples stay available to region clips; clips fetched by different threads
+// or through caches are a few frames apart at most
+static const size_t SHARED_FRAME_HISTORY = 8;
+
+// lossless mode drops the samples it cannot spill once the spill file is this large, rather than filling the disk
+static const __int64 LOSSLESS_SPILL_LIMIT = (__int64)64 * 1024 * 1024 * 1024;
+
+
+
+// buffers of snapshots are recycled, since a fresh allocation for every sample costs page faults each time.
+// Snapshots hold the pool, so they may outlive the source.
+class SnapshotPool {
+private:
+	size_t mSize;
+	std::mutex mLock;
+	std::vector<unsigned char*> mFree;
+	// buffers made and not freed yet, in use or waiting in mFree
+	std::atomic<size_t> mCount;
+
+public:
+	SnapshotPool(const size_t size) : mSize(size), mCount(0) {
+	}
+
+	~SnapshotPool() {
+		for (size_t i = 0; i < mFree.size(); i++) {
+			_aligned_free(mFree[i]);
+		}
+	}
+
+	unsigned char* Take() {
+		{
+			std::lock_guard<std::mutex> lock(mLock);
+			if (!mFree.empty()) {
+				unsigned char* pixels = mFree.back();
+				mFree.pop_back();
+				return pixels;
+			}
+		}
+		unsigned char* pixels = (unsigned char*)_aligned_malloc(mSize, sizeof(__m128));
+		if (pixels != NULL) {
+			mCount++;
+		}
+		return pixels;
 	}
 
-	if (!mVideoInput.setupDevice(mDeviceID, width, height, conenction)) {
-		throw "VideoInputSource: cannot init device";
+	void Give(unsigned char* pixels) {
+		std::lock_guard<std::mutex> lock(mLock);
+		if (mFree.size() < SNAPSHOT_POOL_SIZE) {
+			mFree.push_back(pixels);
+		}
+		else {
+			_aligned_free(pixels);
+			mCount--;
+		}
 	}
 
-	mWidth = mVideoInput.getWidth(mDeviceID);
-	mHeight = mVideoInput.getHeight(mDeviceID);
-	int mSize = mVideoInput.getSize(mDeviceID);
-	if (!(mWidth == width && mHeight == height)) {
-		mVideoInput.stopDevice(mDeviceID);
-		throw "VideoInputSource: cannot init device with assigned width and height";
+	size_t GetMemory() {
+		return mCount * mSize;
 	}
+};
 
-	mBuffer = (unsigned char*)_aligned_malloc(sizeof(unsigned char) * mSize, sizeof(__m128));
-	if (mBuffer == NULL) {
-		mVideoInput.stopDevice(mDeviceID);
+static std::shared_ptr<FrameSnapshot> NewSnapshot(const std::shared_ptr<SnapshotPool>& pool) {
+	unsigned char* pixels = pool->Take();
+	if (pixels == NULL) {
 		throw "VideoInputSource: cannot allocate frame buffer";
 	}
-	memset(mBuffer, 0, sizeof(unsigned char) * mSize);
+	FrameSnapshot* snapshot = new FrameSnapshot();
+	snapshot->pixels = pixels;
+	snapshot->number = 0;
+	snapshot->time = 0.0;
+	return std::shared_ptr<FrameSnapshot>(snapshot, [pool](FrameSnapshot* released) {
+		pool->Give(released->pixels);
+		delete released;
+	});
 }
 
-VideoInputSource::~VideoInputSource() {
-	mVideoInput.stopDevice(mDeviceID);
-	_aligned_free(mBuffer);
+
+
+// parses "name=x,y,width,height;name=..." into regions inside a frame of width x height
+static std::vector<CaptureRegion> ParseRegions(const char* regions, const int width, const int height) {
+	std::vector<CaptureRegion> parsed;
+	std::string list(regions);
+	size_t start = 0;
+	while (start < list.size()) {
+		size_t end = list.find(';', start);
+		if (end == std::string::npos) {
+			end = list.size();
+		}
+		std::string item = list.substr(start, end - start);
+		start = end + 1;
+		if (item.find_first_not_of(" ") == std::string::npos) {
+			continue;
+		}
+
+		size_t equals = item.find('=');
+		if (equals == std::string::npos) {
+			throw "VideoInputSource: regions is invalid";
+		}
+		CaptureRegion region;
+		size_t nameStart = item.find_first_not_of(" ");
+		size_t nameEnd = item.find_last_not_of(" ", equals - 1);
+		if (nameStart >= equals || nameEnd == std::string::npos) {
+			throw "VideoInputSource: regions is invalid";
+		}
+		region.name = item.substr(nameStart, nameEnd - nameStart + 1);
+		int consumed = 0;
+		if (sscanf(item.c_str() + equals + 1, " %d , %d , %d , %d %n", &region.x, &region.y, &region.width, &region.height, &consumed) != 4 || item[equals + 1 + consumed] != '\0') {
+			throw "VideoInputSource: regions is invalid";
+		}
+		if (region.x < 0 || region.y < 0 || region.width <= 0 || region.height <= 0 || region.x + region.width > width || region.y + region.height > height) {
+			throw "VideoInputSource: region is outside the frame";
+		}
+		for (size_t i = 0; i < parsed.size(); i++) {
+			if (parsed[i].name == region.name) {
+				throw "VideoInputSource: region name is used twice";
+			}
+		}
+		parsed.push_back(region);
+	}
+	return parsed;
 }
 
-const unsigned char* VideoInputSource::GetFrame() {
-	bool hasNewFrame = false;
-	while (true) {
-		hasNewFrame = mVideoInput.isFrameNew(mDeviceID);
-		if (hasNewFrame) {
-			bool success = mVideoInput.getPixels(mDeviceID, mBuffer, false, false);
-			if (!success) {
-				throw "VideoInputSource: cannot get frame";
+VideoInputSource::VideoInputSource(const VideoInputSourceParams& params)
+	: mBackend(NULL), mDeviceID(params.deviceID), mWidth(params.width), mHeight(params.height), mFpsNumerator(params.fpsNumerator), mFpsDenominator(params.fpsDenominator), mFrameSkip(params.frameSkip), mFieldOrder(FIELD_ORDER_NONE), mFieldPair(-1), mResizeFilter(RESIZE_NONE), mResizer(NULL), mStreaming(false), mCaptureError(NULL), mReadyPending(false), mLossless(0), mSpill(NULL), mSpillDropped(0), mReconnectTimeout(params.reconnectTimeout), mThreadStop(false), mOpenDone(false), mOpenError(NULL), mFrameNumber(0), mFrameTime(0.0), mTimeOrigin(-1.0), mFrameDuplicate(true), mFramesDropped(0), mFramesDelivered(0), mFramesDuplicated(0), mDeadlineMisses(0), mWaitTime(0.0), mLatencySum(0.0), mLatencyFrames(0), mReconnects(0), mSamplesReceivedBase(0), mSamplesDroppedBase(0), mSamplesReceived(0), mSamplesDropped(0), mConstructTime(0.0), mSetupTime(0.0), mStartupWait(0.0), mRateMeter(FRAME_RATE_WARMUP), mNegotiatedFps(0.0), mMeasuredFps(0.0), mDeviceMemory(0), mCaptureWidth(params.width), mCaptureHeight(params.height), mPacer(PACER_WAIT), mPacerReset(true), mClockRatio(0.0), mRealtime(params.realtime), mRealtimeClock(REALTIME_CATCHUP), mOutputFps(0.0), mRealtimeSlips(0), mAudioRing(NULL), mToneSource(NULL), mAudioNextStart(-1), mAudioNextIndex(0), mAudioLatency(0.0), mAudioDrift(0.0), mAudioSlips(0), mSharedNext(0), mSharedCapturing(false), mCaptureBytes(0), mRegionBytes(0), mFramesShared(0), mOpens(1) {
+	std::chrono::steady_clock::time_point constructStart = std::chrono::steady_clock::now();
+
+	double outputPeriod = (double)mFpsDenominator / (double)mFpsNumerator;
+	mPacer.Reset(outputPeriod, outputPeriod);
+	mRealtimeClock.Reset(outputPeriod);
+
+	CaptureParams capture;
+	capture.deviceID = params.deviceID;
+	// the synthetic device takes options of its own after a colon, which its backend reads
+	std::string connection(params.connectionType);
+	size_t colon = connection.find(':');
+	if (colon != std::string::npos) {
+		capture.syntheticOptions = connection.substr(colon + 1);
+		connection.erase(colon);
+		if (stricmp(connection.c_str(), "Synthetic") != 0) {
+			throw "VideoInputSource: connection type is invalid";
+		}
+	}
+	if (stricmp(connection.c_str(), "Composite") == 0) {
+		capture.connection = CONNECTION_COMPOSITE;
+	}
+	else if (stricmp(connection.c_str(), "S_Video") == 0) {
+		capture.connection = CONNECTION_S_VIDEO;
+	}
+	else if (stricmp(connection.c_str(), "Tuner") == 0) {
+		capture.connection = CONNECTION_TUNER;
+	}
+	else if (stricmp(connection.c_str(), "USB") == 0) {
+		capture.connection = CONNECTION_USB;
+	}
+	else if (stricmp(connection.c_str(), "Synthetic") == 0) {
+		capture.connection = CONNECTION_SYNTHETIC;
+	}
+	else {
+		throw "VideoInputSource: connection type is invalid";
+	}
+	capture.width = params.width;
+	capture.height = params.height;
+	capture.fpsNumerator = params.fpsNumerator;
+	capture.fpsDenominator = params.fpsDenominator;
+	capture.captureFormat = params.captureFormat;
+	capture.reconnectTimeout = params.reconnectTimeout;
+	if (params.queueDepth < 2) {
+		throw "VideoInputSource: queue depth is invalid";
+	}
+	capture.queueDepth = params.queueDepth;
+	if (params.waitSpin < 0 || params.waitTimeout < 0) {
+		throw "VideoInputSource: wait spin or timeout is invalid";
+	}
+	mWaitSpin = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::microseconds(params.waitSpin));
+	mWaitTimeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::milliseconds(params.waitTimeout));
+	// a percentage of the output frame period; waiting a whole period or more would fall behind the output
+	if (params.frameDeadline < 0 || params.frameDeadline >= 100) {
+		throw "VideoInputSource: frame deadline is invalid";
+	}
+	mFrameDeadline = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(outputPeriod * params.frameDeadline / 100.0));
+	if (params.lossless < 0) {
+		throw "VideoInputSource: lossless is invalid";
+	}
+	// frame_skip leaves samples out on purpose
+	if (params.lossless > 0 && params.frameSkip) {
+		throw "VideoInputSource: lossless cannot be combined with frame_skip";
+	}
+	mLossless = (size_t)params.lossless;
+	capture.lossless = params.lossless > 0;
+	if (stricmp(params.resize.c_str(), "none") == 0) {
+		mResizeFilter = RESIZE_NONE;
+	}
+	else if (stricmp(params.resize.c_str(), "bilinear") == 0) {
+		mResizeFilter = RESIZE_BILINEAR;
+	}
+	else if (stricmp(params.resize.c_str(), "bicubic") == 0) {
+		mResizeFilter = RESIZE_BICUBIC;
+	}
+	else if (stricmp(params.resize.c_str(), "area") == 0) {
+		mResizeFilter = RESIZE_AREA;
+	}
+	else {
+		throw "VideoInputSource: resize is invalid";
+	}
+	capture.resize = mResizeFilter != RESIZE_NONE;
+
+	if (stricmp(params.fields.c_str(), "none") == 0) {
+		mFieldOrder = FIELD_ORDER_NONE;
+	}
+	else if (stricmp(params.fields.c_str(), "tff") == 0) {
+		mFieldOrder = FIELD_ORDER_TOP_FIRST;
+	}
+	else if (stricmp(params.fields.c_str(), "bff") == 0) {
+		mFieldOrder = FIELD_ORDER_BOTTOM_FIRST;
+	}
+	else {
+		throw "VideoInputSource: fields is invalid";
+	}
+	if (mFieldOrder != FIELD_ORDER_NONE && params.height % 2 != 0) {
+		throw "VideoInputSource: height must be even to separate fields";
+	}
+	capture.fieldOrder = mFieldOrder;
+
+	mRegions = ParseRegions(params.regions.c_str(), params.width, params.height);
+	if (!mRegions.empty() && mFieldOrder != FIELD_ORDER_NONE) {
+		throw "VideoInputSource: regions cannot be combined with fields";
+	}
+
+	if (stricmp(params.audio.c_str(), "none") == 0) {
+		mAudioMode = AUDIO_NONE;
+	}
+	else if (stricmp(params.audio.c_str(), "device") == 0) {
+		mAudioMode = AUDIO_DEVICE;
+	}
+	else if (stricmp(params.audio.c_str(), "tone") == 0) {
+		mAudioMode = AUDIO_TONE;
+	}
+	else {
+		throw "VideoInputSource: audio is invalid";
+	}
+	if (mAudioMode != AUDIO_NONE) {
+		if (params.audioRate <= 0 || params.audioChannels <= 0) {
+			throw "VideoInputSource: audio rate or channels is invalid";
+		}
+	}
+
+	if (mAudioMode != AUDIO_NONE) {
+		mAudioRing = new AudioRing(params.audioRate, params.audioChannels, AUDIO_RING_SIZE);
+	}
+	capture.audioSink = (mAudioMode == AUDIO_DEVICE) ? mAudioRing : NULL;
+	capture.audioRate = params.audioRate;
+	capture.audioChannels = params.audioChannels;
+
+	// the destructor does not run when the constructor throws, so everything made from here on is released by hand
+	try {
+		mBackend = CreateCaptureBackend(capture);
+
+		// frames are BGR24 at the assigned size; a backend only delivers another size with resize, which is scaled to it
+		int mSize = 3 * mWidth * mHeight;
+		mSnapshotPool = std::make_shared<SnapshotPool>(sizeof(unsigned char) * mSize);
+		if (mAudioMode == AUDIO_TONE) {
+			mToneSource = new ToneSource(mAudioRing, params.audioRate, params.audioChannels, TONE_FREQUENCY);
+		}
+
+		// building the graph takes seconds, so it is left to the device thread and the first GetFrame waits for it
+		mDeviceThread = std::thread(&VideoInputSource::DeviceThread, this);
+	}
+	catch (...) {
+		delete mToneSource;
+		delete mBackend;
+		delete mAudioRing;
+		throw;
+	}
+
+#ifdef _WIN32
+	// sleeps end on the system timer tick, 15.6 ms unless raised; raised only once nothing can throw,
+	// since the destructor restoring it does not run for a constructor that throws
+	if (mRealtime) {
+		timeBeginPeriod(1);
+	}
+#endif
+
+	mConstructTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - constructStart).count();
+}
+
+std::shared_ptr<VideoInputSource> VideoInputSource::Create(const VideoInputSourceParams& params) {
+	// a clip asking for a source another clip is constructing waits for it, so clips created at once still
+	// end up sharing; sources for other devices or modes are constructed meanwhile
+	std::unique_lock<std::mutex> lock(sourceRegistryLock);
+	bool waiting = true;
+	while (waiting) {
+		waiting = false;
+		for (size_t i = sourceRegistry.size(); i > 0; i--) {
+			if (sourceRegistry[i - 1].params == params) {
+				if (sourceRegistry[i - 1].pending) {
+					waiting = true;
+					break;
+				}
+				std::shared_ptr<VideoInputSource> source = sourceRegistry[i - 1].source.lock();
+				if (source) {
+					source->mOpens++;
+					return source;
+				}
+			}
+		}
+		if (waiting) {
+			sourceRegistrySignal.wait(lock);
+		}
+	}
+
+	SourceEntry entry;
+	entry.params = params;
+	entry.pending = true;
+	sourceRegistry.push_back(entry);
+	lock.unlock();
+
+	std::shared_ptr<VideoInputSource> source;
+	try {
+		source.reset(new VideoInputSource(params));
+	}
+	catch (...) {
+		// clips waiting for it try to construct it themselves, and fail the same way
+		lock.lock();
+		for (size_t i = sourceRegistry.size(); i > 0; i--) {
+			if (sourceRegistry[i - 1].pending && sourceRegistry[i - 1].params == params) {
+				sourceRegistry.erase(sourceRegistry.begin() + (i - 1));
+				break;
 			}
 		}
-		if (mFrameSkip || hasNewFrame) {
+		sourceRegistrySignal.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	for (size_t i = sourceRegistry.size(); i > 0; i--) {
+		if (sourceRegistry[i - 1].pending && sourceRegistry[i - 1].params == params) {
+			sourceRegistry[i - 1].source = source;
+			sourceRegistry[i - 1].pending = false;
 			break;
 		}
-		Sleep(0);
 	}
+	sourceRegistrySignal.notify_all();
+	return source;
+}
 
-	return mBuffer;
+VideoInputSource::~VideoInputSource() {
+	{
+		// the entry of this source has expired already; entries of other sources still open or being constructed are kept
+		std::lock_guard<std::mutex> lock(sourceRegistryLock);
+		for (size_t i = sourceRegistry.size(); i > 0; i--) {
+			if (!sourceRegistry[i - 1].pending && sourceRegistry[i - 1].source.expired()) {
+				sourceRegistry.erase(sourceRegistry.begin() + (i - 1));
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mThreadLock);
+		mThreadStop = true;
+	}
+	mThreadSignal.notify_all();
+	mDeviceThread.join();
+	FrameScheduler::GetInstance().Unwatch(this);
+
+	delete mToneSource;
+	delete mBackend;
+	delete mAudioRing;
+	delete mSpill;
+	delete mResizer;
+
+#ifdef _WIN32
+	if (mRealtime) {
+		timeEndPeriod(1);
+	}
+#endif
+}
+
+// sets up the device with the requested mode, returns an error message on failure
+const char* VideoInputSource::OpenDevice() {
+	const char* error = mBackend->Open();
+	int captureWidth = mWidth;
+	int captureHeight = mHeight;
+	if (error == NULL) {
+		// with resize the device may have settled on the closest size it offers, possibly another one than last time
+		captureWidth = mBackend->GetCaptureWidth();
+		captureHeight = mBackend->GetCaptureHeight();
+		bool scaled = (captureWidth != mWidth || captureHeight != mHeight);
+		if (mResizer != NULL && (!scaled || mResizer->GetSrcWidth() != captureWidth || mResizer->GetSrcHeight() != captureHeight)) {
+			delete mResizer;
+			mResizer = NULL;
+		}
+		if (scaled && mResizer == NULL) {
+			mResizer = new FrameResizer(captureWidth, captureHeight, mWidth, mHeight, mResizeFilter, mFieldOrder != FIELD_ORDER_NONE);
+		}
+		mCapturePixels.resize(scaled ? sizeof(unsigned char) * 3 * captureWidth * captureHeight : 0);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mStatsLock);
+		mCaptureMode = mBackend->GetCaptureModeReport();
+		mNegotiatedFps = mBackend->GetNegotiatedFramerate();
+		mMeasuredFps = 0.0;
+		mDeviceMemory = mBackend->GetBufferMemory() + mCapturePixels.size();
+		mCaptureWidth = captureWidth;
+		mCaptureHeight = captureHeight;
+	}
+	mRateMeter.Reset();
+	mPacerReset = true;
+	return error;
+}
+
+// blocks until the device thread has finished opening the device, throws when that failed
+void VideoInputSource::WaitForDevice() {
+	if (!mOpenDone) {
+		std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(mThreadLock);
+		mThreadSignal.wait(lock, [this] { return (bool)mOpenDone; });
+		mStartupWait = std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+	}
+	if (mOpenError != NULL) {
+		throw mOpenError;
+	}
+}
+
+// opens the device, then rebuilds the graph whenever the device stops delivering samples,
+// so neither script loading nor GetFrame ever blocks on graph building
+void VideoInputSource::DeviceThread() {
+#ifdef _WIN32
+	// every device thread joins the multithreaded apartment on its own, so graphs of several devices are built
+	// at the same time whatever apartment the thread that created the source is in
+	HRESULT comResult = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+#endif
+
+	std::chrono::steady_clock::time_point setupStart = std::chrono::steady_clock::now();
+	const char* error;
+	{
+		std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+		error = OpenDevice();
+	}
+	// streaming before the open counts as done, so the first frame waits for a sample
+	if (error == NULL) {
+		error = SetStreaming(true);
+	}
+
+	std::unique_lock<std::mutex> lock(mThreadLock);
+	mSetupTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - setupStart).count();
+	mOpenError = error;
+	mOpenDone = true;
+	mThreadSignal.notify_all();
+
+	while (error == NULL && mReconnectTimeout > 0 && !mThreadStop) {
+		mThreadSignal.wait_for(lock, std::chrono::milliseconds(WATCHDOG_INTERVAL));
+		if (mThreadStop) {
+			break;
+		}
+		lock.unlock();
+
+		bool reopen, notify;
+		{
+			std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+			// a device that failed to reopen last time is retried as well
+			reopen = !mBackend->IsOpen() || mBackend->IsFrozen();
+			// looking for a freeze may have taken in a sample the scheduler is not told about
+			notify = !reopen && mBackend->IsFrameNew();
+		}
+		if (notify) {
+			FrameScheduler::GetInstance().Notify(this);
+		}
+		if (reopen) {
+			SetStreaming(false);
+			const char* reopenError;
+			{
+				std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+				if (mBackend->IsOpen()) {
+					mSamplesReceivedBase += mBackend->GetSampleCount();
+					mSamplesDroppedBase += mBackend->GetDroppedSampleCount();
+					mBackend->Close();
+				}
+				mReconnects++;
+				reopenError = OpenDevice();
+			}
+			// a device the scheduler cannot take is left closed and retried on the next round
+			if (reopenError == NULL) {
+				SetStreaming(true);
+			}
+		}
+
+		lock.lock();
+	}
+	lock.unlock();
+
+#ifdef _WIN32
+	if (SUCCEEDED(comResult)) {
+		CoUninitialize();
+	}
+#endif
+}
+
+const char* VideoInputSource::SetStreaming(const bool streaming) {
+	if (streaming) {
+		CaptureEvent event;
+		{
+			std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+			event = mBackend->GetFrameEvent();
+		}
+		const char* error = FrameScheduler::GetInstance().Watch(this, event);
+		if (error != NULL) {
+			std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+			mBackend->Close();
+			return error;
+		}
+	}
+	else {
+		FrameScheduler::GetInstance().Unwatch(this);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mReadyLock);
+		mStreaming = streaming;
+	}
+	mReadySignal.notify_all();
+	return NULL;
+}
+
+void VideoInputSource::OnFrameReady() {
+	std::shared_ptr<FrameSnapshot> snapshot;
+	const char* error = NULL;
+	try {
+		std::lock_guard<std::mutex> deviceLock(mDeviceLock);
+		if (!mBackend->IsOpen() || !mBackend->IsFrameNew()) {
+			return;
+		}
+		snapshot = NewSnapshot(mSnapshotPool);
+		unsigned char* pixels = (mResizer != NULL) ? &mCapturePixels[0] : snapshot->pixels;
+		if (!mBackend->GetPixels(pixels)) {
+			throw "VideoInputSource: cannot get frame";
+		}
+		// a sample of another size is scaled straight into the frame
+		if (mResizer != NULL) {
+			mResizer->Resize(pixels, snapshot->pixels);
+		}
+		mCaptureBytes += sizeof(unsigned char) * 3 * mWidth * mHeight;
+		snapshot->number = mSamplesReceivedBase + mBackend->GetFrameNumber();
+		snapshot->time = mBackend->GetFrameTime();
+		// GetStats only tries the lock this is held for, so the counters are kept up to date here as well
+		mSamplesReceived = mSamplesReceivedBase + mBackend->GetSampleCount();
+		mSamplesDropped = mSamplesDroppedBase + mBackend->GetDroppedSampleCount();
+
+		if (!mRateMeter.IsDone()) {
+			mRateMeter.AddSample(snapshot->number, snapshot->time);
+			std::lock_guard<std::mutex> lock(mStatsLock);
+			mMeasuredFps = mRateMeter.GetRate();
+		}
+	}
+	catch (const char* e) {
+		// thrown on to the next caller taking a frame
+		error = e;
+		snapshot.reset();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mReadyLock);
+		// a sample nobody took is replaced by the newer one, like a device overwrites its grabber buffer;
+		// lossless mode queues it instead, spilling what does not fit in memory to disk
+		if (error != NULL) {
+			mCaptureError = error;
+		}
+		else if (mLossless > 0) {
+			if (mQueue.size() < mLossless && (mSpill == NULL || mSpill->GetCount() == 0)) {
+				mQueue.push_back(snapshot);
+			}
+			else {
+				try {
+					if (mSpill == NULL) {
+						mSpill = new FrameSpill(sizeof(unsigned char) * 3 * mWidth * mHeight, LOSSLESS_SPILL_LIMIT);
+					}
+					if (!mSpill->Write(snapshot->pixels, snapshot->number, snapshot->time)) {
+						mSpillDropped++;
+					}
+				}
+				catch (const char* e) {
+					mCaptureError = e;
+				}
+			}
+		}
+		else {
+			mReady = snapshot;
+		}
+		mReadyPending = true;
+	}
+	mReadySignal.notify_all();
+}
+
+std::shared_ptr<FrameSnapshot> VideoInputSource::TakeReady() {
+	mReadyPending = false;
+	if (mCaptureError != NULL) {
+		const char* error = mCaptureError;
+		mCaptureError = NULL;
+		throw error;
+	}
+	std::shared_ptr<FrameSnapshot> snapshot;
+	if (mLossless > 0) {
+		if (!mQueue.empty()) {
+			// the oldest spilled sample moves up, so the queue in memory always holds the oldest ones
+			if (mSpill != NULL && mSpill->GetCount() > 0) {
+				std::shared_ptr<FrameSnapshot> spilled = NewSnapshot(mSnapshotPool);
+				mSpill->Read(spilled->pixels, spilled->number, spilled->time);
+				mQueue.push_back(spilled);
+			}
+			snapshot = mQueue.front();
+			mQueue.pop_front();
+		}
+		mReadyPending = !mQueue.empty();
+	}
+	else {
+		snapshot.swap(mReady);
+	}
+	if (snapshot) {
+		mLatencySum += GetCaptureTime() - snapshot->time;
+		mLatencyFrames++;
+		// the clip timeline starts at the first frame taken
+		if (mTimeOrigin < 0.0) {
+			mTimeOrigin = snapshot->time;
+		}
+		snapshot->time -= mTimeOrigin;
+	}
+	return snapshot;
+}
+
+std::shared_ptr<FrameSnapshot> VideoInputSource::NewBlackSnapshot() {
+	std::shared_ptr<FrameSnapshot> black = NewSnapshot(mSnapshotPool);
+	memset(black->pixels, 0, sizeof(unsigned char) * 3 * mWidth * mHeight);
+	return black;
+}
+
+void VideoInputSource::WaitReady(std::unique_lock<std::mutex>& lock, const std::chrono::steady_clock::time_point waitStart, const std::chrono::steady_clock::time_point deadline) {
+	if (mReady || !mQueue.empty() || !mStreaming || mCaptureError != NULL) {
+		return;
+	}
+
+	// a sample due within the spin is picked up as soon as it is published, without the wake-up of a sleeping
+	// thread; yielding leaves the core to the worker converting it
+	std::chrono::steady_clock::time_point spinEnd = (mWaitSpin < deadline - waitStart) ? waitStart + mWaitSpin : deadline;
+	if (mWaitSpin.count() > 0) {
+		lock.unlock();
+		while (!mReadyPending && mStreaming && std::chrono::steady_clock::now() < spinEnd) {
+			std::this_thread::yield();
+		}
+		lock.lock();
+	}
+
+	// a longer wait sleeps until the scheduler publishes a sample, so a waiting source costs no CPU
+	auto published = [this] { return mReady || !mQueue.empty() || !mStreaming || mCaptureError != NULL; };
+	if (deadline == std::chrono::steady_clock::time_point::max()) {
+		mReadySignal.wait(lock, published);
+	}
+	else {
+		mReadySignal.wait_until(lock, deadline, published);
+	}
+}
+
+const unsigned char* VideoInputSource::GetFrame() {
+	TakeFrame();
+	return mFrame->pixels;
+}
+
+const unsigned char* VideoInputSource::TryGetFrame() {
+	WaitForDevice();
+
+	std::shared_ptr<FrameSnapshot> frame;
+	{
+		std::lock_guard<std::mutex> lock(mReadyLock);
+		frame = TakeReady();
+	}
+	if (!frame) {
+		return NULL;
+	}
+
+	mFramesDelivered++;
+	ShowFrame(frame);
+	return mFrame->pixels;
+}
+
+void VideoInputSource::ShowFrame(const std::shared_ptr<FrameSnapshot>& frame) {
+	// sample numbers count every sample the device delivered, so a gap is what got skipped
+	mFramesDropped = (mFrameNumber == 0 || frame->number <= mFrameNumber) ? 0 : (int)(frame->number - mFrameNumber - 1);
+	mFrameNumber = frame->number;
+	mFrameTime = frame->time;
+	mFrameDuplicate = false;
+	mFrame = frame;
+
+	mPacer.OnSample(frame->number, frame->time + mTimeOrigin);
+	mClockRatio = mPacer.GetRatio();
+}
+
+void VideoInputSource::PaceFrame() {
+	if (!mRealtime) {
+		return;
+	}
+	mRealtimeClock.WaitTick();
+	mOutputFps = mRealtimeClock.GetRate();
+	mRealtimeSlips = mRealtimeClock.GetSlips();
+}
+
+bool VideoInputSource::TakeFrame() {
+	WaitForDevice();
+	PaceFrame();
+
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+
+	if (mPacerReset.exchange(false)) {
+		std::lock_guard<std::mutex> lock(mStatsLock);
+		double deviceFps = (mNegotiatedFps > 0.0) ? mNegotiatedFps : (double)mFpsNumerator / (double)mFpsDenominator;
+		mPacer.ResetDevice(1.0 / deviceFps);
+	}
+
+	// with frame_skip the pacer decides whether this frame shows a new sample, and a planned sample
+	// that is just late is waited for briefly rather than duplicating now and dropping one later.
+	// In deadline mode every frame asks for one and waits up to mFrameDeadline for it.
+	bool takeNewFrame = true;
+	bool deadlineMode = mFrameSkip && mFrameDeadline.count() > 0;
+	std::chrono::steady_clock::time_point deadline = (mWaitTimeout.count() > 0) ? waitStart + mWaitTimeout : std::chrono::steady_clock::time_point::max();
+	if (deadlineMode) {
+		std::chrono::steady_clock::time_point planned = waitStart + mFrameDeadline;
+		deadline = (planned < deadline) ? planned : deadline;
+	}
+	else if (mFrameSkip) {
+		takeNewFrame = mPacer.PlanFrame(GetCaptureTime());
+		std::chrono::steady_clock::time_point planned = waitStart;
+		if (takeNewFrame && mPacer.IsLocked()) {
+			planned += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(mPacer.GetOutputPeriod() * PACER_WAIT_LIMIT));
+		}
+		deadline = (planned < deadline) ? planned : deadline;
+	}
+
+	// while the watchdog is reconnecting, the last good frame is served instead of waiting
+	std::shared_ptr<FrameSnapshot> frame;
+	{
+		std::unique_lock<std::mutex> lock(mReadyLock);
+		if (takeNewFrame) {
+			WaitReady(lock, waitStart, deadline);
+		}
+		frame = takeNewFrame ? TakeReady() : NULL;
+	}
+	bool hasNewFrame = (bool)frame;
+
+	{
+		std::lock_guard<std::mutex> lock(mStatsLock);
+		mWaitTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+	}
+
+	mFramesDelivered++;
+	if (hasNewFrame) {
+		ShowFrame(frame);
+	}
+	else {
+		// until the first sample arrives, a black frame stands in
+		if (!mFrame) {
+			mFrame = NewBlackSnapshot();
+		}
+		mFramesDropped = 0;
+		mFrameDuplicate = true;
+		mFramesDuplicated++;
+		if (deadlineMode) {
+			mDeadlineMisses++;
+		}
+	}
+
+	return hasNewFrame;
 }
 
 int VideoInputSource::GetWidth() {
@@ -110,3 +1086,317 @@ int VideoInputSource::GetWidth() {
 int VideoInputSource::GetHeight() {
 	return mHeight;
 }
+
+unsigned int VideoInputSource::GetFpsNumerator() {
+	return mFpsNumerator;
+}
+
+unsigned int VideoInputSource::GetFpsDenominator() {
+	return mFpsDenominator;
+}
+
+bool VideoInputSource::HasFields() {
+	return mFieldOrder != FIELD_ORDER_NONE;
+}
+
+bool VideoInputSource::IsTopField(const int n) {
+	return (n % 2 == 0) == (mFieldOrder == FIELD_ORDER_TOP_FIRST);
+}
+
+const unsigned char* VideoInputSource::GetField(const int n, ptrdiff_t& pitch) {
+	if (n / 2 != mFieldPair) {
+		TakeFrame();
+		mFieldPair = n / 2;
+	}
+	return GetFieldRows(mFrame->pixels, n, pitch);
+}
+
+const unsigned char* VideoInputSource::GetFieldRows(const unsigned char* frame, const int n, ptrdiff_t& pitch) {
+	// the frame is bottom-up with an even height, so the top field is on the odd rows counted from its start
+	ptrdiff_t rowSize = (ptrdiff_t)mWidth * 3;
+	pitch = rowSize * 2;
+	return IsTopField(n) ? frame + rowSize : frame;
+}
+
+unsigned long VideoInputSource::GetFrameNumber() {
+	return mFrameNumber;
+}
+
+double VideoInputSource::GetFrameTime() {
+	return mFrameTime;
+}
+
+bool VideoInputSource::IsFrameDuplicate() {
+	return mFrameDuplicate;
+}
+
+int VideoInputSource::GetFramesDropped() {
+	return mFramesDropped;
+}
+
+void VideoInputSource::Release() {
+	mOpens--;
+}
+
+int VideoInputSource::OpenSharedClip() {
+	std::lock_guard<std::mutex> lock(mSharedLock);
+	return mSharedNext;
+}
+
+std::shared_ptr<const FrameSnapshot> VideoInputSource::GetSharedFrame(int& base, const int n, bool& duplicate, int& dropped) {
+	std::unique_lock<std::mutex> lock(mSharedLock);
+	int key;
+	while (true) {
+		// both fields of a pair show the same capture
+		key = base + (HasFields() ? n / 2 : n);
+
+		// nothing is kept for a frame older than the history, so the clip moves on to the live frame
+		if (key < mSharedNext && (mSharedFrames.empty() || key < mSharedFrames.front().n)) {
+			base += mSharedNext - key;
+			key = mSharedNext;
+		}
+
+		// a frame captured already is served from the history. Frames a clip jumped over were never
+		// captured, the one shown before them stands in as a duplicate
+		if (key < mSharedNext) {
+			const SharedFrame* shared = &mSharedFrames.front();
+			for (size_t i = 1; i < mSharedFrames.size() && mSharedFrames[i].n <= key; i++) {
+				shared = &mSharedFrames[i];
+			}
+			mFramesShared++;
+			duplicate = (shared->n == key) ? shared->duplicate : true;
+			dropped = (shared->n == key) ? shared->dropped : 0;
+			return shared->snapshot;
+		}
+		if (!mSharedCapturing) {
+			break;
+		}
+		// another clip is capturing, maybe this very frame
+		mSharedSignal.wait(lock);
+	}
+
+	// requests of a parallel filter come out of order, so output frames a little before n that nobody asked for
+	// yet are captured first, in turn: samples then follow the frame numbers, and one that is asked for later
+	// finds its own. A clip jumping further ahead captures n alone.
+	int next = (key - mSharedNext < (int)SHARED_FRAME_HISTORY) ? mSharedNext : key;
+	// the history is left open while waiting for the device, so clips behind keep reading it meanwhile
+	mSharedCapturing = true;
+	SharedFrame shared;
+	do {
+		lock.unlock();
+
+		// the snapshot the sample was converted into is the one every clip reads; a duplicate reuses the previous
+		try {
+			TakeFrame();
+		}
+		catch (...) {
+			lock.lock();
+			mSharedCapturing = false;
+			mSharedSignal.notify_all();
+			throw;
+		}
+
+		lock.lock();
+		shared.n = next;
+		shared.snapshot = mFrame;
+		shared.duplicate = mFrameDuplicate;
+		shared.dropped = mFramesDropped;
+
+		mSharedFrames.push_back(shared);
+		mSharedNext = next + 1;
+		if (mSharedFrames.size() > SHARED_FRAME_HISTORY) {
+			mSharedFrames.pop_front();
+		}
+		mSharedSignal.notify_all();
+	} while (++next <= key);
+	mSharedCapturing = false;
+	mSharedSignal.notify_all();
+
+	duplicate = shared.duplicate;
+	dropped = shared.dropped;
+	return shared.snapshot;
+}
+
+int VideoInputSource::FindRegion(const char* name) {
+	for (size_t i = 0; i < mRegions.size(); i++) {
+		if (mRegions[i].name == name) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+const CaptureRegion& VideoInputSource::GetRegion(const int index) {
+	return mRegions[index];
+}
+
+const unsigned char* VideoInputSource::GetRegionRows(const unsigned char* frame, const int index, ptrdiff_t& pitch) {
+	// the frame is bottom-up, so the bottom row of the region comes first
+	const CaptureRegion& region = mRegions[index];
+	pitch = (ptrdiff_t)mWidth * 3;
+	mRegionBytes += sizeof(unsigned char) * 3 * region.width * region.height;
+	return frame + (ptrdiff_t)(mHeight - region.y - region.height) * pitch + (ptrdiff_t)region.x * 3;
+}
+
+bool VideoInputSource::HasAudio() {
+	return mAudioRing != NULL;
+}
+
+int VideoInputSource::GetAudioRate() {
+	return (mAudioRing != NULL) ? mAudioRing->GetRate() : 0;
+}
+
+int VideoInputSource::GetAudioChannels() {
+	return (mAudioRing != NULL) ? mAudioRing->GetChannels() : 0;
+}
+
+// audio frame n of the clip is what was captured n / rate seconds after the first video frame,
+// so audio stays locked to video without any resampling
+void VideoInputSource::GetAudio(short* buf, const __int64 start, const __int64 count) {
+	if (mAudioRing == NULL) {
+		return;
+	}
+	int rate = mAudioRing->GetRate();
+	int channels = mAudioRing->GetChannels();
+
+	double origin = mTimeOrigin;
+	__int64 mapped;
+	if (origin < 0.0 || !mAudioRing->IndexAt(origin + (double)start / rate, mapped)) {
+		memset(buf, 0, sizeof(short) * (size_t)count * channels);
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mAudioLock);
+
+	// contiguous requests read on from where the last one stopped, so jitter in the clock mapping
+	// never cuts samples out or in; only a larger drift slips the reading position back onto the clock
+	__int64 index = mapped;
+	if (start == mAudioNextStart) {
+		__int64 drift = mAudioNextIndex - mapped;
+		if (drift <= (__int64)(AUDIO_SLIP * rate) && drift >= -(__int64)(AUDIO_SLIP * rate)) {
+			index = mAudioNextIndex;
+		}
+		else {
+			mAudioSlips++;
+		}
+	}
+	mAudioDrift = (double)(index - mapped) / rate;
+	mAudioLatency = GetCaptureTime() - (origin + (double)start / rate);
+
+	// a request ahead of the capture waits for it, but never much longer than the capture takes
+	double deadline = GetCaptureTime() + (double)count / rate + AUDIO_WAIT;
+	while (mAudioRing->GetWritten() < index + count && GetCaptureTime() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	for (__int64 done = 0; done < count; ) {
+		int length = (int)((count - done < rate) ? count - done : rate);
+		mAudioRing->Read(index + done, buf + done * channels, length);
+		done += length;
+	}
+
+	mAudioNextStart = start + count;
+	mAudioNextIndex = index + count;
+}
+
+VideoInputSourceStats VideoInputSource::GetStats() {
+	{
+		// during a reconnect the counters read last time are reported
+		std::unique_lock<std::mutex> deviceLock(mDeviceLock, std::try_to_lock);
+		if (deviceLock.owns_lock()) {
+			mSamplesReceived = mSamplesReceivedBase + mBackend->GetSampleCount();
+			mSamplesDropped = mSamplesDroppedBase + mBackend->GetDroppedSampleCount();
+		}
+	}
+
+	VideoInputSourceStats stats;
+	stats.samplesReceived = mSamplesReceived;
+	stats.samplesDropped = mSamplesDropped + mSpillDropped;
+	stats.framesDelivered = mFramesDelivered;
+	stats.framesDuplicated = mFramesDuplicated;
+	stats.deadlineMisses = mDeadlineMisses;
+	{
+		std::lock_guard<std::mutex> lock(mReadyLock);
+		stats.frameLatency = (mLatencyFrames > 0) ? mLatencySum / mLatencyFrames : 0.0;
+		stats.spilledFrames = (mSpill != NULL) ? (int)mSpill->GetCount() : 0;
+		stats.queuedFrames = (int)mQueue.size() + stats.spilledFrames;
+		stats.spillBytes = (mSpill != NULL) ? mSpill->GetBytesWritten() : 0.0;
+	}
+	stats.reconnects = mReconnects;
+	stats.constructTime = mConstructTime;
+	stats.setupTime = mSetupTime;
+	stats.startupWait = mStartupWait;
+	{
+		std::lock_guard<std::mutex> lock(mStatsLock);
+		stats.waitTime = mWaitTime;
+		stats.captureMode = mCaptureMode;
+		stats.negotiatedFps = mNegotiatedFps;
+		stats.measuredFps = mMeasuredFps;
+		stats.frameMemory = (double)mDeviceMemory;
+		stats.captureWidth = mCaptureWidth;
+		stats.captureHeight = mCaptureHeight;
+	}
+	stats.clockRatio = mClockRatio;
+	stats.outputFps = mOutputFps;
+	stats.realtimeSlips = mRealtimeSlips;
+	stats.audioFrames = (mAudioRing != NULL) ? (unsigned long)mAudioRing->GetWritten() : 0;
+	{
+		std::lock_guard<std::mutex> lock(mAudioLock);
+		stats.audioLatency = mAudioLatency;
+		stats.audioDrift = mAudioDrift;
+		stats.audioSlips = mAudioSlips;
+	}
+	stats.copyRate = GetFrameCopyRate();
+	stats.captureBytes = (double)mCaptureBytes;
+	stats.regionBytes = (double)mRegionBytes;
+	stats.framesShared = mFramesShared;
+	stats.opens = mOpens;
+	stats.frameMemory += (double)mSnapshotPool->GetMemory();
+	return stats;
+}
+
+std::shared_ptr<VideoInputSource> VideoInputSource::FindByDeviceID(const int device_id) {
+	// the source opened last on the device
+	std::lock_guard<std::mutex> lock(sourceRegistryLock);
+	for (size_t i = sourceRegistry.size(); i > 0; i--) {
+		if (sourceRegistry[i - 1].params.deviceID == device_id && !sourceRegistry[i - 1].source.expired()) {
+			return sourceRegistry[i - 1].source.lock();
+		}
+	}
+	return std::shared_ptr<VideoInputSource>();
+}
+
+bool VideoInputSource::GetStatsByDeviceID(const int device_id, VideoInputSourceStats& stats) {
+	std::shared_ptr<VideoInputSource> source = FindByDeviceID(device_id);
+	if (!source) {
+		return false;
+	}
+	stats = source->GetStats();
+	return true;
+}
+
+bool VideoInputSource::WaitForDevices(const std::vector<int>& device_ids, std::vector<DeviceOpenResult>& results) {
+	// sources are held while waiting, so a clip freed meanwhile cannot take its source away
+	std::vector<std::shared_ptr<VideoInputSource> > sources;
+	for (size_t i = 0; i < device_ids.size(); i++) {
+		std::shared_ptr<VideoInputSource> source = FindByDeviceID(device_ids[i]);
+		if (!source) {
+			return false;
+		}
+		sources.push_back(source);
+	}
+
+	results.clear();
+	for (size_t i = 0; i < sources.size(); i++) {
+		VideoInputSource* source = sources[i].get();
+		std::unique_lock<std::mutex> lock(source->mThreadLock);
+		source->mThreadSignal.wait(lock, [source] { return (bool)source->mOpenDone; });
+
+		DeviceOpenResult result;
+		result.deviceID = device_ids[i];
+		result.setupTime = source->mSetupTime;
+		result.error = source->mOpenError;
+		results.push_back(result);
+	}
+	return true;
+}
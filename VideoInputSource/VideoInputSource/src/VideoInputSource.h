@@ -20,7 +20,118 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
-#include "videoInput/videoInput.h"
+#include "CaptureBackend.h"
+#include "AudioCapture.h"
+#include "FrameScheduler.h"
+#include "FrameResize.h"
+#include "FrameSpill.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+struct VideoInputSourceStats {
+	unsigned long samplesReceived;
+	unsigned long samplesDropped;
+	unsigned long framesDelivered;
+	unsigned long framesDuplicated;
+	unsigned long deadlineMisses;
+	double waitTime;
+	double frameLatency;
+	int reconnects;
+	double constructTime;
+	double setupTime;
+	double startupWait;
+	std::string captureMode;
+	double negotiatedFps;
+	double measuredFps;
+	double clockRatio;
+	double outputFps;
+	int realtimeSlips;
+	unsigned long audioFrames;
+	double audioLatency;
+	double audioDrift;
+	int audioSlips;
+	double copyRate;
+	double captureBytes;
+	double regionBytes;
+	unsigned long framesShared;
+	int opens;
+	double frameMemory;
+	int queuedFrames;
+	int spilledFrames;
+	double spillBytes;
+	int captureWidth;
+	int captureHeight;
+};
+
+
+
+// the arguments of a VideoInputSource call, defaulting to what the filters default to. Names are compared
+// regardless of case, so two clips asking for the same capture compare equal and share it.
+struct VideoInputSourceParams {
+	int deviceID;
+	std::string connectionType;
+	int width, height;
+	unsigned int fpsNumerator, fpsDenominator;
+	bool frameSkip;
+	int reconnectTimeout;
+	std::string captureFormat;
+	std::string audio;
+	int audioRate, audioChannels;
+	int queueDepth;
+	int waitSpin, waitTimeout;
+	int frameDeadline;
+	bool realtime;
+	int lossless;
+	std::string resize;
+	std::string fields;
+	std::string regions;
+
+	VideoInputSourceParams();
+	bool operator==(const VideoInputSourceParams& other) const;
+	bool operator!=(const VideoInputSourceParams& other) const;
+};
+
+
+
+// how opening the device of one source went, as reported by WaitForDevices
+struct DeviceOpenResult {
+	int deviceID;
+	// seconds the device thread spent opening the device
+	double setupTime;
+	// NULL when the device is streaming
+	const char* error;
+};
+
+
+
+// a frame handed out by GetSharedFrame, never changed once published.
+// Its pixels, in the layout GetFrame returns, go back to a pool when the last holder lets go.
+struct FrameSnapshot {
+	unsigned char* pixels;
+	unsigned long number;
+	double time;
+};
+
+class SnapshotPool;
+
+
+
+// a named rectangle of the captured frame, served as a clip of its own; x and y count from the top left
+struct CaptureRegion {
+	std::string name;
+	int x, y;
+	int width, height;
+};
 
 
 
@@ -28,19 +139,349 @@ int calculateDefaultNumFrames(const unsigned int fps_numerator, const unsigned i
 
 
 
-class VideoInputSource {
+// measures the rate a device really delivers at during a warm-up window
+// sample numbers are used instead of counting calls, so samples skipped by the consumer still count
+class FrameRateMeter {
 private:
-	videoInput mVideoInput;
+	double mWindow;
+	bool mStarted;
+	bool mDone;
+	unsigned long mFirstNumber, mLastNumber;
+	double mFirstTime, mLastTime;
+
+public:
+	FrameRateMeter(const double window);
+
+	void Reset();
+	// returns true when this sample completes the window; later samples are ignored
+	bool AddSample(const unsigned long number, const double time);
+	bool IsDone();
+	// samples per second seen so far, 0 until two samples with distinct times have arrived
+	double GetRate();
+};
+
+
+
+// tracks the period of a clock from jittery tick times with a second order loop, like a software PLL
+class ClockEstimator {
+private:
+	double mNominalPeriod;
+	double mPeriod;
+	double mPhase;
+	int mTicks;
+
+public:
+	ClockEstimator();
+
+	void Reset(const double nominalPeriod);
+	// ticks is how many periods passed since the previous update, so skipped samples keep the phase
+	void Update(const double time, const unsigned long ticks);
+	bool IsLocked();
+	double GetPeriod();
+	// filtered time of the latest tick
+	double GetPhase();
+};
+
+
+
+// plans which output frames show a new sample, so that duplicates and drops caused by clock drift
+// are spread evenly instead of coming in bursts. Like a resampler, output frames are mapped onto
+// the device timeline with both recovered clocks, so jitter no longer decides what is shown.
+class FramePacer {
+private:
+	ClockEstimator mDeviceClock;
+	ClockEstimator mOutputClock;
+	unsigned long mLastSample;
+	double mWait;
+
+public:
+	// wait is the part of an output period a planned sample may be late
+	FramePacer(const double wait);
+
+	void Reset(const double devicePeriod, const double outputPeriod);
+	void ResetDevice(const double devicePeriod);
+
+	// a new sample was taken from the device
+	void OnSample(const unsigned long number, const double time);
+	// called once per output frame, returns true when it should show a new sample
+	bool PlanFrame(const double time);
+
+	bool IsLocked();
+	// device samples per output frame, 0 until both clocks are locked
+	double GetRatio();
+	double GetOutputPeriod();
+};
+
+
+
+// holds frame requests to a fixed frame rate, so a consumer faster than real time does not spin on repeated
+// frames. A request behind schedule returns at once, so up to catchUp frames lost to a stall are made up for;
+// further behind, the schedule starts over from that request instead of bursting through the backlog.
+class RealtimeClock {
+private:
+	int mCatchUp;
+	double mPeriod;
+	std::chrono::steady_clock::time_point mOrigin;
+	unsigned long mTicks;
+	unsigned long mFrames;
+	std::chrono::steady_clock::time_point mFirst, mLast;
+	int mSlips;
+
+public:
+	RealtimeClock(const int catchUp);
+
+	void Reset(const double period);
+	// sleeps until the next frame is due
+	void WaitTick();
+	// frames per second let through since the first, 0 until the second
+	double GetRate();
+	// how many times the schedule started over after a stall
+	int GetSlips();
+};
+
+
+
+// samples are converted as they arrive by the workers of FrameScheduler, which waits on the devices of all
+// sources at once; GetFrame and the other ways to take a frame only wait for a converted one to be published
+class VideoInputSource : public FrameListener {
+private:
+	CaptureBackend* mBackend;
 	int mDeviceID;
 	int mWidth, mHeight;
-	unsigned char* mBuffer;
+	unsigned int mFpsNumerator, mFpsDenominator;
 	bool mFrameSkip;
 
+	// frame returned by GetFrame, black until the first sample and made on its first call
+	std::shared_ptr<const FrameSnapshot> mFrame;
+
+	// fields mode serves the two fields of every captured frame as frames of their own;
+	// mFieldPair is the output frame pair whose capture is in mFrame, -1 before the first
+	int mFieldOrder;
+	int mFieldPair;
+
+	// held while mBackend is used; the device thread holds it for the whole setup or reconnect
+	std::mutex mDeviceLock;
+
+	// resize mode: a sample of another size than the clip is captured into mCapturePixels and scaled from there
+	// by mResizer, which is made for the capture size after every open; both are guarded by mDeviceLock
+	int mResizeFilter;
+	FrameResizer* mResizer;
+	std::vector<unsigned char> mCapturePixels;
+
+	// newest sample converted by the scheduler and not taken yet, its time still on the capture clock;
+	// whoever takes it turns that into clip time. Waited for on mReadySignal, which is also notified when the
+	// device stops or starts streaming or a conversion fails.
+	std::mutex mReadyLock;
+	std::condition_variable mReadySignal;
+	std::shared_ptr<FrameSnapshot> mReady;
+	std::atomic<bool> mStreaming;
+	const char* mCaptureError;
+	// set while mReady holds a sample or mCaptureError an error, so a spinning caller needs no lock
+	std::atomic<bool> mReadyPending;
+	// lossless mode: every sample waits here in order instead of replacing mReady, mLossless of them in
+	// memory and the rest in mSpill, which is made on the first overflow; guarded by mReadyLock as well
+	size_t mLossless;
+	std::deque<std::shared_ptr<FrameSnapshot>> mQueue;
+	FrameSpill* mSpill;
+	// samples dropped because the spill file reached its limit, counted in samples_dropped
+	std::atomic<unsigned long> mSpillDropped;
+
+	// how a frame request waits for a sample: spinning up to mWaitSpin, which wakes up sooner, then
+	// sleeping on mReadySignal until mWaitTimeout, 0 for as long as it takes
+	std::chrono::steady_clock::duration mWaitSpin;
+	std::chrono::steady_clock::duration mWaitTimeout;
+	// frame_skip in deadline mode: every frame waits this long for a new sample before it repeats the
+	// previous one, instead of the pacer planning which frames get one; 0 leaves it to the pacer
+	std::chrono::steady_clock::duration mFrameDeadline;
+
+	// device thread: opens the device, then watches for freezes when mReconnectTimeout > 0
+	int mReconnectTimeout;
+	std::thread mDeviceThread;
+	std::mutex mThreadLock;
+	std::condition_variable mThreadSignal;
+	bool mThreadStop;
+	std::atomic<bool> mOpenDone;
+	const char* mOpenError;
+
+	// metadata of the frame in mFrame
+	unsigned long mFrameNumber;
+	double mFrameTime;
+	std::atomic<double> mTimeOrigin;
+	bool mFrameDuplicate;
+	int mFramesDropped;
+
+	// counted by the caller taking a frame while GetStats may read them; mWaitTime is guarded by mStatsLock
+	std::atomic<unsigned long> mFramesDelivered;
+	std::atomic<unsigned long> mFramesDuplicated;
+	std::atomic<unsigned long> mDeadlineMisses;
+	double mWaitTime;
+	// seconds from capturing the samples taken to handing them out, summed up; guarded by mReadyLock
+	double mLatencySum;
+	unsigned long mLatencyFrames;
+	std::atomic<int> mReconnects;
+
+	// device counters restart with every reconnect, so earlier sessions are summed up here
+	unsigned long mSamplesReceivedBase, mSamplesDroppedBase;
+	std::atomic<unsigned long> mSamplesReceived, mSamplesDropped;
+
+	// startup timing, in seconds
+	double mConstructTime;
+	double mSetupTime;
+	// written by whichever caller waited for the device, while GetStats may read it
+	std::atomic<double> mStartupWait;
+
+	// decision of the auto capture mode selection, empty unless capture_format is "auto"
+	std::mutex mStatsLock;
+	std::string mCaptureMode;
+
+	// frame rate agreed by the device and measured after every open; the meter is guarded by mDeviceLock
+	FrameRateMeter mRateMeter;
+	double mNegotiatedFps;
+	double mMeasuredFps;
+	// frame buffers the backend holds for the open device
+	size_t mDeviceMemory;
+	// size the device delivers samples at
+	int mCaptureWidth, mCaptureHeight;
+
+	// paces frame_skip; only GetFrame touches it, the device thread asks for a reset after every open
+	FramePacer mPacer;
+	std::atomic<bool> mPacerReset;
+	std::atomic<double> mClockRatio;
+
+	// realtime mode: frame requests are held to the nominal frame rate; only the caller taking a frame touches the clock
+	bool mRealtime;
+	RealtimeClock mRealtimeClock;
+	std::atomic<double> mOutputFps;
+	std::atomic<int> mRealtimeSlips;
+
+	// audio captured from the device or the tone source; the clip timeline starts at the first video frame
+	int mAudioMode;
+	AudioRing* mAudioRing;
+	ToneSource* mToneSource;
+	std::mutex mAudioLock;
+	__int64 mAudioNextStart;
+	__int64 mAudioNextIndex;
+	double mAudioLatency;
+	double mAudioDrift;
+	int mAudioSlips;
+
+	std::shared_ptr<SnapshotPool> mSnapshotPool;
+
+	// every clip of the source reads the frames captured for recent output frames of the session, counted
+	// from its first capture. One clip at a time captures, marked by mSharedCapturing
+	struct SharedFrame {
+		// output frame of the session, or pair of fields
+		int n;
+		std::shared_ptr<const FrameSnapshot> snapshot;
+		bool duplicate;
+		int dropped;
+	};
+	std::vector<CaptureRegion> mRegions;
+	std::mutex mSharedLock;
+	std::condition_variable mSharedSignal;
+	std::deque<SharedFrame> mSharedFrames;
+	// output frame of the session captured next
+	int mSharedNext;
+	bool mSharedCapturing;
+
+	// bytes converted from the device and bytes read out by region clips, to check nothing is copied twice
+	std::atomic<unsigned long long> mCaptureBytes;
+	std::atomic<unsigned long long> mRegionBytes;
+	std::atomic<unsigned long> mFramesShared;
+
+	// how many clips Create handed this capture session to are still open
+	std::atomic<int> mOpens;
+
+	VideoInputSource(const VideoInputSourceParams& params);
+
+	const char* OpenDevice();
+	void WaitForDevice();
+	void DeviceThread();
+	// hands the open device to the scheduler, or takes it back before the device is closed; never called
+	// with mDeviceLock held, since taking it back waits for a conversion still running. Returns the error of
+	// a device the scheduler cannot take, which is closed again.
+	const char* SetStreaming(const bool streaming);
+	// converts the new sample on a scheduler worker and publishes it in mReady
+	void OnFrameReady();
+	// takes mReady, or the oldest queued sample in lossless mode, or NULL when nothing was published since; needs mReadyLock
+	std::shared_ptr<FrameSnapshot> TakeReady();
+	std::shared_ptr<FrameSnapshot> NewBlackSnapshot();
+	// in realtime mode waits for the next output frame to be due
+	void PaceFrame();
+	// takes the next frame like GetFrame into mFrame; returns false for a duplicate, which leaves mFrame as it was
+	bool TakeFrame();
+	// makes a new sample the frame GetFrame returns, with its metadata
+	void ShowFrame(const std::shared_ptr<FrameSnapshot>& frame);
+	// waits for mReady until deadline, spinning first; needs lock on mReadyLock
+	void WaitReady(std::unique_lock<std::mutex>& lock, const std::chrono::steady_clock::time_point waitStart, const std::chrono::steady_clock::time_point deadline);
+
 public:
-	VideoInputSource(const int device_id, const char* connection_type, const int width, const int height, const bool frame_skip);
+	// sources are shared by their clips, so region clips may outlive the clip that opened the device.
+	// A source still open with equal params is handed out again instead of opening the device twice, so any
+	// number of clips share one capture session.
+	static std::shared_ptr<VideoInputSource> Create(const VideoInputSourceParams& params);
 	~VideoInputSource();
 
+	// waits for the next sample as set by wait_spin and wait_timeout, or for the frame_skip or frame_deadline deadline;
+	// in realtime mode first for the frame to be due
 	const unsigned char* GetFrame();
+	// the next frame like GetFrame when a sample is converted already, NULL without waiting otherwise, also in realtime mode;
+	// NULL is not counted as a frame, the previous frame and its metadata stay as they were
+	const unsigned char* TryGetFrame();
 	int GetWidth();
 	int GetHeight();
+	unsigned int GetFpsNumerator();
+	unsigned int GetFpsDenominator();
+
+	// in fields mode output frame n is a field of the frame captured for pair n / 2, at twice the frame rate
+	bool HasFields();
+	bool IsTopField(const int n);
+	// rows of field n, bottom-up like GetFrame, every second row of the captured frame; pitch is set to
+	// twice the frame row size. A new frame is captured when n belongs to another pair than the last call.
+	const unsigned char* GetField(const int n, ptrdiff_t& pitch);
+	// the same view into a frame the caller holds, such as a snapshot
+	const unsigned char* GetFieldRows(const unsigned char* frame, const int n, ptrdiff_t& pitch);
+
+	bool HasAudio();
+	int GetAudioRate();
+	int GetAudioChannels();
+	// fills buf with count interleaved 16 bit frames starting at clip audio frame start
+	void GetAudio(short* buf, const __int64 start, const __int64 count);
+
+	// metadata of the frame returned by the last GetFrame call
+	unsigned long GetFrameNumber();
+	double GetFrameTime();
+	bool IsFrameDuplicate();
+	int GetFramesDropped();
+
+	// clips take their frames from here instead of GetFrame, since another clip may be opened on the session
+	// at any time; the two must not be mixed on one source. Every clip keeps the base OpenSharedClip returned:
+	// its frame n is output frame base + n of the session, so clips opened together, like a clip and its
+	// regions, show the same sample for the same n, and a clip opened later starts at the live frame.
+	// The first call for an output frame captures it and later calls for it, from any clip, get that very
+	// sample, so a capture is converted once however many clips read it. A frame older than the history, as
+	// asked by a clip seeking back, is captured live instead and base moves along, so the clip goes on from there.
+	// In fields mode both fields of a pair get the captured frame, as with GetField.
+	// Calls may come from many threads in any order; samples still go to output frames in frame order.
+	int OpenSharedClip();
+	std::shared_ptr<const FrameSnapshot> GetSharedFrame(int& base, const int n, bool& duplicate, int& dropped);
+	// a clip Create handed the source to is done with it; region clips, which share it otherwise, do not call it
+	void Release();
+	// index of the region called name, -1 when there is none
+	int FindRegion(const char* name);
+	const CaptureRegion& GetRegion(const int index);
+	// rows of a region in a frame the caller holds, bottom-up like GetFrame; pitch is set to the frame
+	// row size. The region counts as read once for every call.
+	const unsigned char* GetRegionRows(const unsigned char* frame, const int index, ptrdiff_t& pitch);
+
+	VideoInputSourceStats GetStats();
+
+	// looks up the source capturing from device_id, returns an empty pointer when there is none
+	static std::shared_ptr<VideoInputSource> FindByDeviceID(const int device_id);
+	static bool GetStatsByDeviceID(const int device_id, VideoInputSourceStats& stats);
+	// blocks until the sources capturing from device_ids have finished opening their devices, streaming or
+	// failed. Every source opens its device on a device thread of its own from the moment it is created, so
+	// sources created one after another open at the same time and this waits as long as the slowest one.
+	// Returns false when no source is capturing from one of the devices.
+	static bool WaitForDevices(const std::vector<int>& device_ids, std::vector<DeviceOpenResult>& results);
 };
@@ -0,0 +1,283 @@
+#include "capabilityCache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+//file layout - all integers little endian
+//	magic, version, entry count
+//	per entry: name length, name (UTF-16), capability count, capabilities, mode count, modes
+static const unsigned int CACHE_MAGIC	= 0x43434956;	//"VICC"
+static const unsigned int CACHE_VERSION	= 1;
+
+//sanity limits so a damaged file can't make us allocate gigabytes
+static const unsigned int CACHE_MAX_ENTRIES	= 256;
+static const unsigned int CACHE_MAX_NAME	= 4096;
+static const unsigned int CACHE_MAX_ITEMS	= 4096;
+
+//serializes load-modify-save within the process
+static std::mutex cacheLock;
+
+static bool cachePathSet = false;
+static std::string cachePath;
+
+
+///////////////////////////  ENTRY HELPERS  /////////////////////////////
+
+bool videoCapability::supportsSize(int w, int h) const{
+	if(w < minWidth || w > maxWidth || h < minHeight || h > maxHeight) return false;
+	if(stepX > 0 && (w - minWidth) % stepX != 0) return false;
+	if(stepY > 0 && (h - minHeight) % stepY != 0) return false;
+	return true;
+}
+
+const videoCaptureMode * capabilityCacheEntry::findMode(int requestedWidth, int requestedHeight) const{
+	for(size_t i = 0; i < modes.size(); i++){
+		if(modes[i].requestedWidth == requestedWidth && modes[i].requestedHeight == requestedHeight){
+			return &modes[i];
+		}
+	}
+	return NULL;
+}
+
+void capabilityCacheEntry::setMode(const videoCaptureMode & mode){
+	for(size_t i = 0; i < modes.size(); i++){
+		if(modes[i].requestedWidth == mode.requestedWidth && modes[i].requestedHeight == mode.requestedHeight){
+			modes[i] = mode;
+			return;
+		}
+	}
+	modes.push_back(mode);
+}
+
+bool capabilityCacheEntry::supports(GUID subtype, int w, int h) const{
+	for(size_t i = 0; i < caps.size(); i++){
+		if(memcmp(&caps[i].subtype, &subtype, sizeof(GUID)) == 0 && caps[i].supportsSize(w, h)){
+			return true;
+		}
+	}
+	return false;
+}
+
+
+///////////////////////////  SERIALIZATION  /////////////////////////////
+
+static bool readU32(FILE * fp, unsigned int & value){
+	unsigned char b[4];
+	if(fread(b, 1, 4, fp) != 4) return false;
+	value = b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+	return true;
+}
+
+static bool writeU32(FILE * fp, unsigned int value){
+	unsigned char b[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+	return fwrite(b, 1, 4, fp) == 4;
+}
+
+static bool readI32(FILE * fp, int & value){
+	unsigned int u;
+	if(!readU32(fp, u)) return false;
+	value = (int)u;
+	return true;
+}
+
+static bool readI64(FILE * fp, __int64 & value){
+	unsigned int lo, hi;
+	if(!readU32(fp, lo) || !readU32(fp, hi)) return false;
+	value = (__int64)(((unsigned __int64)hi << 32) | lo);
+	return true;
+}
+
+static bool writeI64(FILE * fp, __int64 value){
+	return writeU32(fp, (unsigned int)value) && writeU32(fp, (unsigned int)((unsigned __int64)value >> 32));
+}
+
+static bool readGUID(FILE * fp, GUID & guid){
+	unsigned int data1, data23;
+	if(!readU32(fp, data1) || !readU32(fp, data23)) return false;
+	if(fread(guid.Data4, 1, 8, fp) != 8) return false;
+	guid.Data1 = data1;
+	guid.Data2 = (unsigned short)(data23 & 0xFFFF);
+	guid.Data3 = (unsigned short)(data23 >> 16);
+	return true;
+}
+
+static bool writeGUID(FILE * fp, const GUID & guid){
+	return writeU32(fp, guid.Data1) && writeU32(fp, guid.Data2 | ((unsigned int)guid.Data3 << 16)) && fwrite(guid.Data4, 1, 8, fp) == 8;
+}
+
+bool capabilityCache::readEntries(FILE * fp, std::map<std::wstring, capabilityCacheEntry> & entries){
+	unsigned int magic, version, count;
+	if(!readU32(fp, magic) || !readU32(fp, version) || !readU32(fp, count)) return false;
+	if(magic != CACHE_MAGIC || version != CACHE_VERSION || count > CACHE_MAX_ENTRIES) return false;
+
+	for(unsigned int e = 0; e < count; e++){
+		unsigned int nameLength;
+		if(!readU32(fp, nameLength) || nameLength > CACHE_MAX_NAME) return false;
+
+		std::wstring name(nameLength, L'\0');
+		for(unsigned int i = 0; i < nameLength; i++){
+			unsigned char b[2];
+			if(fread(b, 1, 2, fp) != 2) return false;
+			name[i] = (wchar_t)(b[0] | (b[1] << 8));
+		}
+
+		capabilityCacheEntry entry;
+
+		unsigned int capCount;
+		if(!readU32(fp, capCount) || capCount > CACHE_MAX_ITEMS) return false;
+		entry.caps.resize(capCount);
+		for(unsigned int i = 0; i < capCount; i++){
+			videoCapability & cap = entry.caps[i];
+			if(!readGUID(fp, cap.subtype)) return false;
+			if(!readI32(fp, cap.minWidth) || !readI32(fp, cap.minHeight)) return false;
+			if(!readI32(fp, cap.maxWidth) || !readI32(fp, cap.maxHeight)) return false;
+			if(!readI32(fp, cap.stepX) || !readI32(fp, cap.stepY)) return false;
+			if(!readI64(fp, cap.minFrameInterval) || !readI64(fp, cap.maxFrameInterval)) return false;
+		}
+
+		unsigned int modeCount;
+		if(!readU32(fp, modeCount) || modeCount > CACHE_MAX_ITEMS) return false;
+		entry.modes.resize(modeCount);
+		for(unsigned int i = 0; i < modeCount; i++){
+			videoCaptureMode & mode = entry.modes[i];
+			if(!readI32(fp, mode.requestedWidth) || !readI32(fp, mode.requestedHeight)) return false;
+			if(!readGUID(fp, mode.subtype)) return false;
+			if(!readI32(fp, mode.width) || !readI32(fp, mode.height)) return false;
+		}
+
+		entries[name] = entry;
+	}
+
+	return true;
+}
+
+bool capabilityCache::writeEntries(FILE * fp, const std::map<std::wstring, capabilityCacheEntry> & entries){
+	if(!writeU32(fp, CACHE_MAGIC) || !writeU32(fp, CACHE_VERSION) || !writeU32(fp, (unsigned int)entries.size())) return false;
+
+	std::map<std::wstring, capabilityCacheEntry>::const_iterator it;
+	for(it = entries.begin(); it != entries.end(); ++it){
+		const std::wstring & name = it->first;
+		if(!writeU32(fp, (unsigned int)name.size())) return false;
+		for(size_t i = 0; i < name.size(); i++){
+			unsigned char b[2] = { (unsigned char)name[i], (unsigned char)(name[i] >> 8) };
+			if(fwrite(b, 1, 2, fp) != 2) return false;
+		}
+
+		const capabilityCacheEntry & entry = it->second;
+
+		if(!writeU32(fp, (unsigned int)entry.caps.size())) return false;
+		for(size_t i = 0; i < entry.caps.size(); i++){
+			const videoCapability & cap = entry.caps[i];
+			if(!writeGUID(fp, cap.subtype)) return false;
+			if(!writeU32(fp, cap.minWidth) || !writeU32(fp, cap.minHeight)) return false;
+			if(!writeU32(fp, cap.maxWidth) || !writeU32(fp, cap.maxHeight)) return false;
+			if(!writeU32(fp, cap.stepX) || !writeU32(fp, cap.stepY)) return false;
+			if(!writeI64(fp, cap.minFrameInterval) || !writeI64(fp, cap.maxFrameInterval)) return false;
+		}
+
+		if(!writeU32(fp, (unsigned int)entry.modes.size())) return false;
+		for(size_t i = 0; i < entry.modes.size(); i++){
+			const videoCaptureMode & mode = entry.modes[i];
+			if(!writeU32(fp, mode.requestedWidth) || !writeU32(fp, mode.requestedHeight)) return false;
+			if(!writeGUID(fp, mode.subtype)) return false;
+			if(!writeU32(fp, mode.width) || !writeU32(fp, mode.height)) return false;
+		}
+	}
+
+	return true;
+}
+
+
+///////////////////////////  FILE ACCESS  /////////////////////////////
+
+void capabilityCache::setPath(const std::string & path){
+	std::lock_guard<std::mutex> lock(cacheLock);
+	cachePath		= path;
+	cachePathSet	= true;
+}
+
+std::string capabilityCache::getPath(){
+	if(!cachePathSet){
+		const char * base = getenv("LOCALAPPDATA");
+		if(base == NULL) base = getenv("TEMP");
+		if(base != NULL){
+			std::string dir = std::string(base) + "\\VideoInputSource";
+			CreateDirectoryA(dir.c_str(), NULL);
+			cachePath = dir + "\\capabilities.bin";
+		}
+		cachePathSet = true;
+	}
+	return cachePath;
+}
+
+bool capabilityCache::load(std::map<std::wstring, capabilityCacheEntry> & entries){
+	std::string path = getPath();
+	if(path.empty()) return false;
+
+	FILE * fp = fopen(path.c_str(), "rb");
+	if(fp == NULL) return false;
+
+	bool success = readEntries(fp, entries);
+	fclose(fp);
+
+	//a damaged or outdated file is simply started over
+	if(!success) entries.clear();
+	return success;
+}
+
+bool capabilityCache::save(const std::map<std::wstring, capabilityCacheEntry> & entries){
+	std::string path = getPath();
+	if(path.empty()) return false;
+
+	//write aside and swap in, so another process never reads half a file
+	char suffix[32];
+	sprintf(suffix, ".%lu.tmp", GetCurrentProcessId());
+	std::string tmpPath = path + suffix;
+
+	FILE * fp = fopen(tmpPath.c_str(), "wb");
+	if(fp == NULL) return false;
+
+	bool success = writeEntries(fp, entries);
+	success = (fclose(fp) == 0) && success;
+
+	if(success){
+		success = MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	}
+	if(!success) DeleteFileA(tmpPath.c_str());
+	return success;
+}
+
+bool capabilityCache::lookup(const std::wstring & device, capabilityCacheEntry & entry){
+	if(device.empty()) return false;
+
+	std::lock_guard<std::mutex> lock(cacheLock);
+	std::map<std::wstring, capabilityCacheEntry> entries;
+	load(entries);
+
+	std::map<std::wstring, capabilityCacheEntry>::iterator it = entries.find(device);
+	if(it == entries.end()) return false;
+	entry = it->second;
+	return true;
+}
+
+void capabilityCache::store(const std::wstring & device, const capabilityCacheEntry & entry){
+	if(device.empty()) return;
+
+	std::lock_guard<std::mutex> lock(cacheLock);
+	std::map<std::wstring, capabilityCacheEntry> entries;
+	load(entries);
+
+	entries[device] = entry;
+	save(entries);
+}
+
+void capabilityCache::invalidate(const std::wstring & device){
+	if(device.empty()) return;
+
+	std::lock_guard<std::mutex> lock(cacheLock);
+	std::map<std::wstring, capabilityCacheEntry> entries;
+	load(entries);
+
+	if(entries.erase(device) > 0) save(entries);
+}
@@ -0,0 +1,76 @@
+#ifndef _CAPABILITYCACHE
+#define _CAPABILITYCACHE
+
+//////////////////////////////////////////////////////////
+//Persistent cache of device stream capabilities        //
+//                                                      //
+//Negotiating a capture mode means trying SetFormat on  //
+//one subtype after another, which takes seconds on     //
+//some capture cards. The capability table of every     //
+//device and the mode that worked for a requested size  //
+//are kept in a small binary file, keyed by the unique  //
+//device name, so the next open tries that mode first.  //
+//////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "../Platform.h"
+
+
+//one entry of IAMStreamConfig::GetStreamCaps
+struct videoCapability{
+	GUID subtype;
+	int minWidth, minHeight;
+	int maxWidth, maxHeight;
+	int stepX, stepY;
+	__int64 minFrameInterval;	//100ns units
+	__int64 maxFrameInterval;	//100ns units
+
+	bool supportsSize(int w, int h) const;
+};
+
+//the mode that was negotiated for a requested size
+struct videoCaptureMode{
+	int requestedWidth, requestedHeight;
+	GUID subtype;
+	int width, height;
+};
+
+struct capabilityCacheEntry{
+	std::vector<videoCapability> caps;
+	std::vector<videoCaptureMode> modes;
+
+	const videoCaptureMode * findMode(int requestedWidth, int requestedHeight) const;
+	void setMode(const videoCaptureMode & mode);
+
+	//true when any capability offers subtype at the given size
+	bool supports(GUID subtype, int w, int h) const;
+};
+
+
+class capabilityCache{
+
+	public:
+		//every call reads the file again, so processes capturing at the same time share it
+		static bool lookup(const std::wstring & device, capabilityCacheEntry & entry);
+		static void store(const std::wstring & device, const capabilityCacheEntry & entry);
+
+		//drops everything known about the device - call when a cached mode fails to negotiate
+		static void invalidate(const std::wstring & device);
+
+		//default is %LOCALAPPDATA%\VideoInputSource\capabilities.bin, an empty path disables the cache
+		static void setPath(const std::string & path);
+		static std::string getPath();
+
+		static bool readEntries(FILE * fp, std::map<std::wstring, capabilityCacheEntry> & entries);
+		static bool writeEntries(FILE * fp, const std::map<std::wstring, capabilityCacheEntry> & entries);
+
+	private:
+		static bool load(std::map<std::wstring, capabilityCacheEntry> & entries);
+		static bool save(const std::map<std::wstring, capabilityCacheEntry> & entries);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "captureModeSelector.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//a mode that can't keep up with the requested rate, saturates the bus or drops colour
+//is only picked when nothing else is offered - these dwarf any realistic cpu load
+static const double PENALTY_FRAMERATE	= 100.0;
+static const double PENALTY_BANDWIDTH	= 10.0;
+static const double PENALTY_GREYSCALE	= 1000.0;
+
+static bool sameSubtype(const GUID & a, const GUID & b){
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+int selectCaptureMode(const std::vector<videoCapability> & caps, const std::vector<captureFormatCost> & costs, int width, int height, double fps, double busBudget, std::vector<captureModeScore> & scores){
+	scores.clear();
+
+	for(size_t i = 0; i < caps.size(); i++){
+		const videoCapability & cap = caps[i];
+		if(!cap.supportsSize(width, height)) continue;
+
+		const captureFormatCost * cost = NULL;
+		for(size_t c = 0; c < costs.size(); c++){
+			if(sameSubtype(costs[c].subtype, cap.subtype)){
+				cost = &costs[c];
+				break;
+			}
+		}
+		if(cost == NULL) continue;
+
+		captureModeScore mode;
+		mode.subtype	= cap.subtype;
+		mode.name		= cost->name;
+		mode.width		= width;
+		mode.height		= height;
+		mode.maxFps		= (cap.minFrameInterval > 0) ? 10000000.0 / (double)cap.minFrameInterval : fps;
+
+		//the device can't deliver faster than its ceiling, so that is what we pay for
+		double deliveredFps	= (mode.maxFps < fps) ? mode.maxFps : fps;
+		double pixels		= (double)width * (double)height;
+
+		mode.cpuLoad	= cost->nsPerPixel * pixels * deliveredFps / 1e9;
+		mode.bandwidth	= cost->bytesPerPixel * pixels * deliveredFps;
+		mode.score		= mode.cpuLoad;
+
+		if(mode.maxFps < fps * 0.99){
+			mode.score += PENALTY_FRAMERATE * (1.0 - mode.maxFps / fps);
+		}
+		if(busBudget > 0 && mode.bandwidth > busBudget){
+			mode.score += PENALTY_BANDWIDTH * (mode.bandwidth / busBudget);
+		}
+		if(!cost->color){
+			mode.score += PENALTY_GREYSCALE;
+		}
+
+		//a subtype can be listed more than once - keep its best entry
+		bool merged = false;
+		for(size_t s = 0; s < scores.size(); s++){
+			if(sameSubtype(scores[s].subtype, mode.subtype)){
+				if(mode.score < scores[s].score) scores[s] = mode;
+				merged = true;
+				break;
+			}
+		}
+		if(!merged) scores.push_back(mode);
+	}
+
+	int selected = -1;
+	for(size_t s = 0; s < scores.size(); s++){
+		if(selected == -1 || scores[s].score < scores[selected].score){
+			selected = (int)s;
+		}
+	}
+	return selected;
+}
+
+std::string describeCaptureModeSelection(const std::vector<captureModeScore> & scores, int selected){
+	if(selected < 0) return "auto: no mode offers the requested size";
+
+	std::string report;
+	char line[256];
+	for(size_t s = 0; s < scores.size(); s++){
+		const captureModeScore & mode = scores[s];
+		sprintf(line, "%s%s %dx%d: cpu %.3f cores, bus %.1f MB/s, max %.2f fps, score %.3f",
+			((int)s == selected) ? "auto: selected " : "; ", mode.name, mode.width, mode.height,
+			mode.cpuLoad, mode.bandwidth / 1e6, mode.maxFps, mode.score);
+		if((int)s == selected){
+			report = std::string(line) + report;
+		}else{
+			report += line;
+		}
+	}
+	return report;
+}
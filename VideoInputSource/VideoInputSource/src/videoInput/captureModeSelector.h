@@ -0,0 +1,46 @@
+#ifndef _CAPTUREMODESELECTOR
+#define _CAPTUREMODESELECTOR
+
+//////////////////////////////////////////////////////////
+//Cost model for automatic capture mode selection       //
+//                                                      //
+//Every mode a device offers at the requested size is   //
+//scored by the CPU time needed to turn it into RGB24,  //
+//the bus bandwidth it takes and whether it can reach   //
+//the requested frame rate. Lower score is better.      //
+//////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include "capabilityCache.h"
+
+
+//what it costs to capture one pixel of a subtype and deliver it as RGB24
+struct captureFormatCost{
+	GUID subtype;
+	const char * name;
+	double nsPerPixel;		//conversion to RGB24 (decoder / colour converter / copy)
+	double bytesPerPixel;	//on the bus - an estimate for compressed subtypes
+	bool color;				//false for greyscale subtypes, which lose information
+};
+
+struct captureModeScore{
+	GUID subtype;
+	const char * name;
+	int width, height;
+	double maxFps;			//frame rate ceiling from the minimum frame interval
+	double cpuLoad;			//estimated cores spent converting at the delivered frame rate
+	double bandwidth;		//bytes per second on the bus
+	double score;
+};
+
+//scores every capability that offers exactly width x height in a subtype we know the cost of.
+//busBudget is the usable bus bandwidth in bytes per second, 0 means unlimited.
+//returns the index of the best score or -1 when nothing offers the size.
+int selectCaptureMode(const std::vector<videoCapability> & caps, const std::vector<captureFormatCost> & costs, int width, int height, double fps, double busBudget, std::vector<captureModeScore> & scores);
+
+//human readable decision and scores, for diagnostics
+std::string describeCaptureModeSelection(const std::vector<captureModeScore> & scores, int selected);
+
+#endif
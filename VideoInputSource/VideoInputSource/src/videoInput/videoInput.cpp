@@ -7,8 +7,12 @@
 //THE SOFTWARE.
 #include  <iostream>
 #include <algorithm>
+#include <mutex>
 
 #include "videoInput.h"
+#include "capabilityCache.h"
+#include "captureModeSelector.h"
+#include "../FrameCopy.h"
 #include <tchar.h>
 
 //Include Directshow stuff here so we don't worry about needing all the h files.
@@ -82,12 +86,33 @@ EXTERN_C const CLSID CLSID_NullRenderer;
 //use videoInput::setVerbose to change 
 static bool verbose = true;
 
+//samples a lossless device queues for getPixels - beyond them a sample is dropped rather than holding up the graph
+static const int LOSSLESS_QUEUE = 8;
+
 //use videoInput::setComMultiThreaded to change 
 static bool VI_COM_MULTI_THREADED = false;
 
 //keeps track of how many instances of VI are being used
 //don't touch
 static int comInitCount = 0;
+//instances are made and freed on whatever thread opens or closes a source
+static std::mutex comInitLock;
+
+//seconds on the performance counter clock - used to timestamp samples on arrival
+static double getPerformanceTime(){
+	static LARGE_INTEGER frequency = {0};
+	if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+//names of mediaSubtypes[] in the same order
+static const char * mediaSubtypeNames[VI_NUM_TYPES] = {
+	"RGB24", "RGB32", "RGB555", "RGB565", "YUY2", "YVYU", "YUYV", "IYUV", "UYVY", "YV12",
+	"YVU9", "Y411", "Y41P", "Y211", "AYUV", "Y800", "Y8", "GREY", "MJPG"
+};
 
 ///////////////////////////  HANDY FUNCTIONS  /////////////////////////////
 
@@ -124,13 +149,20 @@ public:
 	//------------------------------------------------
 	SampleGrabberCallback(){
 		InitializeCriticalSection(&critSection);
-		freezeCheck = 0;
+		lastSampleTime = 0.0;
 
 
 		bufferSetup 		= false;
 		newFrame			= false;
 		latestBufferLength 	= 0;
 
+		sampleCount			= 0;
+		droppedCount		= 0;
+		lossless			= false;
+		queueSize			= 1;
+		queueHead			= 0;
+		queueCount			= 0;
+
 		hEvent = CreateEvent(NULL, true, false, NULL);
 	}
 
@@ -152,10 +184,13 @@ public:
 			return false;
 		}else{
 			numBytes 			= numBytesIn;
-			pixels 				= new unsigned char[numBytes];
+			queueSize			= lossless ? LOSSLESS_QUEUE : 1;
+			pixels 				= new unsigned char[(size_t)numBytes * queueSize];
 			bufferSetup 		= true;
 			newFrame			= false;
 			latestBufferLength 	= 0;
+			queueHead			= 0;
+			queueCount			= 0;
 		}
 		return true;
 	}
@@ -176,19 +211,34 @@ public:
     //This method is meant to have less overhead
 	//------------------------------------------------
     STDMETHODIMP SampleCB(double /*Time*/, IMediaSample *pSample){
-    	if(WaitForSingleObject(hEvent, 0) == WAIT_OBJECT_0) return S_OK;
+    	//every sample gets a number, so a reader can tell how many were skipped in between
+    	sampleCount++;
+    	EnterCriticalSection(&critSection);
+    		lastSampleTime = getPerformanceTime();
+    		//every slot holds a sample not read yet - the graph thread never waits for the reader
+    		bool full = (queueCount == queueSize);
+    		int slot = (queueHead + queueCount) % queueSize;
+    	LeaveCriticalSection(&critSection);
+    	if(full){
+    		droppedCount++;
+    		return S_OK;
+    	}
 
     	HRESULT hr = pSample->GetPointer(&ptrBuffer);
 
     	if(hr == S_OK){
 	    	latestBufferLength = pSample->GetActualDataLength();
 	      	if(latestBufferLength == numBytes){
+				//the free slot is not read until it is queued below, so it is filled without the lock
+				CopyFrame(pixels + (size_t)slot * numBytes, ptrBuffer, latestBufferLength);
 				EnterCriticalSection(&critSection);
-	      			memcpy(pixels, ptrBuffer, latestBufferLength);
+					frameNumber[slot]	= sampleCount;
+					frameTime[slot]		= getPerformanceTime();
+					queueCount++;
 					newFrame	= true;
-					freezeCheck = 1;
+					//set under the lock, so getPixels emptying the queue cannot reset it in between
+					SetEvent(hEvent);
 				LeaveCriticalSection(&critSection);
-				SetEvent(hEvent);
 			}else{
 				printf("ERROR: SampleCB() - buffer sizes do not match\n");
 			}
@@ -203,7 +253,18 @@ public:
     	return E_NOTIMPL;
     }
 
-	int freezeCheck;
+	double lastSampleTime;		//arrival time of the latest sample, read or not - guarded by critSection, a 32 bit build writes a double in two halves
+
+	unsigned long sampleCount;	//samples delivered by the graph
+	unsigned long droppedCount;	//samples discarded because every slot was not read yet
+	bool lossless;				//queue up to LOSSLESS_QUEUE samples for the reader instead of one
+
+	//pixels holds queueSize samples in a ring, queueCount of them from queueHead on not read yet - guarded by critSection
+	int queueSize;
+	int queueHead;
+	int queueCount;
+	unsigned long frameNumber[LOSSLESS_QUEUE];	//number of the sample held in each slot
+	double frameTime[LOSSLESS_QUEUE];			//arrival time of the sample held in each slot
 
 	int latestBufferLength;
 	int numBytes;
@@ -212,7 +273,60 @@ public:
 	unsigned char * pixels;
 	unsigned char * ptrBuffer;
 	CRITICAL_SECTION critSection;
-	HANDLE hEvent;
+	HANDLE hEvent;				//set while a sample is queued
+};
+
+
+//////////////////////////////  AUDIO CALLBACK  ////////////////////////////////
+
+//Passes every audio sample straight on to the sink, stamped on the video sample clock
+class AudioGrabberCallback : public ISampleGrabberCB{
+public:
+
+	//------------------------------------------------
+	AudioGrabberCallback(audioSampleSink * _sink, int _rate, int _channels){
+		sink		= _sink;
+		rate		= _rate;
+		channels	= _channels;
+	}
+
+
+	//------------------------------------------------
+    STDMETHODIMP_(ULONG) AddRef() { return 1; }
+    STDMETHODIMP_(ULONG) Release() { return 2; }
+
+
+	//------------------------------------------------
+    STDMETHODIMP QueryInterface(REFIID /*riid*/, void **ppvObject){
+        *ppvObject = static_cast<ISampleGrabberCB*>(this);
+        return S_OK;
+    }
+
+
+	//------------------------------------------------
+    STDMETHODIMP SampleCB(double /*Time*/, IMediaSample *pSample){
+    	double arrival = getPerformanceTime();
+
+    	BYTE * ptrBuffer = NULL;
+    	if(pSample->GetPointer(&ptrBuffer) != S_OK) return S_OK;
+
+    	int frames = pSample->GetActualDataLength() / (int)(sizeof(short) * channels);
+    	if(frames > 0){
+    		//a sample is delivered once its last frame is captured, so its start lies one duration back
+    		sink->receiveAudio((const short *)ptrBuffer, frames, arrival - (double)frames / (double)rate);
+    	}
+		return S_OK;
+    }
+
+
+	//------------------------------------------------
+    STDMETHODIMP BufferCB(double /*Time*/, BYTE * /*pBuffer*/, long /*BufferLen*/){
+    	return E_NOTIMPL;
+    }
+
+	audioSampleSink * sink;
+	int rate;
+	int channels;
 };
 
 
@@ -240,6 +354,15 @@ videoDevice::videoDevice(){
 		 sgCallback			= new SampleGrabberCallback();
 		 sgCallback->newFrame = false;
 
+		 pAudioGrabberF		= NULL;
+		 pAudioDestFilter	= NULL;
+		 pAudioGrabber		= NULL;
+		 audioCallback		= NULL;
+		 audioSink			= NULL;
+		 audioRate			= 0;
+		 audioChannels		= 0;
+		 audioReady			= false;
+
 		 //Default values for capture type
 		 videoType 			= MEDIASUBTYPE_RGB24;
 	     connection     	= PhysConn_Video_Composite;
@@ -250,10 +373,15 @@ videoDevice::videoDevice(){
 	     height    			= 0;
 	     tryWidth			= 0;
 	     tryHeight			= 0;
-		 nFramesForReconnect= 10000;
-		 nFramesRunning     = 0;
+		 freezeTimeout		= 10000;
 	     myID				= -1;
 
+		 pixels				= NULL;
+		 pBuffer			= NULL;
+
+		 lastFrameNumber	= 0;
+		 lastFrameTime		= 0.0;
+
 	     tryDiffSize     	= false;
 	     useCrossbar     	= false;
 		 readyToCapture  	= false;
@@ -262,6 +390,7 @@ videoDevice::videoDevice(){
 		 specificFormat		= false;
 		 autoReconnect		= false;
 		 requestedFrameTime = -1;
+		 negotiatedFrameTime = 0;
 
 		 memset(wDeviceName, 0, sizeof(WCHAR) * 255);
 		 memset(nDeviceName, 0, sizeof(char) * 255);
@@ -270,8 +399,8 @@ videoDevice::videoDevice(){
 
 
 // ----------------------------------------------------------------------
-//	The only place we are doing new
-//
+//	Only records the size - the frame buffers are made by videoInput
+//	once it knows which capture method uses them
 // ----------------------------------------------------------------------
 
 void videoDevice::setSize(int w, int h){
@@ -284,12 +413,6 @@ void videoDevice::setSize(int w, int h){
 		height 				= h;
 		videoSize 			= w*h*3;
 		sizeSet 			= true;
-		pixels				= new unsigned char[videoSize];
-		pBuffer				= new char[videoSize];
-
-		memset(pixels, 0 , videoSize);
-		sgCallback->setupBuffer(videoSize);
-
 	}
 }
 
@@ -388,6 +511,9 @@ videoDevice::~videoDevice(){
 			sgCallback->Release();
 			delete sgCallback;
 		}
+		if(audioCallback){
+			delete audioCallback;
+		}
 		return;
 	}
 
@@ -400,15 +526,18 @@ videoDevice::~videoDevice(){
         if(verbose)printf("SETUP: freeing Grabber Callback\n");
         sgCallback->Release();
 
-		//delete our pixels
-		if(sizeSet){
-			 delete[] pixels;
-			 delete[] pBuffer;
-		}
-
 		delete sgCallback;
 	}
 
+	//delete our pixels - whichever were made
+	delete[] pixels;
+	delete[] pBuffer;
+
+	//Same for audio - the sink may be gone once we return
+	if( (pAudioGrabber) ){
+		pAudioGrabber->SetCallback(NULL, 1);
+	}
+
 	//Check to see if the graph is running, if so stop it.
  	if( (pControl) )
 	{
@@ -439,6 +568,22 @@ videoDevice::~videoDevice(){
 								(pGrabber)->Release();
 								(pGrabber) = 0;
 	}
+	if( (pAudioGrabber) ){ 		if(verbose)printf("SETUP: freeing Audio Grabber  \n");
+								(pAudioGrabber)->Release();
+								(pAudioGrabber) = 0;
+	}
+	if( (pAudioGrabberF) ){ 	if(verbose)printf("SETUP: freeing Audio Grabber Filter  \n");
+								(pAudioGrabberF)->Release();
+								(pAudioGrabberF) = 0;
+	}
+	if( (pAudioDestFilter) ){ 	if(verbose)printf("SETUP: freeing Audio Renderer  \n");
+								(pAudioDestFilter)->Release();
+								(pAudioDestFilter) = 0;
+	}
+	if( (audioCallback) ){
+								delete audioCallback;
+								audioCallback = NULL;
+	}
 	if( (pControl) ){ 			if(verbose)printf("SETUP: freeing Control   \n");
 								(pControl)->Release();
 								(pControl) = 0;
@@ -506,9 +651,11 @@ videoInput::videoInput(){
 	callbackSetCount 	= 0;
 	bCallback	 		= true;
 	requestedMediaSubType = MEDIASUBTYPE_RGB24;
+	autoMediaSubType	= false;
 
     //setup a max no of device objects
-    for(int i=0; i<VI_MAX_CAMERAS; i++)  VDList[i] = new videoDevice();
+    //device objects are made on first use, see getVideoDevice
+    for(int i=0; i<VI_MAX_CAMERAS; i++)  VDList[i] = NULL;
 
     if(verbose)printf("\n***** VIDEOINPUT LIBRARY - %2.04f - TFW2013 *****\n\n",VI_VERSION);
 
@@ -543,6 +690,39 @@ videoInput::videoInput(){
 	mediaSubtypes[17]	= MEDIASUBTYPE_GREY;
 	mediaSubtypes[18]	= MEDIASUBTYPE_MJPG; // added by gameover
 
+	//Rough cost of delivering each type as RGB24 - used by the auto mode selection
+	//ns per pixel for the decoder / colour converter, bytes per pixel on the bus
+	static const struct { double nsPerPixel; double bytesPerPixel; bool color; } typeCosts[VI_NUM_TYPES] = {
+		{ 0.3,	3.0,	true },		//RGB24 - plain copy
+		{ 0.5,	4.0,	true },		//RGB32
+		{ 0.8,	2.0,	true },		//RGB555
+		{ 0.8,	2.0,	true },		//RGB565
+		{ 1.0,	2.0,	true },		//YUY2
+		{ 1.0,	2.0,	true },		//YVYU
+		{ 1.0,	2.0,	true },		//YUYV
+		{ 1.2,	1.5,	true },		//IYUV
+		{ 1.0,	2.0,	true },		//UYVY
+		{ 1.2,	1.5,	true },		//YV12
+		{ 1.4,	1.125,	true },		//YVU9
+		{ 1.2,	1.5,	true },		//Y411
+		{ 1.2,	1.5,	true },		//Y41P
+		{ 1.4,	1.0,	true },		//Y211
+		{ 1.0,	4.0,	true },		//AYUV
+		{ 0.5,	1.0,	false },	//Y800
+		{ 0.5,	1.0,	false },	//Y8
+		{ 0.5,	1.0,	false },	//GREY
+		{ 6.0,	0.3,	true },		//MJPG - jpeg decode, compressed size is a typical estimate
+	};
+	for(int i = 0; i < VI_NUM_TYPES; i++){
+		captureFormatCost cost;
+		cost.subtype		= mediaSubtypes[i];
+		cost.name			= mediaSubtypeNames[i];
+		cost.nsPerPixel		= typeCosts[i].nsPerPixel;
+		cost.bytesPerPixel	= typeCosts[i].bytesPerPixel;
+		cost.color			= typeCosts[i].color;
+		formatCosts.push_back(cost);
+	}
+
 	//The video formats we support
 	formatTypes[VI_NTSC_M]		= AnalogVideo_NTSC_M;
 	formatTypes[VI_NTSC_M_J]	= AnalogVideo_NTSC_M_J;
@@ -634,11 +814,68 @@ void videoInput::setUseCallback(bool useCallback){
 // ----------------------------------------------------------------------
 
 void videoInput::setIdealFramerate(int deviceNumber, int idealFramerate){
-	if(deviceNumber >= VI_MAX_CAMERAS || VDList[deviceNumber]->readyToCapture) return;
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return;
 
 	if( idealFramerate > 0 ){
-		VDList[deviceNumber]->requestedFrameTime = (unsigned long)(10000000 / idealFramerate);
+		getVideoDevice(deviceNumber)->requestedFrameTime = (unsigned long)(10000000 / idealFramerate);
+	}
+}
+
+//rational version for rates like 30000/1001 - rounds to the nearest 100ns unit
+void videoInput::setIdealFramerate(int deviceNumber, int numerator, int denominator){
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return;
+
+	if( numerator > 0 && denominator > 0 ){
+		getVideoDevice(deviceNumber)->requestedFrameTime = (long)((10000000LL * denominator + numerator / 2) / numerator);
+	}
+}
+
+void videoInput::setLossless(int deviceNumber, bool lossless){
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return;
+
+	getVideoDevice(deviceNumber)->sgCallback->lossless = lossless;
+}
+
+
+// ----------------------------------------------------------------------
+// Capture the audio pin of the device too - no guarantee it has one
+//
+// ----------------------------------------------------------------------
+
+void videoInput::setupAudio(int deviceNumber, int sampleRate, int channels, audioSampleSink * sink){
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return;
+
+	getVideoDevice(deviceNumber)->audioSink		= sink;
+	getVideoDevice(deviceNumber)->audioRate		= sampleRate;
+	getVideoDevice(deviceNumber)->audioChannels	= channels;
+}
+
+bool videoInput::hasAudio(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->audioReady;
 	}
+
+	return false;
+
+}
+
+
+// ----------------------------------------------------------------------
+// Framerate the capture pin agreed to - 0 if it didn't say
+//
+// ----------------------------------------------------------------------
+
+double videoInput::getNegotiatedFramerate(int id){
+
+	if(isDeviceSetup(id) && getVideoDevice(id)->negotiatedFrameTime > 0)
+	{
+		return 10000000.0 / (double)getVideoDevice(id)->negotiatedFrameTime;
+	}
+
+	return 0.0;
+
 }
 
 
@@ -647,11 +884,11 @@ void videoInput::setIdealFramerate(int deviceNumber, int idealFramerate){
 //
 // ----------------------------------------------------------------------
 
-void videoInput::setAutoReconnectOnFreeze(int deviceNumber, bool doReconnect, int numMissedFramesBeforeReconnect){
+void videoInput::setAutoReconnectOnFreeze(int deviceNumber, bool doReconnect, int msWithoutFramesBeforeReconnect){
 	if(deviceNumber >= VI_MAX_CAMERAS) return;
 
-	VDList[deviceNumber]->autoReconnect			= doReconnect;
-	VDList[deviceNumber]->nFramesForReconnect	= numMissedFramesBeforeReconnect;
+	getVideoDevice(deviceNumber)->autoReconnect			= doReconnect;
+	getVideoDevice(deviceNumber)->freezeTimeout			= msWithoutFramesBeforeReconnect;
 
 }
 
@@ -662,7 +899,7 @@ void videoInput::setAutoReconnectOnFreeze(int deviceNumber, bool doReconnect, in
 // ----------------------------------------------------------------------
 
 bool videoInput::setupDevice(int deviceNumber){
-	if(deviceNumber >= VI_MAX_CAMERAS || VDList[deviceNumber]->readyToCapture) return false;
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return false;
 
 	if(setup(deviceNumber))return true;
 	return false;
@@ -675,7 +912,7 @@ bool videoInput::setupDevice(int deviceNumber){
 // ----------------------------------------------------------------------
 
 bool videoInput::setupDevice(int deviceNumber, int connection){
-	if(deviceNumber >= VI_MAX_CAMERAS || VDList[deviceNumber]->readyToCapture) return false;
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return false;
 
 	setPhyCon(deviceNumber, connection);
 	if(setup(deviceNumber))return true;
@@ -689,7 +926,7 @@ bool videoInput::setupDevice(int deviceNumber, int connection){
 // ----------------------------------------------------------------------
 
 bool videoInput::setupDevice(int deviceNumber, int w, int h){
-	if(deviceNumber >= VI_MAX_CAMERAS || VDList[deviceNumber]->readyToCapture) return false;
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return false;
 
 	setAttemptCaptureSize(deviceNumber, w, h);
 	if(setup(deviceNumber))return true;
@@ -703,7 +940,7 @@ bool videoInput::setupDevice(int deviceNumber, int w, int h){
 // ----------------------------------------------------------------------
 
 bool videoInput::setupDevice(int deviceNumber, int w, int h, int connection){
-	if(deviceNumber >= VI_MAX_CAMERAS || VDList[deviceNumber]->readyToCapture) return false;
+	if(deviceNumber >= VI_MAX_CAMERAS || getVideoDevice(deviceNumber)->readyToCapture) return false;
 
 	setAttemptCaptureSize(deviceNumber,w,h);
 	setPhyCon(deviceNumber, connection);
@@ -720,36 +957,36 @@ bool videoInput::setupDevice(int deviceNumber, int w, int h, int connection){
 // ----------------------------------------------------------------------
 
 bool videoInput::setFormat(int deviceNumber, int format){
-	if(deviceNumber >= VI_MAX_CAMERAS || !VDList[deviceNumber]->readyToCapture) return false;
+	if(deviceNumber >= VI_MAX_CAMERAS || !getVideoDevice(deviceNumber)->readyToCapture) return false;
 
 	bool returnVal = false;
 
 	if(format >= 0 && format < VI_NUM_FORMATS){
-		VDList[deviceNumber]->formatType = formatTypes[format];
-		VDList[deviceNumber]->specificFormat = true;
+		getVideoDevice(deviceNumber)->formatType = formatTypes[format];
+		getVideoDevice(deviceNumber)->specificFormat = true;
 
-		if(VDList[deviceNumber]->specificFormat){
+		if(getVideoDevice(deviceNumber)->specificFormat){
 
-			HRESULT hr = getDevice(&VDList[deviceNumber]->pVideoInputFilter, deviceNumber, VDList[deviceNumber]->wDeviceName, VDList[deviceNumber]->nDeviceName);
+			HRESULT hr = getDevice(&getVideoDevice(deviceNumber)->pVideoInputFilter, deviceNumber, getVideoDevice(deviceNumber)->wDeviceName, getVideoDevice(deviceNumber)->nDeviceName);
 			if(hr != S_OK){
 				return false;
 			}
 
 			IAMAnalogVideoDecoder *pVideoDec = NULL;
-	   		hr = VDList[deviceNumber]->pCaptureGraph->FindInterface(NULL, &MEDIATYPE_Video, VDList[deviceNumber]->pVideoInputFilter, IID_IAMAnalogVideoDecoder, (void **)&pVideoDec);
+	   		hr = getVideoDevice(deviceNumber)->pCaptureGraph->FindInterface(NULL, &MEDIATYPE_Video, getVideoDevice(deviceNumber)->pVideoInputFilter, IID_IAMAnalogVideoDecoder, (void **)&pVideoDec);
 
 			//in case the settings window some how freed them first
-			if(VDList[deviceNumber]->pVideoInputFilter)VDList[deviceNumber]->pVideoInputFilter->Release();
-			if(VDList[deviceNumber]->pVideoInputFilter)VDList[deviceNumber]->pVideoInputFilter = NULL;
+			if(getVideoDevice(deviceNumber)->pVideoInputFilter)getVideoDevice(deviceNumber)->pVideoInputFilter->Release();
+			if(getVideoDevice(deviceNumber)->pVideoInputFilter)getVideoDevice(deviceNumber)->pVideoInputFilter = NULL;
 
 			if(FAILED(hr)){
 				printf("SETUP: couldn't set requested format\n");
 			}else{
 				long lValue = 0;
 				hr = pVideoDec->get_AvailableTVFormats(&lValue);
-	    		if( SUCCEEDED(hr) && (lValue & VDList[deviceNumber]->formatType) )
+	    		if( SUCCEEDED(hr) && (lValue & getVideoDevice(deviceNumber)->formatType) )
 	   			{
-	       			hr = pVideoDec->put_TVFormat(VDList[deviceNumber]->formatType);
+	       			hr = pVideoDec->put_TVFormat(getVideoDevice(deviceNumber)->formatType);
 					if( FAILED(hr) ){
 						printf("SETUP: couldn't set requested format\n");
 					}else{
@@ -961,7 +1198,7 @@ int videoInput::getWidth(int id){
 
 	if(isDeviceSetup(id))
 	{
-		return VDList[id] ->width;
+		return getVideoDevice(id)->width;
 	}
 
 	return 0;
@@ -978,7 +1215,7 @@ int videoInput::getHeight(int id){
 
 	if(isDeviceSetup(id))
 	{
-		return VDList[id] ->height;
+		return getVideoDevice(id)->height;
 	}
 
 	return 0;
@@ -995,7 +1232,7 @@ int videoInput::getSize(int id){
 
 	if(isDeviceSetup(id))
 	{
-		return VDList[id] ->videoSize;
+		return getVideoDevice(id)->videoSize;
 	}
 
 	return 0;
@@ -1015,42 +1252,56 @@ bool videoInput::getPixels(int id, unsigned char * dstBuffer, bool flipRedAndBlu
 		if(bCallback){
 			//callback capture
 
-			DWORD result = WaitForSingleObject(VDList[id]->sgCallback->hEvent, 1000);
+			DWORD result = WaitForSingleObject(getVideoDevice(id)->sgCallback->hEvent, 1000);
 			if( result != WAIT_OBJECT_0) return false;
 
-			//double paranoia - mutexing with both event and critical section
-			EnterCriticalSection(&VDList[id]->sgCallback->critSection);
+			//the oldest sample queued - SampleCB leaves its slot alone until it is taken off the queue below,
+			//so it is converted without holding up the graph thread on the lock
+			SampleGrabberCallback * sgCallback = getVideoDevice(id)->sgCallback;
+			EnterCriticalSection(&sgCallback->critSection);
+				int slot = sgCallback->queueHead;
+			LeaveCriticalSection(&sgCallback->critSection);
+
+			unsigned char * src = sgCallback->pixels + (size_t)slot * sgCallback->numBytes;
+			unsigned char * dst = dstBuffer;
+			int height 			= getVideoDevice(id)->height;
+			int width  			= getVideoDevice(id)->width;
+
+			processPixels(src, dst, width, height, flipRedAndBlue, flipImage);
 
-				unsigned char * src = VDList[id]->sgCallback->pixels;
-				unsigned char * dst = dstBuffer;
-				int height 			= VDList[id]->height;
-				int width  			= VDList[id]->width;
+			EnterCriticalSection(&sgCallback->critSection);
 
-				processPixels(src, dst, width, height, flipRedAndBlue, flipImage);
-				VDList[id]->sgCallback->newFrame = false;
+				getVideoDevice(id)->lastFrameNumber	= sgCallback->frameNumber[slot];
+				getVideoDevice(id)->lastFrameTime	= sgCallback->frameTime[slot];
 
-			LeaveCriticalSection(&VDList[id]->sgCallback->critSection);
+				sgCallback->queueHead = (slot + 1) % sgCallback->queueSize;
+				sgCallback->queueCount--;
+				sgCallback->newFrame = (sgCallback->queueCount > 0);
+				if(sgCallback->queueCount == 0) ResetEvent(sgCallback->hEvent);
 
-			ResetEvent(VDList[id]->sgCallback->hEvent);
+			LeaveCriticalSection(&sgCallback->critSection);
 
 			success = true;
 
 		}
 		else{
 			//regular capture method
-			long bufferSize = VDList[id]->videoSize;
-			HRESULT hr = VDList[id]->pGrabber->GetCurrentBuffer(&bufferSize, (long *)VDList[id]->pBuffer);
+			long bufferSize = getVideoDevice(id)->videoSize;
+			HRESULT hr = getVideoDevice(id)->pGrabber->GetCurrentBuffer(&bufferSize, (long *)getVideoDevice(id)->pBuffer);
 			if(hr==S_OK){
-				int numBytes = VDList[id]->videoSize;
+				int numBytes = getVideoDevice(id)->videoSize;
 				if (numBytes == bufferSize){
 
-					unsigned char * src = (unsigned char * )VDList[id]->pBuffer;
+					unsigned char * src = (unsigned char * )getVideoDevice(id)->pBuffer;
 					unsigned char * dst = dstBuffer;
-					int height 			= VDList[id]->height;
-					int width 			= VDList[id]->width;
+					int height 			= getVideoDevice(id)->height;
+					int width 			= getVideoDevice(id)->width;
 
 					processPixels(src, dst, width, height, flipRedAndBlue, flipImage);
 					success = true;
+
+					getVideoDevice(id)->lastFrameNumber++;
+					getVideoDevice(id)->lastFrameTime	= getPerformanceTime();
 				}else{
 					if(verbose)printf("ERROR: GetPixels() - bufferSizes do not match!\n");
 				}
@@ -1070,14 +1321,80 @@ bool videoInput::getPixels(int id, unsigned char * dstBuffer, bool flipRedAndBlu
 unsigned char * videoInput::getPixels(int id, bool flipRedAndBlue, bool flipImage){
 
 	if(isDeviceSetup(id)){
-   		getPixels(id, VDList[id]->pixels, flipRedAndBlue, flipImage);
+		videoDevice * VD = getVideoDevice(id);
+		if(VD->pixels == NULL){
+			VD->pixels = new unsigned char[VD->videoSize];
+			memset(VD->pixels, 0, VD->videoSize);
+		}
+   		getPixels(id, VD->pixels, flipRedAndBlue, flipImage);
+		return VD->pixels;
 	}
 
-	return VDList[id]->pixels;
+	return NULL;
 }
 
 
 
+// ----------------------------------------------------------------------
+// Sample number and arrival time (in seconds on the performance counter
+// clock) of the frame returned by the last getPixels call
+// ----------------------------------------------------------------------
+
+unsigned long videoInput::getFrameNumber(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->lastFrameNumber;
+	}
+
+	return 0;
+
+}
+
+double videoInput::getTime(){
+	return getPerformanceTime();
+}
+
+double videoInput::getFrameTime(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->lastFrameTime;
+	}
+
+	return 0.0;
+
+}
+
+
+// ----------------------------------------------------------------------
+// Capture health counters
+//
+// ----------------------------------------------------------------------
+
+unsigned long videoInput::getSampleCount(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->sgCallback->sampleCount;
+	}
+
+	return 0;
+
+}
+
+unsigned long videoInput::getDroppedSampleCount(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->sgCallback->droppedCount;
+	}
+
+	return 0;
+
+}
+
+
 // ----------------------------------------------------------------------
 //
 //
@@ -1087,35 +1404,46 @@ bool videoInput::isFrameNew(int id){
 	if(!bCallback)return true;
 
 	bool result = false;
-	bool freeze = false;
 
 	//again super paranoia!
-	EnterCriticalSection(&VDList[id]->sgCallback->critSection);
-		result = VDList[id]->sgCallback->newFrame;
+	EnterCriticalSection(&getVideoDevice(id)->sgCallback->critSection);
+		result = getVideoDevice(id)->sgCallback->newFrame;
+	LeaveCriticalSection(&getVideoDevice(id)->sgCallback->critSection);
+
+	return result;
+}
 
-		//we need to give it some time at the begining to start up so lets check after 400 frames
-		if(VDList[id]->nFramesRunning > 400 && VDList[id]->sgCallback->freezeCheck > VDList[id]->nFramesForReconnect ){
-			freeze = true;
-		}
 
-		//we increment the freezeCheck var here - the callback resets it to 1
-		//so as long as the callback is running this var should never get too high.
-		//if the callback is not running then this number will get high and trigger the freeze action below
-		VDList[id]->sgCallback->freezeCheck++;
-	LeaveCriticalSection(&VDList[id]->sgCallback->critSection);
+// ----------------------------------------------------------------------
+//
+//
+// ----------------------------------------------------------------------
+HANDLE videoInput::getFrameEvent(int id){
+	if(!isDeviceSetup(id) || !bCallback) return NULL;
+	return getVideoDevice(id)->sgCallback->hEvent;
+}
 
-	VDList[id]->nFramesRunning++;
 
-	if(freeze && VDList[id]->autoReconnect){
-		if(verbose)printf("ERROR: Device seems frozen - attempting to reconnect\n");
-		if( !restartDevice(VDList[id]->myID) ){
-			if(verbose)printf("ERROR: Unable to reconnect to device\n");
-		}else{
-			if(verbose)printf("SUCCESS: Able to reconnect to device\n");
-		}
+// ----------------------------------------------------------------------
+// Freeze detection by wall clock - true when auto reconnect is on and
+// no sample has arrived for longer than the freeze timeout.
+// Does not reconnect by itself, call restartDevice when it says so.
+// ----------------------------------------------------------------------
+bool videoInput::isDeviceFrozen(int id){
+	if(!isDeviceSetup(id)) return false;
+	if(!bCallback || !getVideoDevice(id)->autoReconnect) return false;
+
+	//the callback only ever moves this forward, start() sets it when the graph starts running
+	EnterCriticalSection(&getVideoDevice(id)->sgCallback->critSection);
+		double lastSampleTime = getVideoDevice(id)->sgCallback->lastSampleTime;
+	LeaveCriticalSection(&getVideoDevice(id)->sgCallback->critSection);
+	double elapsed = getPerformanceTime() - lastSampleTime;
+	if(elapsed * 1000.0 > getVideoDevice(id)->freezeTimeout){
+		if(verbose)printf("ERROR: Device %i seems frozen - no frame for %.0f ms\n", id, elapsed * 1000.0);
+		return true;
 	}
 
-	return result;
+	return false;
 }
 
 
@@ -1126,7 +1454,7 @@ bool videoInput::isFrameNew(int id){
 
 bool videoInput::isDeviceSetup(int id){
 
-	if(id<devicesFound && VDList[id]->readyToCapture)return true;
+	if(id<devicesFound && VDList[id] != NULL && VDList[id]->readyToCapture)return true;
 	else return false;
 
 }
@@ -1161,7 +1489,7 @@ void videoInput::showSettingsWindow(int id){
 		//we reconnect to the device as we have freed our reference to it
 		//why have we freed our reference? because there seemed to be an issue
 		//with some mpeg devices if we didn't
-		HRESULT hr = getDevice(&VDList[id]->pVideoInputFilter, id, VDList[id]->wDeviceName, VDList[id]->nDeviceName);
+		HRESULT hr = getDevice(&getVideoDevice(id)->pVideoInputFilter, id, getVideoDevice(id)->wDeviceName, getVideoDevice(id)->nDeviceName);
 		if(hr == S_OK){
 			myTempThread = (HANDLE)_beginthread(basicThread, 0, (void *)&VDList[id]);
 		}
@@ -1175,7 +1503,7 @@ bool videoInput::getVideoSettingFilter(int deviceID, long Property, long &min, l
 
 	HRESULT hr;
 
-	videoDevice * VD = VDList[deviceID];
+	videoDevice * VD = getVideoDevice(deviceID);
 
 	hr = getDevice(&VD->pVideoInputFilter, deviceID, VD->wDeviceName, VD->nDeviceName);
 	if (FAILED(hr)){
@@ -1250,7 +1578,7 @@ bool videoInput::setVideoSettingFilter(int deviceID, long Property, long lValue,
 
 	HRESULT hr;
 
-	videoDevice * VD = VDList[deviceID];
+	videoDevice * VD = getVideoDevice(deviceID);
 
 	hr = getDevice(&VD->pVideoInputFilter, deviceID, VD->wDeviceName, VD->nDeviceName);
 	if (FAILED(hr)){
@@ -1335,10 +1663,10 @@ bool videoInput::setVideoSettingCamera(int deviceID, long Property, long lValue,
 	if(isDeviceSetup(deviceID))
 	{
 		HRESULT hr;
-		hr = getDevice(&VDList[deviceID]->pVideoInputFilter, deviceID, VDList[deviceID]->wDeviceName, VDList[deviceID]->nDeviceName);
+		hr = getDevice(&getVideoDevice(deviceID)->pVideoInputFilter, deviceID, getVideoDevice(deviceID)->wDeviceName, getVideoDevice(deviceID)->nDeviceName);
 
 		if (verbose) printf("Setting video setting %ld.\n", Property);
-		hr = VDList[deviceID]->pVideoInputFilter->QueryInterface(IID_IAMCameraControl, (void**)&pIAMCameraControl);
+		hr = getVideoDevice(deviceID)->pVideoInputFilter->QueryInterface(IID_IAMCameraControl, (void**)&pIAMCameraControl);
 		if (FAILED(hr)) {
 			printf("Error\n");
 			return false;
@@ -1372,7 +1700,7 @@ bool videoInput::getVideoSettingCamera(int deviceID, long Property, long &min, l
 
 	HRESULT hr;
 
-	videoDevice * VD = VDList[deviceID];
+	videoDevice * VD = getVideoDevice(deviceID);
 
 	hr = getDevice(&VD->pVideoInputFilter, deviceID, VD->wDeviceName, VD->nDeviceName);
 	if (FAILED(hr)){
@@ -1413,8 +1741,9 @@ bool videoInput::getVideoSettingCamera(int deviceID, long Property, long &min, l
 void videoInput::stopDevice(int id){
 	if(id < VI_MAX_CAMERAS)
 	{
+		//made again on first use, so it is ready to be setup again
 		delete VDList[id];
-		VDList[id] = new videoDevice();
+		VDList[id] = NULL;
 	}
 
 }
@@ -1427,24 +1756,34 @@ void videoInput::stopDevice(int id){
 bool videoInput::restartDevice(int id){
 	if(isDeviceSetup(id))
 	{
-		int conn	 	= VDList[id]->storeConn;
-		int tmpW	   	= VDList[id]->width;
-		int tmpH	   	= VDList[id]->height;
+		int conn	 	= getVideoDevice(id)->storeConn;
+		int tmpW	   	= getVideoDevice(id)->width;
+		int tmpH	   	= getVideoDevice(id)->height;
+
+		bool bFormat    = getVideoDevice(id)->specificFormat;
+		long format     = getVideoDevice(id)->formatType;
 
-		bool bFormat    = VDList[id]->specificFormat;
-		long format     = VDList[id]->formatType;
+		int msReconnect	= getVideoDevice(id)->freezeTimeout;
+		bool bReconnect = getVideoDevice(id)->autoReconnect;
 
-		int nReconnect	= VDList[id]->nFramesForReconnect;
-		bool bReconnect = VDList[id]->autoReconnect;
+		unsigned long avgFrameTime = getVideoDevice(id)->requestedFrameTime;
+		bool bLossless = getVideoDevice(id)->sgCallback->lossless;
 
-		unsigned long avgFrameTime = VDList[id]->requestedFrameTime;
+		audioSampleSink * audioSink	= getVideoDevice(id)->audioSink;
+		int audioRate				= getVideoDevice(id)->audioRate;
+		int audioChannels			= getVideoDevice(id)->audioChannels;
 
 		stopDevice(id);
 
+		if( audioSink != NULL ){
+			setupAudio(id, audioRate, audioChannels, audioSink);
+		}
+
 		//set our fps if needed
 		if( avgFrameTime != -1){
-			VDList[id]->requestedFrameTime = avgFrameTime;
+			getVideoDevice(id)->requestedFrameTime = avgFrameTime;
 		}
+		setLossless(id, bLossless);
 
 		if( setupDevice(id, tmpW, tmpH, conn) ){
 			//reapply the format - ntsc / pal etc
@@ -1452,7 +1791,7 @@ bool videoInput::restartDevice(int id){
 				setFormat(id, format);
 			}
 			if( bReconnect ){
-				setAutoReconnectOnFreeze(id, true, nReconnect);
+				setAutoReconnectOnFreeze(id, true, msReconnect);
 			}
 			return true;
 		}
@@ -1478,6 +1817,16 @@ videoInput::~videoInput(){
 //////////////////////////////  VIDEO INPUT  ////////////////////////////////
 ////////////////////////////  PRIVATE METHODS  //////////////////////////////
 
+// ----------------------------------------------------------------------
+// Device objects are made the first time a device is used, so an
+// instance opening one camera doesn't carry VI_MAX_CAMERAS of them
+// ----------------------------------------------------------------------
+
+videoDevice * videoInput::getVideoDevice(int id){
+	if(VDList[id] == NULL) VDList[id] = new videoDevice();
+	return VDList[id];
+}
+
 // ----------------------------------------------------------------------
 // We only should init com if it hasn't been done so by our apps thread
 // Use a static counter to keep track of other times it has been inited
@@ -1485,6 +1834,7 @@ videoInput::~videoInput(){
 // ----------------------------------------------------------------------
 
 bool videoInput::comInit(){
+	std::lock_guard<std::mutex> lock(comInitLock);
 	HRESULT hr = NULL;
 
 	//no need for us to start com more than once
@@ -1516,6 +1866,7 @@ bool videoInput::comInit(){
 // ----------------------------------------------------------------------
 
 bool videoInput::comUnInit(){
+	std::lock_guard<std::mutex> lock(comInitLock);
 	if(comInitCount > 0)comInitCount--;		//decrease the count of instances using com
 
    	if(comInitCount == 0){
@@ -1534,9 +1885,9 @@ bool videoInput::comUnInit(){
 
 void videoInput::setAttemptCaptureSize(int id, int w, int h){
 
-	VDList[id]->tryWidth    = w;
-	VDList[id]->tryHeight   = h;
-	VDList[id]->tryDiffSize = true;
+	getVideoDevice(id)->tryWidth    = w;
+	getVideoDevice(id)->tryHeight   = h;
+	getVideoDevice(id)->tryDiffSize = true;
 
 }
 
@@ -1551,27 +1902,27 @@ void videoInput::setPhyCon(int id, int conn){
 		switch(conn){
 
 			case 0:
-				VDList[id]->connection = PhysConn_Video_Composite;
+				getVideoDevice(id)->connection = PhysConn_Video_Composite;
 				break;
 			case 1:
-				VDList[id]->connection = PhysConn_Video_SVideo;
+				getVideoDevice(id)->connection = PhysConn_Video_SVideo;
 				break;
 			case 2:
-				VDList[id]->connection = PhysConn_Video_Tuner;
+				getVideoDevice(id)->connection = PhysConn_Video_Tuner;
 				break;
 			case 3:
-				VDList[id]->connection = PhysConn_Video_USB;
+				getVideoDevice(id)->connection = PhysConn_Video_USB;
 				break;
 			case 4:
-				VDList[id]->connection = PhysConn_Video_1394;
+				getVideoDevice(id)->connection = PhysConn_Video_1394;
 				break;
 			default:
 				return; //if it is not these types don't set crossbar
 			break;
 		}
 
-		VDList[id]->storeConn	= conn;
-		VDList[id]->useCrossbar	= true;
+		getVideoDevice(id)->storeConn	= conn;
+		getVideoDevice(id)->useCrossbar	= true;
 }
 
 
@@ -1590,13 +1941,13 @@ bool videoInput::setup(int deviceNumber){
     	return false;
     }
 
-    if(VDList[deviceNumber]->readyToCapture)
+    if(getVideoDevice(deviceNumber)->readyToCapture)
     {
-    	if(verbose)printf("SETUP: can't setup, device %i is currently being used\n",VDList[deviceNumber]->myID);
+    	if(verbose)printf("SETUP: can't setup, device %i is currently being used\n",getVideoDevice(deviceNumber)->myID);
     	return false;
     }
 
-    HRESULT hr = start(deviceNumber, VDList[deviceNumber]);
+    HRESULT hr = start(deviceNumber, getVideoDevice(deviceNumber));
     if(hr == S_OK)return true;
 	else return false;
 }
@@ -1614,12 +1965,10 @@ void videoInput::processPixels(unsigned char * src, unsigned char * dst, int wid
 
 	if(!bRGB){
 		if(bFlip){
-			for(int y = 0; y < height; y++){
-				memcpy(dst + (y * widthInBytes), src + ( (height -y -1) * widthInBytes), widthInBytes);
-			}
+			CopyFrameRows(dst, widthInBytes, src + (height - 1) * widthInBytes, -widthInBytes, widthInBytes, height);
 
 		}else{
-			memcpy(dst, src, numBytes);
+			CopyFrame(dst, src, numBytes);
 		}
 	}else{
 		if(bFlip){
@@ -1695,25 +2044,49 @@ void videoInput::getMediaSubtypeAsString(GUID type, char * typeAsString){
 
 void videoInput::setRequestedMediaSubType(int mediatype) {
 	requestedMediaSubType = mediaSubtypes[mediatype];
+	autoMediaSubType = false;
+}
+
+void videoInput::setAutoMediaSubType(bool useAuto) {
+	autoMediaSubType = useAuto;
+}
+
+int videoInput::getBufferMemory(int id){
+
+	if(id < 0 || id >= VI_MAX_CAMERAS || VDList[id] == NULL) return 0;
+
+	videoDevice * VD = VDList[id];
+	int bytes = 0;
+	if(VD->sgCallback && VD->sgCallback->bufferSetup) bytes += VD->sgCallback->numBytes * VD->sgCallback->queueSize;
+	if(VD->pixels)		bytes += VD->videoSize;
+	if(VD->pBuffer)		bytes += VD->videoSize;
+	return bytes;
+
+}
+
+std::string videoInput::getCaptureModeReport(int id){
+
+	if(isDeviceSetup(id))
+	{
+		return getVideoDevice(id)->modeReport;
+	}
+
+	return std::string();
+
 }
 
 
 //-------------------------------------------------------------------------------------------
-static void findClosestSizeAndSubtype(videoDevice * VD, int widthIn, int heightIn, int &widthOut, int &heightOut, GUID & mediatypeOut){
+//reads the capability table of the stream - one entry per format type RGB24 YUV2 etc
+static void enumerateCapabilities(videoDevice * VD, std::vector<videoCapability> & caps){
 	HRESULT hr;
 
-	//find perfect match or closest size
-	int nearW				= 9999999;
-	int nearH				= 9999999;
-	bool foundClosestMatch 	= true;
-
 	int iCount = 0;
 	int iSize = 0;
 	hr = VD->streamConf->GetNumberOfCapabilities(&iCount, &iSize);
 
 	if (iSize == sizeof(VIDEO_STREAM_CONFIG_CAPS))
 	{
-		//For each format type RGB24 YUV2 etc
 	    for (int iFormat = 0; iFormat < iCount; iFormat++)
 	    {
 			VIDEO_STREAM_CONFIG_CAPS scc;
@@ -1721,78 +2094,105 @@ static void findClosestSizeAndSubtype(videoDevice * VD, int widthIn, int heightI
 			hr =  VD->streamConf->GetStreamCaps(iFormat, &pmtConfig, (BYTE*)&scc);
 
 			if (SUCCEEDED(hr)){
-
-				//his is how many diff sizes are available for the format
-	            int stepX = scc.OutputGranularityX;
-	            int stepY = scc.OutputGranularityY;
-
-	       		int tempW = 999999;
-	       		int tempH = 999999;
-
-	       		//Don't want to get stuck in a loop
-	       		if(stepX < 1 || stepY < 1) continue;
-
-	       		//if(verbose)printf("min is %i %i max is %i %i - res is %i %i \n", scc.MinOutputSize.cx, scc.MinOutputSize.cy,  scc.MaxOutputSize.cx,  scc.MaxOutputSize.cy, stepX, stepY);
-	       		//if(verbose)printf("min frame duration is %i  max duration is %i\n", scc.MinFrameInterval, scc.MaxFrameInterval);
-
-	       		bool exactMatch 	= false;
-	       		bool exactMatchX	= false;
-				bool exactMatchY	= false;
-
-	            for(int x = scc.MinOutputSize.cx; x <= scc.MaxOutputSize.cx; x+= stepX){
-	            	//If we find an exact match
-	            	if( widthIn == x ){
-						exactMatchX = true;
-	            		tempW = x;
-	            	}
-	            	//Otherwise lets find the closest match based on width
-	            	else if( abs(widthIn-x) < abs(widthIn-tempW) ){
-	            		tempW = x;
-	            	}
-	            }
-
-	            for(int y = scc.MinOutputSize.cy; y <= scc.MaxOutputSize.cy; y+= stepY){
-	            	//If we find an exact match
-	            	if( heightIn == y){
-						exactMatchY = true;
-	            		tempH = y;
-	            	}
-	            	//Otherwise lets find the closest match based on height
-	            	else if( abs(heightIn-y) < abs(heightIn-tempH) ){
-	            		tempH = y;
-	            	}
-	            }
-
-		        //see if we have an exact match!
-		        if(exactMatchX && exactMatchY){
-		        	foundClosestMatch = false;
-		        	exactMatch = true;
-
-					widthOut		= widthIn;
-					heightOut		= heightIn;
-					mediatypeOut	= pmtConfig->subtype;
-		        }
-
-		      	//otherwise lets see if this filters closest size is the closest
-		      	//available. the closest size is determined by the sum difference
-		    	//of the widths and heights
-		      	else if( abs(widthIn - tempW) + abs(heightIn - tempH)  < abs(widthIn - nearW) + abs(heightIn - nearH) )
-		      	{
-		      		nearW = tempW;
-		      		nearH = tempH;
-
-					widthOut		= nearW;
-					heightOut		= nearH;
-					mediatypeOut	= pmtConfig->subtype;
-		      	}
+				videoCapability cap;
+				cap.subtype				= pmtConfig->subtype;
+				cap.minWidth			= scc.MinOutputSize.cx;
+				cap.minHeight			= scc.MinOutputSize.cy;
+				cap.maxWidth			= scc.MaxOutputSize.cx;
+				cap.maxHeight			= scc.MaxOutputSize.cy;
+				cap.stepX				= scc.OutputGranularityX;
+				cap.stepY				= scc.OutputGranularityY;
+				cap.minFrameInterval	= scc.MinFrameInterval;
+				cap.maxFrameInterval	= scc.MaxFrameInterval;
+				caps.push_back(cap);
 
 		        MyDeleteMediaType(pmtConfig);
-
-		        //If we have found an exact match no need to search anymore
-		        if(exactMatch)break;
 	        }
 	     }
 	}
+}
+
+
+//-------------------------------------------------------------------------------------------
+static void findClosestSizeAndSubtype(const std::vector<videoCapability> & caps, int widthIn, int heightIn, int &widthOut, int &heightOut, GUID & mediatypeOut){
+
+	//find perfect match or closest size
+	int nearW				= 9999999;
+	int nearH				= 9999999;
+	bool foundClosestMatch 	= true;
+
+	//For each format type RGB24 YUV2 etc
+    for (size_t iFormat = 0; iFormat < caps.size(); iFormat++)
+    {
+		const videoCapability & cap = caps[iFormat];
+
+		//his is how many diff sizes are available for the format
+        int stepX = cap.stepX;
+        int stepY = cap.stepY;
+
+   		int tempW = 999999;
+   		int tempH = 999999;
+
+   		//Don't want to get stuck in a loop
+   		if(stepX < 1 || stepY < 1) continue;
+
+   		//if(verbose)printf("min is %i %i max is %i %i - res is %i %i \n", cap.minWidth, cap.minHeight,  cap.maxWidth,  cap.maxHeight, stepX, stepY);
+   		//if(verbose)printf("min frame duration is %i  max duration is %i\n", cap.minFrameInterval, cap.maxFrameInterval);
+
+   		bool exactMatch 	= false;
+   		bool exactMatchX	= false;
+		bool exactMatchY	= false;
+
+        for(int x = cap.minWidth; x <= cap.maxWidth; x+= stepX){
+        	//If we find an exact match
+        	if( widthIn == x ){
+				exactMatchX = true;
+        		tempW = x;
+        	}
+        	//Otherwise lets find the closest match based on width
+        	else if( abs(widthIn-x) < abs(widthIn-tempW) ){
+        		tempW = x;
+        	}
+        }
+
+        for(int y = cap.minHeight; y <= cap.maxHeight; y+= stepY){
+        	//If we find an exact match
+        	if( heightIn == y){
+				exactMatchY = true;
+        		tempH = y;
+        	}
+        	//Otherwise lets find the closest match based on height
+        	else if( abs(heightIn-y) < abs(heightIn-tempH) ){
+        		tempH = y;
+        	}
+        }
+
+        //see if we have an exact match!
+        if(exactMatchX && exactMatchY){
+        	foundClosestMatch = false;
+        	exactMatch = true;
+
+			widthOut		= widthIn;
+			heightOut		= heightIn;
+			mediatypeOut	= cap.subtype;
+        }
+
+      	//otherwise lets see if this filters closest size is the closest
+      	//available. the closest size is determined by the sum difference
+    	//of the widths and heights
+      	else if( abs(widthIn - tempW) + abs(heightIn - tempH)  < abs(widthIn - nearW) + abs(heightIn - nearH) )
+      	{
+      		nearW = tempW;
+      		nearH = tempH;
+
+			widthOut		= nearW;
+			heightOut		= nearH;
+			mediatypeOut	= cap.subtype;
+      	}
+
+        //If we have found an exact match no need to search anymore
+        if(exactMatch)break;
+    }
 
 }
 
@@ -1837,6 +2237,112 @@ static bool setSizeAndSubtype(videoDevice * VD, int attemptWidth, int attemptHei
 	return false;
 }
 
+// ----------------------------------------------------------------------
+// Renders the audio pin of the capture filter through a grabber
+// into a null renderer - returns false when there is no usable pin
+// ----------------------------------------------------------------------
+
+static bool setupAudioStream(videoDevice * VD){
+
+	HRESULT hr;
+
+	WAVEFORMATEX wfx;
+	ZeroMemory(&wfx, sizeof(WAVEFORMATEX));
+	wfx.wFormatTag		= WAVE_FORMAT_PCM;
+	wfx.nChannels		= (WORD)VD->audioChannels;
+	wfx.nSamplesPerSec	= VD->audioRate;
+	wfx.wBitsPerSample	= 16;
+	wfx.nBlockAlign		= (WORD)(wfx.nChannels * wfx.wBitsPerSample / 8);
+	wfx.nAvgBytesPerSec	= wfx.nSamplesPerSec * wfx.nBlockAlign;
+
+	AM_MEDIA_TYPE amt;
+	ZeroMemory(&amt, sizeof(AM_MEDIA_TYPE));
+	amt.majortype			= MEDIATYPE_Audio;
+	amt.subtype				= MEDIASUBTYPE_PCM;
+	amt.bFixedSizeSamples	= TRUE;
+	amt.lSampleSize			= wfx.nBlockAlign;
+	amt.formattype			= FORMAT_WaveFormatEx;
+	amt.cbFormat			= sizeof(WAVEFORMATEX);
+	amt.pbFormat			= (BYTE *)&wfx;
+
+	//ask the pin for exactly the format we deliver - there is no converter in between
+	IAMStreamConfig * audioConf = NULL;
+	hr = VD->pCaptureGraph->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Audio, VD->pVideoInputFilter, IID_IAMStreamConfig, (void **)&audioConf);
+	if(FAILED(hr)){
+		if(verbose)printf("SETUP: Device has no audio pin\n");
+		return false;
+	}
+	hr = audioConf->SetFormat(&amt);
+	audioConf->Release();
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Audio pin doesn't support %i Hz, %i channels, 16 bit\n", VD->audioRate, VD->audioChannels);
+		return false;
+	}
+
+	//the default buffers hold half a second or more - ask for 10ms ones to keep the latency down
+	IAMBufferNegotiation * audioBuffers = NULL;
+	hr = VD->pCaptureGraph->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Audio, VD->pVideoInputFilter, IID_IAMBufferNegotiation, (void **)&audioBuffers);
+	if(SUCCEEDED(hr)){
+		ALLOCATOR_PROPERTIES props;
+		props.cbBuffer	= wfx.nAvgBytesPerSec / 100;
+		props.cBuffers	= 8;
+		props.cbAlign	= -1;
+		props.cbPrefix	= -1;
+		audioBuffers->SuggestAllocatorProperties(&props);
+		audioBuffers->Release();
+	}
+
+	hr = CoCreateInstance(CLSID_SampleGrabber, NULL, CLSCTX_INPROC_SERVER, IID_IBaseFilter, (void**)&VD->pAudioGrabberF);
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not Create Audio Sample Grabber - CoCreateInstance()\n");
+		return false;
+	}
+
+	hr = VD->pGraph->AddFilter(VD->pAudioGrabberF, L"Audio Grabber");
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not add Audio Sample Grabber - AddFilter()\n");
+		return false;
+	}
+
+	hr = VD->pAudioGrabberF->QueryInterface(IID_ISampleGrabber, (void**)&VD->pAudioGrabber);
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not query Audio SampleGrabber\n");
+		return false;
+	}
+
+	VD->pAudioGrabber->SetOneShot(FALSE);
+	VD->pAudioGrabber->SetBufferSamples(FALSE);
+	VD->pAudioGrabber->SetMediaType(&amt);
+
+	VD->audioCallback = new AudioGrabberCallback(VD->audioSink, VD->audioRate, VD->audioChannels);
+	hr = VD->pAudioGrabber->SetCallback(VD->audioCallback, 0);
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: problem setting audio callback\n");
+		return false;
+	}
+
+	hr = CoCreateInstance(CLSID_NullRenderer, NULL, CLSCTX_INPROC_SERVER, IID_IBaseFilter, (void**)(&VD->pAudioDestFilter));
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not create filter - Audio NullRenderer\n");
+		return false;
+	}
+
+	hr = VD->pGraph->AddFilter(VD->pAudioDestFilter, L"Audio NullRenderer");
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not add filter - Audio NullRenderer\n");
+		return false;
+	}
+
+	hr = VD->pCaptureGraph->RenderStream(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Audio, VD->pVideoInputFilter, VD->pAudioGrabberF, VD->pAudioDestFilter);
+	if(FAILED(hr)){
+		if(verbose)printf("ERROR: Could not connect audio pins - RenderStream()\n");
+		return false;
+	}
+
+	return true;
+}
+
+
 // ----------------------------------------------------------------------
 // Where all the work happens!
 // Attempts to build a graph for the specified device
@@ -1894,7 +2400,7 @@ int videoInput::start(int deviceID, videoDevice *VD){
 
 	//FIND VIDEO DEVICE AND ADD TO GRAPH//
 	//gets the device specified by the second argument.
-	hr = getDevice(&VD->pVideoInputFilter, deviceID, VD->wDeviceName, VD->nDeviceName);
+	hr = getDevice(&VD->pVideoInputFilter, deviceID, VD->wDeviceName, VD->nDeviceName, &VD->uniqueName);
 
 	if (SUCCEEDED(hr)){
 		if(verbose)printf("SETUP: %s\n", VD->nDeviceName);
@@ -1953,26 +2459,82 @@ int videoInput::start(int deviceID, videoDevice *VD){
 		if(verbose)	printf("SETUP: Default Format is set to %i by %i \n", currentWidth, currentHeight);
 
 		char guidStr[8];
-		getMediaSubtypeAsString(requestedMediaSubType, guidStr); 
+		GUID foundSubtype = requestedMediaSubType;
+
+		//the capability table and the mode that worked last time come from the on-disk cache when possible
+		capabilityCacheEntry cacheEntry;
+		bool cachedTable = capabilityCache::lookup(VD->uniqueName, cacheEntry);
+		if( !cachedTable ){
+			enumerateCapabilities(VD, cacheEntry.caps);
+		}
 
-		if(verbose)printf("SETUP: trying requested format %s @ %i by %i\n", guidStr, VD->tryWidth, VD->tryHeight);
-		if( setSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, requestedMediaSubType) ) {
+		//auto mode - pick the cheapest mode for what we have to deliver
+		if( autoMediaSubType ){
+			double fps = (VD->requestedFrameTime > 0) ? 10000000.0 / (double)VD->requestedFrameTime : 30.0;
+			double busBudget = (VD->storeConn == VI_USB) ? VI_USB_BANDWIDTH : 0.0;
+
+			std::vector<captureModeScore> scores;
+			int selected = selectCaptureMode(cacheEntry.caps, formatCosts, VD->tryWidth, VD->tryHeight, fps, busBudget, scores);
+			VD->modeReport = describeCaptureModeSelection(scores, selected);
+			if(verbose)printf("SETUP: %s\n", VD->modeReport.c_str());
+
+			if( selected >= 0 && setSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, scores[selected].subtype) ){
 				VD->setSize(VD->tryWidth, VD->tryHeight);
+				foundSubtype = scores[selected].subtype;
 				foundSize = true;
+			}
 		}
 
+		const videoCaptureMode * knownMode = cacheEntry.findMode(VD->tryWidth, VD->tryHeight);
+		if( !foundSize && knownMode != NULL ){
+			videoCaptureMode mode = *knownMode;
+			getMediaSubtypeAsString(mode.subtype, guidStr);
 
-		if (!foundSize) {
-
-			for(int i = 0; i < VI_NUM_TYPES; i++){
+			if(verbose)printf("SETUP: trying cached format %s @ %i by %i\n", guidStr, mode.width, mode.height);
+			if( setSizeAndSubtype(VD, mode.width, mode.height, mode.subtype) ){
+				VD->setSize(mode.width, mode.height);
+				foundSubtype = mode.subtype;
+				foundSize = true;
+			}else{
+				//the device changed - forget what we knew and negotiate from scratch
+				if(verbose)printf("SETUP: cached format failed - invalidating capability cache\n");
+				capabilityCache::invalidate(VD->uniqueName);
+				cacheEntry = capabilityCacheEntry();
+				enumerateCapabilities(VD, cacheEntry.caps);
+				cachedTable = false;
+			}
+		}
 
-				getMediaSubtypeAsString(mediaSubtypes[i], guidStr);
+		if (!foundSize) {
+			getMediaSubtypeAsString(requestedMediaSubType, guidStr);
 
-				if(verbose)printf("SETUP: trying format %s @ %i by %i\n", guidStr, VD->tryWidth, VD->tryHeight);
-				if( setSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, mediaSubtypes[i]) ){
+			if(verbose)printf("SETUP: trying requested format %s @ %i by %i\n", guidStr, VD->tryWidth, VD->tryHeight);
+			if( setSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, requestedMediaSubType) ) {
 					VD->setSize(VD->tryWidth, VD->tryHeight);
+					foundSubtype = requestedMediaSubType;
 					foundSize = true;
-					break;
+			}
+		}
+
+
+		if (!foundSize) {
+
+			//first the subtypes the device lists for this size, then the rest just in case
+			for(int pass = 0; pass < 2 && !foundSize; pass++){
+				for(int i = 0; i < VI_NUM_TYPES; i++){
+
+					bool listed = cacheEntry.supports(mediaSubtypes[i], VD->tryWidth, VD->tryHeight);
+					if( listed != (pass == 0) ) continue;
+
+					getMediaSubtypeAsString(mediaSubtypes[i], guidStr);
+
+					if(verbose)printf("SETUP: trying format %s @ %i by %i\n", guidStr, VD->tryWidth, VD->tryHeight);
+					if( setSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, mediaSubtypes[i]) ){
+						VD->setSize(VD->tryWidth, VD->tryHeight);
+						foundSubtype = mediaSubtypes[i];
+						foundSize = true;
+						break;
+					}
 				}
 			}
 
@@ -1983,14 +2545,15 @@ int videoInput::start(int deviceID, videoDevice *VD){
 
 
 		//if we didn't find the requested size - lets try and find the closest matching size
-		if( foundSize == false ){
+		//a table from the cache gets one more go after being enumerated afresh, the device may have changed
+		while( foundSize == false ){
 			if( verbose )printf("SETUP: couldn't find requested size - searching for closest matching size\n");
 
 			int closestWidth		= -1;
 			int closestHeight		= -1;
 			GUID newMediaSubtype;
 
-			findClosestSizeAndSubtype(VD, VD->tryWidth, VD->tryHeight, closestWidth, closestHeight, newMediaSubtype);
+			findClosestSizeAndSubtype(cacheEntry.caps, VD->tryWidth, VD->tryHeight, closestWidth, closestHeight, newMediaSubtype);
 
 			if( closestWidth != -1 && closestHeight != -1){
 				getMediaSubtypeAsString(newMediaSubtype, guidStr);
@@ -1998,9 +2561,32 @@ int videoInput::start(int deviceID, videoDevice *VD){
 				if(verbose)printf("SETUP: closest supported size is %s @ %i %i\n", guidStr, closestWidth, closestHeight);
 				if( setSizeAndSubtype(VD, closestWidth, closestHeight, newMediaSubtype) ){
 					VD->setSize(closestWidth, closestHeight);
+					foundSubtype = newMediaSubtype;
 					foundSize = true;
 				}
 			}
+
+			if( foundSize || !cachedTable ) break;
+			if(verbose)printf("SETUP: nothing in the cached capabilities worked - enumerating them again\n");
+			cacheEntry = capabilityCacheEntry();
+			enumerateCapabilities(VD, cacheEntry.caps);
+			cachedTable = false;
+		}
+
+		//remember what worked, so the next open tries it first; when nothing did, whatever is cached is stale
+		if( !foundSize ){
+			if(verbose)printf("SETUP: negotiation failed - invalidating capability cache\n");
+			capabilityCache::invalidate(VD->uniqueName);
+		}
+		if( foundSize ){
+			videoCaptureMode mode;
+			mode.requestedWidth		= VD->tryWidth;
+			mode.requestedHeight	= VD->tryHeight;
+			mode.subtype			= foundSubtype;
+			mode.width				= VD->width;
+			mode.height				= VD->height;
+			cacheEntry.setMode(mode);
+			capabilityCache::store(VD->uniqueName, cacheEntry);
 		}
 	}
 
@@ -2045,6 +2631,13 @@ int videoInput::start(int deviceID, videoDevice *VD){
 		hr = VD->pGrabber->SetBufferSamples(TRUE);
 	}
 
+	//only the buffer of the capture method in use is made
+	if(bCallback){
+		VD->sgCallback->setupBuffer(VD->videoSize);
+	}else{
+		VD->pBuffer = new char[VD->videoSize];
+	}
+
 	if(bCallback){
 		//Tell the grabber to use our callback function - 0 is for SampleCB and 1 for BufferCB
 		//We use SampleCB
@@ -2110,6 +2703,35 @@ int videoInput::start(int deviceID, videoDevice *VD){
 	}
 
 
+	//AUDIO//
+	//the audio pin of the capture filter goes into the same graph, so both streams share one clock
+	VD->audioReady = false;
+	if( VD->audioSink != NULL ){
+		VD->audioReady = setupAudioStream(VD);
+		if(!VD->audioReady){
+			if(verbose)printf("SETUP: No audio captured from this device\n");
+		}else{
+			if(verbose)printf("SETUP: Capturing audio at %i Hz, %i channels\n", VD->audioRate, VD->audioChannels);
+		}
+	}
+
+
+	//find out which frame interval the capture pin really agreed to
+	VD->negotiatedFrameTime = 0;
+	{
+		AM_MEDIA_TYPE connectedType;
+		ZeroMemory(&connectedType, sizeof(AM_MEDIA_TYPE));
+		hr = VD->pGrabber->GetConnectedMediaType(&connectedType);
+		if(SUCCEEDED(hr)){
+			if(connectedType.formattype == FORMAT_VideoInfo && connectedType.cbFormat >= sizeof(VIDEOINFOHEADER) && connectedType.pbFormat != NULL){
+				VD->negotiatedFrameTime = (long)reinterpret_cast<VIDEOINFOHEADER*>(connectedType.pbFormat)->AvgTimePerFrame;
+			}
+			MyFreeMediaType(connectedType);
+		}
+		if(verbose && VD->negotiatedFrameTime > 0)printf("SETUP: Negotiated frame interval is %ld (%.3f fps)\n", VD->negotiatedFrameTime, 10000000.0 / (double)VD->negotiatedFrameTime);
+	}
+
+
 	//EXP - lets try setting the sync source to null - and make it run as fast as possible
 	{
 		IMediaFilter *pMediaFilter = 0;
@@ -2124,6 +2746,10 @@ int videoInput::start(int deviceID, videoDevice *VD){
 
 
 	//LETS RUN THE STREAM!
+	//freeze detection counts from here until the first sample arrives
+	EnterCriticalSection(&VD->sgCallback->critSection);
+		VD->sgCallback->lastSampleTime = getPerformanceTime();
+	LeaveCriticalSection(&VD->sgCallback->critSection);
 	hr = VD->pControl->Run();
 
 	if (FAILED(hr)){
@@ -2231,7 +2857,7 @@ int videoInput::getDeviceCount(){
 // Return the filter with a matching friendly name
 // ----------------------------------------------------------------------
 
-HRESULT videoInput::getDevice(IBaseFilter** gottaFilter, int deviceId, WCHAR * wDeviceName, char * nDeviceName){
+HRESULT videoInput::getDevice(IBaseFilter** gottaFilter, int deviceId, WCHAR * wDeviceName, char * nDeviceName, std::wstring * uniqueName){
 	BOOL done = false;
 	int deviceCounter = 0;
 
@@ -2276,6 +2902,15 @@ HRESULT videoInput::getDevice(IBaseFilter** gottaFilter, int deviceId, WCHAR * w
 	                  		 count++;
 	                 	}
 
+						//the display name identifies the device across sessions
+						if(uniqueName != NULL){
+							LPOLESTR displayName = NULL;
+							if(SUCCEEDED(pMoniker->GetDisplayName(NULL, NULL, &displayName))){
+								*uniqueName = displayName;
+								CoTaskMemFree(displayName);
+							}
+						}
+
 						// We found it, so send it back to the caller
 						hr = pMoniker->BindToObject(NULL, NULL, IID_IBaseFilter, (void**)gottaFilter);
 						done = true;
@@ -172,6 +172,9 @@ Thanks to:
 #define VI_MEDIASUBTYPE_GREY    17
 #define VI_MEDIASUBTYPE_MJPG    18
 
+//usable USB 2.0 bandwidth in bytes per second - the budget for auto mode selection on USB devices
+#define VI_USB_BANDWIDTH	35000000.0
+
 //allows us to directShow classes here with the includes in the cpp
 struct ICaptureGraphBuilder2;
 struct IGraphBuilder;
@@ -183,10 +186,22 @@ struct IMediaEventEx;
 struct IAMStreamConfig;
 struct _AMMediaType;
 class SampleGrabberCallback;
+class AudioGrabberCallback;
+struct captureFormatCost;
 typedef _AMMediaType AM_MEDIA_TYPE;
 
 
 
+//receives captured audio as interleaved 16 bit PCM. Called on a DirectShow thread, so it must not block.
+//time is the arrival of the first frame of the block, in seconds on the clock of videoInput::getTime
+class audioSampleSink{
+	public:
+		virtual ~audioSampleSink(){}
+		virtual void receiveAudio(const short * samples, int frames, double time) = 0;
+};
+
+
+
 
 ////////////////////////////////////////   VIDEO DEVICE   ///////////////////////////////////
 
@@ -224,6 +239,16 @@ class videoDevice{
 
 		SampleGrabberCallback * sgCallback;
 
+		//audio pin of the same capture filter, rendered into the graph when audioSink is set
+		IBaseFilter * pAudioGrabberF;
+		IBaseFilter * pAudioDestFilter;
+		ISampleGrabber * pAudioGrabber;
+		AudioGrabberCallback * audioCallback;
+		audioSampleSink * audioSink;
+		int audioRate;
+		int audioChannels;
+		bool audioReady;
+
 		bool tryDiffSize;
 		bool useCrossbar;
 		bool readyToCapture;
@@ -231,18 +256,23 @@ class videoDevice{
 		bool setupStarted;
 		bool specificFormat;
 		bool autoReconnect;
-		int  nFramesForReconnect;
-		unsigned long nFramesRunning;
+		int  freezeTimeout; //ms without a sample before the device counts as frozen
 		int  connection;
 		int	 storeConn;
 		int  myID;
 		long requestedFrameTime; //ie fps
+		long negotiatedFrameTime; //AvgTimePerFrame of the connected grabber pin, 0 if unknown
 
 		char 	nDeviceName[255];
 		WCHAR 	wDeviceName[255];
+		std::wstring uniqueName;	//moniker display name, keys the capability cache
+		std::string modeReport;		//scores of the auto mode selection
+
+		unsigned char * pixels;		//returned by getPixels(id), made on its first call
+		char * pBuffer;				//GetCurrentBuffer target, only without the callback
 
-		unsigned char * pixels;
-		char * pBuffer;
+		unsigned long lastFrameNumber;	//sample number of the last frame read by getPixels
+		double lastFrameTime;			//arrival time of the last frame read by getPixels
 
 };
 
@@ -285,11 +315,25 @@ class videoInput{
 		//call before setupDevice
 		//directshow will try and get the closest possible framerate to what is requested
 		void setIdealFramerate(int deviceID, int idealFramerate);
+		void setIdealFramerate(int deviceID, int numerator, int denominator);
+
+		//the framerate the device agreed to - devices are free to deliver at another rate anyway
+		double getNegotiatedFramerate(int deviceID);
+
+		//call before setupDevice - samples arriving while earlier ones are unread are queued for getPixels,
+		//a few of them, instead of being dropped; the graph never waits, so a reader that keeps up on average loses none
+		void setLossless(int deviceID, bool lossless);
+
+		//call before setupDevice - captures the audio pin of the capture filter as 16 bit PCM into sink,
+		//in the same graph as the video. A device without a suitable audio pin still sets up its video,
+		//check hasAudio afterwards.
+		void setupAudio(int deviceID, int sampleRate, int channels, audioSampleSink * sink);
+		bool hasAudio(int deviceID);
 
 		//some devices will stop delivering frames after a while - this method gives you the option to try and reconnect
-		//to a device if videoInput detects that a device has stopped delivering frames.
-		//you MUST CALL isFrameNew every app loop for this to have any effect
-		void setAutoReconnectOnFreeze(int deviceNumber, bool doReconnect, int numMissedFramesBeforeReconnect);
+		//to a device if videoInput detects that a device has stopped delivering frames for the given time.
+		//detection does not reconnect by itself - poll isDeviceFrozen (from any thread) and call restartDevice
+		void setAutoReconnectOnFreeze(int deviceNumber, bool doReconnect, int msWithoutFramesBeforeReconnect);
 
 		//Choose one of these four to setup your device
 		bool setupDevice(int deviceID);
@@ -308,9 +352,23 @@ class videoInput{
 		bool setFormat(int deviceNumber, int format);
 		void setRequestedMediaSubType(int mediatype); // added by gameover
 
-		//Tells you when a new frame has arrived - you should call this if you have specified setAutoReconnectOnFreeze to true
+		//instead of a fixed subtype, pick the mode that is cheapest to deliver as RGB24
+		//at the requested size and framerate - call before setupDevice
+		void setAutoMediaSubType(bool useAuto);
+
+		//decision and scores of the auto mode selection - empty when auto was not used
+		std::string getCaptureModeReport(int deviceID);
+
+		//Tells you when a new frame has arrived
 		bool isFrameNew(int deviceID);
 
+		//Event set while a new frame waits to be read, so many devices can be waited on at once.
+		//Owned by the device, NULL when it is not set up or frames are not captured by callback
+		HANDLE getFrameEvent(int deviceID);
+
+		//Tells you when auto reconnect is on and the device has not delivered a frame for too long
+		bool isDeviceFrozen(int deviceID);
+
 		bool isDeviceSetup(int deviceID);
 
 		//Returns the pixels - flipRedAndBlue toggles RGB/BGR flipping - and you can flip the image too
@@ -319,6 +377,19 @@ class videoInput{
 		//Or pass in a buffer for getPixels to fill returns true if successful.
 		bool getPixels(int id, unsigned char * pixels, bool flipRedAndBlue = true, bool flipImage = false);
 
+		//Sample number and arrival time (seconds) of the frame returned by the last getPixels call.
+		//Sample numbers count every sample the device delivered, so a gap means samples were skipped.
+		unsigned long getFrameNumber(int deviceID);
+		double getFrameTime(int deviceID);
+
+		//Current time on the clock getFrameTime uses, in seconds
+		static double getTime();
+
+		//Capture health counters - samples delivered by the device and samples discarded because
+		//the previous one was not read in time
+		unsigned long getSampleCount(int deviceID);
+		unsigned long getDroppedSampleCount(int deviceID);
+
 		//Launches a pop up settings window
 		//For some reason in GLUT you have to call it twice each time.
 		void showSettingsWindow(int deviceID);
@@ -340,6 +411,9 @@ class videoInput{
 		int  getHeight(int deviceID);
 		int  getSize(int deviceID);
 
+		//bytes of frame buffers held for the device - buffers are only made for the capture method in use
+		int  getBufferMemory(int deviceID);
+
 		//completely stops and frees a device
 		void stopDevice(int deviceID);
 
@@ -373,12 +447,13 @@ class videoInput{
 		void setPhyCon(int deviceID, int conn);
 		void setAttemptCaptureSize(int deviceID, int w, int h);
 		bool setup(int deviceID);
+		videoDevice * getVideoDevice(int deviceID);
 		void processPixels(unsigned char * src, unsigned char * dst, int width, int height, bool bRGB, bool bFlip);
 		int  start(int deviceID, videoDevice * VD);
 		int  getDeviceCount();
 		void getMediaSubtypeAsString(GUID type, char * typeAsString);
 
-		HRESULT getDevice(IBaseFilter **pSrcFilter, int deviceID, WCHAR * wDeviceName, char * nDeviceName);
+		HRESULT getDevice(IBaseFilter **pSrcFilter, int deviceID, WCHAR * wDeviceName, char * nDeviceName, std::wstring * uniqueName = NULL);
 		static HRESULT ShowFilterPropertyPages(IBaseFilter *pFilter);
 		HRESULT SaveGraphFile(IGraphBuilder *pGraph, WCHAR *wszPath);
 		HRESULT routeCrossbar(ICaptureGraphBuilder2 **ppBuild, IBaseFilter **pVidInFilter, int conType, GUID captureMode);
@@ -393,12 +468,15 @@ class videoInput{
 
 		GUID CAPTURE_MODE;
 		GUID requestedMediaSubType;
+		bool autoMediaSubType;
+		std::vector<captureFormatCost> formatCosts;
 
 		//Extra video subtypes
 		GUID MEDIASUBTYPE_Y800;
 		GUID MEDIASUBTYPE_Y8;
 		GUID MEDIASUBTYPE_GREY;
 
+		//NULL until the device is first used
 		videoDevice * VDList[VI_MAX_CAMERAS];
 		GUID mediaSubtypes[VI_NUM_TYPES];
 		long formatTypes[VI_NUM_FORMATS];
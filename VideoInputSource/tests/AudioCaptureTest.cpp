@@ -0,0 +1,211 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// AudioRing fed blocks with a drifting, jittery clock, and the tone source of a synthetic device read
+// through GetAudio along with the video, checking latency and drift against the capture time
+
+#include "TestCheck.h"
+
+#include <math.h>
+
+#include <random>
+#include <vector>
+
+#include "VideoInputSource.h"
+
+
+
+static const int AUDIO_RATE = 48000;
+static const int AUDIO_CHANNELS = 2;
+// frames per block, as delivered by the tone source and most devices
+static const int AUDIO_BLOCK = 480;
+
+
+
+static short Marker(const __int64 index) {
+	return (short)(index & 0x7fff);
+}
+
+static void Fill(std::vector<short>& block, const __int64 index) {
+	for (int i = 0; i < (int)block.size() / AUDIO_CHANNELS; i++) {
+		for (int c = 0; c < AUDIO_CHANNELS; c++) {
+			block[(size_t)i * AUDIO_CHANNELS + c] = Marker(index + i);
+		}
+	}
+}
+
+// a device whose sample clock runs drift off the capture clock, delivering blocks with 2ms of jitter and
+// a constant 3ms delay; the mapping has to follow the drift and average the jitter out
+static void TestMappingDrift(const double drift) {
+	AudioRing ring(AUDIO_RATE, AUDIO_CHANNELS, 4.0);
+	std::mt19937 random(3);
+	std::normal_distribution<double> jitter(0.0, 0.002);
+	std::vector<short> block((size_t)AUDIO_BLOCK * AUDIO_CHANNELS);
+
+	const double rate = AUDIO_RATE * (1.0 + drift);
+	__int64 index = 0;
+	double worst = 0.0, sum = 0.0;
+	int checked = 0;
+	// 60 seconds
+	for (int b = 0; b < 6000; b++) {
+		Fill(block, index);
+		ring.ReceiveAudio(&block[0], AUDIO_BLOCK, 5.0 + (double)index / rate + jitter(random) + 0.003);
+		index += AUDIO_BLOCK;
+
+		// once settled, the middle of the latest block is looked up by the time it was captured
+		if (b > 500) {
+			__int64 mapped;
+			CHECK(ring.IndexAt(5.0 + (double)(index - AUDIO_BLOCK / 2) / rate, mapped));
+			double error = (double)(mapped - (index - AUDIO_BLOCK / 2)) / AUDIO_RATE;
+			worst = (fabs(error) > worst) ? fabs(error) : worst;
+			sum += error;
+			checked++;
+		}
+	}
+	printf("drift %+.1f%%: mapping error mean %.2f ms, worst %.2f ms\n", drift * 100.0, sum / checked * 1000.0, worst * 1000.0);
+	// the constant delay shows as 3ms, the rest has to stay small
+	CHECK(fabs(sum / checked + 0.003) < 0.002);
+	CHECK(worst < 0.010);
+
+	std::vector<short> out((size_t)100 * AUDIO_CHANNELS);
+	CHECK(ring.Read(index - 100, &out[0], 100) == 100);
+	CHECK(out[0] == Marker(index - 100) && out[out.size() - 1] == Marker(index - 1));
+}
+
+static void TestRead() {
+	// one second of ring
+	AudioRing ring(AUDIO_RATE, AUDIO_CHANNELS, 1.0);
+	std::vector<short> block((size_t)AUDIO_BLOCK * AUDIO_CHANNELS);
+	std::vector<short> out((size_t)1000 * AUDIO_CHANNELS);
+
+	__int64 index;
+	CHECK(!ring.IndexAt(0.0, index));
+	CHECK(ring.Read(0, &out[0], 1000) == 0);
+
+	__int64 written = 0;
+	for (int b = 0; b < 250; b++) {
+		Fill(block, written);
+		ring.ReceiveAudio(&block[0], AUDIO_BLOCK, (double)written / AUDIO_RATE);
+		written += AUDIO_BLOCK;
+	}
+	CHECK(ring.GetWritten() == written);
+	CHECK(ring.IndexAt((double)written / AUDIO_RATE, index) && index == written);
+
+	// across the wrap of the ring
+	__int64 start = written - AUDIO_RATE + 500;
+	CHECK(ring.Read(start, &out[0], 1000) == 1000);
+	bool same = true;
+	for (int i = 0; i < 1000; i++) {
+		same = same && out[(size_t)i * AUDIO_CHANNELS] == Marker(start + i) && out[(size_t)i * AUDIO_CHANNELS + 1] == Marker(start + i);
+	}
+	CHECK(same);
+
+	// frames overwritten already and frames not captured yet read as silence
+	start = written - AUDIO_RATE - 200;
+	CHECK(ring.Read(start, &out[0], 1000) == 800);
+	CHECK(out[0] == 0 && out[199 * AUDIO_CHANNELS] == 0 && out[200 * AUDIO_CHANNELS] == Marker(start + 200));
+	start = written - 300;
+	CHECK(ring.Read(start, &out[0], 1000) == 300);
+	CHECK(out[299 * AUDIO_CHANNELS] == Marker(written - 1) && out[300 * AUDIO_CHANNELS] == 0);
+
+	// a block larger than the ring keeps its tail, stamped with the time of the tail
+	std::vector<short> large((size_t)AUDIO_RATE * 2 * AUDIO_CHANNELS);
+	Fill(large, written);
+	ring.ReceiveAudio(&large[0], AUDIO_RATE * 2, 100.0);
+	written += AUDIO_RATE * 2;
+	CHECK(ring.GetWritten() == written);
+	CHECK(ring.Read(written - 10, &out[0], 10) == 10 && out[0] == Marker(written - 10));
+	CHECK(ring.IndexAt(102.0, index) && index == written);
+}
+
+// a stall or restart further off than the jitter moves the mapping at once instead of slowly
+static void TestResync() {
+	AudioRing ring(AUDIO_RATE, AUDIO_CHANNELS, 1.0);
+	std::vector<short> block((size_t)AUDIO_BLOCK * AUDIO_CHANNELS, 0);
+
+	__int64 written = 0;
+	for (int b = 0; b < 100; b++) {
+		ring.ReceiveAudio(&block[0], AUDIO_BLOCK, (double)written / AUDIO_RATE);
+		written += AUDIO_BLOCK;
+	}
+	// the device stopped for half a second
+	double time = (double)written / AUDIO_RATE + 0.5;
+	ring.ReceiveAudio(&block[0], AUDIO_BLOCK, time);
+	__int64 index;
+	CHECK(ring.IndexAt(time, index) && index == written);
+}
+
+// the tone source of a synthetic device read along with the video, one frame of audio per frame, paced
+// by realtime like a player
+static void TestToneSource() {
+	VideoInputSourceParams params;
+	params.connectionType = "Synthetic";
+	params.width = 320;
+	params.height = 240;
+	params.captureFormat = "YUY2";
+	params.audio = "tone";
+	params.audioRate = AUDIO_RATE;
+	params.audioChannels = AUDIO_CHANNELS;
+	params.realtime = true;
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(params);
+	CHECK(source->HasAudio());
+	CHECK(source->GetAudioRate() == AUDIO_RATE && source->GetAudioChannels() == AUDIO_CHANNELS);
+
+	const int frameAudio = AUDIO_RATE / 30;
+	std::vector<short> audio((size_t)frameAudio * AUDIO_CHANNELS);
+	int crossings = 0, crossingFrames = 0;
+	double worstDrift = 0.0, worstLatency = 0.0;
+	// 3 seconds
+	for (int n = 0; n < 90; n++) {
+		source->GetFrame();
+		source->GetAudio(&audio[0], (__int64)n * frameAudio, frameAudio);
+
+		VideoInputSourceStats stats = source->GetStats();
+		worstDrift = (fabs(stats.audioDrift) > worstDrift) ? fabs(stats.audioDrift) : worstDrift;
+		// the first frames wait for the tone to start
+		if (n >= 15) {
+			worstLatency = (stats.audioLatency > worstLatency) ? stats.audioLatency : worstLatency;
+			for (int i = 1; i < frameAudio; i++) {
+				crossings += (audio[(size_t)(i - 1) * AUDIO_CHANNELS] < 0) != (audio[(size_t)i * AUDIO_CHANNELS] < 0);
+			}
+			crossingFrames++;
+		}
+	}
+
+	VideoInputSourceStats stats = source->GetStats();
+	double frequency = crossings / 2.0 / (crossingFrames / 30.0);
+	printf("tone: %.0f Hz, audio frames %lu, latency up to %.1f ms, drift up to %.1f ms, %d slips\n", frequency, stats.audioFrames, worstLatency * 1000.0, worstDrift * 1000.0, stats.audioSlips);
+	CHECK(fabs(frequency - 1000.0) < 20.0);
+	CHECK(stats.audioFrames > (unsigned long)(AUDIO_RATE * 2));
+	CHECK(worstDrift < 0.020);
+	CHECK(worstLatency < 0.2);
+	CHECK(stats.audioSlips <= 1);
+}
+
+int main() {
+	TestMappingDrift(0.001);
+	TestMappingDrift(-0.001);
+	TestRead();
+	TestResync();
+	TestToneSource();
+	return TEST_RESULT();
+}
@@ -0,0 +1,301 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// capabilityCache and captureModeSelector of videoInput against a mocked capability list: the cache file
+// round trip and the automatic mode choice, neither needs a device nor DirectShow
+
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "videoInput/capabilityCache.h"
+#include "videoInput/captureModeSelector.h"
+
+
+
+// stand-ins for the media subtypes, only compared by value
+static const GUID SUBTYPE_RGB24 = { 0xe436eb7d, 0x524f, 0x11ce, { 0x9f, 0x53, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70 } };
+static const GUID SUBTYPE_YUY2 = { 0x32595559, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID SUBTYPE_Y800 = { 0x30303859, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID SUBTYPE_MJPG = { 0x47504a4d, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+static const GUID SUBTYPE_H264 = { 0x34363248, 0x0000, 0x0010, { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 } };
+
+// the usable bandwidth videoInput assumes for USB devices, VI_USB_BANDWIDTH
+static const double USB_BANDWIDTH = 35000000.0;
+
+
+
+static bool SameSubtype(const GUID& a, const GUID& b) {
+	return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+static videoCapability Capability(const GUID& subtype, int width, int height, double fps) {
+	videoCapability cap;
+	cap.subtype = subtype;
+	cap.minWidth = cap.maxWidth = width;
+	cap.minHeight = cap.maxHeight = height;
+	cap.stepX = cap.stepY = 0;
+	cap.minFrameInterval = (__int64)(10000000.0 / fps + 0.5);
+	cap.maxFrameInterval = 10000000;
+	return cap;
+}
+
+// the costs videoInput uses for the subtypes above, H264 has none and is never picked
+static std::vector<captureFormatCost> FormatCosts() {
+	static const captureFormatCost costs[] = {
+		{ SUBTYPE_RGB24, "RGB24", 0.3, 3.0, true },
+		{ SUBTYPE_YUY2, "YUY2", 1.0, 2.0, true },
+		{ SUBTYPE_Y800, "Y800", 0.5, 1.0, false },
+		{ SUBTYPE_MJPG, "MJPG", 6.0, 0.3, true },
+	};
+	return std::vector<captureFormatCost>(costs, costs + sizeof(costs) / sizeof(costs[0]));
+}
+
+static int Select(const std::vector<videoCapability>& caps, int width, int height, double fps, double busBudget, std::vector<captureModeScore>& scores) {
+	return selectCaptureMode(caps, FormatCosts(), width, height, fps, busBudget, scores);
+}
+
+
+
+static void TestSupportsSize() {
+	videoCapability cap = Capability(SUBTYPE_YUY2, 0, 0, 30.0);
+	cap.minWidth = 160;
+	cap.maxWidth = 1920;
+	cap.stepX = 8;
+	cap.minHeight = 120;
+	cap.maxHeight = 1080;
+	cap.stepY = 2;
+
+	CHECK(cap.supportsSize(160, 120));
+	CHECK(cap.supportsSize(640, 480));
+	CHECK(cap.supportsSize(1920, 1080));
+	CHECK(!cap.supportsSize(644, 480));
+	CHECK(!cap.supportsSize(640, 481));
+	CHECK(!cap.supportsSize(152, 120));
+	CHECK(!cap.supportsSize(1928, 1080));
+}
+
+static void TestEntry() {
+	capabilityCacheEntry entry;
+	entry.caps.push_back(Capability(SUBTYPE_YUY2, 640, 480, 30.0));
+	entry.caps.push_back(Capability(SUBTYPE_MJPG, 1920, 1080, 30.0));
+
+	CHECK(entry.supports(SUBTYPE_YUY2, 640, 480));
+	CHECK(!entry.supports(SUBTYPE_YUY2, 1920, 1080));
+	CHECK(entry.supports(SUBTYPE_MJPG, 1920, 1080));
+	CHECK(!entry.supports(SUBTYPE_RGB24, 640, 480));
+
+	CHECK(entry.findMode(640, 480) == NULL);
+	videoCaptureMode mode = { 640, 480, SUBTYPE_YUY2, 640, 480 };
+	entry.setMode(mode);
+	mode.subtype = SUBTYPE_MJPG;
+	mode.requestedWidth = mode.width = 1920;
+	mode.requestedHeight = mode.height = 1080;
+	entry.setMode(mode);
+	CHECK(entry.modes.size() == 2);
+
+	// a second mode for the same requested size replaces the first
+	mode.requestedWidth = 640;
+	mode.requestedHeight = 480;
+	mode.subtype = SUBTYPE_RGB24;
+	entry.setMode(mode);
+	CHECK(entry.modes.size() == 2);
+	const videoCaptureMode* found = entry.findMode(640, 480);
+	CHECK(found != NULL && SameSubtype(found->subtype, SUBTYPE_RGB24));
+}
+
+static void TestCacheFile() {
+	char directory[] = "/tmp/VideoInputSource-cache-XXXXXX";
+	CHECK(mkdtemp(directory) != NULL);
+	std::string path = std::string(directory) + "/capabilities.bin";
+	capabilityCache::setPath(path);
+
+	capabilityCacheEntry entry;
+	entry.caps.push_back(Capability(SUBTYPE_YUY2, 640, 480, 30.0));
+	entry.caps.push_back(Capability(SUBTYPE_MJPG, 1920, 1080, 60.0));
+	entry.caps[1].maxFrameInterval = (__int64)1 << 40;
+	videoCaptureMode mode = { 1920, 1080, SUBTYPE_MJPG, 1920, 1080 };
+	entry.setMode(mode);
+
+	capabilityCacheEntry loaded;
+	CHECK(!capabilityCache::lookup(L"usb camera", loaded));
+
+	capabilityCache::store(L"usb camera", entry);
+	capabilityCache::store(L"capture card \x4e2d", entry);
+	CHECK(capabilityCache::lookup(L"usb camera", loaded));
+	CHECK(loaded.caps.size() == 2 && loaded.modes.size() == 1);
+	if (loaded.caps.size() == 2 && loaded.modes.size() == 1) {
+		CHECK(SameSubtype(loaded.caps[1].subtype, SUBTYPE_MJPG));
+		CHECK(loaded.caps[1].maxWidth == 1920 && loaded.caps[1].maxHeight == 1080);
+		CHECK(loaded.caps[1].minFrameInterval == entry.caps[1].minFrameInterval);
+		CHECK(loaded.caps[1].maxFrameInterval == ((__int64)1 << 40));
+		CHECK(SameSubtype(loaded.modes[0].subtype, SUBTYPE_MJPG) && loaded.modes[0].width == 1920);
+	}
+	CHECK(capabilityCache::lookup(L"capture card \x4e2d", loaded));
+
+	// a mode that fails to negotiate drops the device, the others stay
+	capabilityCache::invalidate(L"usb camera");
+	CHECK(!capabilityCache::lookup(L"usb camera", loaded));
+	CHECK(capabilityCache::lookup(L"capture card \x4e2d", loaded));
+
+	// a damaged file reads as empty and is started over by the next store
+	FILE* fp = fopen(path.c_str(), "r+b");
+	CHECK(fp != NULL);
+	if (fp != NULL) {
+		fputs("damaged", fp);
+		fclose(fp);
+	}
+	CHECK(!capabilityCache::lookup(L"capture card \x4e2d", loaded));
+	capabilityCache::store(L"usb camera", entry);
+	CHECK(capabilityCache::lookup(L"usb camera", loaded));
+	CHECK(!capabilityCache::lookup(L"capture card \x4e2d", loaded));
+
+	// a truncated file as well
+	CHECK(truncate(path.c_str(), 40) == 0);
+	CHECK(!capabilityCache::lookup(L"usb camera", loaded));
+
+	unlink(path.c_str());
+
+	// an empty path disables the cache
+	capabilityCache::setPath("");
+	capabilityCache::store(L"usb camera", entry);
+	CHECK(!capabilityCache::lookup(L"usb camera", loaded));
+	CHECK(access(path.c_str(), F_OK) != 0);
+
+	rmdir(directory);
+}
+
+static void TestSelectCheapest() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_MJPG, 640, 480, 30.0));
+	caps.push_back(Capability(SUBTYPE_YUY2, 640, 480, 30.0));
+	caps.push_back(Capability(SUBTYPE_RGB24, 640, 480, 30.0));
+	caps.push_back(Capability(SUBTYPE_H264, 640, 480, 30.0));
+
+	// 640x480 at 30 fps fits the USB budget uncompressed, so the cheapest conversion wins
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 640, 480, 30.0, USB_BANDWIDTH, scores);
+	CHECK(scores.size() == 3);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_RGB24));
+	CHECK(describeCaptureModeSelection(scores, selected).compare(0, 20, "auto: selected RGB24") == 0);
+}
+
+static void TestSelectBandwidth() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_RGB24, 1920, 1080, 30.0));
+	caps.push_back(Capability(SUBTYPE_YUY2, 1920, 1080, 30.0));
+	caps.push_back(Capability(SUBTYPE_MJPG, 1920, 1080, 30.0));
+
+	// uncompressed 1080p30 saturates USB, so MJPG pays off despite the decode
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 1920, 1080, 30.0, USB_BANDWIDTH, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_MJPG));
+	if (selected >= 0) {
+		CHECK(scores[selected].bandwidth < USB_BANDWIDTH);
+		CHECK(scores[selected].cpuLoad > 0.3 && scores[selected].cpuLoad < 0.4);
+	}
+
+	// without a bus limit, as on a PCIe capture card, the plain copy is back in front
+	selected = Select(caps, 1920, 1080, 30.0, 0.0, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_RGB24));
+}
+
+static void TestSelectFrameRate() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_RGB24, 1280, 720, 10.0));
+	caps.push_back(Capability(SUBTYPE_YUY2, 1280, 720, 30.0));
+
+	// a mode that cannot reach the requested rate loses to a dearer one that can
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 1280, 720, 30.0, 0.0, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_YUY2));
+	if (selected >= 0) {
+		CHECK(scores[selected].maxFps > 29.9 && scores[selected].maxFps < 30.1);
+	}
+
+	// and wins when the requested rate is within its reach
+	selected = Select(caps, 1280, 720, 10.0, 0.0, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_RGB24));
+}
+
+static void TestSelectGreyscale() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_Y800, 640, 480, 30.0));
+	caps.push_back(Capability(SUBTYPE_MJPG, 640, 480, 15.0));
+
+	// colour is kept even at half the frame rate
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 640, 480, 30.0, USB_BANDWIDTH, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_MJPG));
+
+	// but greyscale is taken when it is all there is
+	caps.pop_back();
+	selected = Select(caps, 640, 480, 30.0, USB_BANDWIDTH, scores);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_Y800));
+}
+
+static void TestSelectNoSize() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_YUY2, 640, 480, 30.0));
+	caps.push_back(Capability(SUBTYPE_H264, 1920, 1080, 30.0));
+
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 1920, 1080, 30.0, USB_BANDWIDTH, scores);
+	CHECK(selected == -1);
+	CHECK(scores.empty());
+	CHECK(describeCaptureModeSelection(scores, selected) == "auto: no mode offers the requested size");
+}
+
+static void TestSelectMerge() {
+	std::vector<videoCapability> caps;
+	caps.push_back(Capability(SUBTYPE_YUY2, 1280, 720, 5.0));
+	caps.push_back(Capability(SUBTYPE_MJPG, 1280, 720, 30.0));
+	caps.push_back(Capability(SUBTYPE_YUY2, 1280, 720, 30.0));
+	caps.push_back(Capability(SUBTYPE_YUY2, 1280, 720, 10.0));
+
+	// a subtype listed more than once is scored once, by its best entry
+	std::vector<captureModeScore> scores;
+	int selected = Select(caps, 1280, 720, 30.0, 0.0, scores);
+	CHECK(scores.size() == 2);
+	CHECK(selected >= 0 && SameSubtype(scores[selected].subtype, SUBTYPE_YUY2));
+	if (selected >= 0) {
+		CHECK(scores[selected].maxFps > 29.9);
+	}
+}
+
+int main() {
+	TestSupportsSize();
+	TestEntry();
+	TestCacheFile();
+	TestSelectCheapest();
+	TestSelectBandwidth();
+	TestSelectFrameRate();
+	TestSelectGreyscale();
+	TestSelectNoSize();
+	TestSelectMerge();
+	return TEST_RESULT();
+}
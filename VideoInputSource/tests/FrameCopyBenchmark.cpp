@@ -0,0 +1,116 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// FrameCopyBenchmark [copies] [working set KB]
+// copy throughput of a 4K BGR24 frame under each copy policy, and how much slower a downstream filter
+// re-reading a cache-sized working set gets right after the copy; then what splitting a frame across the
+// copy threads costs per copy. ctest runs it with a few copies only, pass more for stable numbers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "CaptureBackend.h"
+#include "FrameCopy.h"
+
+
+
+struct NamedPolicy {
+	const char* name;
+	FrameCopyPolicy policy;
+};
+
+static volatile unsigned int sink;
+
+
+
+// reads the working set like a filter going over its buffers again, returns the seconds it took
+static double Victim(const std::vector<unsigned int>& workingSet) {
+	double start = GetCaptureTime();
+	unsigned int sum = 0;
+	for (size_t i = 0; i < workingSet.size(); i += 16) {
+		sum += workingSet[i];
+	}
+	sink = sum;
+	return GetCaptureTime() - start;
+}
+
+int main(int argc, char** argv) {
+	int copies = (argc > 1) ? atoi(argv[1]) : 40;
+	size_t workingSetKB = (argc > 2) ? (size_t)atoi(argv[2]) : 1024;
+	if (copies < 1 || workingSetKB < 1) {
+		fprintf(stderr, "usage: FrameCopyBenchmark [copies] [working set KB]\n");
+		return 1;
+	}
+
+	const size_t size = (size_t)3840 * 2160 * 3;
+	unsigned char* src = (unsigned char*)_aligned_malloc(size, 64);
+	unsigned char* dst = (unsigned char*)_aligned_malloc(size, 64);
+	memset(src, 1, size);
+	memset(dst, 2, size);
+	std::vector<unsigned int> workingSet(workingSetKB * 1024 / sizeof(unsigned int), 1);
+
+	FrameCopyPolicy original = GetFrameCopyPolicy();
+	const NamedPolicy policies[] = {
+		{ "memcpy", { (size_t)-1, (size_t)-1, 1 } },
+		{ "stream", { 0, (size_t)-1, 1 } },
+		{ "stream, 4 threads", { 0, 0, 4 } },
+		{ "default", original },
+	};
+	printf("3840x2160 BGR24, %d copies, working set %zu KB\n", copies, workingSetKB);
+	for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+		SetFrameCopyPolicy(policies[p].policy);
+		double copyTime = 0.0, warm = 0.0, after = 0.0;
+		for (int i = 0; i < copies; i++) {
+			Victim(workingSet);
+			warm += Victim(workingSet);
+			double start = GetCaptureTime();
+			CopyFrame(dst, src, size);
+			copyTime += GetCaptureTime() - start;
+			after += Victim(workingSet);
+		}
+		printf("%-18s copy %6.2f GB/s, working set warm %7.1f us, after the copy %7.1f us (x%.2f)\n", policies[p].name, (double)size * copies / copyTime / 1e9, warm / copies * 1e6, after / copies * 1e6, after / warm);
+	}
+
+	// what handing bands to the copy threads costs, on frames around the parallel threshold
+	const size_t sizes[] = { (size_t)640 * 480 * 3, (size_t)1920 * 1080 * 3, size };
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (int threads = 1; threads <= 4; threads += 3) {
+			FrameCopyPolicy policy = { (size_t)-1, 0, threads };
+			SetFrameCopyPolicy(policy);
+			CopyFrame(dst, src, sizes[s]);
+			double start = GetCaptureTime();
+			for (int i = 0; i < copies * 5; i++) {
+				CopyFrame(dst, src, sizes[s]);
+			}
+			printf("%9zu bytes, %d threads: %8.1f us per copy\n", sizes[s], threads, (GetCaptureTime() - start) / (copies * 5) * 1e6);
+		}
+	}
+
+	SetFrameCopyPolicy(original);
+	printf("copy_rate %.2f GB/s\n", GetFrameCopyRate() / 1e9);
+	_aligned_free(src);
+	_aligned_free(dst);
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// CopyFrame and CopyFrameRows under every copy policy: odd sizes and misaligned buffers, flipped rows,
+// and several callers sharing the copy threads at once
+
+#include "TestCheck.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "FrameCopy.h"
+
+
+
+struct NamedPolicy {
+	const char* name;
+	FrameCopyPolicy policy;
+};
+
+// thresholds of 0 force the streaming stores and the split across threads on any size
+static const NamedPolicy POLICIES[] = {
+	{ "memcpy", { (size_t)-1, (size_t)-1, 1 } },
+	{ "stream", { 0, (size_t)-1, 1 } },
+	{ "memcpy, 4 threads", { (size_t)-1, 0, 4 } },
+	{ "stream, 4 threads", { 0, 0, 4 } },
+};
+static const int NUM_POLICIES = sizeof(POLICIES) / sizeof(POLICIES[0]);
+
+
+
+static void Fill(std::vector<unsigned char>& buffer, const int seed) {
+	for (size_t i = 0; i < buffer.size(); i++) {
+		buffer[i] = (unsigned char)(i * 31 + seed + (i >> 11));
+	}
+}
+
+// sizes around the 16 byte blocks of the streaming copy, from 3 bytes in to leave the source misaligned;
+// the bytes around the copy must stay untouched
+static void TestEdges(const NamedPolicy& named) {
+	static const size_t SIZES[] = { 0, 1, 15, 16, 17, 100, 4096 + 3, (1 << 20) + 7 };
+	std::vector<unsigned char> src((1 << 20) + 16);
+	std::vector<unsigned char> dst((1 << 20) + 16);
+	Fill(src, 1);
+	for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+		size_t size = SIZES[s];
+		for (size_t dstOffset = 0; dstOffset < 3; dstOffset++) {
+			memset(&dst[0], 0, dst.size());
+			CopyFrame(&dst[dstOffset + 1], &src[3], size);
+			bool same = memcmp(&dst[dstOffset + 1], &src[3], size) == 0 && dst[dstOffset] == 0 && dst[dstOffset + 1 + size] == 0;
+			if (!same) {
+				printf("%s: copy of %zu bytes to offset %zu is wrong\n", named.name, size, dstOffset + 1);
+			}
+			CHECK(same);
+		}
+	}
+}
+
+static void TestRows(const NamedPolicy& named) {
+	// BGR24 rows, padded at the source like a driver buffer
+	const int width = 1001, height = 601;
+	const size_t rowSize = (size_t)width * 3;
+	const size_t srcPitch = rowSize + 16;
+	std::vector<unsigned char> src(srcPitch * height);
+	std::vector<unsigned char> dst(rowSize * height);
+	Fill(src, 2);
+
+	// flipped, as every backend stores frames bottom-up
+	CopyFrameRows(&dst[(height - 1) * rowSize], -(ptrdiff_t)rowSize, &src[0], srcPitch, rowSize, height);
+	bool same = true;
+	for (int y = 0; y < height; y++) {
+		same = same && memcmp(&dst[(height - 1 - y) * rowSize], &src[y * srcPitch], rowSize) == 0;
+	}
+	if (!same) {
+		printf("%s: flipped rows are wrong\n", named.name);
+	}
+	CHECK(same);
+
+	// and straight
+	memset(&dst[0], 0, dst.size());
+	CopyFrameRows(&dst[0], rowSize, &src[0], srcPitch, rowSize, height);
+	same = true;
+	for (int y = 0; y < height; y++) {
+		same = same && memcmp(&dst[y * rowSize], &src[y * srcPitch], rowSize) == 0;
+	}
+	CHECK(same);
+
+	// too few rows to split
+	memset(&dst[0], 0, dst.size());
+	CopyFrameRows(&dst[0], rowSize, &src[0], srcPitch, rowSize, 1);
+	CHECK(memcmp(&dst[0], &src[0], rowSize) == 0 && dst[rowSize] == 0);
+}
+
+// callers capturing from several devices share the copy threads; each must get exactly its own frame
+static void TestConcurrent() {
+	SetFrameCopyPolicy(POLICIES[3].policy);
+	const size_t rowSize = 1000 * 3;
+	const int height = 1000;
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 3; t++) {
+		threads.push_back(std::thread([&wrong, t, rowSize, height]() {
+			std::vector<unsigned char> src(rowSize * height);
+			std::vector<unsigned char> dst(rowSize * height);
+			Fill(src, t + 10);
+			for (int k = 0; k < 20; k++) {
+				memset(&dst[0], 0, dst.size());
+				bool flip = (k % 2 == 0);
+				if (flip) {
+					CopyFrameRows(&dst[(height - 1) * rowSize], -(ptrdiff_t)rowSize, &src[0], rowSize, rowSize, height);
+				}
+				else {
+					CopyFrame(&dst[0], &src[0], src.size());
+				}
+				for (int y = 0; y < height; y++) {
+					if (memcmp(&dst[(flip ? height - 1 - y : y) * rowSize], &src[y * rowSize], rowSize) != 0) {
+						wrong++;
+						break;
+					}
+				}
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	CHECK(wrong == 0);
+}
+
+int main() {
+	FrameCopyPolicy original = GetFrameCopyPolicy();
+	CHECK(original.maxThreads >= 1);
+	CHECK(original.streamingThreshold <= original.parallelThreshold);
+
+	for (int p = 0; p < NUM_POLICIES; p++) {
+		SetFrameCopyPolicy(POLICIES[p].policy);
+		FrameCopyPolicy policy = GetFrameCopyPolicy();
+		CHECK(policy.streamingThreshold == POLICIES[p].policy.streamingThreshold && policy.maxThreads == POLICIES[p].policy.maxThreads);
+		TestEdges(POLICIES[p]);
+		TestRows(POLICIES[p]);
+	}
+	TestConcurrent();
+	SetFrameCopyPolicy(original);
+
+	CHECK(GetFrameCopyRate() > 0.0);
+	return TEST_RESULT();
+}
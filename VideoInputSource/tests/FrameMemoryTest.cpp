@@ -0,0 +1,119 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// the frame buffers an open device holds: the mapped driver buffers of the backend, exactly queue_depth
+// samples in the format it captures, and frame_memory of a source, those plus a few frames, counted for
+// each device on its own
+
+#include "TestCheck.h"
+
+#include "SyntheticDevice.h"
+#include "VideoInputSource.h"
+
+
+
+// frames a source may hold besides its spare pool: the one returned, the newest converted and one being converted
+static const int FRAMES_IN_USE = 3;
+static const int SNAPSHOT_POOL_SIZE = 4;
+
+
+
+static CaptureParams BackendParams(const char* format, const int width, const int height, const int queueDepth) {
+	CaptureParams params = CaptureParams();
+	params.connection = CONNECTION_SYNTHETIC;
+	params.width = width;
+	params.height = height;
+	params.fpsNumerator = 60;
+	params.fpsDenominator = 1;
+	params.captureFormat = format;
+	params.fieldOrder = FIELD_ORDER_NONE;
+	params.queueDepth = queueDepth;
+	return params;
+}
+
+static std::shared_ptr<VideoInputSource> CreateSource(const int deviceID, const int width, const int height, const int queueDepth) {
+	VideoInputSourceParams params;
+	params.deviceID = deviceID;
+	params.connectionType = "Synthetic";
+	params.width = width;
+	params.height = height;
+	params.fpsNumerator = 60;
+	params.frameSkip = false;
+	params.captureFormat = "YUY2";
+	params.queueDepth = queueDepth;
+	return VideoInputSource::Create(params);
+}
+
+static void TestBufferMemory() {
+	SyntheticBackend yuyv(BackendParams("YUY2", 64, 48, 4));
+	CHECK(yuyv.GetBufferMemory() == 0);
+	CHECK(yuyv.Open() == NULL);
+	CHECK(yuyv.GetBufferMemory() == (size_t)4 * 64 * 2 * 48);
+
+	// another device at the same time holds its own
+	SyntheticBackend rgb(BackendParams("RGB24", 32, 24, 2));
+	CHECK(rgb.Open() == NULL);
+	CHECK(rgb.GetBufferMemory() == (size_t)2 * 32 * 3 * 24);
+	CHECK(yuyv.GetBufferMemory() == (size_t)4 * 64 * 2 * 48);
+
+	yuyv.Close();
+	CHECK(yuyv.GetBufferMemory() == 0);
+	CHECK(rgb.GetBufferMemory() == (size_t)2 * 32 * 3 * 24);
+	rgb.Close();
+}
+
+// what frame_memory holds beyond the device buffers, in whole frames
+static int FramesHeld(const std::shared_ptr<VideoInputSource>& source, const double deviceBytes, const double frameBytes) {
+	double frames = (source->GetStats().frameMemory - deviceBytes) / frameBytes;
+	return (frames == (int)frames) ? (int)frames : -1;
+}
+
+static void TestFrameMemory() {
+	std::shared_ptr<VideoInputSource> first = CreateSource(0, 64, 48, 4);
+	for (int n = 0; n < 30; n++) {
+		first->GetFrame();
+	}
+	const double firstDevice = 4.0 * 64 * 2 * 48;
+	const double firstFrame = 64.0 * 48 * 3;
+	int firstHeld = FramesHeld(first, firstDevice, firstFrame);
+
+	// a second device at another size and queue depth
+	std::shared_ptr<VideoInputSource> second = CreateSource(1, 128, 96, 2);
+	for (int n = 0; n < 30; n++) {
+		second->GetFrame();
+	}
+	const double secondDevice = 2.0 * 128 * 2 * 96;
+	const double secondFrame = 128.0 * 96 * 3;
+	int secondHeld = FramesHeld(second, secondDevice, secondFrame);
+	printf("memory: %d and %d frames besides the device buffers\n", firstHeld, secondHeld);
+	CHECK(firstHeld >= 1 && firstHeld <= FRAMES_IN_USE + SNAPSHOT_POOL_SIZE);
+	CHECK(secondHeld >= 1 && secondHeld <= FRAMES_IN_USE + SNAPSHOT_POOL_SIZE);
+	// the first device goes on capturing, but opening the second one added nothing to it
+	firstHeld = FramesHeld(first, firstDevice, firstFrame);
+	CHECK(firstHeld >= 1 && firstHeld <= FRAMES_IN_USE + SNAPSHOT_POOL_SIZE);
+}
+
+int main() {
+	TestBufferMemory();
+	TestFrameMemory();
+	return TEST_RESULT();
+}
@@ -0,0 +1,69 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// FrameResizeBenchmark [frames]
+// time per frame of every filter on the modes a clip is commonly scaled between, up and down, and on the
+// near sizes where the device is a few pixels off. ctest runs it with one frame each, pass more for stable
+// numbers.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "CaptureBackend.h"
+#include "FrameResize.h"
+
+
+
+static const char* FILTER_NAMES[] = { "none", "bilinear", "bicubic", "area" };
+
+
+
+int main(int argc, char** argv) {
+	int frames = (argc > 1) ? atoi(argv[1]) : 30;
+	if (frames < 1) {
+		fprintf(stderr, "usage: FrameResizeBenchmark [frames]\n");
+		return 1;
+	}
+
+	const int modes[][4] = { { 1280, 720, 1920, 1080 }, { 1920, 1080, 1280, 720 }, { 640, 480, 1920, 1080 }, { 3840, 2160, 1920, 1080 }, { 1920, 1080, 3840, 2160 }, { 1920, 1088, 1920, 1080 }, { 1280, 720, 1282, 720 } };
+	for (int f = RESIZE_BILINEAR; f <= RESIZE_AREA; f++) {
+		for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			const int* mode = modes[m];
+			std::vector<unsigned char> src((size_t)mode[0] * mode[1] * 3), dst((size_t)mode[2] * mode[3] * 3);
+			for (size_t i = 0; i < src.size(); i++) {
+				src[i] = (unsigned char)rand();
+			}
+			FrameResizer resizer(mode[0], mode[1], mode[2], mode[3], f, false);
+			resizer.Resize(&src[0], &dst[0]);
+
+			double start = GetCaptureTime();
+			for (int i = 0; i < frames; i++) {
+				resizer.Resize(&src[0], &dst[0]);
+			}
+			double elapsed = GetCaptureTime() - start;
+			printf("%-8s %4dx%-4d -> %4dx%-4d %7.2f ms per frame, %6.0f Mpixel/s out\n", FILTER_NAMES[f], mode[0], mode[1], mode[2], mode[3], elapsed / frames * 1e3, (double)mode[2] * mode[3] * frames / elapsed / 1e6);
+		}
+	}
+	return 0;
+}
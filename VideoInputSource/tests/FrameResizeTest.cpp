@@ -0,0 +1,312 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// FrameResizer against a double precision reference of the same filters, on flat, smooth and noisy frames
+// of odd sizes, and its PSNR on a smooth image; fields are scaled apart. Then clips of the synthetic device
+// asking for a size the device does not offer, which must equal the device frame scaled by FrameResizer.
+
+#include "TestCheck.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "FrameResize.h"
+#include "VideoInputSource.h"
+
+
+
+static const char* FILTER_NAMES[] = { "none", "bilinear", "bicubic", "area" };
+
+
+
+static double Bilinear(double x) {
+	x = fabs(x);
+	return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+// Mitchell-Netravali, B = C = 1/3
+static double Bicubic(double x) {
+	const double b = 1.0 / 3.0, c = 1.0 / 3.0;
+	x = fabs(x);
+	if (x < 1.0) {
+		return ((12 - 9 * b - 6 * c) * x * x * x + (-18 + 12 * b + 6 * c) * x * x + (6 - 2 * b)) / 6;
+	}
+	if (x < 2.0) {
+		return ((-b - 6 * c) * x * x * x + (6 * b + 30 * c) * x * x + (-12 * b - 48 * c) * x + (8 * b + 24 * c)) / 6;
+	}
+	return 0.0;
+}
+
+// weights[i][k] of source pixel k in output pixel i, edges clamped
+static std::vector<std::vector<double> > ReferenceWeights(const int srcSize, const int dstSize, const int filter) {
+	std::vector<std::vector<double> > weights(dstSize, std::vector<double>(srcSize, 0.0));
+	double scale = (double)srcSize / dstSize;
+	for (int i = 0; i < dstSize; i++) {
+		if (srcSize == dstSize) {
+			weights[i][i] = 1.0;
+			continue;
+		}
+		if (filter == RESIZE_AREA) {
+			double left = i * scale, right = (i + 1) * scale;
+			for (int k = 0; k < srcSize; k++) {
+				double overlap = std::min(right, k + 1.0) - std::max(left, (double)k);
+				if (overlap > 0.0) {
+					weights[i][k] += overlap;
+				}
+			}
+		}
+		else {
+			double center = (i + 0.5) * scale - 0.5;
+			double stretch = (scale > 1.0) ? scale : 1.0;
+			double support = ((filter == RESIZE_BICUBIC) ? 2.0 : 1.0) * stretch;
+			for (int k = (int)ceil(center - support); k <= (int)floor(center + support); k++) {
+				int clamped = std::min(std::max(k, 0), srcSize - 1);
+				weights[i][clamped] += (filter == RESIZE_BICUBIC) ? Bicubic((k - center) / stretch) : Bilinear((k - center) / stretch);
+			}
+		}
+		double sum = 0.0;
+		for (int k = 0; k < srcSize; k++) {
+			sum += weights[i][k];
+		}
+		for (int k = 0; k < srcSize; k++) {
+			weights[i][k] /= sum;
+		}
+	}
+	return weights;
+}
+
+static unsigned char Round(const double value) {
+	return (unsigned char)std::min(255.0, std::max(0.0, floor(value + 0.5)));
+}
+
+// vertical pass first and rounded in between, as FrameResizer does
+static void ReferenceResize(const unsigned char* src, const int srcWidth, const int srcHeight, unsigned char* dst, const int dstWidth, const int dstHeight, const int filter) {
+	std::vector<std::vector<double> > vertical = ReferenceWeights(srcHeight, dstHeight, filter);
+	std::vector<std::vector<double> > horizontal = ReferenceWeights(srcWidth, dstWidth, filter);
+	std::vector<double> row(srcWidth * 3);
+	for (int y = 0; y < dstHeight; y++) {
+		for (int x = 0; x < srcWidth * 3; x++) {
+			double sum = 0.0;
+			for (int k = 0; k < srcHeight; k++) {
+				sum += vertical[y][k] * src[k * srcWidth * 3 + x];
+			}
+			row[x] = Round(sum);
+		}
+		for (int x = 0; x < dstWidth; x++) {
+			for (int c = 0; c < 3; c++) {
+				double sum = 0.0;
+				for (int k = 0; k < srcWidth; k++) {
+					sum += horizontal[x][k] * row[k * 3 + c];
+				}
+				dst[(y * dstWidth + x) * 3 + c] = Round(sum);
+			}
+		}
+	}
+}
+
+static double Smooth(const double x, const double y, const int c) {
+	return 127.5 + 127.5 * sin((x * 0.05 + y * 0.03) * (c + 1));
+}
+
+// 0 flat, 1 smooth, 2 noise
+static void Pattern(std::vector<unsigned char>& pixels, const int width, const int height, const int kind) {
+	pixels.resize(width * height * 3);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			for (int c = 0; c < 3; c++) {
+				int value = (kind == 0) ? 90 + c * 40 : (kind == 1) ? (int)Smooth(x, y, c) : rand() & 255;
+				pixels[(y * width + x) * 3 + c] = (unsigned char)value;
+			}
+		}
+	}
+}
+
+static int FilterID(const char* name) {
+	for (int f = RESIZE_BILINEAR; f <= RESIZE_AREA; f++) {
+		if (strcmp(name, FILTER_NAMES[f]) == 0) {
+			return f;
+		}
+	}
+	return RESIZE_NONE;
+}
+
+
+
+// every filter within 2 of the reference, flat frames kept flat, nothing written past the frame
+static void TestReference() {
+	const int sizes[][4] = { { 160, 120, 161, 120 }, { 64, 48, 40, 30 }, { 40, 30, 64, 48 }, { 160, 120, 50, 37 }, { 33, 17, 97, 51 }, { 320, 240, 80, 60 }, { 7, 5, 3, 2 }, { 3, 2, 11, 9 } };
+	int worst = 0;
+	double total = 0.0, count = 0.0;
+	for (int f = RESIZE_BILINEAR; f <= RESIZE_AREA; f++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			const int* size = sizes[s];
+			for (int kind = 0; kind < 3; kind++) {
+				std::vector<unsigned char> src;
+				Pattern(src, size[0], size[1], kind);
+				std::vector<unsigned char> dst(size[2] * size[3] * 3 + 1, 0xEE), expect(size[2] * size[3] * 3);
+				FrameResizer resizer(size[0], size[1], size[2], size[3], f, false);
+				resizer.Resize(&src[0], &dst[0]);
+				ReferenceResize(&src[0], size[0], size[1], &expect[0], size[2], size[3], f);
+
+				int difference = 0;
+				bool flat = true;
+				for (size_t i = 0; i < expect.size(); i++) {
+					int d = abs(dst[i] - expect[i]);
+					difference = std::max(difference, d);
+					total += d;
+					count++;
+					flat = flat && (kind != 0 || dst[i] == src[i % 3]);
+				}
+				worst = std::max(worst, difference);
+				if (difference > 2 || !flat || dst.back() != 0xEE) {
+					printf("%s %dx%d -> %dx%d pattern %d: difference %d, flat %d, guard %d\n", FILTER_NAMES[f], size[0], size[1], size[2], size[3], kind, difference, flat, dst.back());
+				}
+				CHECK(difference <= 2);
+				CHECK(flat);
+				CHECK(dst.back() == 0xEE);
+			}
+		}
+	}
+	printf("reference: worst difference %d, mean %.4f\n", worst, total / count);
+}
+
+// scaled against the smooth image sampled at the centres of the output pixels
+static void TestPSNR() {
+	const int srcWidth = 1280, srcHeight = 720;
+	const int sizes[][2] = { { 1920, 1080 }, { 640, 360 } };
+	std::vector<unsigned char> src(srcWidth * srcHeight * 3);
+	for (int y = 0; y < srcHeight; y++) {
+		for (int x = 0; x < srcWidth; x++) {
+			for (int c = 0; c < 3; c++) {
+				src[(y * srcWidth + x) * 3 + c] = Round(Smooth(x, y, c));
+			}
+		}
+	}
+	for (int f = RESIZE_BILINEAR; f <= RESIZE_AREA; f++) {
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			int width = sizes[s][0], height = sizes[s][1];
+			std::vector<unsigned char> dst(width * height * 3);
+			FrameResizer resizer(srcWidth, srcHeight, width, height, f, false);
+			resizer.Resize(&src[0], &dst[0]);
+			double error = 0.0;
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					for (int c = 0; c < 3; c++) {
+						double e = dst[(y * width + x) * 3 + c] - Smooth((x + 0.5) * srcWidth / width - 0.5, (y + 0.5) * srcHeight / height - 0.5, c);
+						error += e * e;
+					}
+				}
+			}
+			double psnr = 10.0 * log10(255.0 * 255.0 / (error / (width * height * 3)));
+			printf("%-8s 1280x720 -> %dx%d: PSNR %.1f dB\n", FILTER_NAMES[f], width, height, psnr);
+			CHECK(psnr > 35.0);
+		}
+	}
+}
+
+// one field black and the other white stay so
+static void TestFields() {
+	std::vector<unsigned char> src(64 * 48 * 3), dst(80 * 60 * 3);
+	for (int y = 0; y < 48; y++) {
+		memset(&src[y * 64 * 3], (y & 1) ? 255 : 0, 64 * 3);
+	}
+	FrameResizer resizer(64, 48, 80, 60, RESIZE_BICUBIC, true);
+	resizer.Resize(&src[0], &dst[0]);
+	int mixed = 0;
+	for (int y = 0; y < 60; y++) {
+		for (int x = 0; x < 80 * 3; x++) {
+			mixed += (dst[y * 80 * 3 + x] != ((y & 1) ? 255 : 0));
+		}
+	}
+	CHECK(mixed == 0);
+}
+
+static std::shared_ptr<VideoInputSource> Open(const int width, const char* resize, const char* fields) {
+	VideoInputSourceParams params;
+	params.connectionType = "Synthetic";
+	params.width = width;
+	params.height = 120;
+	params.frameSkip = false;
+	params.captureFormat = "YUYV";
+	params.queueDepth = 8;
+	params.lossless = 200;
+	params.resize = resize;
+	params.fields = fields;
+	return VideoInputSource::Create(params);
+}
+
+// the synthetic device renders sample n the same in every session, so a 161 wide clip it can only serve
+// at 160 must be frame n of a 160 wide clip, scaled
+static void TestSource() {
+	const char* fieldOrders[] = { "none", "tff" };
+	const char* filters[] = { "bilinear", "bicubic", "area" };
+	for (int o = 0; o < 2; o++) {
+		for (int f = 0; f < 3; f++) {
+			std::shared_ptr<VideoInputSource> exact = Open(160, "none", fieldOrders[o]);
+			std::shared_ptr<VideoInputSource> scaled = Open(161, filters[f], fieldOrders[o]);
+			const unsigned char* exactFrame = NULL;
+			const unsigned char* scaledFrame = NULL;
+			for (int i = 0; i < 10; i++) {
+				exactFrame = exact->GetFrame();
+				scaledFrame = scaled->GetFrame();
+			}
+			CHECK(exact->GetFrameNumber() == scaled->GetFrameNumber());
+			CHECK(scaled->GetWidth() == 161 && scaled->GetHeight() == 120);
+			CHECK(scaled->GetStats().captureWidth == 160);
+
+			std::vector<unsigned char> expect(161 * 120 * 3);
+			FrameResizer resizer(160, 120, 161, 120, FilterID(filters[f]), strcmp(fieldOrders[o], "none") != 0);
+			resizer.Resize(exactFrame, &expect[0]);
+			CHECK(memcmp(scaledFrame, &expect[0], expect.size()) == 0);
+		}
+	}
+
+	// a size the device does not offer needs resize, and resize a filter it knows
+	const char* resizes[] = { "none", "lanczos" };
+	for (int r = 0; r < 2; r++) {
+		const char* error = NULL;
+		try {
+			Open(161, resizes[r], "none")->GetFrame();
+		}
+		catch (const char* message) {
+			error = message;
+		}
+		CHECK(error != NULL);
+	}
+
+	// resize is not used when the device has the size
+	std::shared_ptr<VideoInputSource> exact = Open(160, "bicubic", "none");
+	exact->GetFrame();
+	CHECK(exact->GetStats().captureWidth == 160);
+}
+
+int main() {
+	TestReference();
+	TestPSNR();
+	TestFields();
+	TestSource();
+	return TEST_RESULT();
+}
@@ -0,0 +1,264 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// FrameScheduler on eventfds standing in for devices: every signal reaches its listener, never on two
+// workers at once, Unwatch leaves no call running and the threads stay parked for the next Watch. Then frame
+// requests of a stalling synthetic source waiting on the scheduler with wait_timeout.
+
+#include "TestCheck.h"
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "FrameScheduler.h"
+#include "VideoInputSource.h"
+
+
+
+// a device whose sample is taken by reading its eventfd, as converting it would
+class EventListener : public FrameListener {
+public:
+	int event;
+	std::atomic<int> calls;
+	std::atomic<int> running;
+	std::atomic<int> overlaps;
+	int workMilliseconds;
+
+	EventListener(const int workMilliseconds) : calls(0), running(0), overlaps(0), workMilliseconds(workMilliseconds) {
+		event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+
+	~EventListener() {
+		close(event);
+	}
+
+	void Signal() {
+		eventfd_write(event, 1);
+	}
+
+	void OnFrameReady() {
+		if (running.fetch_add(1) != 0) {
+			overlaps++;
+		}
+		eventfd_t count;
+		eventfd_read(event, &count);
+		if (workMilliseconds > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(workMilliseconds));
+		}
+		calls++;
+		running--;
+	}
+};
+
+static bool WaitFor(const std::atomic<int>& value, const int expected) {
+	for (int i = 0; i < 2000 && value < expected; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return value >= expected;
+}
+
+
+
+static void TestSignal() {
+	FrameScheduler& scheduler = FrameScheduler::GetInstance();
+	EventListener listener(0);
+	CHECK(scheduler.Watch(&listener, listener.event) == NULL);
+
+	for (int i = 1; i <= 20; i++) {
+		listener.Signal();
+		CHECK(WaitFor(listener.calls, i));
+	}
+	// a sample that came without a signal
+	scheduler.Notify(&listener);
+	CHECK(WaitFor(listener.calls, 21));
+
+	scheduler.Unwatch(&listener);
+	listener.Signal();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK(listener.calls == 21);
+}
+
+// a listener busy converting is not called again meanwhile; signals that came in are seen once it is done
+static void TestNoOverlap() {
+	FrameScheduler& scheduler = FrameScheduler::GetInstance();
+	EventListener listener(20);
+	CHECK(scheduler.Watch(&listener, listener.event) == NULL);
+	for (int i = 0; i < 10; i++) {
+		listener.Signal();
+		scheduler.Notify(&listener);
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	CHECK(WaitFor(listener.calls, 2));
+	scheduler.Unwatch(&listener);
+	CHECK(listener.overlaps == 0);
+	CHECK(listener.running == 0);
+	CHECK(listener.calls < 10);
+}
+
+// many devices at once are served by a few workers, each one still called
+static void TestManyListeners() {
+	FrameScheduler& scheduler = FrameScheduler::GetInstance();
+	std::vector<EventListener*> listeners;
+	for (int i = 0; i < 16; i++) {
+		listeners.push_back(new EventListener(2));
+		CHECK(scheduler.Watch(listeners.back(), listeners.back()->event) == NULL);
+	}
+
+	std::atomic<int> concurrent(0);
+	for (int round = 1; round <= 5; round++) {
+		for (size_t i = 0; i < listeners.size(); i++) {
+			listeners[i]->Signal();
+		}
+		for (size_t i = 0; i < listeners.size(); i++) {
+			int running = 0;
+			for (size_t j = 0; j < listeners.size(); j++) {
+				running += listeners[j]->running;
+			}
+			concurrent = (running > concurrent) ? running : (int)concurrent;
+			CHECK(WaitFor(listeners[i]->calls, round));
+		}
+	}
+	printf("16 listeners: at most %d converting at once, %d workers\n", (int)concurrent, FrameScheduler::GetWorkerCount());
+	CHECK(concurrent <= FrameScheduler::GetWorkerCount());
+
+	for (size_t i = 0; i < listeners.size(); i++) {
+		scheduler.Unwatch(listeners[i]);
+		CHECK(listeners[i]->running == 0 && listeners[i]->overlaps == 0);
+		delete listeners[i];
+	}
+}
+
+// Unwatch returns only once a call still running is done, so the listener may go away right after
+static void TestUnwatchRunning() {
+	FrameScheduler& scheduler = FrameScheduler::GetInstance();
+	for (int i = 0; i < 10; i++) {
+		EventListener* listener = new EventListener(10);
+		CHECK(scheduler.Watch(listener, listener->event) == NULL);
+		listener->Signal();
+		std::this_thread::sleep_for(std::chrono::milliseconds(i));
+		scheduler.Unwatch(listener);
+		CHECK(listener->running == 0);
+		delete listener;
+	}
+}
+
+static int CountThreads() {
+	DIR* tasks = opendir("/proc/self/task");
+	if (tasks == NULL) {
+		return -1;
+	}
+	int threads = 0;
+	while (dirent* task = readdir(tasks)) {
+		threads += (task->d_name[0] != '.');
+	}
+	closedir(tasks);
+	return threads;
+}
+
+// the threads stay parked once the last listener is gone, and the next Watch, as when the watchdog reopens
+// a device, reuses them and is served right away
+static void TestParkedThreads() {
+	FrameScheduler& scheduler = FrameScheduler::GetInstance();
+	EventListener first(0);
+	CHECK(scheduler.Watch(&first, first.event) == NULL);
+	const int threads = CountThreads();
+	scheduler.Unwatch(&first);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	printf("scheduler: %d threads watching, %d with nothing watched\n", threads, CountThreads());
+	CHECK(CountThreads() == threads);
+
+	for (int i = 1; i <= 5; i++) {
+		EventListener listener(0);
+		CHECK(scheduler.Watch(&listener, listener.event) == NULL);
+		listener.Signal();
+		CHECK(WaitFor(listener.calls, 1));
+		scheduler.Unwatch(&listener);
+		CHECK(CountThreads() == threads);
+	}
+}
+
+// frame requests of a source stalling for 1.5s every 3s wait no longer than wait_timeout, then repeat
+static void TestWaitTimeout() {
+	VideoInputSourceParams params;
+	params.connectionType = "Synthetic:stall=1500,interval=3000";
+	params.width = 64;
+	params.height = 48;
+	params.frameSkip = false;
+	params.captureFormat = "YUYV";
+	params.waitTimeout = 100;
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(params);
+	source->GetFrame();
+
+	double longest = 0.0;
+	int duplicates = 0;
+	for (int i = 0; i < 90; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		source->GetFrame();
+		double wait = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		longest = (wait > longest) ? wait : longest;
+		duplicates += source->IsFrameDuplicate();
+	}
+	printf("wait_timeout: longest wait %.3f s, %d duplicates\n", longest, duplicates);
+	CHECK(longest < 0.15);
+	CHECK(duplicates > 0);
+
+	// TryGetFrame never waits
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 1000; i++) {
+		source->TryGetFrame();
+	}
+	CHECK(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < 0.1);
+
+	const char* error = NULL;
+	try {
+		VideoInputSourceParams params;
+		params.deviceID = 1;
+		params.connectionType = "Synthetic";
+		params.width = 64;
+		params.height = 48;
+		params.frameSkip = false;
+		params.captureFormat = "YUYV";
+		params.waitSpin = -1;
+		VideoInputSource::Create(params);
+	}
+	catch (const char* message) {
+		error = message;
+	}
+	CHECK(error != NULL);
+}
+
+int main() {
+	CHECK(FrameScheduler::GetWorkerCount() >= 1);
+	TestSignal();
+	TestNoOverlap();
+	TestManyListeners();
+	TestUnwatchRunning();
+	TestParkedThreads();
+	TestWaitTimeout();
+	return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// FrameSpill written and read in bursts across segment boundaries: frames come back whole and in order,
+// read segments are reused instead of growing the file, and writes past the size limit are refused
+
+#include "TestCheck.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "FrameSpill.h"
+
+
+
+// a size that is no multiple of anything, so frames straddle pages; 63 of them fill a segment
+static const size_t FRAME_SIZE = 1024 * 1024 + 123;
+static const __int64 MB = 1024 * 1024;
+
+
+
+class SpillChecker {
+private:
+	FrameSpill& mSpill;
+	std::vector<unsigned char> mFrame;
+
+public:
+	unsigned long written, read;
+	int wrong;
+
+	SpillChecker(FrameSpill& spill) : mSpill(spill), mFrame(FRAME_SIZE), written(0), read(0), wrong(0) {
+	}
+
+	// frame n is filled with n, its last byte with n * 7
+	bool Put(const int count) {
+		for (int i = 0; i < count; i++) {
+			memset(&mFrame[0], (int)((written + 1) & 0xFF), FRAME_SIZE);
+			mFrame[FRAME_SIZE - 1] = (unsigned char)((written + 1) * 7);
+			if (!mSpill.Write(&mFrame[0], written + 1, (written + 1) * 0.5)) {
+				return false;
+			}
+			written++;
+		}
+		return true;
+	}
+
+	bool Get(const int count) {
+		for (int i = 0; i < count; i++) {
+			unsigned long number;
+			double time;
+			if (!mSpill.Read(&mFrame[0], number, time)) {
+				return false;
+			}
+			read++;
+			unsigned char value = (unsigned char)(read & 0xFF);
+			if (number != read || time != read * 0.5 || mFrame[0] != value || mFrame[FRAME_SIZE / 2] != value || mFrame[FRAME_SIZE - 2] != value || mFrame[FRAME_SIZE - 1] != (unsigned char)(read * 7)) {
+				wrong++;
+			}
+		}
+		return true;
+	}
+};
+
+
+
+static void TestOrder() {
+	FrameSpill spill(FRAME_SIZE, (__int64)1 << 40);
+	SpillChecker checker(spill);
+	CHECK(spill.GetCount() == 0 && spill.GetFileSize() == 0);
+
+	// a backlog of 100 frames takes two segments
+	CHECK(checker.Put(100));
+	CHECK(checker.Get(30));
+	CHECK(spill.GetCount() == 70);
+	__int64 fileSize = spill.GetFileSize();
+	printf("order: 100 frames spilled in %lld MB\n", (long long)(fileSize / MB));
+	CHECK(fileSize >= (__int64)(100 * FRAME_SIZE) && fileSize <= 160 * MB);
+
+	// reading the first segment to its end frees it for the frames written next, so the file stays as it is
+	CHECK(checker.Get(40));
+	CHECK(checker.Put(50));
+	CHECK(spill.GetFileSize() == fileSize);
+
+	// reading everything and starting over
+	CHECK(checker.Get(80));
+	unsigned long number;
+	double time;
+	std::vector<unsigned char> frame(FRAME_SIZE);
+	CHECK(!spill.Read(&frame[0], number, time));
+	CHECK(spill.GetCount() == 0);
+	CHECK(checker.Put(5));
+	CHECK(checker.Get(5));
+	CHECK(spill.GetFileSize() == fileSize);
+
+	CHECK(checker.wrong == 0);
+	CHECK(checker.read == 155 && checker.written == 155);
+	CHECK(spill.GetBytesWritten() == 155.0 * FRAME_SIZE);
+}
+
+static void TestLimit() {
+	// room for two segments only
+	FrameSpill spill(FRAME_SIZE, 130 * MB);
+	SpillChecker checker(spill);
+
+	int accepted = 0;
+	while (accepted < 1000 && checker.Put(1)) {
+		accepted++;
+	}
+	printf("limit: %d frames accepted in %lld MB\n", accepted, (long long)(spill.GetFileSize() / MB));
+	CHECK(accepted == 126);
+	CHECK(spill.GetFileSize() <= 130 * MB);
+
+	// a refused frame is not kept, reading a segment back makes room again
+	CHECK(spill.GetCount() == 126);
+	CHECK(checker.Get(63));
+	CHECK(checker.Put(63));
+	CHECK(!checker.Put(1));
+	CHECK(checker.Get(126));
+	CHECK(checker.wrong == 0);
+}
+
+int main() {
+	TestOrder();
+	TestLimit();
+	return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// the timing helpers of VideoInputSource driven directly with made-up sample times: the rate FrameRateMeter
+// measures over its warm-up window, how FramePacer spreads out the drops and repeats of a drifting device, and
+// the ticks RealtimeClock lets frames through at on the real clock
+
+#include "TestCheck.h"
+
+#include <math.h>
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "VideoInputSource.h"
+
+
+
+static bool Near(const double value, const double expected, const double tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+// samples every period seconds, numbered from first; returns the rate once AddSample reports the window full
+static double MeasureRate(FrameRateMeter& meter, const unsigned long first, const unsigned long step, const double period, int& samples) {
+	samples = 0;
+	for (unsigned long number = first; ; number += step) {
+		samples++;
+		if (meter.AddSample(number, 100.0 + (number - first) * period)) {
+			return meter.GetRate();
+		}
+		if (samples > 10000) {
+			return 0.0;
+		}
+	}
+}
+
+static void TestFrameRateMeter() {
+	FrameRateMeter meter(1.0);
+	CHECK(meter.GetRate() == 0.0);
+	CHECK(!meter.AddSample(1, 10.0));
+	CHECK(meter.GetRate() == 0.0);
+	CHECK(!meter.IsDone());
+
+	// 30 fps: the window fills at the sample one second after the first, the 31st
+	meter.Reset();
+	int samples;
+	double rate = MeasureRate(meter, 1, 1, 1.0 / 30.0, samples);
+	printf("meter: %.6f fps after %d samples\n", rate, samples);
+	CHECK(Near(rate, 30.0, 1e-9));
+	CHECK(samples == 31);
+	CHECK(meter.IsDone());
+	// later samples no longer move the rate
+	CHECK(!meter.AddSample(1000, 101.5));
+	CHECK(meter.GetRate() == rate);
+
+	// NTSC rate with the consumer taking only every third sample: the numbers still count the skipped ones
+	meter.Reset();
+	rate = MeasureRate(meter, 7, 3, 1001.0 / 30000.0, samples);
+	printf("meter: %.6f fps taking every third sample\n", rate);
+	CHECK(Near(rate, 30000.0 / 1001.0, 1e-9));
+
+	// repeated and older samples are ignored rather than counted
+	meter.Reset();
+	CHECK(!meter.AddSample(10, 0.0));
+	CHECK(!meter.AddSample(20, 0.5));
+	CHECK(!meter.AddSample(20, 0.6));
+	CHECK(!meter.AddSample(15, 0.7));
+	CHECK(!meter.AddSample(25, 0.4));
+	CHECK(Near(meter.GetRate(), 20.0, 1e-9));
+	CHECK(meter.AddSample(35, 1.25));
+	CHECK(Near(meter.GetRate(), 20.0, 1e-9));
+}
+
+// a device whose clock is off by drift from the output clock, both with up to 1ms of jitter, consumed the way
+// TakeFrame does: a planned frame takes the newest sample, or waits up to half an output period for the next.
+// Returns the output frames a sample was dropped or repeated at and the device samples per output frame
+static std::vector<int> PaceDriftingDevice(const double drift, const int frames, double& ratio) {
+	const double outputPeriod = 1.0 / 30.0;
+	const double devicePeriod = outputPeriod * (1.0 + drift);
+	std::mt19937 random(1);
+	std::uniform_real_distribution<double> jitter(0.0, 0.001);
+
+	// arrival time of sample number, counted from 1 like the device numbers them
+	std::vector<double> arrival(1, 0.0);
+	FramePacer pacer(0.25);
+	pacer.Reset(devicePeriod, outputPeriod);
+	std::vector<int> events;
+	unsigned long shown = 0;
+	for (int n = 0; n < frames; n++) {
+		double time = n * outputPeriod + jitter(random);
+		while (arrival.back() <= time + outputPeriod) {
+			arrival.push_back(0.4 * devicePeriod + arrival.size() * devicePeriod + jitter(random));
+		}
+		unsigned long newest = 0;
+		while (arrival[newest + 1] <= time) {
+			newest++;
+		}
+
+		unsigned long next = shown;
+		if (pacer.PlanFrame(time)) {
+			if (newest > shown) {
+				next = newest;
+			}
+			else if (arrival[shown + 1] <= time + outputPeriod * 0.5) {
+				next = shown + 1;
+			}
+		}
+		// the first sample shown counts as neither
+		if (shown != 0 && next != shown + 1) {
+			events.push_back(n);
+		}
+		if (next != shown) {
+			pacer.OnSample(next, arrival[next]);
+			shown = next;
+		}
+	}
+	ratio = pacer.GetRatio();
+	return events;
+}
+
+// with the clocks 0.1% apart, one sample in a thousand is dropped or repeated: the ratio settles on the true one
+// and, the start aside, the drops or repeats come one at a time about a thousand frames apart rather than in bursts
+static void TestFramePacer(const double drift) {
+	const int frames = 6000;
+	double ratio;
+	std::vector<int> events = PaceDriftingDevice(drift, frames, ratio);
+	double expected = 1.0 / (1.0 + drift);
+
+	int shortest = frames, longest = 0, settled = 0;
+	for (size_t i = 1; i < events.size(); i++) {
+		if (events[i - 1] < 500) {
+			continue;
+		}
+		int gap = events[i] - events[i - 1];
+		shortest = (gap < shortest) ? gap : shortest;
+		longest = (gap > longest) ? gap : longest;
+		settled++;
+	}
+	printf("pacer %+.1f%%: ratio %.6f (%.6f), %d events, gaps %d to %d frames\n", drift * 100.0, ratio, expected, (int)events.size(), shortest, longest);
+	CHECK(Near(ratio, expected, 1e-4));
+	CHECK(settled >= 3);
+	CHECK(shortest >= 900 && longest <= 1100);
+}
+
+static double Now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a caller asking for frames faster than 100 fps gets one every 10 ms on the schedule of the first; a stall shorter
+// than the catch-up of two periods is made up by ticking at once, a longer one starts the schedule over
+static void TestRealtimeClock() {
+	const double period = 0.010;
+	RealtimeClock clock(2);
+	clock.Reset(period);
+	clock.WaitTick();
+	double first = Now();
+	CHECK(clock.GetRate() == 0.0);
+
+	double early = 0.0, late = 0.0;
+	for (int tick = 1; tick <= 50; tick++) {
+		clock.WaitTick();
+		double offset = Now() - (first + tick * period);
+		early = (offset < early) ? offset : early;
+		late = (offset > late) ? offset : late;
+	}
+	printf("realtime: %.3f fps, ticks %.2f to %+.2f ms off schedule\n", clock.GetRate(), early * 1000.0, late * 1000.0);
+	CHECK(Near(clock.GetRate(), 100.0, 1.0));
+	CHECK(early > -0.0005);
+	CHECK(late < 0.004);
+
+	// 15 ms late: this tick comes at once, the next one back on the schedule
+	std::this_thread::sleep_for(std::chrono::milliseconds(15));
+	double asked = Now();
+	clock.WaitTick();
+	CHECK(Now() - asked < 0.002);
+	clock.WaitTick();
+	CHECK(Near(Now(), first + 52 * period, 0.004));
+	CHECK(clock.GetSlips() == 0);
+
+	// 50 ms late: the schedule starts over from this tick
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	asked = Now();
+	clock.WaitTick();
+	double restart = Now();
+	CHECK(restart - asked < 0.002);
+	CHECK(clock.GetSlips() == 1);
+	for (int tick = 1; tick <= 5; tick++) {
+		clock.WaitTick();
+	}
+	printf("realtime: restarted after a stall, 5 ticks in %.2f ms\n", (Now() - restart) * 1000.0);
+	CHECK(Near(Now(), restart + 5 * period, 0.004));
+	CHECK(clock.GetSlips() == 1);
+
+	// a new period forgets the slips and the rate
+	clock.Reset(period);
+	CHECK(clock.GetSlips() == 0);
+	CHECK(clock.GetRate() == 0.0);
+}
+
+int main() {
+	TestFrameRateMeter();
+	TestFramePacer(0.001);
+	TestFramePacer(-0.001);
+	TestRealtimeClock();
+	return TEST_RESULT();
+}
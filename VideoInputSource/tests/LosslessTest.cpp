@@ -0,0 +1,184 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// LosslessTest [seconds] [frames in memory]
+// a 60 fps synthetic device read at 30 fps in lossless mode, so the backlog grows by 30 frames a second and
+// most of it is spilled, then drained as fast as possible: every sample has to come out once and in order,
+// with memory staying flat, and the watchdog never taking the consumer falling behind for a frozen device.
+// ctest runs it for a few seconds; pass 600 or more for a long run, which reports its progress every 30
+// seconds. Then a device stalling long enough to be reopened by the watchdog in lossless mode: the samples
+// queued before the stall still come out once and in order.
+
+#include "TestCheck.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+
+#include "VideoInputSource.h"
+
+
+
+static long ResidentKB() {
+	FILE* file = fopen("/proc/self/status", "r");
+	if (file == NULL) {
+		return 0;
+	}
+	char line[256];
+	long kb = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0) {
+			kb = atol(line + 6);
+		}
+	}
+	fclose(file);
+	return kb;
+}
+
+static std::shared_ptr<VideoInputSource> CreateSource(const int deviceID, const char* connectionType, const int memory) {
+	VideoInputSourceParams params;
+	params.deviceID = deviceID;
+	params.connectionType = connectionType;
+	params.width = 160;
+	params.height = 120;
+	params.fpsNumerator = 60;
+	params.frameSkip = false;
+	params.captureFormat = "YUYV";
+	params.queueDepth = 8;
+	params.lossless = memory;
+	params.reconnectTimeout = 300;
+	return VideoInputSource::Create(params);
+}
+
+static void TestBacklog(const int seconds, const int memory) {
+	std::shared_ptr<VideoInputSource> source = CreateSource(0, "Synthetic:jitter=3", memory);
+
+	unsigned long previous = 0, gaps = 0, frames = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point next = start;
+	long residentStart = 0;
+	int reported = 0;
+	while (std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)) {
+		next += std::chrono::microseconds(33333);
+		std::this_thread::sleep_until(next);
+		source->GetFrame();
+		unsigned long number = source->GetFrameNumber();
+		gaps += (previous != 0 && number != previous + 1);
+		previous = number;
+		frames++;
+		if (frames == 30) {
+			residentStart = ResidentKB();
+		}
+
+		int elapsed = (int)std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed / 30 != reported) {
+			reported = elapsed / 30;
+			VideoInputSourceStats stats = source->GetStats();
+			printf("%5d s: taken %lu, queued %d, spilled %d, spill %.0f MB, resident %ld MB, gaps %lu\n", elapsed, frames, stats.queuedFrames, stats.spilledFrames, stats.spillBytes / 1048576, ResidentKB() / 1024, gaps);
+			fflush(stdout);
+		}
+	}
+
+	VideoInputSourceStats stats = source->GetStats();
+	int backlog = stats.queuedFrames;
+	int spilled = stats.spilledFrames;
+	long residentPeak = ResidentKB();
+
+	// the device keeps delivering, so the consumer drains faster than it fills until nothing is left
+	while (source->GetStats().queuedFrames > 0) {
+		source->GetFrame();
+		unsigned long number = source->GetFrameNumber();
+		gaps += (number != previous + 1);
+		previous = number;
+		frames++;
+	}
+
+	stats = source->GetStats();
+	printf("%d s: backlog %d with %d spilled, resident %+ld KB; drained %lu frames, %lu gaps, %lu received, %lu dropped, spill %.0f MB, %d reconnects\n", seconds, backlog, spilled, residentPeak - residentStart, frames, gaps, stats.samplesReceived, stats.samplesDropped, stats.spillBytes / 1048576, stats.reconnects);
+	CHECK(gaps == 0);
+	CHECK(stats.samplesDropped == 0);
+	CHECK(backlog >= seconds * 25);
+	CHECK(spilled > 0 && spilled >= backlog - memory);
+	// the backlog lives in the spill file, not in memory
+	CHECK(residentPeak - residentStart < 32 * 1024);
+	// the device kept delivering however far behind the consumer was
+	CHECK(stats.reconnects == 0);
+}
+
+// 60 fps stalling for 600 ms every 1.5 s, read at 30 fps for 3 s, so there is a backlog whenever the watchdog
+// reopens the device: the frames taken never go back, each sample received comes out once and none is dropped
+static void TestReconnect(const int memory) {
+	std::shared_ptr<VideoInputSource> source = CreateSource(1, "Synthetic:jitter=3,stall=600,interval=1500", memory);
+
+	unsigned long previous = 0, backwards = 0, taken = 0, repeats = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point next = start;
+	while (std::chrono::steady_clock::now() - start < std::chrono::seconds(3)) {
+		next += std::chrono::microseconds(33333);
+		std::this_thread::sleep_until(next);
+		source->GetFrame();
+		unsigned long number = source->GetFrameNumber();
+		if (source->IsFrameDuplicate()) {
+			repeats += (number != previous);
+		}
+		else {
+			backwards += (number <= previous);
+			taken++;
+		}
+		previous = number;
+	}
+	int reconnects = source->GetStats().reconnects;
+
+	// samples still queued come out after the reopen, so the stall is over before the consumer catches up
+	while (source->GetStats().queuedFrames > 0) {
+		source->GetFrame();
+		unsigned long number = source->GetFrameNumber();
+		if (!source->IsFrameDuplicate()) {
+			backwards += (number <= previous);
+			taken++;
+		}
+		previous = number;
+	}
+
+	VideoInputSourceStats stats = source->GetStats();
+	printf("reconnect: %d reconnects, taken %lu of %lu received, %lu dropped, %lu backwards\n", reconnects, taken, stats.samplesReceived, stats.samplesDropped, backwards);
+	CHECK(reconnects >= 1);
+	CHECK(backwards == 0);
+	CHECK(repeats == 0);
+	CHECK(stats.samplesDropped == 0);
+	// the device may have delivered one more since the queue was seen empty
+	CHECK(taken <= stats.samplesReceived && taken + 1 >= stats.samplesReceived);
+}
+
+int main(int argc, char** argv) {
+	int seconds = (argc > 1) ? atoi(argv[1]) : 5;
+	int memory = (argc > 2) ? atoi(argv[2]) : 30;
+	if (seconds < 1 || memory < 1) {
+		fprintf(stderr, "usage: LosslessTest [seconds] [frames in memory]\n");
+		return 1;
+	}
+	TestBacklog(seconds, memory);
+	TestReconnect(memory);
+	return TEST_RESULT();
+}
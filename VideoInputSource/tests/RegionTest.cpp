@@ -0,0 +1,157 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// region clips read the way the plugins read them: every region of frame n comes from the capture the main
+// clip shows at n, whoever asks first and whichever n the other clips are at, and a capture is converted once.
+
+#include "TestCheck.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "VideoInputSource.h"
+
+
+
+static const int WIDTH = 64;
+static const int HEIGHT = 48;
+static const int FRAMES = 40;
+
+
+
+static std::shared_ptr<VideoInputSource> CreateSource(const int deviceID) {
+	VideoInputSourceParams params;
+	params.deviceID = deviceID;
+	params.connectionType = "Synthetic";
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 120;
+	params.frameSkip = false;
+	params.regions = "left=0,0,32,48;corner=40,30,16,12";
+	return VideoInputSource::Create(params);
+}
+
+// whether the rows GetRegionRows hands out are the region's part of frame, which is bottom-up
+static bool RegionMatches(const std::shared_ptr<VideoInputSource>& source, const unsigned char* frame, const int index) {
+	const CaptureRegion& region = source->GetRegion(index);
+	ptrdiff_t pitch;
+	const unsigned char* rows = source->GetRegionRows(frame, index, pitch);
+	for (int y = 0; y < region.height; y++) {
+		const unsigned char* expected = frame + (ptrdiff_t)(HEIGHT - 1 - region.y - (region.height - 1 - y)) * WIDTH * 3 + region.x * 3;
+		if (memcmp(rows + y * pitch, expected, 3 * region.width) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static double RegionBytes(const std::shared_ptr<VideoInputSource>& source, const int index) {
+	const CaptureRegion& region = source->GetRegion(index);
+	return 3.0 * region.width * region.height;
+}
+
+// the main clip and two region clips opened together ask for every frame in turn, a different one first each time
+static void TestSameCapture() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(0);
+	const int regions[2] = {source->FindRegion("left"), source->FindRegion("corner")};
+	CHECK(regions[0] == 0 && regions[1] == 1);
+	CHECK(source->FindRegion("right") < 0);
+	int bases[3] = {source->OpenSharedClip(), source->OpenSharedClip(), source->OpenSharedClip()};
+
+	bool duplicate;
+	int dropped;
+	int mismatches = 0, wrongRows = 0;
+	for (int n = 0; n < FRAMES; n++) {
+		std::shared_ptr<const FrameSnapshot> frames[3];
+		for (int i = 0; i < 3; i++) {
+			int clip = (n + i) % 3;
+			frames[clip] = source->GetSharedFrame(bases[clip], n, duplicate, dropped);
+		}
+		mismatches += (frames[1] != frames[0]) + (frames[2] != frames[0]);
+		wrongRows += !RegionMatches(source, frames[1]->pixels, regions[0]) + !RegionMatches(source, frames[2]->pixels, regions[1]);
+	}
+	printf("regions: %d from another capture, %d with wrong rows\n", mismatches, wrongRows);
+	CHECK(mismatches == 0);
+	CHECK(wrongRows == 0);
+	CHECK(bases[0] == 0 && bases[1] == 0 && bases[2] == 0);
+
+	// one conversion per sample however many clips read it, and the regions counted once per read
+	VideoInputSourceStats stats = source->GetStats();
+	const double frameBytes = 3.0 * WIDTH * HEIGHT;
+	printf("region bytes %.0f, capture bytes %.0f for %lu samples\n", stats.regionBytes, stats.captureBytes, stats.samplesReceived);
+	CHECK(stats.framesDelivered == (unsigned long)FRAMES);
+	CHECK(stats.framesShared == (unsigned long)(2 * FRAMES));
+	CHECK(stats.regionBytes == FRAMES * (RegionBytes(source, regions[0]) + RegionBytes(source, regions[1])));
+	CHECK(stats.captureBytes >= FRAMES * frameBytes);
+	CHECK(stats.captureBytes <= (stats.samplesReceived + 1) * frameBytes);
+	source->Release();
+}
+
+// a region clip read from its own thread a few frames behind the main clip still gets the captures the main
+// clip showed at the same n, since it stays within the history
+static void TestLaggingRegion() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(1);
+	const int region = source->FindRegion("corner");
+	int mainBase = source->OpenSharedClip();
+	int regionBase = source->OpenSharedClip();
+	const int lag = 4;
+
+	std::vector<std::shared_ptr<const FrameSnapshot>> shown(FRAMES);
+	std::atomic<int> progress(0);
+	std::thread mainClip([&]() {
+		bool duplicate;
+		int dropped;
+		for (int n = 0; n < FRAMES; n++) {
+			shown[n] = source->GetSharedFrame(mainBase, n, duplicate, dropped);
+			progress = n + 1;
+		}
+	});
+
+	int mismatches = 0, wrongRows = 0;
+	bool duplicate;
+	int dropped;
+	for (int n = 0; n < FRAMES; n++) {
+		while (progress < ((n + lag < FRAMES) ? n + lag : FRAMES)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::shared_ptr<const FrameSnapshot> frame = source->GetSharedFrame(regionBase, n, duplicate, dropped);
+		mismatches += (frame != shown[n]);
+		wrongRows += !RegionMatches(source, frame->pixels, region);
+	}
+	mainClip.join();
+	printf("lagging region: %d from another capture, %d with wrong rows, base %d\n", mismatches, wrongRows, regionBase);
+	CHECK(mismatches == 0);
+	CHECK(wrongRows == 0);
+	CHECK(regionBase == 0);
+	CHECK(source->GetStats().framesDelivered == (unsigned long)FRAMES);
+	source->Release();
+}
+
+int main() {
+	TestSameCapture();
+	TestLaggingRegion();
+	return TEST_RESULT();
+}
@@ -0,0 +1,253 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// GetSharedFrame asked from several threads out of order, the way a parallel VapourSynth API 4 filter
+// asks: samples must still follow the frame numbers, and both fields of a pair show the same sample.
+// Clips opened later or seeking back get live samples. Then how many requests per second the history serves.
+
+#include "TestCheck.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "VideoInputSource.h"
+
+
+
+static const int THREADS = 4;
+// frames each thread asks for at once, in reverse; all threads together stay within the history
+static const int WINDOW = 2;
+
+
+
+static std::shared_ptr<VideoInputSource> CreateSource(const int deviceID, const char* fields) {
+	VideoInputSourceParams params;
+	params.deviceID = deviceID;
+	params.connectionType = "Synthetic";
+	params.width = 64;
+	params.height = 48;
+	params.fpsNumerator = 120;
+	params.frameSkip = false;
+	params.fields = fields;
+	return VideoInputSource::Create(params);
+}
+
+// sample number of every output frame, requested by THREADS threads each taking the next WINDOW frames backwards
+static std::vector<unsigned long> RequestOutOfOrder(const std::shared_ptr<VideoInputSource>& source, const int frames) {
+	std::vector<unsigned long> numbers(frames, 0);
+	int clipBase = source->OpenSharedClip();
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++) {
+		threads.push_back(std::thread([&]() {
+			for (int base = next.fetch_add(WINDOW); base < frames; base = next.fetch_add(WINDOW)) {
+				for (int n = ((base + WINDOW < frames) ? base + WINDOW : frames) - 1; n >= base; n--) {
+					bool duplicate;
+					int dropped;
+					numbers[n] = source->GetSharedFrame(clipBase, n, duplicate, dropped)->number;
+				}
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	return numbers;
+}
+
+static void TestFrameOrder() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(0, "none");
+	std::vector<unsigned long> numbers = RequestOutOfOrder(source, 240);
+
+	// without frame_skip every frame takes the next sample
+	int reordered = 0, repeated = 0;
+	for (size_t n = 1; n < numbers.size(); n++) {
+		reordered += (numbers[n] < numbers[n - 1]);
+		repeated += (numbers[n] == numbers[n - 1]);
+	}
+	printf("frames: %d out of order, %d repeated, samples %lu to %lu\n", reordered, repeated, numbers.front(), numbers.back());
+	CHECK(reordered == 0);
+	CHECK(repeated == 0);
+	CHECK(source->GetStats().framesDelivered == 240);
+}
+
+static void TestFieldOrder() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(1, "tff");
+	std::vector<unsigned long> numbers = RequestOutOfOrder(source, 240);
+
+	int split = 0, reordered = 0;
+	for (size_t n = 1; n < numbers.size(); n++) {
+		if (n % 2 == 1) {
+			split += (numbers[n] != numbers[n - 1]);
+		}
+		else {
+			reordered += (numbers[n] <= numbers[n - 1]);
+		}
+	}
+	printf("fields: %d pairs split, %d out of order\n", split, reordered);
+	CHECK(split == 0);
+	CHECK(reordered == 0);
+}
+
+// a second clip on the session reads the very samples the first one captured
+static void TestSecondClip() {
+	std::shared_ptr<VideoInputSource> first = CreateSource(2, "none");
+	std::shared_ptr<VideoInputSource> second = CreateSource(2, "none");
+	CHECK(first == second);
+	CHECK(first->GetStats().opens == 2);
+
+	int firstBase = first->OpenSharedClip();
+	int secondBase = second->OpenSharedClip();
+	bool duplicate;
+	int dropped;
+	for (int n = 0; n < 10; n++) {
+		std::shared_ptr<const FrameSnapshot> a = first->GetSharedFrame(firstBase, n, duplicate, dropped);
+		std::shared_ptr<const FrameSnapshot> b = second->GetSharedFrame(secondBase, n, duplicate, dropped);
+		CHECK(a == b);
+	}
+	CHECK(first->GetStats().framesShared >= 10);
+	second->Release();
+	CHECK(first->GetStats().opens == 1);
+}
+
+// two clips of one session read at once at different frames, one of them asked out of order by many threads
+// as a parallel filter is: each gets its samples in frame order, and the same n shows the same sample
+static void TestParallelClips() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(5, "none");
+	std::shared_ptr<VideoInputSource> other = CreateSource(5, "none");
+	int otherBase = other->OpenSharedClip();
+	const int frames = 240;
+
+	std::vector<unsigned long> otherNumbers(frames, 0);
+	std::thread reader([&]() {
+		bool duplicate;
+		int dropped;
+		for (int n = 0; n < frames; n++) {
+			otherNumbers[n] = other->GetSharedFrame(otherBase, n, duplicate, dropped)->number;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+	std::vector<unsigned long> numbers = RequestOutOfOrder(source, frames);
+	reader.join();
+
+	int reordered = 0, mismatches = 0;
+	for (int n = 0; n < frames; n++) {
+		reordered += (n > 0 && (numbers[n] <= numbers[n - 1] || otherNumbers[n] <= otherNumbers[n - 1]));
+		mismatches += (numbers[n] != otherNumbers[n]);
+	}
+	printf("parallel clips: %d out of order, %d mismatches\n", reordered, mismatches);
+	CHECK(reordered == 0);
+	// the sequential clip stays within the history, so it never moved on from the frames the other captured
+	CHECK(otherBase == 0);
+	CHECK(mismatches == 0);
+	CHECK(source->GetStats().framesDelivered == (unsigned long)frames);
+	other->Release();
+}
+
+// a clip opened on a session that has run for a while starts at the live frame, and a clip seeking back
+// further than the history goes on from the live frame too, rather than being served a stale sample
+static void TestLateClip() {
+	std::shared_ptr<VideoInputSource> first = CreateSource(4, "none");
+	int firstBase = first->OpenSharedClip();
+	bool duplicate;
+	int dropped;
+	unsigned long last = 0;
+	for (int n = 0; n < 60; n++) {
+		last = first->GetSharedFrame(firstBase, n, duplicate, dropped)->number;
+	}
+
+	std::shared_ptr<VideoInputSource> second = CreateSource(4, "none");
+	CHECK(first == second);
+	int secondBase = second->OpenSharedClip();
+	int stale = 0, duplicates = 0;
+	for (int n = 0; n < 30; n++) {
+		unsigned long number = second->GetSharedFrame(secondBase, n, duplicate, dropped)->number;
+		stale += (number <= last);
+		duplicates += duplicate;
+		last = number;
+	}
+	printf("late clip: %d stale, %d duplicates, base %d\n", stale, duplicates, secondBase);
+	CHECK(secondBase == 60);
+	CHECK(stale == 0);
+	CHECK(duplicates == 0);
+
+	// the first clip seeks back to its start, which has left the history long ago
+	stale = duplicates = 0;
+	for (int n = 0; n < 10; n++) {
+		unsigned long number = first->GetSharedFrame(firstBase, n, duplicate, dropped)->number;
+		stale += (number <= last);
+		duplicates += duplicate;
+		last = number;
+	}
+	CHECK(stale == 0);
+	CHECK(duplicates == 0);
+	CHECK(firstBase == 90);
+
+	// frames still in the history are served again, flags and all
+	std::shared_ptr<const FrameSnapshot> again = first->GetSharedFrame(firstBase, 9, duplicate, dropped);
+	CHECK(again->number == last && !duplicate);
+	second->Release();
+}
+
+// frames already captured are served from the history, so once the device has delivered them the
+// requests of many threads only contend for the history lock
+static void BenchmarkHistory() {
+	std::shared_ptr<VideoInputSource> source = CreateSource(3, "none");
+	int base = source->OpenSharedClip();
+	bool duplicate;
+	int dropped;
+	for (int n = 0; n < 8; n++) {
+		source->GetSharedFrame(base, n, duplicate, dropped);
+	}
+
+	const int requests = 200000;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++) {
+		threads.push_back(std::thread([&source, base, t]() {
+			int clipBase = base;
+			bool duplicate;
+			int dropped;
+			for (int i = 0; i < requests / THREADS; i++) {
+				source->GetSharedFrame(clipBase, (i + t) % 8, duplicate, dropped);
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("history: %.0f requests/s from %d threads\n", requests / seconds, THREADS);
+	CHECK(source->GetStats().framesShared >= (unsigned long)requests);
+}
+
+int main() {
+	TestFrameOrder();
+	TestFieldOrder();
+	TestSecondClip();
+	TestLateClip();
+	TestParallelClips();
+	BenchmarkHistory();
+	return TEST_RESULT();
+}
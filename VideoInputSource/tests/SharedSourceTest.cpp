@@ -0,0 +1,287 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// many clips opening the same synthetic device at once, reading at different speeds, coming and going:
+// they must share one capture session and see the same sample for every frame number. Creates failing
+// or running at the same time must neither hang nor hand out a broken session, and waiting for several
+// devices takes as long as the slowest.
+
+#include "TestCheck.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "VideoInputSource.h"
+
+
+
+static const int WIDTH = 320;
+static const int HEIGHT = 240;
+static const int CLIPS = 8;
+static const int FRAMES = 120;
+
+
+
+static std::shared_ptr<VideoInputSource> Open(const int deviceID, const bool frameSkip, const char* format, const char* resize = "none") {
+	VideoInputSourceParams params;
+	params.deviceID = deviceID;
+	params.connectionType = "Synthetic:jitter=2";
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 60;
+	params.frameSkip = frameSkip;
+	params.captureFormat = format;
+	params.resize = resize;
+	return VideoInputSource::Create(params);
+}
+
+static unsigned long long Hash(const unsigned char* pixels, const size_t size) {
+	unsigned long long hash = 1469598103934665603ULL;
+	for (size_t i = 0; i < size; i += 61) {
+		hash = (hash ^ pixels[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static void JoinAll(std::vector<std::thread>& threads) {
+	for (size_t t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+	threads.clear();
+}
+
+
+
+// clips opened at the same moment, like the clips of one script, some of them reading slowly
+static void TestConsumers() {
+	std::vector<std::shared_ptr<VideoInputSource> > sources(CLIPS);
+	std::vector<int> bases(CLIPS);
+	std::vector<std::vector<unsigned long> > numbers(CLIPS, std::vector<unsigned long>(FRAMES));
+	std::vector<std::vector<unsigned long long> > hashes(CLIPS, std::vector<unsigned long long>(FRAMES));
+	std::atomic<int> started(0), opened(0);
+	std::vector<std::thread> threads;
+	for (int c = 0; c < CLIPS; c++) {
+		threads.push_back(std::thread([&, c]() {
+			started++;
+			while (started < CLIPS) {
+				std::this_thread::yield();
+			}
+			sources[c] = Open(0, false, "YUY2");
+			bases[c] = sources[c]->OpenSharedClip();
+			opened++;
+			while (opened < CLIPS) {
+				std::this_thread::yield();
+			}
+			for (int n = 0; n < FRAMES; n++) {
+				bool duplicate;
+				int dropped;
+				std::shared_ptr<const FrameSnapshot> frame = sources[c]->GetSharedFrame(bases[c], n, duplicate, dropped);
+				numbers[c][n] = frame->number;
+				hashes[c][n] = Hash(frame->pixels, (size_t)WIDTH * HEIGHT * 3);
+				if (c % 4 == 0) {
+					std::this_thread::sleep_for(std::chrono::microseconds(100 * c));
+				}
+			}
+		}));
+	}
+	JoinAll(threads);
+
+	int sessions = 1, mismatches = 0, reordered = 0;
+	for (int c = 1; c < CLIPS; c++) {
+		sessions += (sources[c] != sources[0]);
+	}
+	for (int n = 0; n < FRAMES; n++) {
+		for (int c = 1; c < CLIPS; c++) {
+			mismatches += (numbers[c][n] != numbers[0][n] || hashes[c][n] != hashes[0][n]);
+		}
+		reordered += (n > 0 && numbers[0][n] <= numbers[0][n - 1]);
+	}
+	VideoInputSourceStats stats = sources[0]->GetStats();
+	printf("consumers: %d sessions, opens %d, %d mismatches, %d out of order, %lu frames shared\n", sessions, stats.opens, mismatches, reordered, stats.framesShared);
+	CHECK(sessions == 1);
+	CHECK(stats.opens == CLIPS);
+	CHECK(mismatches == 0);
+	CHECK(reordered == 0);
+	// every sample was converted once, however many clips read it
+	CHECK(stats.framesDelivered == FRAMES);
+	CHECK(stats.captureBytes == (double)FRAMES * WIDTH * HEIGHT * 3);
+	CHECK(stats.framesShared == (unsigned long)(CLIPS - 1) * FRAMES);
+
+	for (int c = 1; c < CLIPS; c++) {
+		sources[c]->Release();
+	}
+	CHECK(sources[0]->GetStats().opens == 1);
+}
+
+// clips come and go while one stays open, they all land on its session
+static void TestChurn() {
+	std::shared_ptr<VideoInputSource> keep = Open(1, false, "YUY2");
+	std::atomic<int> elsewhere(0);
+	std::vector<std::thread> threads;
+	for (int c = 0; c < CLIPS; c++) {
+		threads.push_back(std::thread([&]() {
+			for (int i = 0; i < 100; i++) {
+				std::shared_ptr<VideoInputSource> source = Open(1, false, "YUY2");
+				elsewhere += (source != keep);
+				source->Release();
+			}
+		}));
+	}
+	JoinAll(threads);
+	CHECK(elsewhere == 0);
+	CHECK(keep->GetStats().opens == 1);
+
+	// names are compared regardless of case
+	std::shared_ptr<VideoInputSource> lower = Open(1, false, "yuy2");
+	CHECK(lower == keep);
+	lower->Release();
+	lower.reset();
+
+	// another mode on the same device is a session of its own, found first by device_id
+	std::shared_ptr<VideoInputSource> rgb = Open(1, false, "RGB24");
+	CHECK(rgb != keep);
+	CHECK(VideoInputSource::FindByDeviceID(1) == rgb);
+
+	// once the last clip is gone the session closes, and the next create opens a new one
+	keep.reset();
+	rgb.reset();
+	VideoInputSourceStats stats;
+	CHECK(!VideoInputSource::GetStatsByDeviceID(1, stats));
+	std::shared_ptr<VideoInputSource> again = Open(1, false, "YUY2");
+	CHECK(again->GetStats().opens == 1);
+}
+
+// sessions made and freed on two devices at once, each read by two clips
+static void TestCreateDestroy() {
+	std::atomic<int> wrong(0);
+	std::vector<std::thread> threads;
+	for (int c = 0; c < 8; c++) {
+		threads.push_back(std::thread([&wrong, c]() {
+			for (int i = 0; i < 10; i++) {
+				std::shared_ptr<VideoInputSource> a = Open(100 + c % 2, true, "YUY2");
+				std::shared_ptr<VideoInputSource> b = Open(100 + c % 2, true, "YUY2");
+				wrong += (a != b);
+				// clips opened together start at the same frame, unless another thread captured in between
+				int baseA = a->OpenSharedClip();
+				int baseB = b->OpenSharedClip();
+				bool duplicate;
+				int dropped;
+				std::shared_ptr<const FrameSnapshot> frameA = a->GetSharedFrame(baseA, i, duplicate, dropped);
+				std::shared_ptr<const FrameSnapshot> frameB = b->GetSharedFrame(baseB, i, duplicate, dropped);
+				wrong += (!frameA || !frameB || (baseA == baseB && frameA != frameB));
+				b->Release();
+				a->Release();
+			}
+		}));
+	}
+	JoinAll(threads);
+	CHECK(wrong == 0);
+}
+
+// creates for one mode waiting on each other: a failing one must wake the others, which fail as well
+static void TestFailingCreate() {
+	std::atomic<int> failed(0);
+	std::vector<std::thread> threads;
+	for (int c = 0; c < 8; c++) {
+		threads.push_back(std::thread([&failed]() {
+			try {
+				Open(200, true, "RGB24", "bogus");
+			}
+			catch (const char*) {
+				failed++;
+			}
+		}));
+	}
+	JoinAll(threads);
+	CHECK(failed == 8);
+	VideoInputSourceStats stats;
+	CHECK(!VideoInputSource::GetStatsByDeviceID(200, stats));
+
+	// creates of other devices are not held up by each other
+	std::vector<std::shared_ptr<VideoInputSource> > sources(8);
+	for (int c = 0; c < 8; c++) {
+		threads.push_back(std::thread([&sources, c]() {
+			sources[c] = Open(200 + c % 2, true, "RGB24");
+		}));
+	}
+	JoinAll(threads);
+	CHECK(sources[0] != sources[1]);
+	CHECK(sources[0] == sources[2] && sources[2] == sources[4] && sources[4] == sources[6]);
+	CHECK(sources[1] == sources[3] && sources[3] == sources[5] && sources[5] == sources[7]);
+	CHECK(VideoInputSource::GetStatsByDeviceID(200, stats) && stats.opens == 4);
+}
+
+// devices taking 200 to 400ms to set up, opened one after another: each opens on its own device thread, so
+// waiting for all of them takes about as long as the slowest one and not the sum, and every device reports
+// its own setup time and error
+static void TestWaitForDevices() {
+	const int setups[] = { 300, 200, 400 };
+	std::vector<std::shared_ptr<VideoInputSource> > sources;
+	std::vector<int> deviceIDs;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int d = 0; d < 4; d++) {
+		char connection[64];
+		sprintf(connection, "Synthetic:setup=%d", setups[d % 3]);
+		VideoInputSourceParams params;
+		params.deviceID = 300 + d;
+		params.connectionType = connection;
+		params.height = HEIGHT;
+		params.fpsNumerator = 60;
+		params.captureFormat = "YUY2";
+		// the last device cannot deliver an odd width in YUY2, so it fails to open before its setup delay
+		params.width = (d == 3) ? WIDTH - 1 : WIDTH;
+		sources.push_back(VideoInputSource::Create(params));
+		deviceIDs.push_back(300 + d);
+	}
+	double created = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<DeviceOpenResult> results;
+	CHECK(VideoInputSource::WaitForDevices(deviceIDs, results));
+	double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("wait for devices: created in %.3f s, all open after %.3f s\n", created, waited);
+	CHECK(created < 0.1);
+	CHECK(waited >= 0.4 && waited < 0.7);
+
+	CHECK(results.size() == 4);
+	for (size_t d = 0; d < results.size(); d++) {
+		printf("device %d: setup %.3f s, %s\n", results[d].deviceID, results[d].setupTime, (results[d].error != NULL) ? results[d].error : "streaming");
+		CHECK(results[d].deviceID == 300 + (int)d);
+		CHECK((results[d].error == NULL) == (d != 3));
+		double setup = (d != 3) ? setups[d % 3] / 1000.0 : 0.0;
+		CHECK(results[d].setupTime >= setup && results[d].setupTime < setup + 0.2);
+	}
+
+	// no source is capturing from an unknown device
+	deviceIDs.push_back(399);
+	CHECK(!VideoInputSource::WaitForDevices(deviceIDs, results));
+}
+
+int main() {
+	TestConsumers();
+	TestChurn();
+	TestCreateDestroy();
+	TestFailingCreate();
+	TestWaitForDevices();
+	return TEST_RESULT();
+}
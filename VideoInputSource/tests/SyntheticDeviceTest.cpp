@@ -0,0 +1,432 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// the synthetic device captured through V4L2Backend in every format it offers, checked pixel by pixel
+// against the pattern, and its pacing, stalls, freezes and setup time; then end to end through VideoInputSource
+
+#include "TestCheck.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "SyntheticDevice.h"
+#include "VideoInputSource.h"
+
+
+
+// the pattern of SyntheticDevice
+static const int SCROLL_STEP = 4;
+static const int BAND_STEP = 2;
+static const int BAND_HEIGHT = 8;
+static const unsigned char BAR_COLORS[8][3] = {
+	{ 191, 191, 191 }, { 191, 191, 0 }, { 0, 191, 191 }, { 0, 191, 0 },
+	{ 191, 0, 191 }, { 191, 0, 0 }, { 0, 0, 191 }, { 0, 0, 0 }
+};
+static const unsigned char BAND_COLOR[3] = { 255, 255, 255 };
+
+static const int WIDTH = 320;
+static const int HEIGHT = 240;
+
+
+
+static CaptureParams Params(const char* format, const int fieldOrder) {
+	CaptureParams params = CaptureParams();
+	params.deviceID = 0;
+	params.connection = CONNECTION_SYNTHETIC;
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 60;
+	params.fpsDenominator = 1;
+	params.captureFormat = format;
+	params.fieldOrder = fieldOrder;
+	params.queueDepth = 4;
+	return params;
+}
+
+// RGB of the pattern at row y of the device, counted from the top, in the sample of sequence
+static const unsigned char* PatternColor(const int x, const int y, const unsigned int sequence, const int fieldOrder) {
+	unsigned int half = 0;
+	if (fieldOrder != FIELD_ORDER_NONE) {
+		half = ((y % 2 == 0) == (fieldOrder == FIELD_ORDER_TOP_FIRST)) ? 0 : 1;
+	}
+	unsigned int scroll = (sequence * SCROLL_STEP + half * SCROLL_STEP / 2) % WIDTH;
+	int band = (int)((sequence * BAND_STEP + half * BAND_STEP / 2) % HEIGHT);
+	if ((y - band + HEIGHT) % HEIGHT < BAND_HEIGHT) {
+		return BAND_COLOR;
+	}
+	return BAR_COLORS[((x + scroll) % WIDTH) * 8 / WIDTH];
+}
+
+static bool WaitSample(CaptureBackend& backend, const int timeout) {
+	pollfd event = { backend.GetFrameEvent(), POLLIN, 0 };
+	return poll(&event, 1, timeout) == 1 && backend.IsFrameNew();
+}
+
+// largest difference of a BGR frame, bottom-up, from the pattern; grey compares against its luma
+static int PatternError(const unsigned char* pixels, const unsigned int sequence, const int fieldOrder, const bool grey) {
+	int worst = 0;
+	for (int y = 0; y < HEIGHT; y++) {
+		const unsigned char* row = pixels + (size_t)(HEIGHT - 1 - y) * WIDTH * 3;
+		for (int x = 0; x < WIDTH; x++) {
+			const unsigned char* rgb = PatternColor(x, y, sequence, fieldOrder);
+			int expected[3] = { rgb[2], rgb[1], rgb[0] };
+			if (grey) {
+				expected[0] = expected[1] = expected[2] = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2] + 128) >> 8;
+			}
+			for (int c = 0; c < 3; c++) {
+				int error = abs(row[x * 3 + c] - expected[c]);
+				worst = (error > worst) ? error : worst;
+			}
+		}
+	}
+	return worst;
+}
+
+
+
+static void TestFormat(const char* format, const int fieldOrder, const bool grey, const int tolerance) {
+	SyntheticBackend backend(Params(format, fieldOrder));
+	CHECK(backend.Open() == NULL);
+	CHECK(backend.GetNegotiatedFramerate() == 60.0);
+
+	std::vector<unsigned char> pixels((size_t)WIDTH * HEIGHT * 3);
+	// a few samples, so the bars have scrolled and the band has moved
+	for (int i = 0; i < 3; i++) {
+		CHECK(WaitSample(backend, 1000));
+		CHECK(backend.GetPixels(&pixels[0]));
+		unsigned int sequence = (unsigned int)backend.GetFrameNumber() - 1;
+		int error = PatternError(&pixels[0], sequence, fieldOrder, grey);
+		if (error > tolerance) {
+			printf("%s, field order %d, sample %u: off the pattern by %d\n", format, fieldOrder, sequence, error);
+		}
+		CHECK(error <= tolerance);
+	}
+	backend.Close();
+}
+
+static void TestPacing() {
+	SyntheticBackend backend(Params("YUY2", FIELD_ORDER_NONE));
+	CHECK(backend.Open() == NULL);
+
+	std::vector<unsigned char> pixels((size_t)WIDTH * HEIGHT * 3);
+	double start = GetCaptureTime();
+	double first = 0.0, last = 0.0;
+	unsigned long firstNumber = 0, lastNumber = 0;
+	while (GetCaptureTime() - start < 1.0) {
+		if (WaitSample(backend, 100) && backend.GetPixels(&pixels[0])) {
+			if (firstNumber == 0) {
+				firstNumber = backend.GetFrameNumber();
+				first = backend.GetFrameTime();
+			}
+			lastNumber = backend.GetFrameNumber();
+			last = backend.GetFrameTime();
+		}
+	}
+	double rate = (lastNumber - firstNumber) / (last - first);
+	printf("pacing: %lu samples, %.2f fps, %lu dropped\n", backend.GetSampleCount(), rate, backend.GetDroppedSampleCount());
+	CHECK(rate > 59.0 && rate < 61.0);
+	CHECK(backend.GetSampleCount() >= 55);
+	backend.Close();
+}
+
+static void TestStall() {
+	// nothing for 250ms of every 500ms, after a setup of 200ms
+	CaptureParams params = Params("YUY2", FIELD_ORDER_NONE);
+	params.syntheticOptions = "stall=250,interval=500,setup=200,jitter=5";
+	SyntheticBackend backend(params);
+
+	double start = GetCaptureTime();
+	CHECK(backend.Open() == NULL);
+	double setup = GetCaptureTime() - start;
+	CHECK(setup >= 0.2);
+
+	std::vector<unsigned char> pixels((size_t)WIDTH * HEIGHT * 3);
+	start = GetCaptureTime();
+	while (GetCaptureTime() - start < 1.0) {
+		if (WaitSample(backend, 100)) {
+			backend.GetPixels(&pixels[0]);
+		}
+	}
+	// half of the samples are lost to the stalls, which shows as gaps in the sequence
+	printf("stall: setup %.3f s, %lu samples, %lu dropped\n", setup, backend.GetSampleCount(), backend.GetDroppedSampleCount());
+	CHECK(backend.GetDroppedSampleCount() >= 20);
+	CHECK(backend.GetSampleCount() >= 50);
+	backend.Close();
+}
+
+// a device delivering for 1s and then stalling for 1s counts as frozen once the stall outlasts reconnect_timeout;
+// a source on it serves the last good frame meanwhile, and its watchdog reconnects so samples come again
+static void TestReconnect() {
+	CaptureParams params = Params("YUY2", FIELD_ORDER_NONE);
+	params.syntheticOptions = "stall=1000,interval=2000";
+	params.reconnectTimeout = 300;
+	SyntheticBackend backend(params);
+	CHECK(backend.Open() == NULL);
+	std::vector<unsigned char> pixels((size_t)WIDTH * HEIGHT * 3);
+	double start = GetCaptureTime();
+	bool frozenEarly = false;
+	while (GetCaptureTime() - start < 0.9) {
+		if (WaitSample(backend, 100)) {
+			backend.GetPixels(&pixels[0]);
+		}
+		frozenEarly |= backend.IsFrozen();
+	}
+	while (GetCaptureTime() - start < 1.2) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		frozenEarly |= backend.IsFrozen();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	bool frozen = backend.IsFrozen();
+	backend.Close();
+	CHECK(!frozenEarly);
+	CHECK(frozen);
+
+	VideoInputSourceParams sourceParams;
+	sourceParams.deviceID = 3;
+	sourceParams.connectionType = "Synthetic:stall=1000,interval=2000";
+	sourceParams.width = WIDTH;
+	sourceParams.height = HEIGHT;
+	sourceParams.fpsNumerator = 60;
+	sourceParams.reconnectTimeout = 300;
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(sourceParams);
+	std::vector<unsigned char> good(pixels.size());
+	memcpy(&good[0], source->GetFrame(), good.size());
+	unsigned long lastNumber = source->GetFrameNumber();
+	int changed = 0, duplicates = 0, newAfterStall = 0;
+	start = GetCaptureTime();
+	while (GetCaptureTime() - start < 2.0) {
+		const unsigned char* frame = source->GetFrame();
+		if (source->IsFrameDuplicate()) {
+			duplicates++;
+			changed += (memcmp(frame, &good[0], good.size()) != 0 || source->GetFrameNumber() != lastNumber);
+		}
+		else {
+			memcpy(&good[0], frame, good.size());
+			lastNumber = source->GetFrameNumber();
+			newAfterStall += (source->GetStats().reconnects > 0);
+		}
+	}
+	VideoInputSourceStats stats = source->GetStats();
+	printf("reconnect: %d reconnects, %d duplicates, %d changed, %d new frames after\n", stats.reconnects, duplicates, changed, newAfterStall);
+	CHECK(stats.reconnects >= 1);
+	CHECK(duplicates > 0);
+	CHECK(changed == 0);
+	CHECK(newAfterStall > 0);
+}
+
+static bool OptionsFail(const char* options) {
+	try {
+		ParseSyntheticOptions(options);
+	}
+	catch (const char*) {
+		return true;
+	}
+	return false;
+}
+
+static void TestOptions() {
+	SyntheticOptions options = ParseSyntheticOptions("");
+	CHECK(options.jitter == 0.0 && options.stall == 0.0 && options.stallInterval == 10.0 && options.setup == 0.0);
+	options = ParseSyntheticOptions("jitter=5, stall = 250,interval=500,setup=200");
+	CHECK(options.jitter == 0.005 && options.stall == 0.25 && options.stallInterval == 0.5 && options.setup == 0.2);
+
+	CHECK(OptionsFail("jitter"));
+	CHECK(OptionsFail("jitter=-1"));
+	CHECK(OptionsFail("jitter=5,"));
+	CHECK(OptionsFail("jitter=5x"));
+	CHECK(OptionsFail("drift=5"));
+	CHECK(OptionsFail("stall=500,interval=500"));
+
+	// only the synthetic device takes options
+	bool failed = false;
+	try {
+		VideoInputSourceParams params;
+		params.connectionType = "USB:jitter=5";
+		params.width = WIDTH;
+		params.height = HEIGHT;
+		params.fpsNumerator = 60;
+		params.frameSkip = false;
+		params.captureFormat = "auto";
+		VideoInputSource::Create(params);
+	}
+	catch (const char*) {
+		failed = true;
+	}
+	CHECK(failed);
+}
+
+// through VideoInputSource: auto picks the plain copy, and frames come out as the backend delivers them
+static void TestSource() {
+	VideoInputSourceParams params;
+	params.connectionType = "Synthetic";
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 60;
+	params.frameSkip = false;
+	params.captureFormat = "auto";
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(params);
+	for (int n = 0; n < 5; n++) {
+		const unsigned char* pixels = source->GetFrame();
+		CHECK(PatternError(pixels, (unsigned int)source->GetFrameNumber() - 1, FIELD_ORDER_NONE, false) == 0);
+	}
+	VideoInputSourceStats stats = source->GetStats();
+	CHECK(stats.captureMode.compare(0, 28, "auto: selected BGR3 320x240:") == 0);
+	CHECK(stats.negotiatedFps == 60.0);
+	CHECK(stats.framesDelivered == 5);
+
+	// fields come out as every second row of the frame, the first in time being the top one
+	params.deviceID = 1;
+	params.captureFormat = "RGB24";
+	params.fields = "tff";
+	source = VideoInputSource::Create(params);
+	CHECK(source->HasFields() && source->IsTopField(0) && !source->IsTopField(1));
+	for (int n = 0; n < 4; n++) {
+		ptrdiff_t pitch;
+		const unsigned char* field = source->GetField(n, pitch);
+		CHECK(pitch == WIDTH * 3 * 2);
+		// rows are bottom-up, so the top field starts at the second row of the frame
+		unsigned int sequence = (unsigned int)source->GetFrameNumber() - 1;
+		const unsigned char* rgb = PatternColor(0, source->IsTopField(n) ? 0 : 1, sequence, FIELD_ORDER_TOP_FIRST);
+		const unsigned char* top = field + (HEIGHT / 2 - 1) * pitch;
+		CHECK(top[0] == rgb[2] && top[1] == rgb[1] && top[2] == rgb[0]);
+	}
+}
+
+// every delivery counter against what the caller saw, while another thread keeps reading the stats: in deadline
+// mode each frame waits at most frame_deadline, here 5 ms, and each one without a new sample is a duplicate and a miss
+static void TestStats() {
+	VideoInputSourceParams params;
+	params.deviceID = 2;
+	params.connectionType = "Synthetic:jitter=2";
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 60;
+	params.frameDeadline = 30;
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(params);
+	source->GetFrame();
+
+	std::atomic<bool> done(false);
+	int backwards = 0;
+	std::thread reader([&]() {
+		VideoInputSourceStats last = source->GetStats();
+		while (!done) {
+			VideoInputSourceStats stats = source->GetStats();
+			backwards += (stats.framesDelivered < last.framesDelivered || stats.framesDuplicated < last.framesDuplicated || stats.deadlineMisses < last.deadlineMisses || stats.waitTime < last.waitTime);
+			last = stats;
+			std::this_thread::yield();
+		}
+	});
+
+	VideoInputSourceStats before = source->GetStats();
+	const unsigned long frames = 120;
+	unsigned long duplicates = 0;
+	double start = GetCaptureTime();
+	for (unsigned long n = 0; n < frames; n++) {
+		source->GetFrame();
+		duplicates += source->IsFrameDuplicate();
+	}
+	double elapsed = GetCaptureTime() - start;
+	done = true;
+	reader.join();
+
+	VideoInputSourceStats stats = source->GetStats();
+	double waited = stats.waitTime - before.waitTime;
+	printf("stats: %lu duplicates, %lu misses, waited %.3f of %.3f s\n", stats.framesDuplicated - before.framesDuplicated, stats.deadlineMisses - before.deadlineMisses, waited, elapsed);
+	CHECK(backwards == 0);
+	CHECK(stats.framesDelivered - before.framesDelivered == frames);
+	CHECK(stats.framesDuplicated - before.framesDuplicated == duplicates);
+	CHECK(stats.deadlineMisses - before.deadlineMisses == duplicates);
+	CHECK(duplicates > 0 && duplicates < frames);
+	CHECK(waited <= elapsed);
+	CHECK(waited >= duplicates * 0.0045);
+}
+
+// frame_deadline against a producer up to 20 ms late at 30 fps, read every 30 ms so the phase of the reads sweeps
+// through the period: a frame without a new sample by the deadline, 10 ms here, repeats the last one right at the
+// deadline and counts as a miss, and a sample arriving before the deadline is waited for and shown
+static void TestDeadline() {
+	VideoInputSourceParams params;
+	params.deviceID = 4;
+	params.connectionType = "Synthetic:jitter=20";
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.fpsNumerator = 30;
+	params.frameDeadline = 30;
+	std::shared_ptr<VideoInputSource> source = VideoInputSource::Create(params);
+	source->GetFrame();
+	const double deadline = 0.010;
+
+	VideoInputSourceStats before = source->GetStats();
+	const int frames = 90;
+	int duplicates = 0, early = 0, late = 0, waitedFor = 0;
+	double start = GetCaptureTime();
+	for (int n = 0; n < frames; n++) {
+		double now = GetCaptureTime();
+		if (start + n * 0.030 > now) {
+			std::this_thread::sleep_for(std::chrono::duration<double>(start + n * 0.030 - now));
+		}
+		double asked = GetCaptureTime();
+		source->GetFrame();
+		double waited = GetCaptureTime() - asked;
+		if (source->IsFrameDuplicate()) {
+			duplicates++;
+			early += (waited < deadline - 0.0005);
+		}
+		else {
+			late += (waited > deadline + 0.008);
+			waitedFor += (waited > 0.001);
+		}
+	}
+
+	VideoInputSourceStats stats = source->GetStats();
+	printf("deadline: %d duplicates, %lu misses, %d new samples waited for, %d early, %d late\n", duplicates, stats.deadlineMisses - before.deadlineMisses, waitedFor, early, late);
+	CHECK(duplicates > 0 && duplicates < frames);
+	CHECK(stats.deadlineMisses - before.deadlineMisses == (unsigned long)duplicates);
+	CHECK(stats.framesDuplicated - before.framesDuplicated == (unsigned long)duplicates);
+	CHECK(early == 0);
+	CHECK(late == 0);
+	CHECK(waitedFor > 0);
+}
+
+int main() {
+	TestFormat("RGB24", FIELD_ORDER_NONE, false, 0);
+	TestFormat("YUY2", FIELD_ORDER_NONE, false, 3);
+	TestFormat("UYVY", FIELD_ORDER_NONE, false, 3);
+	TestFormat("GREY", FIELD_ORDER_NONE, true, 0);
+	TestFormat("RGB24", FIELD_ORDER_TOP_FIRST, false, 0);
+	TestFormat("RGB24", FIELD_ORDER_BOTTOM_FIRST, false, 0);
+	TestFormat("YUY2", FIELD_ORDER_BOTTOM_FIRST, false, 3);
+	TestPacing();
+	TestStall();
+	TestReconnect();
+	TestOptions();
+	TestSource();
+	TestStats();
+	TestDeadline();
+	return TEST_RESULT();
+}
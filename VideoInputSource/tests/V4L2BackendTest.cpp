@@ -0,0 +1,523 @@
+/*
+
+VideoInputSource - A AviSynth plug-in to capture video from webcam or video capture device
+Copyright (C) 2014-present Himawari Tachibana <fieliapm@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+
+// V4L2Backend on a stand-in for the system calls that serves frames from a file, so format negotiation,
+// conversion and sample accounting run without a device
+
+#include "TestCheck.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "V4L2Backend.h"
+
+
+
+// a driver offering a list of formats at one size, which it adjusts every request to like real drivers do.
+// Every dequeued buffer is filled with the next frame of the file, rows padded to bytesperline.
+class FileIo : public V4L2Io {
+private:
+	FILE* mFile;
+	std::vector<unsigned int> mOffered;
+	int mWidth, mHeight;
+	unsigned int mFormat;
+	std::vector<std::vector<unsigned char> > mBuffers;
+	std::deque<unsigned int> mQueued;
+	bool mStreaming;
+
+	int BytesPerPixel() {
+		return (mFormat == V4L2_PIX_FMT_BGR24) ? 3 : (mFormat == V4L2_PIX_FMT_GREY) ? 1 : 2;
+	}
+
+	int BytesPerLine() {
+		return mWidth * BytesPerPixel() + 16;
+	}
+
+public:
+	// buffers the driver filled and not dequeued yet
+	int ready;
+	// added to the sequence of the next buffer, as when the driver had none queued
+	unsigned int skip;
+	unsigned int sequence;
+	// the next buffer is flagged damaged
+	bool error;
+	int openFiles;
+	int mappedBuffers;
+	// frame rate of every offered format at the one size the driver lists; left empty, sizes are not enumerated
+	std::vector<unsigned int> rates;
+
+	FileIo(FILE* file, const unsigned int* offered, const int count, const int width, const int height)
+		: mFile(file), mOffered(offered, offered + count), mWidth(width), mHeight(height), mFormat(offered[0]), mStreaming(false), ready(0), skip(0), sequence(0), error(false), openFiles(0), mappedBuffers(0) {
+	}
+
+	int Open(const char* path, int /*flags*/) {
+		if (strcmp(path, "/dev/video0") != 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		openFiles++;
+		return 1000;
+	}
+
+	int Close(int /*fd*/) {
+		openFiles--;
+		return 0;
+	}
+
+	int Ioctl(int /*fd*/, unsigned long request, void* arg) {
+		switch (request) {
+		case VIDIOC_QUERYCAP: {
+			v4l2_capability* capability = (v4l2_capability*)arg;
+			capability->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+			return 0;
+		}
+		case VIDIOC_ENUM_FMT: {
+			v4l2_fmtdesc* description = (v4l2_fmtdesc*)arg;
+			if (description->index >= mOffered.size()) {
+				errno = EINVAL;
+				return -1;
+			}
+			description->pixelformat = mOffered[description->index];
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMESIZES: {
+			v4l2_frmsizeenum* size = (v4l2_frmsizeenum*)arg;
+			if (rates.empty() || size->index != 0) {
+				errno = EINVAL;
+				return -1;
+			}
+			size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+			size->discrete.width = mWidth;
+			size->discrete.height = mHeight;
+			return 0;
+		}
+		case VIDIOC_ENUM_FRAMEINTERVALS: {
+			v4l2_frmivalenum* interval = (v4l2_frmivalenum*)arg;
+			for (size_t i = 0; i < mOffered.size() && i < rates.size(); i++) {
+				if (mOffered[i] == interval->pixel_format && interval->index == 0) {
+					interval->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+					interval->discrete.numerator = 1;
+					interval->discrete.denominator = rates[i];
+					return 0;
+				}
+			}
+			errno = EINVAL;
+			return -1;
+		}
+		case VIDIOC_S_FMT: {
+			v4l2_format* format = (v4l2_format*)arg;
+			mFormat = mOffered[0];
+			for (size_t i = 0; i < mOffered.size(); i++) {
+				if (mOffered[i] == format->fmt.pix.pixelformat) {
+					mFormat = mOffered[i];
+				}
+			}
+			format->fmt.pix.pixelformat = mFormat;
+			format->fmt.pix.width = mWidth;
+			format->fmt.pix.height = mHeight;
+			format->fmt.pix.bytesperline = BytesPerLine();
+			format->fmt.pix.field = V4L2_FIELD_NONE;
+			return 0;
+		}
+		case VIDIOC_G_PARM:
+		case VIDIOC_S_PARM: {
+			v4l2_streamparm* parm = (v4l2_streamparm*)arg;
+			parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+			if (request == VIDIOC_S_PARM) {
+				parm->parm.capture.timeperframe.numerator = 1001;
+				parm->parm.capture.timeperframe.denominator = 30000;
+			}
+			return 0;
+		}
+		case VIDIOC_REQBUFS: {
+			v4l2_requestbuffers* buffers = (v4l2_requestbuffers*)arg;
+			mBuffers.assign(buffers->count, std::vector<unsigned char>((size_t)BytesPerLine() * mHeight));
+			mQueued.clear();
+			return 0;
+		}
+		case VIDIOC_QUERYBUF: {
+			v4l2_buffer* buffer = (v4l2_buffer*)arg;
+			buffer->length = (unsigned int)mBuffers[buffer->index].size();
+			buffer->m.offset = buffer->index * 4096;
+			return 0;
+		}
+		case VIDIOC_QBUF:
+			mQueued.push_back(((v4l2_buffer*)arg)->index);
+			return 0;
+		case VIDIOC_STREAMON:
+			mStreaming = true;
+			return 0;
+		case VIDIOC_STREAMOFF:
+			mStreaming = false;
+			mQueued.clear();
+			return 0;
+		case VIDIOC_DQBUF: {
+			if (!mStreaming || mQueued.empty() || ready == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			v4l2_buffer* buffer = (v4l2_buffer*)arg;
+			unsigned int index = mQueued.front();
+			std::vector<unsigned char>& data = mBuffers[index];
+			size_t rowSize = (size_t)mWidth * BytesPerPixel();
+			for (int y = 0; y < mHeight; y++) {
+				if (fread(&data[(size_t)y * BytesPerLine()], 1, rowSize, mFile) != rowSize) {
+					errno = EAGAIN;
+					return -1;
+				}
+			}
+			mQueued.pop_front();
+			ready--;
+			sequence += skip;
+			skip = 0;
+			buffer->index = index;
+			buffer->sequence = sequence++;
+			buffer->bytesused = (unsigned int)data.size();
+			buffer->flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | (error ? V4L2_BUF_FLAG_ERROR : 0);
+			buffer->timestamp.tv_sec = 100 + buffer->sequence;
+			buffer->timestamp.tv_usec = 0;
+			error = false;
+			return 0;
+		}
+		default:
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	void* Mmap(size_t /*length*/, int /*fd*/, off_t offset) {
+		mappedBuffers++;
+		return &mBuffers[offset / 4096][0];
+	}
+
+	int Munmap(void* /*address*/, size_t /*length*/) {
+		mappedBuffers--;
+		return 0;
+	}
+};
+
+
+
+static CaptureParams Params(const int width, const int height, const char* format) {
+	CaptureParams params = CaptureParams();
+	params.deviceID = 0;
+	params.connection = CONNECTION_USB;
+	params.width = width;
+	params.height = height;
+	params.fpsNumerator = 30000;
+	params.fpsDenominator = 1001;
+	params.captureFormat = format;
+	params.fieldOrder = FIELD_ORDER_NONE;
+	params.queueDepth = 3;
+	return params;
+}
+
+// a file holding frames copies of frame, laid out as the driver delivers it but without row padding
+static FILE* FrameFile(const std::vector<unsigned char>& frame, const int frames) {
+	FILE* file = tmpfile();
+	for (int f = 0; f < frames; f++) {
+		fwrite(&frame[0], 1, frame.size(), file);
+	}
+	rewind(file);
+	return file;
+}
+
+static bool SamePixel(const unsigned char* pixel, const int b, const int g, const int r) {
+	return pixel[0] == b && pixel[1] == g && pixel[2] == r;
+}
+
+
+
+static void TestYUYV() {
+	// rows of black, BT.601 red and white, each two pixel pairs
+	const int width = 4, height = 3;
+	const unsigned char rows[height][8] = {
+		{ 16, 128, 16, 128, 16, 128, 16, 128 },
+		{ 81, 90, 81, 240, 81, 90, 81, 240 },
+		{ 235, 128, 235, 128, 235, 128, 235, 128 },
+	};
+	std::vector<unsigned char> frame(&rows[0][0], &rows[0][0] + sizeof(rows));
+	FILE* file = FrameFile(frame, 4);
+
+	const unsigned int offered[] = { V4L2_PIX_FMT_YUYV };
+	FileIo io(file, offered, 1, width, height);
+	V4L2Backend backend(Params(width, height, "YUY2"), &io);
+	CHECK(backend.Open() == NULL);
+	CHECK(backend.GetCaptureModeReport().empty());
+	CHECK(backend.GetNegotiatedFramerate() > 29.96 && backend.GetNegotiatedFramerate() < 29.98);
+
+	unsigned char pixels[width * height * 3];
+	CHECK(!backend.IsFrameNew());
+	io.ready = 1;
+	CHECK(backend.IsFrameNew());
+	CHECK(backend.GetPixels(pixels));
+	// rows come out bottom-up
+	CHECK(SamePixel(pixels + (height - 1) * width * 3, 0, 0, 0));
+	CHECK(SamePixel(pixels + (height - 1) * width * 3 + 9, 0, 0, 0));
+	CHECK(SamePixel(pixels + width * 3, 0, 0, 255));
+	CHECK(SamePixel(pixels + width * 3 + 9, 0, 0, 255));
+	CHECK(SamePixel(pixels, 255, 255, 255));
+	CHECK(backend.GetFrameNumber() == 1);
+	CHECK(backend.GetFrameTime() == 100.0);
+
+	backend.Close();
+	CHECK(!backend.IsOpen());
+	CHECK(io.openFiles == 0 && io.mappedBuffers == 0);
+	fclose(file);
+}
+
+static void TestOtherFormats() {
+	const int width = 2, height = 2;
+	unsigned char pixels[width * height * 3];
+
+	// UYVY white over black
+	const unsigned char uyvy[] = { 128, 235, 128, 235, 128, 16, 128, 16 };
+	FILE* file = FrameFile(std::vector<unsigned char>(uyvy, uyvy + sizeof(uyvy)), 1);
+	const unsigned int offeredUYVY[] = { V4L2_PIX_FMT_UYVY };
+	FileIo io(file, offeredUYVY, 1, width, height);
+	V4L2Backend backend(Params(width, height, "UYVY"), &io);
+	CHECK(backend.Open() == NULL);
+	io.ready = 1;
+	CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+	CHECK(SamePixel(pixels + width * 3, 255, 255, 255) && SamePixel(pixels, 0, 0, 0));
+	backend.Close();
+	fclose(file);
+
+	// BGR24 is copied as it is, upside down
+	const unsigned char bgr[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+	file = FrameFile(std::vector<unsigned char>(bgr, bgr + sizeof(bgr)), 1);
+	const unsigned int offeredBGR[] = { V4L2_PIX_FMT_BGR24 };
+	FileIo ioBGR(file, offeredBGR, 1, width, height);
+	V4L2Backend backendBGR(Params(width, height, "RGB24"), &ioBGR);
+	CHECK(backendBGR.Open() == NULL);
+	ioBGR.ready = 1;
+	CHECK(backendBGR.IsFrameNew() && backendBGR.GetPixels(pixels));
+	CHECK(memcmp(pixels, bgr + 6, 6) == 0 && memcmp(pixels + 6, bgr, 6) == 0);
+	backendBGR.Close();
+	fclose(file);
+
+	// GREY to all three channels
+	const unsigned char grey[] = { 10, 20, 30, 40 };
+	file = FrameFile(std::vector<unsigned char>(grey, grey + sizeof(grey)), 1);
+	const unsigned int offeredGrey[] = { V4L2_PIX_FMT_GREY };
+	FileIo ioGrey(file, offeredGrey, 1, width, height);
+	V4L2Backend backendGrey(Params(width, height, "Y800"), &ioGrey);
+	CHECK(backendGrey.Open() == NULL);
+	ioGrey.ready = 1;
+	CHECK(backendGrey.IsFrameNew() && backendGrey.GetPixels(pixels));
+	CHECK(SamePixel(pixels, 30, 30, 30) && SamePixel(pixels + 3, 40, 40, 40) && SamePixel(pixels + 6, 10, 10, 10));
+	backendGrey.Close();
+	fclose(file);
+}
+
+static void TestSamples() {
+	const int width = 2, height = 2;
+	std::vector<unsigned char> frame(width * height * 2, 128);
+	FILE* file = FrameFile(frame, 20);
+	const unsigned int offered[] = { V4L2_PIX_FMT_YUYV };
+	FileIo io(file, offered, 1, width, height);
+	V4L2Backend backend(Params(width, height, "YUY2"), &io);
+	CHECK(backend.Open() == NULL);
+	unsigned char pixels[width * height * 3];
+
+	io.ready = 1;
+	CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+	CHECK(backend.GetSampleCount() == 1 && backend.GetDroppedSampleCount() == 0);
+
+	// two samples filled meanwhile: only the newest is kept, the other one counts as dropped
+	io.ready = 2;
+	CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+	CHECK(backend.GetFrameNumber() == 3);
+	CHECK(backend.GetSampleCount() == 3 && backend.GetDroppedSampleCount() == 1);
+	CHECK(!backend.IsFrameNew());
+
+	// the driver had no buffer for two samples, which shows as a gap in the sequence
+	io.skip = 2;
+	io.ready = 1;
+	CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+	CHECK(backend.GetFrameNumber() == 6);
+	CHECK(backend.GetSampleCount() == 6 && backend.GetDroppedSampleCount() == 3);
+
+	// a damaged sample is given back
+	io.error = true;
+	io.ready = 1;
+	CHECK(!backend.IsFrameNew());
+	CHECK(backend.GetDroppedSampleCount() == 4);
+
+	// counters restart with every open
+	CHECK(backend.Open() == NULL);
+	CHECK(backend.GetSampleCount() == 0 && backend.GetDroppedSampleCount() == 0);
+	CHECK(io.openFiles == 1);
+	io.ready = 1;
+	CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+	CHECK(backend.GetFrameNumber() == 1);
+	backend.Close();
+	fclose(file);
+}
+
+static void TestLossless() {
+	const int width = 2, height = 2;
+	std::vector<unsigned char> frame(width * height * 2, 128);
+	FILE* file = FrameFile(frame, 10);
+	const unsigned int offered[] = { V4L2_PIX_FMT_YUYV };
+	FileIo io(file, offered, 1, width, height);
+	CaptureParams params = Params(width, height, "YUY2");
+	params.lossless = true;
+	V4L2Backend backend(params, &io);
+	CHECK(backend.Open() == NULL);
+	unsigned char pixels[width * height * 3];
+
+	// every sample is handed out in order
+	io.ready = 3;
+	for (unsigned long n = 1; n <= 3; n++) {
+		CHECK(backend.IsFrameNew() && backend.GetPixels(pixels));
+		CHECK(backend.GetFrameNumber() == n);
+	}
+	CHECK(!backend.IsFrameNew());
+	CHECK(backend.GetDroppedSampleCount() == 0);
+	backend.Close();
+	fclose(file);
+}
+
+static void TestAuto() {
+	const int width = 4, height = 2;
+	std::vector<unsigned char> frame(width * height * 3, 128);
+	FILE* file = FrameFile(frame, 1);
+
+	// the cheapest conversion offered wins, compressed formats are never picked
+	const unsigned int offered[] = { V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24 };
+	FileIo io(file, offered, 3, width, height);
+	V4L2Backend backend(Params(width, height, "auto"), &io);
+	CHECK(backend.Open() == NULL);
+	std::string report = backend.GetCaptureModeReport();
+	printf("%s\n", report.c_str());
+	CHECK(report.compare(0, 24, "auto: selected BGR3 4x2:") == 0);
+	CHECK(report.find("; YUYV 4x2:") != std::string::npos);
+	CHECK(report.find("MJPG 4x2") == std::string::npos);
+	CHECK(report.compare(report.size() - 25, 25, "; offered: MJPG YUYV BGR3") == 0);
+	CHECK(backend.GetBufferMemory() == (size_t)3 * (width * 3 + 16) * height);
+	backend.Close();
+
+	FileIo ioYUYV(file, offered, 2, width, height);
+	V4L2Backend backendYUYV(Params(width, height, "auto"), &ioYUYV);
+	CHECK(backendYUYV.Open() == NULL);
+	CHECK(backendYUYV.GetCaptureModeReport().compare(0, 24, "auto: selected YUYV 4x2:") == 0);
+
+	// a driver listing its frame rates: the copy that cannot keep up loses to the conversion that can
+	FileIo ioRates(file, offered, 3, width, height);
+	const unsigned int rates[] = { 30, 30, 5 };
+	ioRates.rates.assign(rates, rates + 3);
+	V4L2Backend backendRates(Params(width, height, "auto"), &ioRates);
+	CHECK(backendRates.Open() == NULL);
+	report = backendRates.GetCaptureModeReport();
+	printf("%s\n", report.c_str());
+	CHECK(report.compare(0, 24, "auto: selected YUYV 4x2:") == 0);
+	CHECK(report.find("; BGR3 4x2:") != std::string::npos && report.find("max 5.00 fps") != std::string::npos);
+	backendRates.Close();
+
+	// nothing we can convert
+	FileIo ioMJPG(file, offered, 1, width, height);
+	V4L2Backend backendMJPG(Params(width, height, "auto"), &ioMJPG);
+	CHECK(backendMJPG.Open() != NULL);
+	CHECK(backendMJPG.GetCaptureModeReport() == "auto: no mode offers the requested size");
+	CHECK(ioMJPG.openFiles == 0);
+	fclose(file);
+}
+
+static void TestRejected() {
+	const int width = 4, height = 2;
+	std::vector<unsigned char> frame(width * height * 3, 128);
+	FILE* file = FrameFile(frame, 1);
+
+	// RGB24 asked of a driver that only does YUYV, which it answers with YUYV
+	const unsigned int offered[] = { V4L2_PIX_FMT_YUYV };
+	FileIo io(file, offered, 1, width, height);
+	V4L2Backend backend(Params(width, height, "RGB24"), &io);
+	CHECK(backend.Open() != NULL);
+	CHECK(!backend.IsOpen() && io.openFiles == 0 && io.mappedBuffers == 0);
+
+	// formats there is no conversion for are refused up front
+	const char* error = NULL;
+	try {
+		V4L2Backend mjpg(Params(width, height, "MJPG"), &io);
+	}
+	catch (const char* message) {
+		error = message;
+	}
+	CHECK(error != NULL && strcmp(error, "VideoInputSource: capture format is invalid") == 0);
+
+	// a device that is not there
+	CaptureParams params = Params(width, height, "YUY2");
+	params.deviceID = 1;
+	V4L2Backend missing(params, &io);
+	CHECK(missing.Open() != NULL);
+	fclose(file);
+}
+
+static void TestSize() {
+	std::vector<unsigned char> frame(6 * 4 * 3, 128);
+	FILE* file = FrameFile(frame, 1);
+
+	// packed 4:2:2 at an odd width leaves the last pixel without chroma, so it is refused even with resize
+	const unsigned int offered[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_GREY };
+	FileIo io(file, offered, 1, 5, 4);
+	CaptureParams params = Params(5, 4, "YUY2");
+	V4L2Backend backend(params, &io);
+	CHECK(backend.Open() != NULL);
+	params.resize = true;
+	V4L2Backend resized(params, &io);
+	CHECK(resized.Open() != NULL);
+
+	// auto goes on to a format that can
+	FileIo ioGrey(file, offered, 2, 5, 4);
+	V4L2Backend backendGrey(Params(5, 4, "auto"), &ioGrey);
+	CHECK(backendGrey.Open() == NULL);
+	CHECK(backendGrey.GetCaptureModeReport().compare(0, 24, "auto: selected GREY 5x4:") == 0);
+	backendGrey.Close();
+
+	// a driver adjusting the size fails the open, unless resize takes the size it offers
+	FileIo ioSize(file, offered, 1, 6, 4);
+	V4L2Backend fixed(Params(4, 4, "YUY2"), &ioSize);
+	CHECK(fixed.Open() != NULL);
+	params = Params(4, 4, "YUY2");
+	params.resize = true;
+	V4L2Backend scaled(params, &ioSize);
+	CHECK(scaled.Open() == NULL);
+	CHECK(scaled.GetCaptureWidth() == 6 && scaled.GetCaptureHeight() == 4);
+	scaled.Close();
+	fclose(file);
+}
+
+int main() {
+	TestYUYV();
+	TestOtherFormats();
+	TestSamples();
+	TestLossless();
+	TestAuto();
+	TestRejected();
+	TestSize();
+	return TEST_RESULT();
+}